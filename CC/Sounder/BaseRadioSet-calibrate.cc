@@ -14,7 +14,9 @@
 
 #include "include/BaseRadioSet.h"
 #include "include/Radio.h"
+#include "include/calibration_cache.h"
 #include "include/comms-lib.h"
+#include "include/logger.h"
 #include "include/macros.h"
 //#include "include/matplotlibcpp.h"
 #include "include/utils.h"
@@ -224,8 +226,16 @@ static void setIQBalance(
     dev->setIQBalance(direction, channel, IQcorr);
 }
 
-static void dciqMinimize(SoapySDR::Device* targetDev, SoapySDR::Device* refDev,
-    int direction, size_t channel, double rxCenterTone, double txCenterTone)
+static void applyDciq(SoapySDR::Device* dev, int direction, size_t channel,
+    const CalibrationCache::DciqCorrection& corr)
+{
+    dev->setDCOffset(direction, channel, corr.dc);
+    setIQBalance(dev, direction, channel, corr.gcorr, corr.iqcorr);
+}
+
+static CalibrationCache::DciqCorrection dciqMinimize(
+    SoapySDR::Device* targetDev, SoapySDR::Device* refDev, int direction,
+    size_t channel, double rxCenterTone, double txCenterTone)
 {
     size_t N = 1024;
     std::vector<float> win = CommsLib::hannWindowFunction(N);
@@ -364,21 +374,59 @@ static void dciqMinimize(SoapySDR::Device* targetDev, SoapySDR::Device* refDev,
                   << " dB, imLvl=" << measImbalanceLevel
                   << " dB, toneLevel=" << desiredToneLevel << "dB" << std::endl;
     }
+    return { bestDcCorr, bestgcorr, bestiqcorr };
 }
 
-void BaseRadioSet::dciqCalibrationProc(size_t channel)
+void BaseRadioSet::dciqCalibrationProc(size_t cell, size_t channel)
 {
+    size_t radioSize = _cfg->n_bs_sdrs().at(cell);
+    size_t referenceRadio = _cfg->cal_ref_sdr_id(); //radioSize / 2;
+    if (radioSize < 2 || referenceRadio >= radioSize) {
+        MLPD_WARN("Cell %zu: DC/IQ calibration needs a reference radio and "
+                  "at least one other radio, skipping\n",
+            cell);
+        return;
+    }
     std::cout << "****************************************************\n";
-    std::cout << "   DC Offset and IQ Imbalance Calibration: Ch " << channel
-              << std::endl;
+    std::cout << "   DC Offset and IQ Imbalance Calibration: Cell " << cell
+              << ", Ch " << channel << std::endl;
     std::cout << "****************************************************\n";
     double sampleRate = _cfg->rate();
     double centerRfFreq = _cfg->radio_rf_freq();
     double toneBBFreq = sampleRate / 7;
-    size_t radioSize = _cfg->n_bs_sdrs().at(0);
 
-    size_t referenceRadio = _cfg->cal_ref_sdr_id(); //radioSize / 2;
-    Radio* refRadio = bsRadios[0][referenceRadio];
+    // Corrections of an earlier run are reused once every radio of the
+    // cell has both of its paths cached
+    if (calCache != nullptr) {
+        std::vector<CalibrationCache::DciqCorrection> rx(radioSize);
+        std::vector<CalibrationCache::DciqCorrection> tx(radioSize);
+        bool found = true;
+        for (size_t r = 0; r < radioSize && found; r++) {
+            const std::string& serial = _cfg->bs_sdr_ids().at(cell).at(r);
+            found = calCache->findDciq(serial, SOAPY_SDR_RX, channel, rx[r])
+                && calCache->findDciq(serial, SOAPY_SDR_TX, channel, tx[r]);
+        }
+        if (found) {
+            for (size_t r = 0; r < radioSize; r++) {
+                SoapySDR::Device* dev = bsRadios[cell][r]->dev;
+                dev->setDCOffsetMode(SOAPY_SDR_RX, channel, false);
+                applyDciq(dev, SOAPY_SDR_RX, channel, rx[r]);
+                applyDciq(dev, SOAPY_SDR_TX, channel, tx[r]);
+            }
+            std::cout << "Cell " << cell << ", Ch " << channel
+                      << ": applied cached DC/IQ corrections" << std::endl;
+            return;
+        }
+    }
+    auto store = [&](size_t r, int direction,
+                     const CalibrationCache::DciqCorrection& corr) {
+        if (calCache != nullptr) {
+            calCache->storeDciq(_cfg->bs_sdr_ids().at(cell).at(r), direction,
+                channel, corr);
+        }
+    };
+
+    Radio* refRadio = bsRadios[cell][referenceRadio];
     SoapySDR::Device* refDev = refRadio->dev;
 
     /* 
@@ -393,7 +441,7 @@ void BaseRadioSet::dciqCalibrationProc(size_t channel)
     for (size_t r = 0; r < radioSize; r++) {
         if (r == referenceRadio)
             continue;
-        Radio* bsRadio = bsRadios[0][r];
+        Radio* bsRadio = bsRadios[cell][r];
         SoapySDR::Device* dev = bsRadio->dev;
         // must set TX "RF" Freq to make sure, we continue using the same LO for rx cal
         dev->setFrequency(SOAPY_SDR_TX, channel, "RF", centerRfFreq);
@@ -411,12 +459,13 @@ void BaseRadioSet::dciqCalibrationProc(size_t channel)
     adjustCalibrationGains(
         allButRefDevs, refDev, channel, toneBBFreq / sampleRate);
 
-    // Minimize Rx DC offset and IQ Imbalance on all receiving radios
-    // TODO: Parallelize this loop
-    for (size_t r = 0; r < radioSize - 1; r++) {
-        dciqMinimize(allButRefDevs[r], allButRefDevs[r], SOAPY_SDR_RX, channel,
-            0.0, toneBBFreq / sampleRate);
-    }
+    // Minimize Rx DC offset and IQ Imbalance on all receiving radios, each
+    // one only tunes and reads back its own rx path so they run in parallel
+    runParallel(allButRefDevs.size(), [&](size_t r) {
+        store(r < referenceRadio ? r : r + 1, SOAPY_SDR_RX,
+            dciqMinimize(allButRefDevs[r], allButRefDevs[r], SOAPY_SDR_RX,
+                channel, 0.0, toneBBFreq / sampleRate));
+    });
 
     refDev->writeSetting(SOAPY_SDR_TX, channel, "TSP_TSG_CONST", "NONE");
     refDev->writeSetting(SOAPY_SDR_TX, channel, "TX_ENB_OVERRIDE", "false");
@@ -427,7 +476,8 @@ void BaseRadioSet::dciqCalibrationProc(size_t channel)
     std::cout << "Calibrating Rx Channel of the Reference Radio\n";
     std::vector<SoapySDR::Device*> refDevContainer;
     refDevContainer.push_back(refDev);
-    SoapySDR::Device* refRefDev = allButRefDevs[referenceRadio - 1];
+    SoapySDR::Device* refRefDev
+        = allButRefDevs[referenceRadio > 0 ? referenceRadio - 1 : 0];
 
     refRefDev->setFrequency(
         SOAPY_SDR_TX, channel, "RF", centerRfFreq + toneBBFreq);
@@ -446,8 +496,9 @@ void BaseRadioSet::dciqCalibrationProc(size_t channel)
     // Tune tx gain on neighboring radio to reference radio
     adjustCalibrationGains(
         refDevContainer, refRefDev, channel, toneBBFreq / sampleRate);
-    dciqMinimize(
-        refDev, refDev, SOAPY_SDR_RX, channel, 0.0, toneBBFreq / sampleRate);
+    store(referenceRadio, SOAPY_SDR_RX,
+        dciqMinimize(refDev, refDev, SOAPY_SDR_RX, channel, 0.0,
+            toneBBFreq / sampleRate));
 
     refRefDev->writeSetting(SOAPY_SDR_TX, channel, "TSP_TSG_CONST", "NONE");
     refRefDev->writeSetting(SOAPY_SDR_TX, channel, "TX_ENB_OVERRIDE", "false");
@@ -475,8 +526,9 @@ void BaseRadioSet::dciqCalibrationProc(size_t channel)
     // Tune rx gain on neighboring radio to reference radio
     adjustCalibrationGains(refRefDevContainer, refDev, channel,
         (toneBBFreq + txToneBBFreq) / sampleRate);
-    dciqMinimize(refDev, refRefDev, SOAPY_SDR_TX, channel,
-        toneBBFreq / sampleRate, txToneBBFreq / sampleRate);
+    store(referenceRadio, SOAPY_SDR_TX,
+        dciqMinimize(refDev, refRefDev, SOAPY_SDR_TX, channel,
+            toneBBFreq / sampleRate, txToneBBFreq / sampleRate));
 
     // kill TX on ref at the end
     refDev->writeSetting(SOAPY_SDR_TX, channel, "TSP_TSG_CONST", "NONE");
@@ -486,6 +538,7 @@ void BaseRadioSet::dciqCalibrationProc(size_t channel)
 
     /* 
      * Now calibrate the tx paths on all other radios using the reference radio
+     * This stays sequential, the reference radio is the only receiver
      */
     std::cout << "Calibrating Tx Channel of the Reference Radio\n";
     // refDev->setFrequency(SOAPY_SDR_RX, channel, "RF", centerRfFreq);
@@ -504,8 +557,9 @@ void BaseRadioSet::dciqCalibrationProc(size_t channel)
         // Tune rx gain on the reference radio
         adjustCalibrationGains(refDevContainer, allButRefDevs[r], channel,
             (toneBBFreq + txToneBBFreq) / sampleRate);
-        dciqMinimize(allButRefDevs[r], refDev, SOAPY_SDR_TX, channel,
-            toneBBFreq / sampleRate, txToneBBFreq / sampleRate);
+        store(r < referenceRadio ? r : r + 1, SOAPY_SDR_TX,
+            dciqMinimize(allButRefDevs[r], refDev, SOAPY_SDR_TX, channel,
+                toneBBFreq / sampleRate, txToneBBFreq / sampleRate));
         allButRefDevs[r]->writeSetting(
             SOAPY_SDR_TX, channel, "TX_ENB_OVERRIDE", "false");
         allButRefDevs[r]->writeSetting(
@@ -517,14 +571,16 @@ void BaseRadioSet::dciqCalibrationProc(size_t channel)
     std::cout << "****************************************************\n";
 }
 
-void BaseRadioSet::collectCSI(bool& adjust)
+bool BaseRadioSet::collectCSI(bool& adjust)
 {
     int R = bsRadios[0].size();
     if (R < 2) {
         std::cout << "No need to sample calibrate with one Iris! skipping ..."
                   << std::endl;
-        return;
+        return true;
     }
+    if (triggerDelays.size() != bsRadios[0].size())
+        triggerDelays.assign(R, 0);
     //std::vector<std::complex<float>> pilot_cf32;
     int seqLen = 160; // Sequence length
     std::vector<std::vector<float>> pilot
@@ -621,10 +677,14 @@ void BaseRadioSet::collectCSI(bool& adjust)
     std::vector<int> offset(R);
 
     bool good_csi = true;
+    // correlation and conversion buffers shared by all radios
+    CommsLib::SignCorrelation lts_work;
+    std::vector<std::complex<float>> rx;
     for (int i = 0; i < R; i++) {
         int k = ((i == ref_ant) ? ref_offset : ref_ant) * R + i;
-        auto rx = Utils::cint16_to_cfloat(buff[k]);
-        int peak = CommsLib::findLTS(rx, seqLen);
+        rx.resize(buff[k].size());
+        Utils::cint16_to_cfloat(buff[k].data(), buff[k].size(), rx.data());
+        int peak = CommsLib::findLTS(rx, seqLen, lts_work);
         offset[i] = peak < 128 ? 0 : peak - 128;
         //std::cout << i << " " << offset[i] << std::endl;
         if (offset[i] == 0)
@@ -644,6 +704,12 @@ void BaseRadioSet::collectCSI(bool& adjust)
 #endif
     }
 
+    bool aligned = good_csi;
+    for (int i = 0; i < R; i++) {
+        if (offset[i] != offset[ref_offset])
+            aligned = false;
+    }
+
     // adjusting trigger delays based on lts peak index
     adjust &= good_csi;
     if (adjust) {
@@ -654,6 +720,7 @@ void BaseRadioSet::collectCSI(bool& adjust)
             int delta = (offset[i] == 0) ? 0 : offset[ref_offset] - offset[i];
             std::cout << "adjusting delay of node " << i << " by " << delta
                       << std::endl;
+            triggerDelays[i] += delta;
             while (delta < 0) {
                 dev->writeSetting("ADJUST_DELAYS", "-1");
                 ++delta;
@@ -673,4 +740,50 @@ void BaseRadioSet::collectCSI(bool& adjust)
         dev->setGain(SOAPY_SDR_TX, ch, "PAD", _cfg->tx_gain().at(ch)); //[0,30]
         bsRadio->drain_buffers(dummybuffs, _cfg->samps_per_symbol());
     }
+    return aligned;
+}
+
+bool BaseRadioSet::loadTriggerDelays(void)
+{
+    size_t R = bsRadios[0].size();
+    if (calCache == nullptr || R < 2)
+        return false;
+    const std::string& reference
+        = _cfg->bs_sdr_ids().at(0).at(_cfg->cal_ref_sdr_id());
+    std::vector<int> delays(R);
+    for (size_t i = 0; i < R; i++) {
+        if (!calCache->findTriggerDelay(
+                _cfg->bs_sdr_ids().at(0).at(i), reference, delays[i]))
+            return false;
+    }
+
+    triggerDelays = delays;
+    for (size_t i = 0; i < R; i++) {
+        SoapySDR::Device* dev = bsRadios[0][i]->dev;
+        for (int delta = delays[i]; delta != 0; delta -= (delta > 0) ? 1 : -1)
+            dev->writeSetting("ADJUST_DELAYS", (delta > 0) ? "1" : "-1");
+    }
+    if (_cfg->cal_cache_validate() == false)
+        return true;
+
+    bool adjust = false;
+    if (collectCSI(adjust) == true)
+        return true;
+    std::cout << "cached trigger delays do not line up the radios, "
+                 "recalibrating..."
+              << std::endl;
+    return false;
+}
+
+void BaseRadioSet::storeTriggerDelays(void)
+{
+    if (calCache == nullptr || triggerDelays.size() != bsRadios[0].size())
+        return;
+    const std::string& reference
+        = _cfg->bs_sdr_ids().at(0).at(_cfg->cal_ref_sdr_id());
+    for (size_t i = 0; i < triggerDelays.size(); i++) {
+        calCache->storeTriggerDelay(
+            _cfg->bs_sdr_ids().at(0).at(i), reference, triggerDelays[i]);
+    }
+    calCache->save();
 }
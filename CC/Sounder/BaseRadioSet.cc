@@ -12,6 +12,7 @@
 
 #include "include/BaseRadioSet.h"
 #include "include/Radio.h"
+#include "include/calibration_cache.h"
 #include "include/comms-lib.h"
 #include "include/logger.h"
 #include "include/macros.h"
@@ -21,6 +22,9 @@
 #include <SoapySDR/Errors.hpp>
 #include <SoapySDR/Formats.hpp>
 #include <SoapySDR/Time.hpp>
+#include <exception>
+#include <mutex>
+#include <thread>
 
 using json = nlohmann::json;
 
@@ -32,6 +36,8 @@ BaseRadioSet::BaseRadioSet(Config* cfg)
     radioNotFound = false;
     std::vector<std::string> radio_serial_not_found;
 
+    // Radios of all cells are brought up together, (cell, radio) pairs
+    std::vector<std::pair<size_t, size_t>> radios;
     for (size_t c = 0; c < _cfg->num_cells(); c++) {
         size_t num_radios = _cfg->n_bs_sdrs()[c];
         num_bs_antenntas[c] = num_radios * _cfg->bs_channel().length();
@@ -45,35 +51,18 @@ BaseRadioSet::BaseRadioSet(Config* cfg)
             hubs.push_back(SoapySDR::Device::make(args));
         }
         bsRadios.at(c).resize(num_radios);
-        std::atomic_ulong thread_count = ATOMIC_VAR_INIT(num_radios);
-
-        MLPD_TRACE("Init base radios: %zu\n", num_radios);
-        for (size_t i = 0; i < num_radios; i++) {
-            BaseRadioContext* context = new BaseRadioContext;
-            context->brs = this;
-            context->thread_count = &thread_count;
-            context->tid = i;
-            context->cell = c;
-#ifdef THREADED_INIT
-            pthread_t init_thread_;
-
-            if (pthread_create(
-                    &init_thread_, NULL, BaseRadioSet::init_launch, context)
-                != 0) {
-                delete context;
-                throw std::runtime_error(
-                    "BaseRadioSet - init thread create failed");
-            }
-#else
-            init(context);
-#endif
-        }
+        for (size_t i = 0; i < num_radios; i++)
+            radios.emplace_back(c, i);
+    }
 
-        // Wait for init
-        while (thread_count.load() > 0) {
-        }
+    MLPD_TRACE("Init base radios: %zu\n", radios.size());
+    runParallel(radios.size(), [&](size_t r) {
+        this->init(radios[r].first, radios[r].second);
+    });
 
-        // Strip out broken radios.
+    // Strip out broken radios.
+    for (size_t c = 0; c < _cfg->num_cells(); c++) {
+        size_t num_radios = bsRadios.at(c).size();
         for (size_t i = 0; i < num_radios; i++) {
             if (bsRadios.at(c).at(i) == NULL) {
                 radioNotFound = true;
@@ -92,42 +81,36 @@ BaseRadioSet::BaseRadioSet(Config* cfg)
         }
         bsRadios.at(c).shrink_to_fit();
         _cfg->n_bs_sdrs().at(c) = num_radios;
-        if (radioNotFound == true) {
-            break;
-        }
+    }
 
-        // Perform DC Offset & IQ Imbalance Calibration
-        if (_cfg->imbalance_cal_en() == true) {
-            if (_cfg->bs_channel().find('A') != std::string::npos)
-                dciqCalibrationProc(0);
-            if (_cfg->bs_channel().find('B') != std::string::npos)
-                dciqCalibrationProc(1);
-        }
+    if (!radioNotFound && !_cfg->cal_cache_file().empty())
+        calCache.reset(new CalibrationCache(_cfg->cal_cache_file(), _cfg));
 
-        thread_count.store(num_radios);
-        for (size_t i = 0; i < num_radios; i++) {
-            BaseRadioContext* context = new BaseRadioContext;
-            context->brs = this;
-            context->thread_count = &thread_count;
-            context->tid = i;
-            context->cell = c;
-#ifdef THREADED_INIT
-            pthread_t configure_thread_;
-            if (pthread_create(&configure_thread_, NULL,
-                    BaseRadioSet::configure_launch, context)
-                != 0) {
-                delete context;
-                throw std::runtime_error(
-                    "BaseRadioSet - configure thread create failed");
-            }
-#else
-            configure(context);
-#endif
+    if (!radioNotFound) {
+        // Perform DC Offset & IQ Imbalance Calibration, every cell has its
+        // own hub and reference radio so the cells calibrate concurrently
+        if (_cfg->imbalance_cal_en() == true) {
+            runParallel(_cfg->num_cells(), [this](size_t c) {
+                if (_cfg->bs_channel().find('A') != std::string::npos)
+                    this->dciqCalibrationProc(c, 0);
+                if (_cfg->bs_channel().find('B') != std::string::npos)
+                    this->dciqCalibrationProc(c, 1);
+            });
         }
+        if (_cfg->imbalance_cal_en() == true && calCache != nullptr)
+            calCache->save();
 
-        while (thread_count.load() > 0) {
+        radios.clear();
+        for (size_t c = 0; c < _cfg->num_cells(); c++) {
+            for (size_t i = 0; i < bsRadios.at(c).size(); i++)
+                radios.emplace_back(c, i);
         }
+        runParallel(radios.size(), [&](size_t r) {
+            this->configure(radios[r].first, radios[r].second);
+        });
+    }
 
+    for (size_t c = 0; c < _cfg->num_cells() && !radioNotFound; c++) {
         auto channels = Utils::strToChannels(_cfg->bs_channel());
 
         for (size_t i = 0; i < bsRadios.at(c).size(); i++) {
@@ -211,7 +194,9 @@ BaseRadioSet::BaseRadioSet(Config* cfg)
                      "discovered in the network!\033[0m"
                   << std::endl;
     } else {
-        if (_cfg->sample_cal_en() == true) {
+        if (_cfg->sample_cal_en() == true && loadTriggerDelays() == true) {
+            std::cout << "using cached sample offset calibration" << std::endl;
+        } else if (_cfg->sample_cal_en() == true) {
             bool adjust = false;
             int cal_cnt = 0;
             while (!adjust) {
@@ -224,9 +209,12 @@ BaseRadioSet::BaseRadioSet(Config* cfg)
                 adjust = true;
                 collectCSI(adjust); // run 1: find offsets and adjust
             }
-            collectCSI(adjust); // run 2: verify adjustments
+            // run 2: verify adjustments
+            bool aligned = collectCSI(adjust);
             usleep(100000);
             std::cout << "sample offset calibration done!" << std::endl;
+            if (aligned)
+                storeTriggerDelays();
         }
 
         nlohmann::json tddConf;
@@ -344,33 +332,59 @@ BaseRadioSet::BaseRadioSet(Config* cfg)
     }
 }
 
+BaseRadioSet::BaseRadioSet(Config* cfg, NoRadios)
+    : _cfg(cfg)
+{
+    bsRadios.resize(_cfg->num_cells());
+    radioNotFound = false;
+}
+
 BaseRadioSet::~BaseRadioSet(void)
 {
     if (!_cfg->hub_ids().empty()) {
         for (unsigned int i = 0; i < hubs.size(); i++)
             SoapySDR::Device::unmake(hubs.at(i));
     }
-    for (unsigned int c = 0; c < _cfg->num_cells(); c++)
-        for (size_t i = 0; i < _cfg->n_bs_sdrs().at(c); i++)
+    for (unsigned int c = 0; c < bsRadios.size(); c++)
+        for (size_t i = 0; i < bsRadios.at(c).size(); i++)
             delete bsRadios.at(c).at(i);
 }
 
-void* BaseRadioSet::init_launch(void* in_context)
+void BaseRadioSet::runParallel(
+    size_t count, const std::function<void(size_t)>& task)
 {
-    BaseRadioContext* context = reinterpret_cast<BaseRadioContext*>(in_context);
-    context->brs->init(context);
-    return 0;
+#ifdef THREADED_INIT
+    size_t num_threads = std::min(_cfg->init_threads(), count);
+    std::atomic<size_t> next(0);
+    std::exception_ptr error;
+    std::mutex error_mutex;
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < num_threads; t++) {
+        threads.emplace_back([&] {
+            size_t id;
+            while ((id = next++) < count) {
+                try {
+                    task(id);
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock(error_mutex);
+                    if (!error)
+                        error = std::current_exception();
+                }
+            }
+        });
+    }
+    for (auto& thread : threads)
+        thread.join();
+    if (error)
+        std::rethrow_exception(error);
+#else
+    for (size_t id = 0; id < count; id++)
+        task(id);
+#endif
 }
 
-void BaseRadioSet::init(BaseRadioContext* context)
+void BaseRadioSet::init(size_t c, size_t i)
 {
-    int i = context->tid;
-    int c = context->cell;
-    std::atomic_ulong* thread_count = context->thread_count;
-    delete context;
-
-    MLPD_TRACE("Deleting context for tid: %d\n", i);
-
     auto channels = Utils::strToChannels(_cfg->bs_channel());
     SoapySDR::Kwargs args;
     if (kUseUHD == false) {
@@ -401,24 +415,10 @@ void BaseRadioSet::init(BaseRadioContext* context)
         }
     }
     MLPD_TRACE("BaseRadioSet: Init complete\n");
-    assert(thread_count->load() != 0);
-    thread_count->store(thread_count->load() - 1);
 }
 
-void* BaseRadioSet::configure_launch(void* in_context)
+void BaseRadioSet::configure(size_t c, size_t i)
 {
-    BaseRadioContext* context = reinterpret_cast<BaseRadioContext*>(in_context);
-    context->brs->configure(context);
-    return 0;
-}
-
-void BaseRadioSet::configure(BaseRadioContext* context)
-{
-    int i = context->tid;
-    int c = context->cell;
-    std::atomic_ulong* thread_count = context->thread_count;
-    delete context;
-
     //load channels
     auto channels = Utils::strToChannels(_cfg->bs_channel());
     Radio* bsRadio = bsRadios.at(c).at(i);
@@ -429,9 +429,6 @@ void BaseRadioSet::configure(BaseRadioContext* context)
         double txgain = _cfg->tx_gain().at(ch);
         bsRadios.at(c).at(i)->dev_init(_cfg, ch, rxgain, txgain);
     }
-
-    assert(thread_count->load() != 0);
-    thread_count->store(thread_count->load() - 1);
 }
 
 SoapySDR::Device* BaseRadioSet::baseRadio(size_t cellId)
@@ -557,6 +554,40 @@ void BaseRadioSet::radioRx(void* const* buffs)
     }
 }
 
+size_t BaseRadioSet::radioRxDirectBuffers(size_t radio_id, size_t cell_id)
+{
+    if (radio_id < bsRadios.at(cell_id).size())
+        return bsRadios.at(cell_id).at(radio_id)->numDirectRecvBuffers();
+    return 0;
+}
+
+int BaseRadioSet::radioRxDirect(size_t radio_id, size_t cell_id,
+    size_t& handle, const void** buffs, long long& frameTime)
+{
+    int ret = 0;
+
+    if (radio_id < bsRadios.at(cell_id).size()) {
+        long long frameTimeNs = 0;
+        ret = bsRadios.at(cell_id).at(radio_id)->acquireRecv(
+            handle, buffs, frameTimeNs);
+        // for UHD device recv using ticks
+        if (kUseUHD == false)
+            frameTime = frameTimeNs;
+        else
+            frameTime = SoapySDR::timeNsToTicks(frameTimeNs, _cfg->rate());
+    } else {
+        MLPD_WARN("Invalid radio id: %zu in cell %zu\n", radio_id, cell_id);
+        ret = 0;
+    }
+    return ret;
+}
+
+void BaseRadioSet::radioRxRelease(
+    size_t radio_id, size_t cell_id, size_t handle)
+{
+    bsRadios.at(cell_id).at(radio_id)->releaseRecv(handle);
+}
+
 int BaseRadioSet::radioRx(
     size_t radio_id, size_t cell_id, void* const* buffs, long long& frameTime)
 {
@@ -92,6 +92,7 @@ Radio::Radio(const SoapySDR::Kwargs& args, const char soapyFmt[],
     }
     rxs = dev->setupStream(SOAPY_SDR_RX, soapyFmt, channels);
     txs = dev->setupStream(SOAPY_SDR_TX, soapyFmt, channels);
+    num_direct_rx_buffs = dev->getNumDirectAccessBuffers(rxs);
 
     if (!kUseUHD)
         reset_DATA_clk_domain();
@@ -123,6 +124,21 @@ int Radio::recv(void* const* buffs, int samples, long long& frameTime)
     return r;
 }
 
+int Radio::acquireRecv(
+    size_t& handle, const void** buffs, long long& frameTime)
+{
+    int flags(0);
+    int r = dev->acquireReadBuffer(
+        rxs, handle, buffs, flags, frameTime, 1000000);
+    if (r < 0) {
+        MLPD_ERROR("Time: %lld, acquireReadBuffer error: %d - %s, flags: %d\n",
+            frameTime, r, SoapySDR::errToStr(r), flags);
+    }
+    return r;
+}
+
+void Radio::releaseRecv(size_t handle) { dev->releaseReadBuffer(rxs, handle); }
+
 int Radio::activateRecv(
     const long long rxTime, const size_t numSamps, int flags)
 {
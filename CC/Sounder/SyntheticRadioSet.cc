@@ -0,0 +1,256 @@
+/*
+ Copyright (c) 2018-2020, Rice University
+ RENEW OPEN SOURCE LICENSE: http://renew-wireless.org/license
+
+---------------------------------------------------------------------
+ Base station radio set without hardware, generates symbols or replays
+ the pilots of a recorded trace at a configurable rate
+---------------------------------------------------------------------
+*/
+
+#include "include/SyntheticRadioSet.h"
+#include "include/logger.h"
+#include "include/macros.h"
+
+#include "H5Cpp.h"
+#include <SoapySDR/Errors.hpp>
+#include <cstring>
+#include <random>
+#include <thread>
+
+// noise symbols generated up front, picked round robin
+const size_t SyntheticRadioSet::kNoiseSymbols = 16;
+// frames of the replay trace held in memory
+const size_t SyntheticRadioSet::kReplayMaxFrames = 100;
+
+SyntheticRadioSet::SyntheticRadioSet(Config* cfg)
+    : BaseRadioSet(cfg, NoRadios())
+    , cfg_(cfg)
+    , num_channels_(cfg->bs_channel().length())
+    , pilot_(cfg->pilot_ci16())
+    , replay_frames_(0)
+    , replay_pilots_(0)
+    , replay_antennas_(0)
+    , symbol_period_(0)
+    , started_(false)
+{
+    if (cfg_->reciprocal_calib() == true) {
+        throw std::invalid_argument(
+            "synthetic radios do not support reciprocal calibration");
+    }
+
+    // Iris only streams the symbols it receives, UHD streams all of them
+    for (auto& frame : cfg_->frames()) {
+        std::vector<size_t> symbols;
+        for (size_t s = 0; s < frame.size(); s++) {
+            if ((kUseUHD == true) || (frame.at(s) == 'P')
+                || (frame.at(s) == 'U') || (frame.at(s) == 'N'))
+                symbols.push_back(s);
+        }
+        this->rx_symbols_.push_back(symbols);
+    }
+    size_t rx_symbol_count = 0;
+    for (auto& symbols : this->rx_symbols_)
+        rx_symbol_count += symbols.size();
+    if (rx_symbol_count == 0) {
+        throw std::invalid_argument(
+            "synthetic radios need at least one P, U or N symbol");
+    }
+
+    for (size_t c = 0; c < cfg_->num_cells(); c++) {
+        this->radio_state_.emplace_back(
+            cfg_->n_bs_sdrs().at(c), RadioState { 0, 0 });
+        this->radio_ant_offset_.push_back(
+            cfg_->n_bs_sdrs_agg().at(c) * this->num_channels_);
+    }
+
+    // Low level noise for uplink data and noise symbols
+    size_t symbol_len = 2 * cfg_->samps_per_symbol();
+    this->noise_.resize(kNoiseSymbols * symbol_len);
+    std::mt19937 generator(0);
+    std::uniform_int_distribution<short> distribution(-64, 64);
+    for (auto& sample : this->noise_)
+        sample = distribution(generator);
+    this->pilot_.resize(cfg_->samps_per_symbol());
+
+    if (cfg_->bs_radio_backend() == "replay")
+        this->loadReplay(cfg_->replay_file());
+
+    if (cfg_->synthetic_rate() > 0) {
+        this->symbol_period_ = std::chrono::nanoseconds(
+            static_cast<long long>(1e9 * cfg_->samps_per_symbol()
+                / (cfg_->rate() * cfg_->synthetic_rate())));
+    }
+    MLPD_INFO("Synthetic base station: %zu antennas, %s, symbol every %ld "
+              "ns\n",
+        cfg_->getTotNumAntennas(),
+        this->replay_frames_ > 0 ? "replaying pilots" : "generated pilots",
+        static_cast<long>(this->symbol_period_.count()));
+}
+
+SyntheticRadioSet::~SyntheticRadioSet(void) {}
+
+void SyntheticRadioSet::loadReplay(const std::string& filename)
+{
+    H5::Exception::dontPrint();
+    try {
+        H5::H5File file(filename, H5F_ACC_RDONLY);
+        H5::DataSet dataset = file.openDataSet("/Data/Pilot_Samples");
+        H5::DataSpace filespace = dataset.getSpace();
+        hsize_t dims[5];
+        if (filespace.getSimpleExtentNdims() != 5) {
+            throw std::runtime_error(
+                "unexpected Pilot_Samples layout in " + filename);
+        }
+        filespace.getSimpleExtentDims(dims);
+        if (dims[4] != 2 * cfg_->samps_per_symbol()) {
+            throw std::runtime_error("replay trace " + filename
+                + " has a different symbol length");
+        }
+
+        // first cell only, the replayed pilots are reused for all cells
+        hsize_t count[5]
+            = { std::min<hsize_t>(dims[0], kReplayMaxFrames), 1, dims[2],
+                  dims[3], dims[4] };
+        hsize_t offset[5] = { 0, 0, 0, 0, 0 };
+        filespace.selectHyperslab(H5S_SELECT_SET, count, offset);
+        H5::DataSpace memspace(5, count);
+        this->replay_.resize(count[0] * count[2] * count[3] * count[4]);
+        dataset.read(this->replay_.data(), H5::PredType::NATIVE_INT16,
+            memspace, filespace);
+
+        this->replay_frames_ = count[0];
+        this->replay_pilots_ = count[2];
+        this->replay_antennas_ = count[3];
+        MLPD_INFO("Replaying %zu frames of %zu pilots and %zu antennas from "
+                  "%s\n",
+            this->replay_frames_, this->replay_pilots_, this->replay_antennas_,
+            filename.c_str());
+    } catch (H5::Exception& error) {
+        error.printErrorStack();
+        throw std::runtime_error("could not read replay trace " + filename);
+    }
+    if (this->replay_frames_ * this->replay_pilots_ * this->replay_antennas_
+        == 0) {
+        throw std::runtime_error("replay trace " + filename + " is empty");
+    }
+}
+
+const short* SyntheticRadioSet::symbolSamples(
+    size_t frame_id, size_t symbol_id, size_t ant_id) const
+{
+    size_t symbol_len = 2 * cfg_->samps_per_symbol();
+    if (cfg_->isPilot(frame_id, symbol_id) == true) {
+        if (this->replay_frames_ == 0)
+            return reinterpret_cast<const short*>(this->pilot_.data());
+        size_t pilot = cfg_->getClientId(frame_id, symbol_id);
+        size_t index = (((frame_id % this->replay_frames_)
+                                * this->replay_pilots_
+                            + (pilot % this->replay_pilots_))
+                               * this->replay_antennas_
+                           + (ant_id % this->replay_antennas_))
+            * symbol_len;
+        return this->replay_.data() + index;
+    }
+    return this->noise_.data()
+        + ((frame_id + symbol_id + ant_id) % kNoiseSymbols) * symbol_len;
+}
+
+int SyntheticRadioSet::radioTx(size_t radio_id, size_t cell_id,
+    const void* const* buffs, int flags, long long& frameTime)
+{
+    (void)radio_id;
+    (void)cell_id;
+    (void)buffs;
+    (void)flags;
+    (void)frameTime;
+    return cfg_->samps_per_symbol();
+}
+
+int SyntheticRadioSet::radioRx(size_t radio_id, size_t cell_id,
+    void* const* buffs, int numSamps, long long& frameTime)
+{
+    if (radio_id >= this->radio_state_.at(cell_id).size()) {
+        MLPD_WARN("Invalid radio id: %zu in cell %zu\n", radio_id, cell_id);
+        return 0;
+    }
+
+    // Like the hardware, nothing is streamed before the trigger
+    while (this->started_.load(std::memory_order_acquire) == false) {
+        if (cfg_->running() == false)
+            return 0;
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+
+    // Next received symbol of this radio, frames without any are skipped
+    RadioState& state = this->radio_state_.at(cell_id).at(radio_id);
+    const std::vector<size_t>* symbols = &this->rx_symbols_.at(
+        state.frame_id % this->rx_symbols_.size());
+    while (state.symbol_idx >= symbols->size()) {
+        state.frame_id++;
+        state.symbol_idx = 0;
+        symbols = &this->rx_symbols_.at(
+            state.frame_id % this->rx_symbols_.size());
+    }
+    size_t frame_id = state.frame_id;
+    size_t symbol_id = symbols->at(state.symbol_idx);
+    state.symbol_idx++;
+
+    if (this->symbol_period_.count() > 0) {
+        std::this_thread::sleep_until(this->start_time_
+            + this->symbol_period_
+                * (frame_id * cfg_->symbols_per_frame() + symbol_id));
+    }
+
+    size_t len = std::min<size_t>(numSamps, cfg_->samps_per_symbol());
+    size_t ant_id = this->radio_ant_offset_.at(cell_id)
+        + radio_id * this->num_channels_;
+    for (size_t ch = 0; ch < this->num_channels_; ch++) {
+        std::memcpy(buffs[ch], this->symbolSamples(frame_id, symbol_id, ant_id),
+            len * 2 * sizeof(short));
+    }
+
+    if (kUseUHD == false) {
+        frameTime = (static_cast<long long>(frame_id) << 32)
+            | (static_cast<long long>(symbol_id) << 16);
+    } else {
+        frameTime = static_cast<long long>(
+            (frame_id * cfg_->symbols_per_frame() + symbol_id)
+            * cfg_->samps_per_symbol());
+    }
+    return len;
+}
+
+size_t SyntheticRadioSet::radioRxDirectBuffers(size_t radio_id, size_t cell_id)
+{
+    (void)radio_id;
+    (void)cell_id;
+    return 0;
+}
+
+int SyntheticRadioSet::radioRxDirect(size_t radio_id, size_t cell_id,
+    size_t& handle, const void** buffs, long long& frameTime)
+{
+    (void)radio_id;
+    (void)cell_id;
+    (void)handle;
+    (void)buffs;
+    (void)frameTime;
+    return SOAPY_SDR_NOT_SUPPORTED;
+}
+
+void SyntheticRadioSet::radioRxRelease(
+    size_t radio_id, size_t cell_id, size_t handle)
+{
+    (void)radio_id;
+    (void)cell_id;
+    (void)handle;
+}
+
+void SyntheticRadioSet::radioStart(void)
+{
+    this->start_time_ = std::chrono::steady_clock::now();
+    this->started_.store(true, std::memory_order_release);
+}
+
+void SyntheticRadioSet::radioStop(void) {}
@@ -0,0 +1,55 @@
+/*
+ Copyright (c) 2018-2020, Rice University
+ RENEW OPEN SOURCE LICENSE: http://renew-wireless.org/license
+
+----------------------------------------------------------------------
+ Streaming beacon detector, correlates samples with the gold sequence
+ as they are read and fires on the first peak of the two repetitions
+---------------------------------------------------------------------
+*/
+
+#include "include/beacon_detector.h"
+#include "include/comms-lib.h"
+#include <algorithm>
+#include <stdexcept>
+
+BeaconDetector::BeaconDetector(
+    const std::vector<std::complex<float>>& seq, size_t max_chunk_size)
+    : seq_(seq)
+    , max_chunk_size_(max_chunk_size)
+    , window_(seq.size() - 1 + max_chunk_size)
+{
+    if (seq.empty() == true)
+        throw std::invalid_argument("BeaconDetector: empty sequence");
+    this->reset();
+}
+
+void BeaconDetector::reset(void)
+{
+    std::fill(this->window_.begin(), this->window_.end(), 0);
+    this->state_.corr_ring.assign(this->seq_.size(), 0);
+    this->state_.ring_pos = 0;
+    this->state_.power_sum = 0;
+    this->position_ = 0;
+}
+
+int BeaconDetector::process(const std::complex<float>* samples, size_t count)
+{
+    const size_t history = this->seq_.size() - 1;
+    count = std::min(count, this->max_chunk_size_);
+    std::copy(samples, samples + count, this->window_.begin() + history);
+    int peak = CommsLib::beacon_search_fused(this->window_.data(), count,
+        this->seq_.data(), this->seq_.size(), this->state_);
+    size_t consumed = peak >= 0 ? peak + 1 : count;
+
+    // Recompute the running sum so rounding doesn't build up over time
+    this->state_.power_sum = 0;
+    for (auto& c : this->state_.corr_ring)
+        this->state_.power_sum += std::norm(c);
+
+    // Keep the samples that overlap the next chunk
+    std::copy(this->window_.begin() + consumed,
+        this->window_.begin() + consumed + history, this->window_.begin());
+    this->position_ += consumed;
+    return peak;
+}
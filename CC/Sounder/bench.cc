@@ -0,0 +1,110 @@
+/*
+ Copyright (c) 2018-2020, Rice University
+ RENEW OPEN SOURCE LICENSE: http://renew-wireless.org/license
+
+---------------------------------------------------------------------
+ Capture benchmark
+ - runs Receiver -> Recorder -> RecorderWorker on synthetic radios
+ - reports sustained symbols/s, drops and latency
+---------------------------------------------------------------------
+*/
+
+#include "include/recorder.h"
+#include "include/signalHandler.hpp"
+#include <gflags/gflags.h>
+
+DEFINE_string(conf, "files/conf.json",
+    "JSON configuration file name, base station only");
+DEFINE_string(storepath, "logs", "Dataset store path");
+DEFINE_string(replay, "",
+    "Trace whose pilots are replayed, pilots are generated otherwise");
+DEFINE_double(rate, 1.0, "Speed versus real time, 0 delivers unpaced");
+DEFINE_uint32(seconds, 10, "Benchmark duration in seconds");
+
+static void report(Sounder::Recorder& recorder, double elapsed_s)
+{
+    Telemetry& telemetry = recorder.telemetry();
+    const std::memory_order relaxed = std::memory_order_relaxed;
+
+    uint64_t received = 0;
+    uint64_t drops = 0;
+    uint64_t short_reads = 0;
+    for (size_t i = 0; i < telemetry.num_rx_threads(); i++) {
+        RxStats& stats = telemetry.rx(i);
+        received += stats.packets.load(relaxed);
+        drops += stats.drops.load(relaxed);
+        short_reads += stats.short_reads.load(relaxed);
+    }
+
+    uint64_t recorded = 0;
+    uint64_t latency_max_ns = 0;
+    std::vector<uint64_t> histogram(kLatencyBuckets, 0);
+    for (size_t i = 0; i < telemetry.num_recorder_threads(); i++) {
+        RecordStats& stats = telemetry.record(i);
+        recorded += stats.packets.load(relaxed);
+        latency_max_ns
+            = std::max(latency_max_ns, stats.latency_max_ns.load(relaxed));
+        for (size_t b = 0; b < kLatencyBuckets; b++)
+            histogram[b] += stats.latency[b].load(relaxed);
+    }
+
+    std::printf("Benchmark ran %.2f s\n", elapsed_s);
+    std::printf("  received  %lu symbols, %.1f symbols/s\n", received,
+        received / elapsed_s);
+    std::printf("  recorded  %lu symbols, %.1f symbols/s\n", recorded,
+        recorded / elapsed_s);
+    std::printf("  dropped   %lu symbols, %lu short reads\n", drops,
+        short_reads);
+    std::printf("  latency   p50 < %lu us, p99 < %lu us, max %lu us\n",
+        Telemetry::latencyPercentile(histogram, recorded, 0.50),
+        Telemetry::latencyPercentile(histogram, recorded, 0.99),
+        latency_max_ns / 1000);
+}
+
+int main(int argc, char* argv[])
+{
+    gflags::SetUsageMessage("Benchmarks the capture path without radios");
+    gflags::ParseCommandLineFlags(&argc, &argv, true);
+    Config config(FLAGS_conf, FLAGS_storepath);
+    config.bs_radio_backend(FLAGS_replay.empty() ? "synthetic" : "replay");
+    config.replay_file(FLAGS_replay);
+    config.synthetic_rate(FLAGS_rate);
+
+    int ret = EXIT_SUCCESS;
+    try {
+        SignalHandler signalHandler;
+        signalHandler.setupSignalHandlers();
+        Sounder::Recorder recorder(&config);
+
+        std::exception_ptr error;
+        auto begin = std::chrono::steady_clock::now();
+        auto end = begin + std::chrono::seconds(FLAGS_seconds);
+        std::thread runner([&recorder, &error] {
+            try {
+                recorder.do_it();
+            } catch (...) {
+                error = std::current_exception();
+            }
+        });
+        while ((config.running() == true)
+            && (SignalHandler::gotExitSignal() == false)
+            && (std::chrono::steady_clock::now() < end)) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+        // rates are over the receive time, the recorders drain after it
+        double elapsed_s = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - begin)
+                               .count();
+        config.running(false);
+        runner.join();
+        if (error != nullptr)
+            std::rethrow_exception(error);
+
+        report(recorder, elapsed_s);
+    } catch (const std::exception& exc) {
+        std::cerr << "Benchmark terminated Exception: " << exc.what()
+                  << std::endl;
+        ret = EXIT_FAILURE;
+    }
+    return ret;
+}
@@ -0,0 +1,146 @@
+/*
+ Copyright (c) 2018-2020, Rice University
+ RENEW OPEN SOURCE LICENSE: http://renew-wireless.org/license
+
+----------------------------------------------------------------------
+ On-disk store of base station calibration results
+---------------------------------------------------------------------
+*/
+
+#include "include/calibration_cache.h"
+#include "include/logger.h"
+#include <SoapySDR/Constants.h>
+#include <cstdio>
+#include <fstream>
+
+using json = nlohmann::json;
+
+static std::string pathName(int direction, size_t channel)
+{
+    return std::string(direction == SOAPY_SDR_RX ? "RX" : "TX")
+        + std::to_string(channel);
+}
+
+CalibrationCache::CalibrationCache(const std::string& filename, Config* cfg)
+    : filename_(filename)
+    , store_(json::object())
+{
+    this->settings_["frequency"] = cfg->radio_rf_freq();
+    this->settings_["rate"] = cfg->rate();
+    this->settings_["channel"] = cfg->bs_channel();
+    this->settings_["rx_gain"] = cfg->rx_gain();
+    this->settings_["tx_gain"] = cfg->tx_gain();
+    this->settings_["cal_tx_gain"] = cfg->cal_tx_gain();
+
+    std::ifstream file(filename);
+    if (!file.is_open()) {
+        MLPD_INFO("Calibration cache %s not found, starting empty\n",
+            filename.c_str());
+        return;
+    }
+    try {
+        file >> this->store_;
+    } catch (const json::exception& e) {
+        MLPD_WARN("Ignoring unreadable calibration cache %s: %s\n",
+            filename.c_str(), e.what());
+        this->store_ = json::object();
+    }
+    if (!this->store_.is_object())
+        this->store_ = json::object();
+}
+
+const json* CalibrationCache::find(const std::string& serial) const
+{
+    auto it = this->store_.find(serial);
+    if (it == this->store_.end() || !it->is_object()
+        || it->value("settings", json()) != this->settings_)
+        return nullptr;
+    return &*it;
+}
+
+json& CalibrationCache::entry(const std::string& serial)
+{
+    json& board = this->store_[serial];
+    if (!board.is_object()
+        || board.value("settings", json()) != this->settings_) {
+        board = json::object();
+        board["settings"] = this->settings_;
+    }
+    return board;
+}
+
+bool CalibrationCache::findDciq(const std::string& serial, int direction,
+    size_t channel, DciqCorrection& corr)
+{
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    const json* board = this->find(serial);
+    if (board == nullptr || !board->contains("dciq"))
+        return false;
+    auto it = board->at("dciq").find(pathName(direction, channel));
+    if (it == board->at("dciq").end())
+        return false;
+    try {
+        corr.dc = std::complex<double>(it->at("dc").at(0).get<double>(),
+            it->at("dc").at(1).get<double>());
+        corr.gcorr = it->at("gcorr").get<int>();
+        corr.iqcorr = it->at("iqcorr").get<int>();
+    } catch (const json::exception&) {
+        return false;
+    }
+    return true;
+}
+
+void CalibrationCache::storeDciq(const std::string& serial, int direction,
+    size_t channel, const DciqCorrection& corr)
+{
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    json& path = this->entry(serial)["dciq"][pathName(direction, channel)];
+    path["dc"] = { corr.dc.real(), corr.dc.imag() };
+    path["gcorr"] = corr.gcorr;
+    path["iqcorr"] = corr.iqcorr;
+}
+
+bool CalibrationCache::findTriggerDelay(
+    const std::string& serial, const std::string& reference, int& delay)
+{
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    const json* board = this->find(serial);
+    if (board == nullptr || !board->contains("trigger_delay"))
+        return false;
+    const json& trigger = board->at("trigger_delay");
+    if (trigger.value("reference", std::string()) != reference
+        || !trigger.contains("delay"))
+        return false;
+    delay = trigger.at("delay").get<int>();
+    return true;
+}
+
+void CalibrationCache::storeTriggerDelay(
+    const std::string& serial, const std::string& reference, int delay)
+{
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    json& trigger = this->entry(serial)["trigger_delay"];
+    trigger["reference"] = reference;
+    trigger["delay"] = delay;
+}
+
+void CalibrationCache::save(void)
+{
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    std::string tmp_name = this->filename_ + ".tmp";
+    {
+        std::ofstream file(tmp_name);
+        file << this->store_.dump(4) << std::endl;
+        if (!file) {
+            MLPD_ERROR("Failed to write calibration cache %s\n",
+                tmp_name.c_str());
+            return;
+        }
+    }
+    if (std::rename(tmp_name.c_str(), this->filename_.c_str()) != 0) {
+        MLPD_ERROR("Failed to replace calibration cache %s\n",
+            this->filename_.c_str());
+        return;
+    }
+    MLPD_INFO("Saved calibration cache %s\n", this->filename_.c_str());
+}
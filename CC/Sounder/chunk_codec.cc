@@ -0,0 +1,292 @@
+/*
+ Copyright (c) 2018-2020, Rice University
+ RENEW OPEN SOURCE LICENSE: http://renew-wireless.org/license
+
+----------------------------------------------------------------------
+ Compression of whole hdf5 chunks outside of the hdf5 library
+---------------------------------------------------------------------
+*/
+
+#include "include/chunk_codec.h"
+#include "include/logger.h"
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#ifdef USE_LZ4
+#include <lz4.h>
+#endif
+#ifdef USE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace Sounder {
+// Ids of the registered hdf5 filter plugins
+static const H5Z_filter_t kLz4FilterId = 32004;
+static const H5Z_filter_t kZstdFilterId = 32015;
+#ifdef USE_LZ4
+// LZ4 filter header, original size (8 bytes) and block size (4 bytes)
+static const size_t kLz4HeaderLen = 12;
+
+static void putBigEndian(char* out, uint64_t value, size_t bytes)
+{
+    for (size_t i = 0; i < bytes; i++)
+        out[i] = static_cast<char>(value >> (8 * (bytes - 1 - i)));
+}
+
+static uint64_t getBigEndian(const char* in, size_t bytes)
+{
+    uint64_t value = 0;
+    for (size_t i = 0; i < bytes; i++)
+        value = (value << 8) | static_cast<unsigned char>(in[i]);
+    return value;
+}
+#endif
+
+// out = in compressed, in the stored format of the filter plugin
+static bool compress(ChunkCodec::Type type, int level, const char* in,
+    size_t len, std::vector<char>& out)
+{
+    (void)level;
+#ifdef USE_LZ4
+    if (type == ChunkCodec::kLz4) {
+        // one block for the whole chunk, stored raw if it does not shrink
+        out.resize(kLz4HeaderLen + 4 + LZ4_compressBound(len));
+        putBigEndian(&out[0], len, 8);
+        putBigEndian(&out[8], len, 4);
+        int block = LZ4_compress_default(
+            in, &out[kLz4HeaderLen + 4], len, out.size() - kLz4HeaderLen - 4);
+        if ((block <= 0) || (static_cast<size_t>(block) >= len)) {
+            std::memcpy(&out[kLz4HeaderLen + 4], in, len);
+            block = len;
+        }
+        putBigEndian(&out[kLz4HeaderLen], block, 4);
+        out.resize(kLz4HeaderLen + 4 + block);
+        return true;
+    }
+#endif
+#ifdef USE_ZSTD
+    if (type == ChunkCodec::kZstd) {
+        out.resize(ZSTD_compressBound(len));
+        size_t size = ZSTD_compress(&out[0], out.size(), in, len, level);
+        if (ZSTD_isError(size))
+            return false;
+        out.resize(size);
+        return true;
+    }
+#endif
+    (void)type;
+    (void)in;
+    (void)len;
+    (void)out;
+    return false;
+}
+
+static bool decompress(ChunkCodec::Type type, const char* in, size_t len,
+    std::vector<char>& out)
+{
+#ifdef USE_LZ4
+    if (type == ChunkCodec::kLz4) {
+        if (len < kLz4HeaderLen)
+            return false;
+        size_t total = getBigEndian(in, 8);
+        size_t block_len = getBigEndian(in + 8, 4);
+        out.resize(total);
+        size_t pos = kLz4HeaderLen;
+        for (size_t done = 0; done < total;) {
+            size_t expected = std::min(block_len, total - done);
+            if ((block_len == 0) || (pos + 4 > len))
+                return false;
+            size_t block = getBigEndian(in + pos, 4);
+            pos += 4;
+            if (pos + block > len)
+                return false;
+            if (block == expected) {
+                std::memcpy(&out[done], in + pos, block);
+            } else if (LZ4_decompress_safe(in + pos, &out[done], block,
+                           expected)
+                != static_cast<int>(expected)) {
+                return false;
+            }
+            pos += block;
+            done += expected;
+        }
+        return true;
+    }
+#endif
+#ifdef USE_ZSTD
+    if (type == ChunkCodec::kZstd) {
+        unsigned long long total = ZSTD_getFrameContentSize(in, len);
+        if ((total == ZSTD_CONTENTSIZE_ERROR)
+            || (total == ZSTD_CONTENTSIZE_UNKNOWN))
+            return false;
+        out.resize(total);
+        size_t size = ZSTD_decompress(&out[0], total, in, len);
+        return (ZSTD_isError(size) == 0) && (size == total);
+    }
+#endif
+    (void)type;
+    (void)in;
+    (void)len;
+    (void)out;
+    return false;
+}
+
+// Filter callback for the library, the shuffle filter runs separately
+static size_t runFilter(ChunkCodec::Type type, unsigned flags,
+    size_t cd_nelmts, const unsigned cd_values[], size_t nbytes,
+    size_t* buf_size, void** buf)
+{
+    int level = (cd_nelmts > 0) ? static_cast<int>(cd_values[0]) : 0;
+    std::vector<char> out;
+    bool ok = (flags & H5Z_FLAG_REVERSE)
+        ? decompress(type, static_cast<const char*>(*buf), nbytes, out)
+        : compress(type, level, static_cast<const char*>(*buf), nbytes, out);
+    if ((ok == false) || out.empty())
+        return 0;
+    void* result = std::malloc(out.size());
+    if (result == nullptr)
+        return 0;
+    std::memcpy(result, out.data(), out.size());
+    std::free(*buf);
+    *buf = result;
+    *buf_size = out.size();
+    return out.size();
+}
+
+static size_t lz4Filter(unsigned flags, size_t cd_nelmts,
+    const unsigned cd_values[], size_t nbytes, size_t* buf_size, void** buf)
+{
+    return runFilter(ChunkCodec::kLz4, flags, cd_nelmts, cd_values, nbytes,
+        buf_size, buf);
+}
+
+static size_t zstdFilter(unsigned flags, size_t cd_nelmts,
+    const unsigned cd_values[], size_t nbytes, size_t* buf_size, void** buf)
+{
+    return runFilter(ChunkCodec::kZstd, flags, cd_nelmts, cd_values, nbytes,
+        buf_size, buf);
+}
+
+// Registers our codec unless a filter plugin already provides it
+static void registerFilter(ChunkCodec::Type type)
+{
+    static std::mutex mutex;
+    std::lock_guard<std::mutex> lock(mutex);
+    H5Z_filter_t id = (type == ChunkCodec::kLz4) ? kLz4FilterId : kZstdFilterId;
+    if (H5Zfilter_avail(id) > 0)
+        return;
+    H5Z_class2_t filter;
+    filter.version = H5Z_CLASS_T_VERS;
+    filter.id = id;
+    filter.encoder_present = 1;
+    filter.decoder_present = 1;
+    filter.name = (type == ChunkCodec::kLz4) ? "lz4" : "zstd";
+    filter.can_apply = NULL;
+    filter.set_local = NULL;
+    filter.filter = (type == ChunkCodec::kLz4) ? lz4Filter : zstdFilter;
+    if (H5Zregister(&filter) < 0)
+        throw std::runtime_error("Failed to register the hdf5 chunk codec");
+}
+
+ChunkCodec::ChunkCodec(const std::string& name, int level)
+    : type_(kNone)
+    , level_(level)
+{
+    if (name == "lz4")
+        this->type_ = kLz4;
+    else if (name == "zstd")
+        this->type_ = kZstd;
+    else if (name != "none")
+        throw std::invalid_argument("Unknown chunk codec " + name);
+    if (this->type_ != kNone)
+        registerFilter(this->type_);
+}
+
+void ChunkCodec::setFilters(H5::DSetCreatPropList& prop) const
+{
+    if (this->type_ == kNone)
+        return;
+    // LZ4 takes its block size (0 for the default), zstd its level
+    unsigned cd_value = (this->type_ == kLz4) ? 0 : this->level_;
+    prop.setShuffle();
+    prop.setFilter((this->type_ == kLz4) ? kLz4FilterId : kZstdFilterId,
+        H5Z_FLAG_OPTIONAL, 1, &cd_value);
+}
+
+void ChunkCodec::encode(const char* in, size_t bytes, size_t element_size,
+    bool swap, std::vector<char>& scratch, std::vector<char>& out) const
+{
+    // Byte b of every value goes to plane b, a trailing partial value is
+    // kept as is, same as H5Z_FILTER_SHUFFLE
+    size_t count = bytes / element_size;
+    scratch.resize(bytes);
+    for (size_t b = 0; b < element_size; b++) {
+        const char* src = in + (swap ? element_size - 1 - b : b);
+        char* dst = &scratch[b * count];
+        for (size_t i = 0; i < count; i++)
+            dst[i] = src[i * element_size];
+    }
+    std::memcpy(&scratch[count * element_size], in + count * element_size,
+        bytes - count * element_size);
+    if (compress(this->type_, this->level_, scratch.data(), bytes, out)
+        == false)
+        throw std::runtime_error("Chunk compression failed");
+}
+
+ChunkPool::ChunkPool(size_t num_threads)
+    : running_(true)
+{
+    for (size_t i = 0; i < num_threads; i++)
+        this->threads_.emplace_back(&ChunkPool::loop, this);
+}
+
+ChunkPool::~ChunkPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        this->running_ = false;
+    }
+    this->task_cond_.notify_all();
+    for (auto& thread : this->threads_)
+        thread.join();
+}
+
+void ChunkPool::submit(Task task)
+{
+    {
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        this->tasks_.push_back(std::move(task));
+    }
+    this->task_cond_.notify_one();
+}
+
+void ChunkPool::waitFor(const std::function<bool(void)>& ready)
+{
+    std::unique_lock<std::mutex> lock(this->mutex_);
+    this->done_cond_.wait(lock, ready);
+}
+
+void ChunkPool::loop(void)
+{
+    std::vector<char> scratch;
+    std::unique_lock<std::mutex> lock(this->mutex_);
+    while (true) {
+        this->task_cond_.wait(lock, [this] {
+            return (this->running_ == false) || (this->tasks_.empty() == false);
+        });
+        if (this->tasks_.empty() == true)
+            return;
+        Task task = std::move(this->tasks_.front());
+        this->tasks_.pop_front();
+        lock.unlock();
+        try {
+            task(scratch);
+        } catch (const std::exception& e) {
+            MLPD_ERROR("Chunk encode failed: %s\n", e.what());
+        }
+        lock.lock();
+        this->done_cond_.notify_all();
+    }
+}
+}; /* End namespace Sounder */
@@ -1,5 +1,6 @@
 /*
- Select signal processing and communications blocks implemented using Intel AVX
+ Select signal processing and communications blocks implemented using SIMD,
+ the kernels for each instruction set are in comms-lib-kernels.h
 
 find_beacon_avx: Correlation and Peak detection of a beacon with Gold code (2 repetitions)
 ---------------------------------------------------------------------
@@ -9,22 +10,15 @@ find_beacon_avx: Correlation and Peak detection of a beacon with Gold code (2 re
 ---------------------------------------------------------------------
 */
 
-#if defined(__x86_64__)
-
+#include "include/comms-lib-kernels.h"
 #include "include/comms-lib.h"
 #include "include/logger.h"
 #include <assert.h>
-#include <immintrin.h>
 #include <iomanip>
 #include <queue>
-
-#define USE_AVX
-
-static const size_t kBytesIn256Bits = (256 / 8);
-
-#define AVX_PACKED_SP 8 //single-precision
-#define AVX_PACKED_SI 16 // short int
-#define AVX_PACKED_CS 8 // complex short int
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
 
 int CommsLib::find_beacon_avx(const std::vector<std::complex<float>>& iq,
     const std::vector<std::complex<float>>& seq)
@@ -113,167 +107,35 @@ int CommsLib::find_beacon_avx(const std::vector<std::complex<float>>& iq,
     return valid_peaks.front();
 }
 
-static inline __m256i __m256_complex_cs16_mult(
-    __m256i data1, __m256i data2, bool conj)
-{
-    const __m256i neg0 = _mm256_set1_epi32(0xFFFF0000);
-    const __m256i neg1 = _mm256_set1_epi32(0x00010000);
-    const __m256i mix = _mm256_set1_epi32(0x0000FFFF);
-
-    __m256i temp0 = _mm256_xor_si256(data2, neg0);
-    temp0 = _mm256_add_epi32(temp0, neg1);
-
-    __m256i temp1 = _mm256_shufflehi_epi16(conj ? temp0 : data2, 0xb1);
-    temp1 = _mm256_shufflelo_epi16(temp1, 0xb1);
-
-    __m256i re = _mm256_madd_epi16(data1, conj ? data2 : temp0);
-    __m256i im = _mm256_madd_epi16(data1, temp1);
-
-    re = _mm256_srai_epi32(re, 15);
-    im = _mm256_srai_epi32(im, 15);
-
-    re = _mm256_and_si256(re, mix);
-    im = _mm256_and_si256(im, mix);
-    im = _mm256_slli_epi32(im, 0x10);
-
-    return _mm256_or_si256(re, im);
-}
-
 std::vector<std::complex<int16_t>> CommsLib::complex_mult_avx(
     std::vector<std::complex<int16_t>> const& f,
     std::vector<std::complex<int16_t>> const& g, const bool conj)
 {
-    size_t length1 = g.size();
-    size_t length0 = f.size();
-    size_t res_len = std::min(length0, length1);
-
-    __m256i* in0 = (__m256i*)(f.data());
-    __m256i* in1 = (__m256i*)(g.data());
+    size_t res_len = std::min(f.size(), g.size());
     std::vector<std::complex<int16_t>> out(res_len, 0);
-    __m256i* outf = (__m256i*)out.data();
-
-    __m256i data0 __attribute__((aligned(kBytesIn256Bits)));
-    __m256i data1 __attribute__((aligned(kBytesIn256Bits)));
-
-    __m256i res __attribute__((aligned(kBytesIn256Bits)));
-
-    size_t vecSize = res_len / AVX_PACKED_CS;
-    for (size_t i = 0; i < vecSize; i++) {
-        data0 = _mm256_loadu_si256(in0 + i);
-        data1 = _mm256_loadu_si256(in1 + i);
-        res = __m256_complex_cs16_mult(data0, data1, conj);
-        _mm256_storeu_si256(outf + i, res);
-    }
-
-    for (size_t i = vecSize * AVX_PACKED_CS; i < res_len; i++) {
-        int16_t i0 = f[i].real();
-        int16_t i1 = g[i].real();
-        int16_t q0 = f[i].imag();
-        int16_t q1 = g[i].imag();
-        int16_t ires = (int16_t)((i0 * i1 + (conj ? 1 : -1) * q0 * q1) >> 15);
-        int16_t qres = (int16_t)((i1 * q0 + (conj ? -1 : 1) * i0 * q1) >> 15);
-        out[i] = std::complex<int16_t>(ires, qres);
-    }
-
+    commsKernels().complex_mult_ci16(
+        f.data(), g.data(), res_len, conj, out.data());
     return out;
 }
 
-static inline __m256 __m256_complex_cf32_mult(
-    __m256 data1, __m256 data2, bool conj)
-{
-    __m256 prod0 __attribute__((aligned(kBytesIn256Bits)));
-    __m256 prod1 __attribute__((aligned(kBytesIn256Bits)));
-    __m256 res __attribute__((aligned(kBytesIn256Bits)));
-
-    // https://stackoverflow.com/questions/39509746
-    const __m256 neg0
-        = _mm256_setr_ps(1.0, -1.0, 1.0, -1.0, 1.0, -1.0, 1.0, -1.0);
-    const __m256 neg1
-        = _mm256_set_ps(1.0, -1.0, 1.0, -1.0, 1.0, -1.0, 1.0, -1.0);
-    prod0 = _mm256_mul_ps(data1, data2); // q1*q2, i1*i2, ...
-
-    /* Step 2: Negate the imaginary elements of vec2 */
-    data2 = _mm256_mul_ps(data2, conj ? neg0 : neg1);
-
-    /* Step 3: Switch the real and imaginary elements of vec2 */
-    data2 = _mm256_permute_ps(data2, 0xb1);
-
-    /* Step 4: Multiply vec1 and the modified vec2 */
-    prod1 = _mm256_mul_ps(data1, data2); // i2*q1, -i1*q2, ...
-
-    /* Horizontally add the elements in vec3 and vec4 */
-    res = conj
-        ? _mm256_hadd_ps(prod0, prod1)
-        : _mm256_hsub_ps(prod0, prod1); // i2*q1+-i1*q2, i1*i2+-q1*q2, ...
-    res = _mm256_permute_ps(res, 0xd8);
-
-    return res;
-}
-
 std::vector<std::complex<float>> CommsLib::complex_mult_avx(
     std::vector<std::complex<float>> const& f,
     std::vector<std::complex<float>> const& g, const bool conj)
 {
-    size_t length1 = 2 * g.size();
-    size_t length0 = 2 * f.size();
-    size_t res_len = std::min(length0, length1);
-
-    float* in0 = (float*)(f.data());
-    float* in1 = (float*)(g.data());
-    std::vector<std::complex<float>> out(res_len / 2, 0);
-    float* outf = (float*)out.data();
-
-    __m256 data0 __attribute__((aligned(kBytesIn256Bits)));
-    __m256 data1 __attribute__((aligned(kBytesIn256Bits)));
-
-    __m256 res __attribute__((aligned(kBytesIn256Bits)));
-
-    size_t rem = res_len - (res_len % AVX_PACKED_SP);
-    for (size_t i = 0; i < rem; i += AVX_PACKED_SP) {
-        data0 = _mm256_loadu_ps(in0 + i);
-        data1 = _mm256_loadu_ps(in1 + i);
-        res = __m256_complex_cf32_mult(data0, data1, conj);
-        _mm256_storeu_ps(outf + i, res);
-    }
-
-    for (size_t i = rem; i < res_len; i += 2)
-        out[i / 2] = f[i / 2] * (conj ? std::conj(g[i / 2]) : g[i / 2]);
-
+    size_t res_len = std::min(f.size(), g.size());
+    std::vector<std::complex<float>> out(res_len, 0);
+    commsKernels().complex_mult_cf32(
+        f.data(), g.data(), res_len, conj, out.data());
     return out;
 }
 
 std::vector<std::complex<float>> CommsLib::auto_corr_mult_avx(
     std::vector<std::complex<float>> const& f, const int dly, const bool conj)
 {
-#if 0
-    size_t length = 2 * f.size();
-    float* in = (float*)(f.data());
-    std::vector<std::complex<float>> out(length / 2, 0);
-    float* outf = (float*)(out.data());
-    int d = 2 * dly;
-
-    __m256 data1 __attribute__((aligned(kAlign256Bits)));
-    __m256 data2 __attribute__((aligned(kAlign256Bits)));
-    __m256 res __attribute__((aligned(kAlign256Bits)));
-
-    size_t rem = length - (length % AVX_PACKED_SP);
-    if (rem > 0) {
-        for (size_t i = d; i < rem; i += AVX_PACKED_SP) {
-            data1 = _mm256_loadu_ps(in + i);
-            data2 = _mm256_loadu_ps(in + i - d);
-            res = __m256_complex_cf32_mult(data1, data2, conj);
-            _mm256_storeu_ps(outf + i, res);
-        }
-    }
-    for (size_t i = rem; i < length; i += 2)
-        out[i / 2] = f[i / 2] * (conj ? std::conj(f[i / 2 - dly]) : f[i / 2 - dly]);
-    return out;
-#else
     std::vector<std::complex<float>> g(f.begin(), f.end() - dly);
     std::vector<std::complex<float>> z(dly, 0);
     g.insert(g.begin(), z.begin(), z.end());
     return CommsLib::complex_mult_avx(f, g, conj);
-#endif
 }
 
 std::vector<std::complex<int16_t>> CommsLib::auto_corr_mult_avx(
@@ -287,66 +149,174 @@ std::vector<std::complex<int16_t>> CommsLib::auto_corr_mult_avx(
 
 std::vector<float> CommsLib::abs2_avx(std::vector<std::complex<float>> const& f)
 {
-    size_t length = 2 * f.size();
-    float* in = (float*)(f.data());
-    std::vector<float> out(length / 2, 0);
-    float* outf = (float*)(out.data());
-
-    __m256 data1 __attribute__((aligned(kBytesIn256Bits)));
-    __m256 data2 __attribute__((aligned(kBytesIn256Bits)));
-    __m256 prod0 __attribute__((aligned(kBytesIn256Bits)));
-    __m256 prod1 __attribute__((aligned(kBytesIn256Bits)));
-    __m256 res __attribute__((aligned(kBytesIn256Bits)));
-    const __m256i perm0
-        = _mm256_set_epi32(0x7, 0x6, 0x3, 0x2, 0x5, 0x4, 0x1, 0x0);
-
-    size_t rem = length - (length % (2 * AVX_PACKED_SP));
-    if (rem > 0) {
-        for (size_t i = 0; i < rem; i += 2 * AVX_PACKED_SP) {
-            data1 = _mm256_loadu_ps(in
-                + i); // low index go to high bit of __m256 variable apparently
-            data2 = _mm256_loadu_ps(in + i + AVX_PACKED_SP);
-
-            prod0 = _mm256_mul_ps(data1, data1);
-            prod1 = _mm256_mul_ps(data2, data2);
-
-            res = _mm256_hadd_ps(prod0, prod1);
-            res = _mm256_permutevar8x32_ps(res, perm0);
-            _mm256_storeu_ps(outf + i / 2, res);
-        }
-    }
-
-    for (size_t i = rem; i < length; i += 2)
-        outf[i / 2] = in[i] * in[i] + in[i + 1] * in[i + 1];
+    std::vector<float> out(f.size(), 0);
+    commsKernels().abs2_cf32(f.data(), f.size(), out.data());
     return out;
 }
 
 std::vector<int32_t> CommsLib::abs2_avx(
     std::vector<std::complex<int16_t>> const& f)
 {
-    size_t len = f.size();
+    std::vector<int32_t> out(f.size(), 0);
+    commsKernels().abs2_ci16(f.data(), f.size(), out.data());
+    return out;
+}
+
+std::vector<std::complex<float>> CommsLib::correlate_avx(
+    std::vector<std::complex<float>> const& f,
+    std::vector<std::complex<float>> const& g)
+{
+    // assuming length0 is larger or equal to length1
+    size_t length0 = f.size();
+    size_t length1 = g.size();
+
+    // length1 - 1 zeros in front, the last length1 - 1 outputs stay zero
+    std::vector<std::complex<float>> in(length0 + length1 - 1, 0);
+    std::copy(f.begin(), f.end(), in.begin() + length1 - 1);
+    std::vector<std::complex<float>> out(in.size(), 0);
+    CommsLib::correlate_avx(in.data(), length0, g.data(), length1, out.data());
+    return out;
+}
 
-    __m256i* in0 = (__m256i*)(f.data());
-    std::vector<int32_t> out(len, 0);
-    __m256i* outf = (__m256i*)out.data();
+void CommsLib::correlate_avx(const std::complex<float>* in, size_t out_len,
+    const std::complex<float>* seq, size_t seq_len, std::complex<float>* out)
+{
+    if (seq_len >= kFftCorrelationMinTaps)
+        CommsLib::correlate_fft(in, out_len, seq, seq_len, out);
+    else
+        commsKernels().correlate_cf32(in, out_len, seq, seq_len, out);
+}
 
-    size_t vecSize = len / AVX_PACKED_CS;
-    for (size_t i = 0; i < vecSize; i++) {
-        __m256i data0 = _mm256_loadu_si256(in0 + i);
-        __m256i mag = _mm256_madd_epi16(data0, data0);
-        _mm256_storeu_si256(outf + i, mag);
+void CommsLib::correlate_sign_avx(const std::complex<float>* iq, size_t len,
+    const std::complex<float>* seq, size_t seq_len, SignCorrelation& work)
+{
+    // seq_len - 1 zero signs on both sides, one output per shift
+    size_t out_len = len + seq_len - 1;
+    work.sign.assign(out_len + seq_len - 1, 0);
+    CommsLib::csign(iq, len, work.sign.data() + seq_len - 1);
+    work.power.resize(out_len);
+
+    if (seq_len >= kFftCorrelationMinTaps) {
+        work.samples.resize(work.sign.size());
+        for (size_t i = 0; i < work.sign.size(); i++)
+            work.samples[i] = work.sign[i];
+        work.corr.resize(out_len);
+        CommsLib::correlate_fft(
+            work.samples.data(), out_len, seq, seq_len, work.corr.data());
+        commsKernels().abs2_cf32(work.corr.data(), out_len, work.power.data());
+        return;
     }
 
-    for (size_t i = vecSize * AVX_PACKED_CS; i < len; i++) {
-        int16_t i0 = f[i].real();
-        int16_t q0 = f[i].imag();
-        out[i] = i0 * i0 + q0 * q0;
+    // sign * conj(seq) = (sign c, -sign d)
+    work.taps_re.resize(seq_len);
+    work.taps_im.resize(seq_len);
+    for (size_t j = 0; j < seq_len; j++) {
+        work.taps_re[j] = seq[j].real();
+        work.taps_im[j] = -seq[j].imag();
+    }
+    work.corr_re.resize(out_len);
+    work.corr_im.resize(out_len);
+    commsKernels().correlate_sign(work.sign.data(), out_len,
+        work.taps_re.data(), work.taps_im.data(), seq_len,
+        work.corr_re.data(), work.corr_im.data());
+    for (size_t i = 0; i < out_len; i++) {
+        work.power[i] = work.corr_re[i] * work.corr_re[i]
+            + work.corr_im[i] * work.corr_im[i];
     }
+}
 
+std::vector<float> CommsLib::correlate_avx_s(
+    std::vector<float> const& f, std::vector<float> const& g)
+{
+    size_t length_f = f.size();
+    size_t length_g = g.size();
+    assert(length_f > length_g);
+
+    //in[length_g:length] = f[0:length_f]
+    std::vector<float> in(length_f + length_g, 0);
+    std::copy(f.begin(), f.end(), in.begin() + length_g);
+    std::vector<float> out(length_f);
+    commsKernels().correlate_f32(
+        in.data(), length_f, g.data(), length_g, out.data());
     return out;
 }
 
-std::vector<std::complex<int16_t>> CommsLib::correlate_avx(
+int CommsLib::beacon_search_fused(const std::complex<float>* in,
+    size_t count, const std::complex<float>* seq, size_t seq_len,
+    BeaconSearchState& state)
+{
+    const CommsKernels& kernels = commsKernels();
+    std::complex<float> corr[kCommsMaxBeaconBlock];
+
+    // Each block is thresholded while it is still in cache, the search
+    // stops at the first peak instead of correlating the whole buffer
+    size_t i = 0;
+    for (; i + kernels.beacon_block <= count; i += kernels.beacon_block) {
+        kernels.beacon_block_cf32(in + i, seq, seq_len, corr);
+        int peak = CommsLib::beacon_scan(corr, kernels.beacon_block, state);
+        if (peak >= 0)
+            return i + peak;
+    }
+    if (i < count) {
+        kernels.correlate_cf32(in + i, count - i, seq, seq_len, corr);
+        int peak = CommsLib::beacon_scan(corr, count - i, state);
+        if (peak >= 0)
+            return i + peak;
+    }
+    return -1;
+}
+
+int CommsLib::find_beacon_fused(const std::vector<std::complex<float>>& iq,
+    const std::vector<std::complex<float>>& seq)
+{
+    // seq_len - 1 zeros in front, as correlate_avx pads
+    size_t seq_len = seq.size();
+    std::vector<std::complex<float>> in(seq_len - 1 + iq.size());
+    std::copy(iq.begin(), iq.end(), in.begin() + seq_len - 1);
+
+    BeaconSearchState state;
+    state.corr_ring.assign(seq_len, 0);
+    state.ring_pos = 0;
+    state.power_sum = 0;
+    return CommsLib::beacon_search_fused(
+        in.data(), iq.size(), seq.data(), seq_len, state);
+}
+
+#if defined(__x86_64__)
+static const size_t kBytesIn256Bits = (256 / 8);
+
+#define AVX_PACKED_SI 16 // short int
+
+// The int16 correlations are only used by the comm-testbench and keep
+// their AVX2 code, compiled for AVX2 whatever the build flags
+__attribute__((target("avx2"))) static inline __m256i
+__m256_complex_cs16_mult(__m256i data1, __m256i data2, bool conj)
+{
+    const __m256i neg0 = _mm256_set1_epi32(0xFFFF0000);
+    const __m256i neg1 = _mm256_set1_epi32(0x00010000);
+    const __m256i mix = _mm256_set1_epi32(0x0000FFFF);
+
+    __m256i temp0 = _mm256_xor_si256(data2, neg0);
+    temp0 = _mm256_add_epi32(temp0, neg1);
+
+    __m256i temp1 = _mm256_shufflehi_epi16(conj ? temp0 : data2, 0xb1);
+    temp1 = _mm256_shufflelo_epi16(temp1, 0xb1);
+
+    __m256i re = _mm256_madd_epi16(data1, conj ? data2 : temp0);
+    __m256i im = _mm256_madd_epi16(data1, temp1);
+
+    re = _mm256_srai_epi32(re, 15);
+    im = _mm256_srai_epi32(im, 15);
+
+    re = _mm256_and_si256(re, mix);
+    im = _mm256_and_si256(im, mix);
+    im = _mm256_slli_epi32(im, 0x10);
+
+    return _mm256_or_si256(re, im);
+}
+
+__attribute__((target("avx2"))) std::vector<std::complex<int16_t>>
+CommsLib::correlate_avx(
     std::vector<std::complex<int16_t>> const& f,
     std::vector<std::complex<int16_t>> const& g)
 {
@@ -385,50 +355,8 @@ std::vector<std::complex<int16_t>> CommsLib::correlate_avx(
     return out;
 }
 
-std::vector<std::complex<float>> CommsLib::correlate_avx(
-    std::vector<std::complex<float>> const& f,
-    std::vector<std::complex<float>> const& g)
-{
-    // assuming length0 is larger or equal to length1
-    size_t length0 = f.size();
-    size_t length1 = g.size();
-
-    std::vector<std::complex<float>> in(length0 + length1 - 1, 0);
-    //std::copy(f.begin(), f.end(), std::back_inserter(in));
-    //in.insert(in.end(), f.begin(), f.end());
-    for (size_t i = length1 - 1; i < in.size(); i++) {
-        size_t j = i - length1 + 1;
-        in[i] = f[j];
-    }
-    size_t length = in.size();
-
-    float* in0 = (float*)(in.data());
-    float* in1 = (float*)(g.data());
-    std::vector<std::complex<float>> out(length, 0);
-    float* outf = (float*)out.data();
-
-    __m256 seq_samp[length1] __attribute__((aligned(kBytesIn256Bits)));
-
-    for (size_t i = 0; i < length1; i++) {
-        __m256 samp_i = _mm256_broadcast_ss(&in1[i * 2]);
-        __m256 samp_q = _mm256_broadcast_ss(&in1[i * 2 + 1]);
-        seq_samp[i] = _mm256_shuffle_ps(samp_i, samp_q, 0x0);
-        seq_samp[i] = _mm256_permute_ps(seq_samp[i], 0xd8);
-    }
-
-    for (size_t i = 0; i < 2 * (length - length1); i += AVX_PACKED_SP) {
-        __m256 accm = _mm256_setzero_ps();
-        for (size_t j = 0; j < length1; j++) {
-            __m256 data = _mm256_loadu_ps(in0 + i + j * 2);
-            __m256 prod = __m256_complex_cf32_mult(data, seq_samp[j], true);
-            accm = _mm256_add_ps(prod, accm);
-        }
-        _mm256_storeu_ps(outf + i, accm);
-    }
-    return out;
-}
-
-std::vector<int16_t> CommsLib::correlate_avx_si(
+__attribute__((target("avx2"))) std::vector<int16_t>
+CommsLib::correlate_avx_si(
     std::vector<int16_t> const& f, std::vector<int16_t> const& g)
 {
     // assuming length0 is larger or equal to length1
@@ -465,61 +393,4 @@ std::vector<int16_t> CommsLib::correlate_avx_si(
     }
     return out;
 }
-
-std::vector<float> CommsLib::correlate_avx_s(
-    std::vector<float> const& f, std::vector<float> const& g)
-{
-    size_t length_f = f.size();
-    size_t length_g = g.size();
-    assert(length_f > length_g);
-
-    std::vector<float> in(length_f + length_g);
-    size_t length = in.size();
-
-    //MLPD_TRACE("correlate_avx_s len_f: %zu, len_g: %zu, length: %zu\n", length_f, length_g, length);
-    //in[length_g:length] = f[0:length_f]
-    std::memset(in.data(), 0, length_g * sizeof(float));
-    for (size_t i = length_g; i < length; i++) {
-        size_t j = i - length_g;
-        in.at(i) = f.at(j);
-    }
-
-    float* in_data_ptr_ = in.data();
-    const float* in_g = g.data();
-
-    __m256 data __attribute__((aligned(kBytesIn256Bits)));
-    __m256 prod __attribute__((aligned(kBytesIn256Bits)));
-    __m256 accm __attribute__((aligned(kBytesIn256Bits)));
-
-    __m256 seq_samp[length_g] __attribute__((aligned(kBytesIn256Bits)));
-
-    // Repeat the kernel across the vector
-    for (size_t i = 0; i < length_g; i++) {
-        seq_samp[i] = _mm256_broadcast_ss(&in_g[i]);
-    }
-
-    static const size_t kAddressIncrement = kBytesIn256Bits / sizeof(float);
-    static_assert((kBytesIn256Bits % sizeof(float)) == 0,
-        "Address alignment not correct");
-
-    size_t padding = kAddressIncrement - (length_f % kAddressIncrement);
-    std::vector<float> out(length_f + padding);
-
-    //Verify no memory overruns
-    assert((out.size() % kAddressIncrement) == 0);
-    for (size_t i = 0; i < (out.size() - 1); i += kAddressIncrement) {
-        accm = _mm256_setzero_ps();
-        for (size_t j = 0; j < length_g; j++) {
-            data = _mm256_loadu_ps(in_data_ptr_ + i + j);
-            prod = _mm256_mul_ps(data, seq_samp[j]);
-            accm = _mm256_add_ps(prod, accm);
-        }
-        _mm256_storeu_ps(out.data() + i, accm);
-    }
-    out.resize(length_f);
-    return out;
-}
-#else
-// TODO: ADD NEON code for ARM support
-
 #endif
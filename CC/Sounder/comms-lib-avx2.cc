@@ -0,0 +1,327 @@
+/*
+ Copyright (c) 2018-2020, Rice University
+ RENEW OPEN SOURCE LICENSE: http://renew-wireless.org/license
+
+----------------------------------------------------------------------
+ AVX2 and FMA CommsLib kernels, this file alone is built with -mavx2
+ -mfma. Leftover samples go through the scalar kernels.
+---------------------------------------------------------------------
+*/
+
+#if defined(__x86_64__)
+
+#include "include/comms-lib-kernels.h"
+#include <immintrin.h>
+
+// complex floats per register
+static const size_t kCf32PerReg = 4;
+// complex shorts per register
+static const size_t kCs16PerReg = 8;
+
+/*
+ * With in[i + j] = (a, b) and seq[j] = (c, d) the correlation kernels
+ * accumulate (a c, b c) and (b d, a d) separately and apply conj(seq)
+ * once at the end as (a c + b d, b c - a d)
+ */
+static inline void correlateBlock8(
+    const float* in, const float* seq, size_t seq_len, float* out)
+{
+    __m256 direct0 = _mm256_setzero_ps();
+    __m256 direct1 = _mm256_setzero_ps();
+    __m256 cross0 = _mm256_setzero_ps();
+    __m256 cross1 = _mm256_setzero_ps();
+    for (size_t j = 0; j < seq_len; j++) {
+        __m256 seq_i = _mm256_broadcast_ss(&seq[j * 2]);
+        __m256 seq_q = _mm256_broadcast_ss(&seq[j * 2 + 1]);
+        __m256 data0 = _mm256_loadu_ps(in + j * 2);
+        __m256 data1 = _mm256_loadu_ps(in + j * 2 + 2 * kCf32PerReg);
+        direct0 = _mm256_fmadd_ps(data0, seq_i, direct0);
+        direct1 = _mm256_fmadd_ps(data1, seq_i, direct1);
+        cross0 = _mm256_fmadd_ps(_mm256_permute_ps(data0, 0xb1), seq_q, cross0);
+        cross1 = _mm256_fmadd_ps(_mm256_permute_ps(data1, 0xb1), seq_q, cross1);
+    }
+    const __m256 ones = _mm256_set1_ps(1);
+    _mm256_storeu_ps(out, _mm256_fmsubadd_ps(direct0, ones, cross0));
+    _mm256_storeu_ps(
+        out + 2 * kCf32PerReg, _mm256_fmsubadd_ps(direct1, ones, cross1));
+}
+
+static void correlateAvx2(const std::complex<float>* in, size_t out_len,
+    const std::complex<float>* seq, size_t seq_len, std::complex<float>* out)
+{
+    const float* inf = reinterpret_cast<const float*>(in);
+    const float* seqf = reinterpret_cast<const float*>(seq);
+    float* outf = reinterpret_cast<float*>(out);
+
+    // eight outputs per pass, never reads past in[out_len + seq_len - 1]
+    const size_t block = 2 * kCf32PerReg;
+    size_t i = 0;
+    for (; i + block <= out_len; i += block)
+        correlateBlock8(inf + i * 2, seqf, seq_len, outf + i * 2);
+    if (i < out_len) {
+        kCommsKernelsScalar.correlate_cf32(
+            in + i, out_len - i, seq, seq_len, out + i);
+    }
+}
+
+static void correlateRealAvx2(const float* in, size_t out_len,
+    const float* seq, size_t seq_len, float* out)
+{
+    const size_t block = 2 * 2 * kCf32PerReg;
+    size_t i = 0;
+    for (; i + block <= out_len; i += block) {
+        __m256 accm0 = _mm256_setzero_ps();
+        __m256 accm1 = _mm256_setzero_ps();
+        for (size_t j = 0; j < seq_len; j++) {
+            __m256 tap = _mm256_broadcast_ss(&seq[j]);
+            accm0 = _mm256_fmadd_ps(_mm256_loadu_ps(in + i + j), tap, accm0);
+            accm1 = _mm256_fmadd_ps(
+                _mm256_loadu_ps(in + i + j + block / 2), tap, accm1);
+        }
+        _mm256_storeu_ps(out + i, accm0);
+        _mm256_storeu_ps(out + i + block / 2, accm1);
+    }
+    if (i < out_len) {
+        kCommsKernelsScalar.correlate_f32(
+            in + i, out_len - i, seq, seq_len, out + i);
+    }
+}
+
+static void complexMultAvx2(const std::complex<float>* f,
+    const std::complex<float>* g, size_t len, bool conj,
+    std::complex<float>* out)
+{
+    const float* in0 = reinterpret_cast<const float*>(f);
+    const float* in1 = reinterpret_cast<const float*>(g);
+    float* outf = reinterpret_cast<float*>(out);
+
+    // f = (a, b), g = (c, d): (a c, b c) -+ (b d, a d)
+    size_t rem = len - (len % kCf32PerReg);
+    for (size_t i = 0; i < 2 * rem; i += 2 * kCf32PerReg) {
+        __m256 data0 = _mm256_loadu_ps(in0 + i);
+        __m256 data1 = _mm256_loadu_ps(in1 + i);
+        __m256 cross = _mm256_mul_ps(
+            _mm256_permute_ps(data0, 0xb1), _mm256_movehdup_ps(data1));
+        __m256 direct = _mm256_moveldup_ps(data1);
+        __m256 res = conj ? _mm256_fmsubadd_ps(data0, direct, cross)
+                          : _mm256_fmaddsub_ps(data0, direct, cross);
+        _mm256_storeu_ps(outf + i, res);
+    }
+    if (rem < len) {
+        kCommsKernelsScalar.complex_mult_cf32(
+            f + rem, g + rem, len - rem, conj, out + rem);
+    }
+}
+
+static inline __m256i complexMultQ15(__m256i data1, __m256i data2, bool conj)
+{
+    const __m256i neg0 = _mm256_set1_epi32(0xFFFF0000);
+    const __m256i neg1 = _mm256_set1_epi32(0x00010000);
+    const __m256i mix = _mm256_set1_epi32(0x0000FFFF);
+
+    __m256i temp0 = _mm256_xor_si256(data2, neg0);
+    temp0 = _mm256_add_epi32(temp0, neg1);
+
+    __m256i temp1 = _mm256_shufflehi_epi16(conj ? temp0 : data2, 0xb1);
+    temp1 = _mm256_shufflelo_epi16(temp1, 0xb1);
+
+    __m256i re = _mm256_madd_epi16(data1, conj ? data2 : temp0);
+    __m256i im = _mm256_madd_epi16(data1, temp1);
+
+    re = _mm256_srai_epi32(re, 15);
+    im = _mm256_srai_epi32(im, 15);
+
+    re = _mm256_and_si256(re, mix);
+    im = _mm256_and_si256(im, mix);
+    im = _mm256_slli_epi32(im, 0x10);
+
+    return _mm256_or_si256(re, im);
+}
+
+static void complexMultQ15Avx2(const std::complex<int16_t>* f,
+    const std::complex<int16_t>* g, size_t len, bool conj,
+    std::complex<int16_t>* out)
+{
+    const __m256i* in0 = reinterpret_cast<const __m256i*>(f);
+    const __m256i* in1 = reinterpret_cast<const __m256i*>(g);
+    __m256i* outf = reinterpret_cast<__m256i*>(out);
+
+    size_t vecSize = len / kCs16PerReg;
+    for (size_t i = 0; i < vecSize; i++) {
+        __m256i res = complexMultQ15(
+            _mm256_loadu_si256(in0 + i), _mm256_loadu_si256(in1 + i), conj);
+        _mm256_storeu_si256(outf + i, res);
+    }
+    size_t rem = vecSize * kCs16PerReg;
+    if (rem < len) {
+        kCommsKernelsScalar.complex_mult_ci16(
+            f + rem, g + rem, len - rem, conj, out + rem);
+    }
+}
+
+static void correlateSignAvx2(const float* sign, size_t out_len,
+    const float* taps_re, const float* taps_im, size_t taps_len,
+    float* out_re, float* out_im)
+{
+    const size_t block = 2 * 2 * kCf32PerReg;
+    size_t i = 0;
+    for (; i + block <= out_len; i += block) {
+        __m256 re0 = _mm256_setzero_ps();
+        __m256 re1 = _mm256_setzero_ps();
+        __m256 im0 = _mm256_setzero_ps();
+        __m256 im1 = _mm256_setzero_ps();
+        for (size_t j = 0; j < taps_len; j++) {
+            __m256 tap_re = _mm256_broadcast_ss(&taps_re[j]);
+            __m256 tap_im = _mm256_broadcast_ss(&taps_im[j]);
+            __m256 sign0 = _mm256_loadu_ps(sign + i + j);
+            __m256 sign1 = _mm256_loadu_ps(sign + i + j + 2 * kCf32PerReg);
+            re0 = _mm256_fmadd_ps(sign0, tap_re, re0);
+            re1 = _mm256_fmadd_ps(sign1, tap_re, re1);
+            im0 = _mm256_fmadd_ps(sign0, tap_im, im0);
+            im1 = _mm256_fmadd_ps(sign1, tap_im, im1);
+        }
+        _mm256_storeu_ps(out_re + i, re0);
+        _mm256_storeu_ps(out_re + i + 2 * kCf32PerReg, re1);
+        _mm256_storeu_ps(out_im + i, im0);
+        _mm256_storeu_ps(out_im + i + 2 * kCf32PerReg, im1);
+    }
+    if (i < out_len) {
+        kCommsKernelsScalar.correlate_sign(sign + i, out_len - i, taps_re,
+            taps_im, taps_len, out_re + i, out_im + i);
+    }
+}
+
+static void abs2Avx2(const std::complex<float>* f, size_t len, float* out)
+{
+    const float* in = reinterpret_cast<const float*>(f);
+    const __m256i perm0
+        = _mm256_set_epi32(0x7, 0x6, 0x3, 0x2, 0x5, 0x4, 0x1, 0x0);
+
+    size_t rem = len - (len % (2 * kCf32PerReg));
+    for (size_t i = 0; i < rem; i += 2 * kCf32PerReg) {
+        __m256 data1 = _mm256_loadu_ps(in + i * 2);
+        __m256 data2 = _mm256_loadu_ps(in + i * 2 + 2 * kCf32PerReg);
+        __m256 res = _mm256_hadd_ps(
+            _mm256_mul_ps(data1, data1), _mm256_mul_ps(data2, data2));
+        res = _mm256_permutevar8x32_ps(res, perm0);
+        _mm256_storeu_ps(out + i, res);
+    }
+    if (rem < len)
+        kCommsKernelsScalar.abs2_cf32(f + rem, len - rem, out + rem);
+}
+
+static void abs2Q15Avx2(
+    const std::complex<int16_t>* f, size_t len, int32_t* out)
+{
+    const __m256i* in0 = reinterpret_cast<const __m256i*>(f);
+    __m256i* outf = reinterpret_cast<__m256i*>(out);
+
+    size_t vecSize = len / kCs16PerReg;
+    for (size_t i = 0; i < vecSize; i++) {
+        __m256i data0 = _mm256_loadu_si256(in0 + i);
+        _mm256_storeu_si256(outf + i, _mm256_madd_epi16(data0, data0));
+    }
+    size_t rem = vecSize * kCs16PerReg;
+    if (rem < len)
+        kCommsKernelsScalar.abs2_ci16(f + rem, len - rem, out + rem);
+}
+
+// (a, b) -> (b, a) in each 32 bit lane
+static inline __m256i swapQ15(__m256i data)
+{
+    return _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(data, 0xb1), 0xb1);
+}
+
+static void ci16ToCf32Avx2(const std::complex<int16_t>* in, size_t len,
+    bool swap, float scale, std::complex<float>* out)
+{
+    const __m256i* in0 = reinterpret_cast<const __m256i*>(in);
+    float* outf = reinterpret_cast<float*>(out);
+    const __m256 factor = _mm256_set1_ps(scale);
+
+    size_t vecSize = len / kCs16PerReg;
+    for (size_t i = 0; i < vecSize; i++) {
+        __m256i data0 = _mm256_loadu_si256(in0 + i);
+        if (swap)
+            data0 = swapQ15(data0);
+        __m256 lo = _mm256_cvtepi32_ps(
+            _mm256_cvtepi16_epi32(_mm256_castsi256_si128(data0)));
+        __m256 hi = _mm256_cvtepi32_ps(
+            _mm256_cvtepi16_epi32(_mm256_extracti128_si256(data0, 1)));
+        float* dst = outf + i * 2 * kCs16PerReg;
+        _mm256_storeu_ps(dst, _mm256_mul_ps(lo, factor));
+        _mm256_storeu_ps(dst + 2 * kCf32PerReg, _mm256_mul_ps(hi, factor));
+    }
+    size_t rem = vecSize * kCs16PerReg;
+    if (rem < len) {
+        kCommsKernelsScalar.ci16_to_cf32(
+            in + rem, len - rem, swap, scale, out + rem);
+    }
+}
+
+static void f32ToCi16Avx2(const float* re, const float* im, size_t len,
+    float scale, std::complex<int16_t>* out)
+{
+    __m256i* outf = reinterpret_cast<__m256i*>(out);
+    const __m256 factor = _mm256_set1_ps(scale);
+    // clamped first, the cvtt overflow value would wrap in the packing
+    const __m256 max = _mm256_set1_ps(32767.f);
+    const __m256 min = _mm256_set1_ps(-32768.f);
+    const __m256i mix = _mm256_set1_epi32(0x0000FFFF);
+
+    size_t vecSize = len / kCs16PerReg;
+    for (size_t i = 0; i < vecSize; i++) {
+        __m256 a = _mm256_mul_ps(_mm256_loadu_ps(re + i * kCs16PerReg), factor);
+        __m256 b = _mm256_mul_ps(_mm256_loadu_ps(im + i * kCs16PerReg), factor);
+        __m256i a32 = _mm256_cvttps_epi32(
+            _mm256_max_ps(_mm256_min_ps(a, max), min));
+        __m256i b32 = _mm256_cvttps_epi32(
+            _mm256_max_ps(_mm256_min_ps(b, max), min));
+        __m256i res = _mm256_or_si256(
+            _mm256_and_si256(a32, mix), _mm256_slli_epi32(b32, 0x10));
+        _mm256_storeu_si256(outf + i, res);
+    }
+    size_t rem = vecSize * kCs16PerReg;
+    if (rem < len) {
+        kCommsKernelsScalar.f32_to_ci16(
+            re + rem, im + rem, len - rem, scale, out + rem);
+    }
+}
+
+static void ci16SwapAvx2(const std::complex<int16_t>* in, size_t len,
+    bool conj, bool swap, std::complex<int16_t>* out)
+{
+    const __m256i* in0 = reinterpret_cast<const __m256i*>(in);
+    __m256i* outf = reinterpret_cast<__m256i*>(out);
+    // two's complement negation of the imaginary parts only
+    const __m256i neg = _mm256_set1_epi32(conj ? 0xFFFF0000 : 0);
+
+    size_t vecSize = len / kCs16PerReg;
+    for (size_t i = 0; i < vecSize; i++) {
+        __m256i data0 = _mm256_loadu_si256(in0 + i);
+        data0 = _mm256_sub_epi16(_mm256_xor_si256(data0, neg), neg);
+        if (swap)
+            data0 = swapQ15(data0);
+        _mm256_storeu_si256(outf + i, data0);
+    }
+    size_t rem = vecSize * kCs16PerReg;
+    if (rem < len) {
+        kCommsKernelsScalar.ci16_swap(
+            in + rem, len - rem, conj, swap, out + rem);
+    }
+}
+
+static void beaconBlockAvx2(const std::complex<float>* in,
+    const std::complex<float>* seq, size_t seq_len, std::complex<float>* out)
+{
+    correlateBlock8(reinterpret_cast<const float*>(in),
+        reinterpret_cast<const float*>(seq), seq_len,
+        reinterpret_cast<float*>(out));
+}
+
+const CommsKernels kCommsKernelsAvx2 = { "avx2", correlateAvx2,
+    correlateRealAvx2, complexMultAvx2, complexMultQ15Avx2, correlateSignAvx2,
+    abs2Avx2, abs2Q15Avx2, ci16ToCf32Avx2, f32ToCi16Avx2, ci16SwapAvx2,
+    beaconBlockAvx2, 2 * kCf32PerReg };
+
+#endif
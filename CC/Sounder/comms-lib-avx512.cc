@@ -0,0 +1,314 @@
+/*
+ Copyright (c) 2018-2020, Rice University
+ RENEW OPEN SOURCE LICENSE: http://renew-wireless.org/license
+
+----------------------------------------------------------------------
+ AVX-512 CommsLib kernels, this file alone is built with -mavx512f
+ -mavx512bw -mfma. Leftover samples go through the scalar kernels.
+---------------------------------------------------------------------
+*/
+
+#if defined(__x86_64__)
+
+#include "include/comms-lib-kernels.h"
+#include <immintrin.h>
+
+// complex floats per register
+static const size_t kCf32PerReg = 8;
+// complex shorts per register
+static const size_t kCs16PerReg = 16;
+
+// Same scheme as the AVX2 kernels, (a c, b c) and (b d, a d) summed
+// separately and combined as (a c + b d, b c - a d)
+static inline void correlateBlock16(
+    const float* in, const float* seq, size_t seq_len, float* out)
+{
+    __m512 direct0 = _mm512_setzero_ps();
+    __m512 direct1 = _mm512_setzero_ps();
+    __m512 cross0 = _mm512_setzero_ps();
+    __m512 cross1 = _mm512_setzero_ps();
+    for (size_t j = 0; j < seq_len; j++) {
+        __m512 seq_i = _mm512_set1_ps(seq[j * 2]);
+        __m512 seq_q = _mm512_set1_ps(seq[j * 2 + 1]);
+        __m512 data0 = _mm512_loadu_ps(in + j * 2);
+        __m512 data1 = _mm512_loadu_ps(in + j * 2 + 2 * kCf32PerReg);
+        direct0 = _mm512_fmadd_ps(data0, seq_i, direct0);
+        direct1 = _mm512_fmadd_ps(data1, seq_i, direct1);
+        cross0 = _mm512_fmadd_ps(_mm512_permute_ps(data0, 0xb1), seq_q, cross0);
+        cross1 = _mm512_fmadd_ps(_mm512_permute_ps(data1, 0xb1), seq_q, cross1);
+    }
+    const __m512 ones = _mm512_set1_ps(1);
+    _mm512_storeu_ps(out, _mm512_fmsubadd_ps(direct0, ones, cross0));
+    _mm512_storeu_ps(
+        out + 2 * kCf32PerReg, _mm512_fmsubadd_ps(direct1, ones, cross1));
+}
+
+static void correlateAvx512(const std::complex<float>* in, size_t out_len,
+    const std::complex<float>* seq, size_t seq_len, std::complex<float>* out)
+{
+    const float* inf = reinterpret_cast<const float*>(in);
+    const float* seqf = reinterpret_cast<const float*>(seq);
+    float* outf = reinterpret_cast<float*>(out);
+
+    // sixteen outputs per pass, never reads past in[out_len + seq_len - 1]
+    const size_t block = 2 * kCf32PerReg;
+    size_t i = 0;
+    for (; i + block <= out_len; i += block)
+        correlateBlock16(inf + i * 2, seqf, seq_len, outf + i * 2);
+    if (i < out_len) {
+        kCommsKernelsScalar.correlate_cf32(
+            in + i, out_len - i, seq, seq_len, out + i);
+    }
+}
+
+static void correlateRealAvx512(const float* in, size_t out_len,
+    const float* seq, size_t seq_len, float* out)
+{
+    const size_t block = 2 * 2 * kCf32PerReg;
+    size_t i = 0;
+    for (; i + block <= out_len; i += block) {
+        __m512 accm0 = _mm512_setzero_ps();
+        __m512 accm1 = _mm512_setzero_ps();
+        for (size_t j = 0; j < seq_len; j++) {
+            __m512 tap = _mm512_set1_ps(seq[j]);
+            accm0 = _mm512_fmadd_ps(_mm512_loadu_ps(in + i + j), tap, accm0);
+            accm1 = _mm512_fmadd_ps(
+                _mm512_loadu_ps(in + i + j + block / 2), tap, accm1);
+        }
+        _mm512_storeu_ps(out + i, accm0);
+        _mm512_storeu_ps(out + i + block / 2, accm1);
+    }
+    if (i < out_len) {
+        kCommsKernelsScalar.correlate_f32(
+            in + i, out_len - i, seq, seq_len, out + i);
+    }
+}
+
+static void complexMultAvx512(const std::complex<float>* f,
+    const std::complex<float>* g, size_t len, bool conj,
+    std::complex<float>* out)
+{
+    const float* in0 = reinterpret_cast<const float*>(f);
+    const float* in1 = reinterpret_cast<const float*>(g);
+    float* outf = reinterpret_cast<float*>(out);
+
+    // f = (a, b), g = (c, d): (a c, b c) -+ (b d, a d)
+    size_t rem = len - (len % kCf32PerReg);
+    for (size_t i = 0; i < 2 * rem; i += 2 * kCf32PerReg) {
+        __m512 data0 = _mm512_loadu_ps(in0 + i);
+        __m512 data1 = _mm512_loadu_ps(in1 + i);
+        __m512 cross = _mm512_mul_ps(
+            _mm512_permute_ps(data0, 0xb1), _mm512_movehdup_ps(data1));
+        __m512 direct = _mm512_moveldup_ps(data1);
+        __m512 res = conj ? _mm512_fmsubadd_ps(data0, direct, cross)
+                          : _mm512_fmaddsub_ps(data0, direct, cross);
+        _mm512_storeu_ps(outf + i, res);
+    }
+    if (rem < len) {
+        kCommsKernelsScalar.complex_mult_cf32(
+            f + rem, g + rem, len - rem, conj, out + rem);
+    }
+}
+
+static inline __m512i complexMultQ15(__m512i data1, __m512i data2, bool conj)
+{
+    const __m512i neg0 = _mm512_set1_epi32(0xFFFF0000);
+    const __m512i neg1 = _mm512_set1_epi32(0x00010000);
+    const __m512i mix = _mm512_set1_epi32(0x0000FFFF);
+
+    __m512i temp0 = _mm512_xor_si512(data2, neg0);
+    temp0 = _mm512_add_epi32(temp0, neg1);
+
+    __m512i temp1 = _mm512_shufflehi_epi16(conj ? temp0 : data2, 0xb1);
+    temp1 = _mm512_shufflelo_epi16(temp1, 0xb1);
+
+    __m512i re = _mm512_madd_epi16(data1, conj ? data2 : temp0);
+    __m512i im = _mm512_madd_epi16(data1, temp1);
+
+    re = _mm512_srai_epi32(re, 15);
+    im = _mm512_srai_epi32(im, 15);
+
+    re = _mm512_and_si512(re, mix);
+    im = _mm512_and_si512(im, mix);
+    im = _mm512_slli_epi32(im, 0x10);
+
+    return _mm512_or_si512(re, im);
+}
+
+static void complexMultQ15Avx512(const std::complex<int16_t>* f,
+    const std::complex<int16_t>* g, size_t len, bool conj,
+    std::complex<int16_t>* out)
+{
+    size_t rem = len - (len % kCs16PerReg);
+    for (size_t i = 0; i < rem; i += kCs16PerReg) {
+        __m512i res = complexMultQ15(_mm512_loadu_si512(f + i),
+            _mm512_loadu_si512(g + i), conj);
+        _mm512_storeu_si512(out + i, res);
+    }
+    if (rem < len) {
+        kCommsKernelsScalar.complex_mult_ci16(
+            f + rem, g + rem, len - rem, conj, out + rem);
+    }
+}
+
+static void correlateSignAvx512(const float* sign, size_t out_len,
+    const float* taps_re, const float* taps_im, size_t taps_len,
+    float* out_re, float* out_im)
+{
+    const size_t block = 2 * 2 * kCf32PerReg;
+    size_t i = 0;
+    for (; i + block <= out_len; i += block) {
+        __m512 re0 = _mm512_setzero_ps();
+        __m512 re1 = _mm512_setzero_ps();
+        __m512 im0 = _mm512_setzero_ps();
+        __m512 im1 = _mm512_setzero_ps();
+        for (size_t j = 0; j < taps_len; j++) {
+            __m512 tap_re = _mm512_set1_ps(taps_re[j]);
+            __m512 tap_im = _mm512_set1_ps(taps_im[j]);
+            __m512 sign0 = _mm512_loadu_ps(sign + i + j);
+            __m512 sign1 = _mm512_loadu_ps(sign + i + j + 2 * kCf32PerReg);
+            re0 = _mm512_fmadd_ps(sign0, tap_re, re0);
+            re1 = _mm512_fmadd_ps(sign1, tap_re, re1);
+            im0 = _mm512_fmadd_ps(sign0, tap_im, im0);
+            im1 = _mm512_fmadd_ps(sign1, tap_im, im1);
+        }
+        _mm512_storeu_ps(out_re + i, re0);
+        _mm512_storeu_ps(out_re + i + 2 * kCf32PerReg, re1);
+        _mm512_storeu_ps(out_im + i, im0);
+        _mm512_storeu_ps(out_im + i + 2 * kCf32PerReg, im1);
+    }
+    if (i < out_len) {
+        kCommsKernelsScalar.correlate_sign(sign + i, out_len - i, taps_re,
+            taps_im, taps_len, out_re + i, out_im + i);
+    }
+}
+
+static void abs2Avx512(const std::complex<float>* f, size_t len, float* out)
+{
+    const float* in = reinterpret_cast<const float*>(f);
+    // squared real parts then squared imaginary parts of two registers
+    const __m512i real_idx = _mm512_setr_epi32(
+        0, 2, 4, 6, 8, 10, 12, 14, 16, 18, 20, 22, 24, 26, 28, 30);
+    const __m512i imag_idx = _mm512_setr_epi32(
+        1, 3, 5, 7, 9, 11, 13, 15, 17, 19, 21, 23, 25, 27, 29, 31);
+
+    size_t rem = len - (len % (2 * kCf32PerReg));
+    for (size_t i = 0; i < rem; i += 2 * kCf32PerReg) {
+        __m512 data1 = _mm512_loadu_ps(in + i * 2);
+        __m512 data2 = _mm512_loadu_ps(in + i * 2 + 2 * kCf32PerReg);
+        __m512 prod1 = _mm512_mul_ps(data1, data1);
+        __m512 prod2 = _mm512_mul_ps(data2, data2);
+        __m512 res = _mm512_add_ps(
+            _mm512_permutex2var_ps(prod1, real_idx, prod2),
+            _mm512_permutex2var_ps(prod1, imag_idx, prod2));
+        _mm512_storeu_ps(out + i, res);
+    }
+    if (rem < len)
+        kCommsKernelsScalar.abs2_cf32(f + rem, len - rem, out + rem);
+}
+
+static void abs2Q15Avx512(
+    const std::complex<int16_t>* f, size_t len, int32_t* out)
+{
+    size_t rem = len - (len % kCs16PerReg);
+    for (size_t i = 0; i < rem; i += kCs16PerReg) {
+        __m512i data0 = _mm512_loadu_si512(f + i);
+        _mm512_storeu_si512(out + i, _mm512_madd_epi16(data0, data0));
+    }
+    if (rem < len)
+        kCommsKernelsScalar.abs2_ci16(f + rem, len - rem, out + rem);
+}
+
+// (a, b) -> (b, a) in each 32 bit lane
+static inline __m512i swapQ15(__m512i data)
+{
+    return _mm512_shufflehi_epi16(_mm512_shufflelo_epi16(data, 0xb1), 0xb1);
+}
+
+static void ci16ToCf32Avx512(const std::complex<int16_t>* in, size_t len,
+    bool swap, float scale, std::complex<float>* out)
+{
+    float* outf = reinterpret_cast<float*>(out);
+    const __m512 factor = _mm512_set1_ps(scale);
+
+    size_t rem = len - (len % kCs16PerReg);
+    for (size_t i = 0; i < rem; i += kCs16PerReg) {
+        __m512i data0 = _mm512_loadu_si512(in + i);
+        if (swap)
+            data0 = swapQ15(data0);
+        __m512 lo = _mm512_cvtepi32_ps(
+            _mm512_cvtepi16_epi32(_mm512_castsi512_si256(data0)));
+        __m512 hi = _mm512_cvtepi32_ps(
+            _mm512_cvtepi16_epi32(_mm512_extracti64x4_epi64(data0, 1)));
+        _mm512_storeu_ps(outf + i * 2, _mm512_mul_ps(lo, factor));
+        _mm512_storeu_ps(
+            outf + i * 2 + 2 * kCf32PerReg, _mm512_mul_ps(hi, factor));
+    }
+    if (rem < len) {
+        kCommsKernelsScalar.ci16_to_cf32(
+            in + rem, len - rem, swap, scale, out + rem);
+    }
+}
+
+static void f32ToCi16Avx512(const float* re, const float* im, size_t len,
+    float scale, std::complex<int16_t>* out)
+{
+    const __m512 factor = _mm512_set1_ps(scale);
+    // clamped first, the cvtt overflow value would wrap in the packing
+    const __m512 max = _mm512_set1_ps(32767.f);
+    const __m512 min = _mm512_set1_ps(-32768.f);
+    const __m512i mix = _mm512_set1_epi32(0x0000FFFF);
+
+    // one complex short per 32 bit lane
+    size_t rem = len - (len % kCs16PerReg);
+    for (size_t i = 0; i < rem; i += kCs16PerReg) {
+        __m512 a = _mm512_mul_ps(_mm512_loadu_ps(re + i), factor);
+        __m512 b = _mm512_mul_ps(_mm512_loadu_ps(im + i), factor);
+        __m512i a32 = _mm512_cvttps_epi32(
+            _mm512_max_ps(_mm512_min_ps(a, max), min));
+        __m512i b32 = _mm512_cvttps_epi32(
+            _mm512_max_ps(_mm512_min_ps(b, max), min));
+        __m512i res = _mm512_or_si512(
+            _mm512_and_si512(a32, mix), _mm512_slli_epi32(b32, 0x10));
+        _mm512_storeu_si512(out + i, res);
+    }
+    if (rem < len) {
+        kCommsKernelsScalar.f32_to_ci16(
+            re + rem, im + rem, len - rem, scale, out + rem);
+    }
+}
+
+static void ci16SwapAvx512(const std::complex<int16_t>* in, size_t len,
+    bool conj, bool swap, std::complex<int16_t>* out)
+{
+    // two's complement negation of the imaginary parts only
+    const __m512i neg = _mm512_set1_epi32(conj ? 0xFFFF0000 : 0);
+
+    size_t rem = len - (len % kCs16PerReg);
+    for (size_t i = 0; i < rem; i += kCs16PerReg) {
+        __m512i data0 = _mm512_loadu_si512(in + i);
+        data0 = _mm512_sub_epi16(_mm512_xor_si512(data0, neg), neg);
+        if (swap)
+            data0 = swapQ15(data0);
+        _mm512_storeu_si512(out + i, data0);
+    }
+    if (rem < len) {
+        kCommsKernelsScalar.ci16_swap(
+            in + rem, len - rem, conj, swap, out + rem);
+    }
+}
+
+static void beaconBlockAvx512(const std::complex<float>* in,
+    const std::complex<float>* seq, size_t seq_len, std::complex<float>* out)
+{
+    correlateBlock16(reinterpret_cast<const float*>(in),
+        reinterpret_cast<const float*>(seq), seq_len,
+        reinterpret_cast<float*>(out));
+}
+
+const CommsKernels kCommsKernelsAvx512 = { "avx512", correlateAvx512,
+    correlateRealAvx512, complexMultAvx512, complexMultQ15Avx512,
+    correlateSignAvx512, abs2Avx512, abs2Q15Avx512, ci16ToCf32Avx512,
+    f32ToCi16Avx512, ci16SwapAvx512, beaconBlockAvx512, 2 * kCf32PerReg };
+
+#endif
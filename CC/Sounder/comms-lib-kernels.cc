@@ -0,0 +1,180 @@
+/*
+ Copyright (c) 2018-2020, Rice University
+ RENEW OPEN SOURCE LICENSE: http://renew-wireless.org/license
+
+----------------------------------------------------------------------
+ Portable CommsLib kernels and the selection of the kernel table for
+ the cpu the binary runs on
+---------------------------------------------------------------------
+*/
+
+#include "include/comms-lib-kernels.h"
+#include "include/logger.h"
+
+static void correlateScalar(const std::complex<float>* in, size_t out_len,
+    const std::complex<float>* seq, size_t seq_len, std::complex<float>* out)
+{
+    for (size_t i = 0; i < out_len; i++) {
+        float re = 0;
+        float im = 0;
+        for (size_t j = 0; j < seq_len; j++) {
+            const std::complex<float>& x = in[i + j];
+            const std::complex<float>& s = seq[j];
+            re += x.real() * s.real() + x.imag() * s.imag();
+            im += x.imag() * s.real() - x.real() * s.imag();
+        }
+        out[i] = std::complex<float>(re, im);
+    }
+}
+
+static void correlateRealScalar(const float* in, size_t out_len,
+    const float* seq, size_t seq_len, float* out)
+{
+    for (size_t i = 0; i < out_len; i++) {
+        float accm = 0;
+        for (size_t j = 0; j < seq_len; j++)
+            accm += in[i + j] * seq[j];
+        out[i] = accm;
+    }
+}
+
+static void complexMultScalar(const std::complex<float>* f,
+    const std::complex<float>* g, size_t len, bool conj,
+    std::complex<float>* out)
+{
+    // spelled out, std::complex multiply checks for inf and nan
+    const float sign = conj ? -1 : 1;
+    for (size_t i = 0; i < len; i++) {
+        float a = f[i].real();
+        float b = f[i].imag();
+        float c = g[i].real();
+        float d = sign * g[i].imag();
+        out[i] = std::complex<float>(a * c - b * d, b * c + a * d);
+    }
+}
+
+static void complexMultQ15Scalar(const std::complex<int16_t>* f,
+    const std::complex<int16_t>* g, size_t len, bool conj,
+    std::complex<int16_t>* out)
+{
+    for (size_t i = 0; i < len; i++) {
+        int16_t i0 = f[i].real();
+        int16_t i1 = g[i].real();
+        int16_t q0 = f[i].imag();
+        int16_t q1 = g[i].imag();
+        int16_t ires = (int16_t)((i0 * i1 + (conj ? 1 : -1) * q0 * q1) >> 15);
+        int16_t qres = (int16_t)((i1 * q0 + (conj ? -1 : 1) * i0 * q1) >> 15);
+        out[i] = std::complex<int16_t>(ires, qres);
+    }
+}
+
+static void correlateSignScalar(const float* sign, size_t out_len,
+    const float* taps_re, const float* taps_im, size_t taps_len,
+    float* out_re, float* out_im)
+{
+    for (size_t i = 0; i < out_len; i++) {
+        float re = 0;
+        float im = 0;
+        for (size_t j = 0; j < taps_len; j++) {
+            re += sign[i + j] * taps_re[j];
+            im += sign[i + j] * taps_im[j];
+        }
+        out_re[i] = re;
+        out_im[i] = im;
+    }
+}
+
+static void abs2Scalar(const std::complex<float>* f, size_t len, float* out)
+{
+    for (size_t i = 0; i < len; i++)
+        out[i] = f[i].real() * f[i].real() + f[i].imag() * f[i].imag();
+}
+
+static void abs2Q15Scalar(
+    const std::complex<int16_t>* f, size_t len, int32_t* out)
+{
+    for (size_t i = 0; i < len; i++) {
+        int16_t i0 = f[i].real();
+        int16_t q0 = f[i].imag();
+        out[i] = i0 * i0 + q0 * q0;
+    }
+}
+
+static void ci16ToCf32Scalar(const std::complex<int16_t>* in, size_t len,
+    bool swap, float scale, std::complex<float>* out)
+{
+    for (size_t i = 0; i < len; i++) {
+        float a = in[i].real() * scale;
+        float b = in[i].imag() * scale;
+        out[i] = swap ? std::complex<float>(b, a) : std::complex<float>(a, b);
+    }
+}
+
+static inline int16_t saturateQ15(float x)
+{
+    if (x >= 32767.f)
+        return 32767;
+    if (x <= -32768.f)
+        return -32768;
+    return (int16_t)x;
+}
+
+static void f32ToCi16Scalar(const float* re, const float* im, size_t len,
+    float scale, std::complex<int16_t>* out)
+{
+    for (size_t i = 0; i < len; i++) {
+        out[i] = std::complex<int16_t>(
+            saturateQ15(re[i] * scale), saturateQ15(im[i] * scale));
+    }
+}
+
+static void ci16SwapScalar(const std::complex<int16_t>* in, size_t len,
+    bool conj, bool swap, std::complex<int16_t>* out)
+{
+    for (size_t i = 0; i < len; i++) {
+        int16_t a = in[i].real();
+        int16_t b = conj ? (int16_t)-in[i].imag() : in[i].imag();
+        out[i] = swap ? std::complex<int16_t>(b, a)
+                      : std::complex<int16_t>(a, b);
+    }
+}
+
+// outputs per beacon block, only sets how often the search checks for a peak
+static const size_t kScalarBeaconBlock = 8;
+
+static void beaconBlockScalar(const std::complex<float>* in,
+    const std::complex<float>* seq, size_t seq_len, std::complex<float>* out)
+{
+    correlateScalar(in, kScalarBeaconBlock, seq, seq_len, out);
+}
+
+const CommsKernels kCommsKernelsScalar = { "scalar", correlateScalar,
+    correlateRealScalar, complexMultScalar, complexMultQ15Scalar,
+    correlateSignScalar, abs2Scalar, abs2Q15Scalar, ci16ToCf32Scalar,
+    f32ToCi16Scalar, ci16SwapScalar, beaconBlockScalar, kScalarBeaconBlock };
+
+static const CommsKernels& selectCommsKernels(void)
+{
+    const CommsKernels* kernels = &kCommsKernelsScalar;
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")
+        && __builtin_cpu_supports("fma")) {
+        kernels = &kCommsKernelsAvx512;
+    } else if (__builtin_cpu_supports("avx2")
+        && __builtin_cpu_supports("fma")) {
+        kernels = &kCommsKernelsAvx2;
+    }
+#elif defined(__aarch64__)
+    // Advanced SIMD is part of the base aarch64 architecture
+    kernels = &kCommsKernelsNeon;
+#endif
+    MLPD_INFO("CommsLib using %s kernels\n", kernels->name);
+    return *kernels;
+}
+
+const CommsKernels& commsKernels(void)
+{
+    static const CommsKernels& kernels = selectCommsKernels();
+    return kernels;
+}
@@ -0,0 +1,316 @@
+/*
+ Copyright (c) 2018-2020, Rice University
+ RENEW OPEN SOURCE LICENSE: http://renew-wireless.org/license
+
+----------------------------------------------------------------------
+ NEON CommsLib kernels for aarch64 hosts. Leftover samples go through
+ the scalar kernels.
+---------------------------------------------------------------------
+*/
+
+#if defined(__aarch64__)
+
+#include "include/comms-lib-kernels.h"
+#include <arm_neon.h>
+
+// complex values per deinterleaved register pair
+static const size_t kCf32PerReg = 4;
+static const size_t kCs16PerReg = 8;
+
+// vld2 splits (a, b) samples into a and b registers, so conj(seq) is
+// applied directly: (a c + b d, b c - a d)
+static inline void correlateBlock8(
+    const float* in, const float* seq, size_t seq_len, float* out)
+{
+    float32x4_t re0 = vdupq_n_f32(0);
+    float32x4_t im0 = vdupq_n_f32(0);
+    float32x4_t re1 = vdupq_n_f32(0);
+    float32x4_t im1 = vdupq_n_f32(0);
+    for (size_t j = 0; j < seq_len; j++) {
+        float32x4_t seq_i = vdupq_n_f32(seq[j * 2]);
+        float32x4_t seq_q = vdupq_n_f32(seq[j * 2 + 1]);
+        float32x4x2_t data0 = vld2q_f32(in + j * 2);
+        float32x4x2_t data1 = vld2q_f32(in + j * 2 + 2 * kCf32PerReg);
+        re0 = vfmaq_f32(re0, data0.val[0], seq_i);
+        re0 = vfmaq_f32(re0, data0.val[1], seq_q);
+        im0 = vfmaq_f32(im0, data0.val[1], seq_i);
+        im0 = vfmsq_f32(im0, data0.val[0], seq_q);
+        re1 = vfmaq_f32(re1, data1.val[0], seq_i);
+        re1 = vfmaq_f32(re1, data1.val[1], seq_q);
+        im1 = vfmaq_f32(im1, data1.val[1], seq_i);
+        im1 = vfmsq_f32(im1, data1.val[0], seq_q);
+    }
+    float32x4x2_t res0 = { { re0, im0 } };
+    float32x4x2_t res1 = { { re1, im1 } };
+    vst2q_f32(out, res0);
+    vst2q_f32(out + 2 * kCf32PerReg, res1);
+}
+
+static void correlateNeon(const std::complex<float>* in, size_t out_len,
+    const std::complex<float>* seq, size_t seq_len, std::complex<float>* out)
+{
+    const float* inf = reinterpret_cast<const float*>(in);
+    const float* seqf = reinterpret_cast<const float*>(seq);
+    float* outf = reinterpret_cast<float*>(out);
+
+    // eight outputs per pass, never reads past in[out_len + seq_len - 1]
+    const size_t block = 2 * kCf32PerReg;
+    size_t i = 0;
+    for (; i + block <= out_len; i += block)
+        correlateBlock8(inf + i * 2, seqf, seq_len, outf + i * 2);
+    if (i < out_len) {
+        kCommsKernelsScalar.correlate_cf32(
+            in + i, out_len - i, seq, seq_len, out + i);
+    }
+}
+
+static void correlateRealNeon(const float* in, size_t out_len,
+    const float* seq, size_t seq_len, float* out)
+{
+    const size_t block = 2 * kCf32PerReg;
+    size_t i = 0;
+    for (; i + block <= out_len; i += block) {
+        float32x4_t accm0 = vdupq_n_f32(0);
+        float32x4_t accm1 = vdupq_n_f32(0);
+        for (size_t j = 0; j < seq_len; j++) {
+            float32x4_t tap = vdupq_n_f32(seq[j]);
+            accm0 = vfmaq_f32(accm0, vld1q_f32(in + i + j), tap);
+            accm1 = vfmaq_f32(accm1, vld1q_f32(in + i + j + block / 2), tap);
+        }
+        vst1q_f32(out + i, accm0);
+        vst1q_f32(out + i + block / 2, accm1);
+    }
+    if (i < out_len) {
+        kCommsKernelsScalar.correlate_f32(
+            in + i, out_len - i, seq, seq_len, out + i);
+    }
+}
+
+static void complexMultNeon(const std::complex<float>* f,
+    const std::complex<float>* g, size_t len, bool conj,
+    std::complex<float>* out)
+{
+    const float* in0 = reinterpret_cast<const float*>(f);
+    const float* in1 = reinterpret_cast<const float*>(g);
+    float* outf = reinterpret_cast<float*>(out);
+
+    size_t rem = len - (len % kCf32PerReg);
+    for (size_t i = 0; i < 2 * rem; i += 2 * kCf32PerReg) {
+        float32x4x2_t data0 = vld2q_f32(in0 + i);
+        float32x4x2_t data1 = vld2q_f32(in1 + i);
+        float32x4x2_t res;
+        res.val[0] = vmulq_f32(data0.val[0], data1.val[0]);
+        res.val[1] = vmulq_f32(data0.val[1], data1.val[0]);
+        if (conj) {
+            res.val[0] = vfmaq_f32(res.val[0], data0.val[1], data1.val[1]);
+            res.val[1] = vfmsq_f32(res.val[1], data0.val[0], data1.val[1]);
+        } else {
+            res.val[0] = vfmsq_f32(res.val[0], data0.val[1], data1.val[1]);
+            res.val[1] = vfmaq_f32(res.val[1], data0.val[0], data1.val[1]);
+        }
+        vst2q_f32(outf + i, res);
+    }
+    if (rem < len) {
+        kCommsKernelsScalar.complex_mult_cf32(
+            f + rem, g + rem, len - rem, conj, out + rem);
+    }
+}
+
+static void complexMultQ15Neon(const std::complex<int16_t>* f,
+    const std::complex<int16_t>* g, size_t len, bool conj,
+    std::complex<int16_t>* out)
+{
+    const int16_t* in0 = reinterpret_cast<const int16_t*>(f);
+    const int16_t* in1 = reinterpret_cast<const int16_t*>(g);
+    int16_t* outs = reinterpret_cast<int16_t*>(out);
+
+    size_t rem = len - (len % kCs16PerReg);
+    for (size_t i = 0; i < 2 * rem; i += 2 * kCs16PerReg) {
+        int16x8x2_t data0 = vld2q_s16(in0 + i);
+        int16x8x2_t data1 = vld2q_s16(in1 + i);
+        int32x4_t re_lo = vmull_s16(
+            vget_low_s16(data0.val[0]), vget_low_s16(data1.val[0]));
+        int32x4_t re_hi = vmull_high_s16(data0.val[0], data1.val[0]);
+        int32x4_t im_lo = vmull_s16(
+            vget_low_s16(data0.val[1]), vget_low_s16(data1.val[0]));
+        int32x4_t im_hi = vmull_high_s16(data0.val[1], data1.val[0]);
+        if (conj) {
+            re_lo = vmlal_s16(re_lo, vget_low_s16(data0.val[1]),
+                vget_low_s16(data1.val[1]));
+            re_hi = vmlal_high_s16(re_hi, data0.val[1], data1.val[1]);
+            im_lo = vmlsl_s16(im_lo, vget_low_s16(data0.val[0]),
+                vget_low_s16(data1.val[1]));
+            im_hi = vmlsl_high_s16(im_hi, data0.val[0], data1.val[1]);
+        } else {
+            re_lo = vmlsl_s16(re_lo, vget_low_s16(data0.val[1]),
+                vget_low_s16(data1.val[1]));
+            re_hi = vmlsl_high_s16(re_hi, data0.val[1], data1.val[1]);
+            im_lo = vmlal_s16(im_lo, vget_low_s16(data0.val[0]),
+                vget_low_s16(data1.val[1]));
+            im_hi = vmlal_high_s16(im_hi, data0.val[0], data1.val[1]);
+        }
+        // truncating narrow, like the (int16_t) cast of the scalar code
+        int16x8x2_t res;
+        res.val[0]
+            = vcombine_s16(vshrn_n_s32(re_lo, 15), vshrn_n_s32(re_hi, 15));
+        res.val[1]
+            = vcombine_s16(vshrn_n_s32(im_lo, 15), vshrn_n_s32(im_hi, 15));
+        vst2q_s16(outs + i, res);
+    }
+    if (rem < len) {
+        kCommsKernelsScalar.complex_mult_ci16(
+            f + rem, g + rem, len - rem, conj, out + rem);
+    }
+}
+
+static void correlateSignNeon(const float* sign, size_t out_len,
+    const float* taps_re, const float* taps_im, size_t taps_len,
+    float* out_re, float* out_im)
+{
+    const size_t block = 2 * kCf32PerReg;
+    size_t i = 0;
+    for (; i + block <= out_len; i += block) {
+        float32x4_t re0 = vdupq_n_f32(0);
+        float32x4_t re1 = vdupq_n_f32(0);
+        float32x4_t im0 = vdupq_n_f32(0);
+        float32x4_t im1 = vdupq_n_f32(0);
+        for (size_t j = 0; j < taps_len; j++) {
+            float32x4_t tap_re = vdupq_n_f32(taps_re[j]);
+            float32x4_t tap_im = vdupq_n_f32(taps_im[j]);
+            float32x4_t sign0 = vld1q_f32(sign + i + j);
+            float32x4_t sign1 = vld1q_f32(sign + i + j + kCf32PerReg);
+            re0 = vfmaq_f32(re0, sign0, tap_re);
+            re1 = vfmaq_f32(re1, sign1, tap_re);
+            im0 = vfmaq_f32(im0, sign0, tap_im);
+            im1 = vfmaq_f32(im1, sign1, tap_im);
+        }
+        vst1q_f32(out_re + i, re0);
+        vst1q_f32(out_re + i + kCf32PerReg, re1);
+        vst1q_f32(out_im + i, im0);
+        vst1q_f32(out_im + i + kCf32PerReg, im1);
+    }
+    if (i < out_len) {
+        kCommsKernelsScalar.correlate_sign(sign + i, out_len - i, taps_re,
+            taps_im, taps_len, out_re + i, out_im + i);
+    }
+}
+
+static void abs2Neon(const std::complex<float>* f, size_t len, float* out)
+{
+    const float* in = reinterpret_cast<const float*>(f);
+    size_t rem = len - (len % kCf32PerReg);
+    for (size_t i = 0; i < rem; i += kCf32PerReg) {
+        float32x4x2_t data = vld2q_f32(in + i * 2);
+        float32x4_t res = vmulq_f32(data.val[0], data.val[0]);
+        vst1q_f32(out + i, vfmaq_f32(res, data.val[1], data.val[1]));
+    }
+    if (rem < len)
+        kCommsKernelsScalar.abs2_cf32(f + rem, len - rem, out + rem);
+}
+
+static void abs2Q15Neon(
+    const std::complex<int16_t>* f, size_t len, int32_t* out)
+{
+    const int16_t* in = reinterpret_cast<const int16_t*>(f);
+    size_t rem = len - (len % kCs16PerReg);
+    for (size_t i = 0; i < rem; i += kCs16PerReg) {
+        int16x8x2_t data = vld2q_s16(in + i * 2);
+        int32x4_t lo = vmull_s16(
+            vget_low_s16(data.val[0]), vget_low_s16(data.val[0]));
+        int32x4_t hi = vmull_high_s16(data.val[0], data.val[0]);
+        lo = vmlal_s16(
+            lo, vget_low_s16(data.val[1]), vget_low_s16(data.val[1]));
+        hi = vmlal_high_s16(hi, data.val[1], data.val[1]);
+        vst1q_s32(out + i, lo);
+        vst1q_s32(out + i + kCs16PerReg / 2, hi);
+    }
+    if (rem < len)
+        kCommsKernelsScalar.abs2_ci16(f + rem, len - rem, out + rem);
+}
+
+static void ci16ToCf32Neon(const std::complex<int16_t>* in, size_t len,
+    bool swap, float scale, std::complex<float>* out)
+{
+    const int16_t* inp = reinterpret_cast<const int16_t*>(in);
+    float* outf = reinterpret_cast<float*>(out);
+
+    // four complex shorts per register
+    const size_t block = kCs16PerReg / 2;
+    size_t rem = len - (len % block);
+    for (size_t i = 0; i < rem; i += block) {
+        int16x8_t data = vld1q_s16(inp + i * 2);
+        if (swap)
+            data = vrev32q_s16(data);
+        float32x4_t lo = vcvtq_f32_s32(vmovl_s16(vget_low_s16(data)));
+        float32x4_t hi = vcvtq_f32_s32(vmovl_high_s16(data));
+        vst1q_f32(outf + i * 2, vmulq_n_f32(lo, scale));
+        vst1q_f32(outf + i * 2 + kCf32PerReg, vmulq_n_f32(hi, scale));
+    }
+    if (rem < len) {
+        kCommsKernelsScalar.ci16_to_cf32(
+            in + rem, len - rem, swap, scale, out + rem);
+    }
+}
+
+static void f32ToCi16Neon(const float* re, const float* im, size_t len,
+    float scale, std::complex<int16_t>* out)
+{
+    int16_t* outp = reinterpret_cast<int16_t*>(out);
+
+    // vcvtq truncates toward zero and saturates, vqmovn saturates again
+    size_t rem = len - (len % kCs16PerReg);
+    for (size_t i = 0; i < rem; i += kCs16PerReg) {
+        int32x4_t a0 = vcvtq_s32_f32(vmulq_n_f32(vld1q_f32(re + i), scale));
+        int32x4_t a1 = vcvtq_s32_f32(
+            vmulq_n_f32(vld1q_f32(re + i + kCf32PerReg), scale));
+        int32x4_t b0 = vcvtq_s32_f32(vmulq_n_f32(vld1q_f32(im + i), scale));
+        int32x4_t b1 = vcvtq_s32_f32(
+            vmulq_n_f32(vld1q_f32(im + i + kCf32PerReg), scale));
+        int16x8x2_t res = { { vqmovn_high_s32(vqmovn_s32(a0), a1),
+            vqmovn_high_s32(vqmovn_s32(b0), b1) } };
+        vst2q_s16(outp + i * 2, res);
+    }
+    if (rem < len) {
+        kCommsKernelsScalar.f32_to_ci16(
+            re + rem, im + rem, len - rem, scale, out + rem);
+    }
+}
+
+static void ci16SwapNeon(const std::complex<int16_t>* in, size_t len,
+    bool conj, bool swap, std::complex<int16_t>* out)
+{
+    const int16_t* inp = reinterpret_cast<const int16_t*>(in);
+    int16_t* outp = reinterpret_cast<int16_t*>(out);
+
+    size_t rem = len - (len % kCs16PerReg);
+    for (size_t i = 0; i < rem; i += kCs16PerReg) {
+        int16x8x2_t data = vld2q_s16(inp + i * 2);
+        if (conj)
+            data.val[1] = vnegq_s16(data.val[1]);
+        if (swap) {
+            int16x8_t a = data.val[0];
+            data.val[0] = data.val[1];
+            data.val[1] = a;
+        }
+        vst2q_s16(outp + i * 2, data);
+    }
+    if (rem < len) {
+        kCommsKernelsScalar.ci16_swap(
+            in + rem, len - rem, conj, swap, out + rem);
+    }
+}
+
+static void beaconBlockNeon(const std::complex<float>* in,
+    const std::complex<float>* seq, size_t seq_len, std::complex<float>* out)
+{
+    correlateBlock8(reinterpret_cast<const float*>(in),
+        reinterpret_cast<const float*>(seq), seq_len,
+        reinterpret_cast<float*>(out));
+}
+
+const CommsKernels kCommsKernelsNeon = { "neon", correlateNeon,
+    correlateRealNeon, complexMultNeon, complexMultQ15Neon, correlateSignNeon,
+    abs2Neon, abs2Q15Neon, ci16ToCf32Neon, f32ToCi16Neon, ci16SwapNeon,
+    beaconBlockNeon, 2 * kCf32PerReg };
+
+#endif
@@ -20,18 +20,29 @@
 */
 
 #include "include/comms-lib.h"
+#include "include/comms-lib-kernels.h"
 #include "include/constants.h"
 #include "include/utils.h"
+#include <map>
 #include <queue>
 //#include <itpp/itbase.h>
 
 int CommsLib::findLTS(const std::vector<std::complex<float>>& iq, int seqLen)
+{
+    SignCorrelation work;
+    return CommsLib::findLTS(iq, seqLen, work);
+}
+
+int CommsLib::findLTS(const std::vector<std::complex<float>>& iq, int seqLen,
+    SignCorrelation& work)
 {
     /*
      * Find 802.11-based LTS (Long Training Sequence)
      * Input:
      *     iq        - IQ complex samples (vector)
      *     seqLen    - Length of sequence
+     *     work      - buffers reused between calls, work.power holds the
+     *                 squared correlation on return
      * Output:
      *     best_peak - LTS peak index (correlation peak)
      */
@@ -43,36 +54,30 @@ int CommsLib::findLTS(const std::vector<std::complex<float>>& iq, int seqLen)
     // Original LTS sequence
     lts_seq = CommsLib::getSequence(LTS_SEQ, seqLen);
 
-    // Re-arrange into complex vector, flip, and compute conjugate
+    // Last symbol of the sequence, the sign correlation flips and
+    // conjugates it
     const size_t lts_symbol_len = Consts::kFftSize_80211;
-    std::vector<std::complex<float>> lts_sym(lts_symbol_len);
-    std::vector<std::complex<float>> lts_sym_conj(lts_sym.size());
-    for (size_t i = 0; i < lts_sym.size(); i++) {
+    std::complex<float> lts_sym[lts_symbol_len];
+    for (size_t i = 0; i < lts_symbol_len; i++) {
         // lts_seq is a 2x160 matrix (real/imag by seqLen=160 elements)
-        // grab one symbol and flip around
-        lts_sym[i] = std::complex<float>(
-            lts_seq[0][seqLen - 1 - i], lts_seq[1][seqLen - 1 - i]);
-        // conjugate
-        lts_sym_conj[i] = std::conj(lts_sym[i]);
+        size_t k = seqLen - lts_symbol_len + i;
+        lts_sym[i] = std::complex<float>(lts_seq[0][k], lts_seq[1][k]);
     }
 
-    // Equivalent to numpy's sign function
-    auto iq_sign = CommsLib::csign(iq);
+    // Convolution of numpy's sign of iq with the flipped conjugate symbol
+    CommsLib::correlate_sign_avx(
+        iq.data(), iq.size(), lts_sym, lts_symbol_len, work);
+    const std::vector<float>& lts_corr_pow = work.power;
+    // compared in power, lts_thresh^2 of the peak
+    double lts_limit = lts_thresh * lts_thresh
+        * *std::max_element(lts_corr_pow.begin(), lts_corr_pow.end());
 
-    // Convolution
-    auto lts_corr = CommsLib::convolve(iq_sign, lts_sym_conj);
-    std::vector<float> lts_corr_abs(lts_corr.size());
-    std::transform(
-        lts_corr.begin(), lts_corr.end(), lts_corr_abs.begin(), computeAbs);
-    double lts_limit = lts_thresh
-        * *std::max_element(lts_corr_abs.begin(), lts_corr_abs.end());
-
-    // Find all peaks, and pairs that are lts_sym.size() samples apart
+    // Find all peaks, and pairs that are lts_symbol_len samples apart
     std::queue<int> valid_peaks;
-    for (size_t i = lts_sym.size(); i < lts_corr.size(); i++) {
-        if (lts_corr_abs[i] > lts_limit
-            && lts_corr_abs[i - lts_sym.size()] > lts_limit)
-            valid_peaks.push(i - lts_sym.size());
+    for (size_t i = lts_symbol_len; i < lts_corr_pow.size(); i++) {
+        if (lts_corr_pow[i] > lts_limit
+            && lts_corr_pow[i - lts_symbol_len] > lts_limit)
+            valid_peaks.push(i - lts_symbol_len);
     }
 
     // Use first LTS found
@@ -88,28 +93,21 @@ int CommsLib::findLTS(const std::vector<std::complex<float>>& iq, int seqLen)
 size_t CommsLib::find_pilot_seq(const std::vector<std::complex<float>>& iq,
     const std::vector<std::complex<float>>& pilot, size_t seq_len)
 {
+    SignCorrelation work;
+    return CommsLib::find_pilot_seq(iq, pilot, seq_len, work);
+}
 
-    // Re-arrange into complex vector, flip, and compute conjugate
-    std::vector<std::complex<float>> pilot_conj;
-    for (size_t i = 0; i < seq_len; i++) {
-        // conjugate
-        pilot_conj.push_back(std::conj(pilot[seq_len - i - 1]));
-    }
-
-    // Equivalent to numpy's sign function
-    auto iq_sign = CommsLib::csign(iq);
-
-    // Convolution
-    auto pilot_corr = CommsLib::convolve(iq_sign, pilot_conj);
-
-    std::vector<float> pilot_corr_abs(pilot_corr.size());
-    for (size_t i = 0; i < pilot_corr_abs.size(); i++)
-        pilot_corr_abs[i] = computePower(pilot_corr[i]);
+size_t CommsLib::find_pilot_seq(const std::vector<std::complex<float>>& iq,
+    const std::vector<std::complex<float>>& pilot, size_t seq_len,
+    SignCorrelation& work)
+{
+    // Convolution of numpy's sign of iq with the flipped conjugate pilot
+    CommsLib::correlate_sign_avx(
+        iq.data(), iq.size(), pilot.data(), seq_len, work);
 
     // Find all peaks
-    auto best_peak
-        = std::max_element(pilot_corr_abs.begin(), pilot_corr_abs.end())
-        - pilot_corr_abs.begin();
+    auto best_peak = std::max_element(work.power.begin(), work.power.end())
+        - work.power.begin();
     return best_peak;
 }
 
@@ -210,6 +208,24 @@ int CommsLib::find_beacon(const std::vector<std::complex<float>>& iq)
     return best_peak;
 }
 
+int CommsLib::beacon_scan(const std::complex<float>* corr, size_t count,
+    BeaconSearchState& state)
+{
+    const size_t seq_len = state.corr_ring.size();
+    for (size_t i = 0; i < count; i++) {
+        std::complex<float> c = corr[i];
+        std::complex<float>& oldest = state.corr_ring[state.ring_pos];
+        bool peak = std::norm(c * std::conj(oldest)) > state.power_sum;
+        state.power_sum += std::norm(c) - std::norm(oldest);
+        oldest = c;
+        if (++state.ring_pos == seq_len)
+            state.ring_pos = 0;
+        if (peak == true)
+            return i;
+    }
+    return -1;
+}
+
 std::vector<std::complex<float>> CommsLib::csign(
     const std::vector<std::complex<float>>& iq)
 {
@@ -222,17 +238,18 @@ std::vector<std::complex<float>> CommsLib::csign(
      * where sign(x) is given by
      *     -1 if x < 0, 0 if x==0, 1 if x > 0
      */
-    std::vector<std::complex<float>> iq_sign;
-    for (int i = 0; i < static_cast<int>(iq.size()); i++) {
+    std::vector<float> sign(iq.size());
+    CommsLib::csign(iq.data(), iq.size(), sign.data());
+    return std::vector<std::complex<float>>(sign.begin(), sign.end());
+}
+
+void CommsLib::csign(const std::complex<float>* iq, size_t len, float* sign)
+{
+    for (size_t i = 0; i < len; i++) {
         // sign(x.real) + 0j if x.real != 0 else sign(x.imag) + 0j
-        std::complex<float> x = iq[i];
-        if (x.real() != 0) {
-            iq_sign.push_back((x.real() > 0) ? 1 : (x.real() < 0) ? -1 : 0);
-        } else {
-            iq_sign.push_back((x.imag() > 0) ? 1 : (x.imag() < 0) ? -1 : 0);
-        }
+        float x = (iq[i].real() != 0) ? iq[i].real() : iq[i].imag();
+        sign[i] = (x > 0) ? 1 : (x < 0) ? -1 : 0;
     }
-    return iq_sign;
 }
 
 float CommsLib::find_max_abs(const std::vector<std::complex<float>>& in)
@@ -419,37 +436,183 @@ std::vector<size_t> CommsLib::getPilotScIndex(
     return pilot_sc;
 }
 
-std::vector<std::complex<float>> CommsLib::IFFT(
-    const std::vector<std::complex<float>>& in, int fftSize, float scale,
-    bool normalize)
-{
-    std::vector<std::complex<float>> out(in.size());
+namespace {
+// muFFT plans keep a scratch buffer while executing, so plans can't be
+// shared between threads. Each thread caches its own plans, keyed by size
+// and direction, with aligned staging buffers for unaligned callers.
+class FftPlanCache {
+public:
+    struct Plan {
+        mufft_plan_1d* plan;
+        std::complex<float>* in;
+        std::complex<float>* out;
+    };
+
+    ~FftPlanCache()
+    {
+        for (auto& it : this->plans_) {
+            mufft_free_plan_1d(it.second.plan);
+            mufft_free(it.second.in);
+            mufft_free(it.second.out);
+        }
+    }
+
+    Plan& get(size_t fftSize, int direction)
+    {
+        auto key = std::make_pair(fftSize, direction);
+        auto it = this->plans_.find(key);
+        if (it != this->plans_.end())
+            return it->second;
+
+        Plan plan;
+        plan.plan = mufft_create_plan_1d_c2c(
+            fftSize, direction, MUFFT_FLAG_CPU_ANY);
+        if (plan.plan == nullptr)
+            throw std::runtime_error("Could not create FFT plan");
+        plan.in = static_cast<std::complex<float>*>(
+            mufft_alloc(fftSize * sizeof(std::complex<float>)));
+        plan.out = static_cast<std::complex<float>*>(
+            mufft_alloc(fftSize * sizeof(std::complex<float>)));
+        return this->plans_.emplace(key, plan).first->second;
+    }
+
+private:
+    std::map<std::pair<size_t, int>, Plan> plans_;
+};
 
-    void* fft_in = mufft_alloc(fftSize * sizeof(std::complex<float>));
-    void* fft_out = mufft_alloc(fftSize * sizeof(std::complex<float>));
-    mufft_plan_1d* mufftplan
-        = mufft_create_plan_1d_c2c(fftSize, MUFFT_INVERSE, MUFFT_FLAG_CPU_ANY);
-
-    memcpy(fft_in, in.data(), fftSize * sizeof(std::complex<float>));
-    mufft_execute_plan_1d(mufftplan, fft_out, fft_in);
-    memcpy(out.data(), fft_out, fftSize * sizeof(std::complex<float>));
-    float max_val = 1;
-    if (normalize) {
-        for (int i = 0; i < fftSize; i++) {
-            if (std::abs(out[i]) > max_val)
-                max_val = std::abs(out[i]);
+thread_local FftPlanCache fft_plan_cache;
+
+// mufft_alloc alignment, enough for any SIMD path of muFFT
+constexpr uintptr_t kFftAlignment = 64;
+
+void executeFft(const std::complex<float>* in, std::complex<float>* out,
+    size_t fftSize, size_t batch, int direction)
+{
+    FftPlanCache::Plan& plan = fft_plan_cache.get(fftSize, direction);
+    size_t symbol_bytes = fftSize * sizeof(std::complex<float>);
+    for (size_t b = 0; b < batch; b++) {
+        const std::complex<float>* src = in + b * fftSize;
+        std::complex<float>* dst = out + b * fftSize;
+        bool aligned
+            = (((reinterpret_cast<uintptr_t>(src) % kFftAlignment) == 0)
+                && ((reinterpret_cast<uintptr_t>(dst) % kFftAlignment) == 0)
+                && (src != dst));
+        if (aligned == true) {
+            mufft_execute_plan_1d(plan.plan, dst, src);
+        } else {
+            std::memcpy(plan.in, src, symbol_bytes);
+            mufft_execute_plan_1d(plan.plan, plan.out, plan.in);
+            std::memcpy(dst, plan.out, symbol_bytes);
         }
     }
+}
+}
+
+void CommsLib::FFT(const std::complex<float>* in, std::complex<float>* out,
+    size_t fftSize, size_t batch)
+{
+    executeFft(in, out, fftSize, batch, MUFFT_FORWARD);
+}
+
+void CommsLib::IFFT(const std::complex<float>* in, std::complex<float>* out,
+    size_t fftSize, float scale, bool normalize, size_t batch)
+{
+    executeFft(in, out, fftSize, batch, MUFFT_INVERSE);
+    for (size_t b = 0; b < batch; b++) {
+        std::complex<float>* sym = out + b * fftSize;
+        float max_val = 1;
+        if (normalize) {
+            for (size_t i = 0; i < fftSize; i++) {
+                if (std::abs(sym[i]) > max_val)
+                    max_val = std::abs(sym[i]);
+            }
+        }
 #if DEBUG_PRINT
-    std::cout << "IFFT output is normalized with " << std::to_string(max_val)
-              << std::endl;
+        std::cout << "IFFT output is normalized with "
+                  << std::to_string(max_val) << std::endl;
 #endif
-    for (int i = 0; i < fftSize; i++)
-        out[i] = (out[i] / max_val) * scale;
+        for (size_t i = 0; i < fftSize; i++)
+            sym[i] = (sym[i] / max_val) * scale;
+    }
+}
 
-    mufft_free_plan_1d(mufftplan);
-    mufft_free(fft_in);
-    mufft_free(fft_out);
+void CommsLib::correlate_fft(const std::complex<float>* in, size_t out_len,
+    const std::complex<float>* seq, size_t seq_len, std::complex<float>* out)
+{
+    if ((out_len == 0) || (seq_len == 0))
+        return;
+
+    // Overlap-save: correlating with seq is convolving with the reversed,
+    // conjugated sequence, and each block of fft_size input samples gives
+    // fft_size - seq_len + 1 valid outputs of the circular convolution
+    const size_t overlap = seq_len - 1;
+    const size_t in_len = out_len + overlap;
+    // four times the sequence keeps most of each block, longer blocks gain
+    // little; short inputs fit in one block
+    size_t fft_size = 1;
+    while (fft_size < std::min(4 * seq_len, in_len))
+        fft_size <<= 1;
+    const size_t step = fft_size - overlap;
+    const size_t blocks = (out_len + step - 1) / step;
+
+    std::vector<std::complex<float>> filter(fft_size, 0);
+    for (size_t k = 0; k < seq_len; k++)
+        filter[k] = std::conj(seq[seq_len - 1 - k]);
+    std::vector<std::complex<float>> filter_f(fft_size);
+    CommsLib::FFT(filter.data(), filter_f.data(), fft_size);
+
+    std::vector<std::complex<float>> time(blocks * fft_size, 0);
+    for (size_t b = 0; b < blocks; b++) {
+        size_t start = b * step;
+        size_t count = std::min(fft_size, in_len - start);
+        std::copy(in + start, in + start + count, time.begin() + b * fft_size);
+    }
+    std::vector<std::complex<float>> freq(blocks * fft_size);
+    CommsLib::FFT(time.data(), freq.data(), fft_size, blocks);
+    for (size_t b = 0; b < blocks; b++) {
+        std::complex<float>* block = freq.data() + b * fft_size;
+        commsKernels().complex_mult_cf32(
+            block, filter_f.data(), fft_size, false, block);
+    }
+    CommsLib::IFFT(freq.data(), time.data(), fft_size, 1.0f / fft_size,
+        false, blocks);
+
+    for (size_t b = 0; b < blocks; b++) {
+        size_t start = b * step;
+        size_t count = std::min(step, out_len - start);
+        auto valid = time.begin() + b * fft_size + overlap;
+        std::copy(valid, valid + count, out + start);
+    }
+}
+
+std::vector<std::complex<float>> CommsLib::convolve_fast(
+    std::vector<std::complex<float>> const& f,
+    std::vector<std::complex<float>> const& g)
+{
+    // convolve(f, g)[i] = sum_j fp[i + j] * g[ng - 1 - j], with fp being f
+    // padded by ng - 1 zeros on both sides
+    size_t nf = f.size();
+    size_t ng = g.size();
+    if (ng == 0)
+        return std::vector<std::complex<float>>();
+    std::vector<std::complex<float>> padded(nf + 2 * (ng - 1), 0);
+    std::copy(f.begin(), f.end(), padded.begin() + ng - 1);
+    std::vector<std::complex<float>> seq(ng);
+    for (size_t j = 0; j < ng; j++)
+        seq[j] = std::conj(g[ng - 1 - j]);
+
+    std::vector<std::complex<float>> out(nf + ng - 1);
+    CommsLib::correlate_avx(
+        padded.data(), out.size(), seq.data(), ng, out.data());
+    return out;
+}
+
+std::vector<std::complex<float>> CommsLib::IFFT(
+    const std::vector<std::complex<float>>& in, int fftSize, float scale,
+    bool normalize)
+{
+    std::vector<std::complex<float>> out(in.size());
+    CommsLib::IFFT(in.data(), out.data(), fftSize, scale, normalize);
     return out;
 }
 
@@ -457,19 +620,7 @@ std::vector<std::complex<float>> CommsLib::FFT(
     const std::vector<std::complex<float>>& in, int fftSize)
 {
     std::vector<std::complex<float>> out(in.size());
-
-    void* fft_in = mufft_alloc(fftSize * sizeof(std::complex<float>));
-    void* fft_out = mufft_alloc(fftSize * sizeof(std::complex<float>));
-    mufft_plan_1d* mufftplan
-        = mufft_create_plan_1d_c2c(fftSize, MUFFT_FORWARD, MUFFT_FLAG_CPU_ANY);
-
-    memcpy(fft_in, in.data(), fftSize * sizeof(std::complex<float>));
-    mufft_execute_plan_1d(mufftplan, fft_out, fft_in);
-    memcpy(out.data(), fft_out, fftSize * sizeof(std::complex<float>));
-
-    mufft_free_plan_1d(mufftplan);
-    mufft_free(fft_in);
-    mufft_free(fft_out);
+    CommsLib::FFT(in.data(), out.data(), fftSize);
     return out;
 }
 
@@ -477,64 +628,71 @@ std::vector<std::complex<float>> CommsLib::modulate(
     std::vector<uint8_t> in, int type)
 {
     std::vector<std::complex<float>> out(in.size());
-    if (type == QPSK) {
-        float qpsk_table[2][4]; // = init_qpsk();
+    CommsLib::modulate(in.data(), in.size(), type, out.data());
+    return out;
+}
+
+// Square constellation of 2^type points, point i has the in-phase
+// level i / side and the quadrature level i % side
+static std::vector<std::complex<float>> qamTable(int type)
+{
+    const size_t order = 1 << type;
+    const size_t side = 1 << (type / 2);
+    std::vector<float> levels;
+    if (type == CommsLib::QPSK) {
         float scale = 1 / sqrt(2);
-        float mod_qpsk[2] = { -scale, scale };
-        for (int i = 0; i < 4; i++) {
-            qpsk_table[0][i] = mod_qpsk[i / 2];
-            qpsk_table[1][i] = mod_qpsk[i % 2];
-        }
-        for (size_t i = 0; i < in.size(); i++) {
-            if (in[i] < 4u)
-                out[i] = std::complex<float>(
-                    qpsk_table[0][in[i]], qpsk_table[1][in[i]]);
-            else {
-                std::cout << "Error: No compatible input vector!" << std::endl;
-                break;
-            }
-        }
-    } else if (type == QAM16) {
-        float qam16_table[2][16]; //= init_qam16();
+        levels = { -scale, scale };
+    } else if (type == CommsLib::QAM16) {
         float scale = 1 / sqrt(10);
-        float mod_16qam[4] = { -3 * scale, -1 * scale, 3 * scale, scale };
-        for (int i = 0; i < 16; i++) {
-            qam16_table[0][i] = mod_16qam[i / 4];
-            qam16_table[1][i] = mod_16qam[i % 4];
-        }
-        for (size_t i = 0; i < in.size(); i++) {
-            if (in[i] < 16u)
-                out[i] = std::complex<float>(
-                    qam16_table[0][in[i]], qam16_table[1][in[i]]);
-            else {
-                std::cout << "Error: No compatible input vector!" << std::endl;
-                break;
-            }
-        }
-    } else if (type == QAM64) {
-        float qam64_table[2][64]; // = init_qam64();
+        levels = { -3 * scale, -1 * scale, 3 * scale, scale };
+    } else {
         float scale = 1 / sqrt(42);
-        float mod_64qam[8] = { -7 * scale, -5 * scale, -3 * scale, -1 * scale,
-            scale, 3 * scale, 5 * scale, 7 * scale };
-        for (int i = 0; i < 64; i++) {
-            qam64_table[0][i] = mod_64qam[i / 8];
-            qam64_table[1][i] = mod_64qam[i % 8];
-        }
-        for (size_t i = 0; i < in.size(); i++) {
-            if (in[i] < 64u)
-                out[i] = std::complex<float>(
-                    qam64_table[0][in[i]], qam64_table[1][in[i]]);
-            else {
-                std::cout << "Error: No compatible input vector!" << std::endl;
-                break;
-            }
-        }
+        levels = { -7 * scale, -5 * scale, -3 * scale, -1 * scale, scale,
+            3 * scale, 5 * scale, 7 * scale };
+    }
+    std::vector<std::complex<float>> table(order);
+    for (size_t i = 0; i < order; i++)
+        table[i] = std::complex<float>(levels[i / side], levels[i % side]);
+    return table;
+}
+
+void CommsLib::modulate(
+    const uint8_t* in, size_t len, int type, std::complex<float>* out)
+{
+    static const std::vector<std::complex<float>> qpsk_table
+        = qamTable(QPSK);
+    static const std::vector<std::complex<float>> qam16_table
+        = qamTable(QAM16);
+    static const std::vector<std::complex<float>> qam64_table
+        = qamTable(QAM64);
+
+    const std::complex<float>* table;
+    if (type == QPSK) {
+        table = qpsk_table.data();
+    } else if (type == QAM16) {
+        table = qam16_table.data();
+    } else if (type == QAM64) {
+        table = qam64_table.data();
     } else {
         // Not Supported
         std::cout << "Modulation Type " << type << " not supported!"
                   << std::endl;
+        return;
     }
-    return out;
+
+    // values are range checked first so the lookup loop is branch free
+    const uint8_t order = 1 << type;
+    size_t valid = len;
+    for (size_t i = 0; i < len; i++) {
+        if (in[i] >= order) {
+            valid = i;
+            break;
+        }
+    }
+    for (size_t i = 0; i < valid; i++)
+        out[i] = table[in[i]];
+    if (valid < len)
+        std::cout << "Error: No compatible input vector!" << std::endl;
 }
 
 std::vector<std::vector<float>> CommsLib::getSequence(
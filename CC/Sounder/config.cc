@@ -32,6 +32,7 @@ Config::Config(const std::string& jsonfile, const std::string& directory)
     ss << jConf.value("BaseStations", tddConf);
     tddConf = json::parse(ss);
     bs_present_ = (tddConf.empty() == false);
+    fanout_node_ = -1;
     if (bs_present_ == true) {
         ss.str(std::string());
         ss.clear();
@@ -120,9 +121,160 @@ Config::Config(const std::string& jsonfile, const std::string& directory)
 
         sample_cal_en_ = tddConf.value("sample_calibrate", false);
         imbalance_cal_en_ = tddConf.value("imbalance_calibrate", false);
+        init_threads_ = tddConf.value("init_threads", 16);
+        if (init_threads_ == 0)
+            throw std::invalid_argument("error init_threads must be > 0\n");
+        cal_cache_file_ = tddConf.value("calibration_cache", "");
+        cal_cache_validate_ = tddConf.value("calibration_cache_validate", true);
         beam_sweep_ = tddConf.value("beamsweep", false);
         beacon_ant_ = tddConf.value("beacon_antenna", 0);
         max_frame_ = tddConf.value("max_frame", 0);
+        record_batch_frames_ = tddConf.value("record_batch_frames", 1);
+        record_chunk_frames_ = tddConf.value("record_chunk_frames", 0);
+        record_chunk_size_kb_ = tddConf.value("record_chunk_size_kb", 1024);
+        record_chunk_cache_mb_ = tddConf.value("record_chunk_cache_mb", 0);
+        record_big_endian_ = tddConf.value("record_big_endian", false);
+        record_compression_ = tddConf.value("record_compression", "none");
+        if ((record_compression_ != "none") && (record_compression_ != "lz4")
+            && (record_compression_ != "zstd")) {
+            throw std::invalid_argument(
+                "error record_compression config: not none/lz4/zstd!\n");
+        }
+#ifndef USE_LZ4
+        if (record_compression_ == "lz4") {
+            throw std::invalid_argument(
+                "error record_compression config: built without LZ4!\n");
+        }
+#endif
+#ifndef USE_ZSTD
+        if (record_compression_ == "zstd") {
+            throw std::invalid_argument(
+                "error record_compression config: built without zstd!\n");
+        }
+#endif
+        if ((record_compression_ != "none") && (record_batch_frames_ == 0)) {
+            throw std::invalid_argument("error record_compression config: "
+                                        "needs record_batch_frames > 0!\n");
+        }
+        record_compression_level_
+            = tddConf.value("record_compression_level", 3);
+        record_compress_threads_ = tddConf.value("record_compress_threads", 2);
+        if ((record_compression_ != "none")
+            && (record_compress_threads_ == 0)) {
+            throw std::invalid_argument(
+                "error record_compress_threads must be > 0\n");
+        }
+        record_flush_ms_ = tddConf.value("record_flush_ms", 1000);
+        record_csi_ = tddConf.value("record_csi", false);
+        record_csi_pilots_ = tddConf.value("record_csi_pilots", false);
+        record_master_file_ = tddConf.value("record_master_file", true);
+        record_frame_index_ = tddConf.value("record_frame_index", true);
+        // the cells share antenna ids, their packages cannot be told apart
+        if ((record_frame_index_ == true) && (num_cells_ > 1)) {
+            MLPD_WARN("record_frame_index is not supported with multiple "
+                      "cells, no frame index is written\n");
+            record_frame_index_ = false;
+        }
+        record_hdf5_ = tddConf.value("record_hdf5", true);
+        live_ring_frames_ = tddConf.value("live_ring_frames", 0);
+        live_ring_name_ = tddConf.value("live_ring_name", "/sounder_live");
+        if ((record_hdf5_ == false) && (live_ring_frames_ == 0)) {
+            throw std::invalid_argument("error record_hdf5 config: nothing "
+                                        "is recorded without live_ring!\n");
+        }
+        rx_backpressure_ = tddConf.value("rx_backpressure", "drop_newest");
+        record_direct_routing_ = tddConf.value("record_direct_routing", false);
+        // one mode for all recorder threads or a list with one per thread
+        auto jWaitModes = tddConf.value("record_wait_mode", json("adaptive"));
+        if (jWaitModes.is_array())
+            record_wait_modes_.assign(jWaitModes.begin(), jWaitModes.end());
+        else
+            record_wait_modes_.push_back(jWaitModes.get<std::string>());
+        if (record_wait_modes_.empty()) {
+            throw std::invalid_argument(
+                "error record_wait_mode config: empty list!\n");
+        }
+        for (auto& mode : record_wait_modes_) {
+            if ((mode != "adaptive") && (mode != "spin")) {
+                throw std::invalid_argument(
+                    "error record_wait_mode config: not adaptive/spin!\n");
+            }
+        }
+        record_spin_count_ = tddConf.value("record_spin_count", 4096);
+        // "fanout_nodes": ["10.0.0.2:9000", ...] sends the packages to the
+        // recorder nodes, "fanout_node": n makes this host node n
+        auto jFanoutNodes = tddConf.value("fanout_nodes", json::array());
+        fanout_nodes_.assign(jFanoutNodes.begin(), jFanoutNodes.end());
+        fanout_batch_ = tddConf.value("fanout_batch", 32);
+        fanout_gso_ = tddConf.value("fanout_gso", false);
+        fanout_node(tddConf.value("fanout_node", -1));
+        if ((fanout_batch_ == 0) || (fanout_batch_ > 1024)) {
+            throw std::invalid_argument(
+                "error fanout_batch config: must be 1 to 1024!\n");
+        }
+        if ((fanout_nodes_.empty() == false)
+            && (record_direct_routing_ == true)) {
+            throw std::invalid_argument("error fanout_nodes config: not "
+                                        "supported with direct routing!\n");
+        }
+        if ((fanout_nodes_.empty() == false) && (live_ring_frames_ > 0)) {
+            throw std::invalid_argument("error fanout_nodes config: not "
+                                        "supported with live_ring!\n");
+        }
+        rx_direct_buffers_ = tddConf.value("rx_direct_buffers", false);
+        rx_balancing_ = tddConf.value("rx_balancing", "static");
+        if ((rx_balancing_ != "static") && (rx_balancing_ != "adaptive")) {
+            throw std::invalid_argument(
+                "error rx_balancing config: not static/adaptive!\n");
+        }
+        // radios holding lent driver buffers cannot move, and with
+        // direct buffers nearly all of them hold some
+        if ((rx_balancing_ == "adaptive") && (rx_direct_buffers_ == true)) {
+            throw std::invalid_argument("error rx_balancing config: "
+                                        "adaptive is not supported with "
+                                        "rx_direct_buffers!\n");
+        }
+        rx_uhd_frame_reads_ = tddConf.value("rx_uhd_frame_reads", false);
+        sample_buffer_frames_ = tddConf.value("sample_buffer_frames", 80);
+        if (sample_buffer_frames_ == 0) {
+            throw std::invalid_argument(
+                "error sample_buffer_frames config: must be > 0!\n");
+        }
+        sample_buffer_huge_pages_
+            = tddConf.value("sample_buffer_huge_pages", true);
+        // "all", "decimate" (every record_decimation-th frame) or "trigger"
+        // (the frames around those whose pilots pass record_trigger_db)
+        record_policy_ = tddConf.value("record_policy", "all");
+        record_decimation_ = tddConf.value("record_decimation", 10);
+        record_trigger_db_ = tddConf.value("record_trigger_db", 10.0);
+        record_trigger_pre_ = tddConf.value("record_trigger_pre", 4);
+        record_trigger_post_ = tddConf.value("record_trigger_post", 16);
+        if ((record_policy_ != "all") && (record_policy_ != "decimate")
+            && (record_policy_ != "trigger")) {
+            throw std::invalid_argument(
+                "error record_policy config: not all/decimate/trigger!\n");
+        }
+        if (record_decimation_ == 0) {
+            throw std::invalid_argument(
+                "error record_decimation config: must be > 0!\n");
+        }
+        // the held frames keep their rx buffer slots
+        if ((record_policy_ == "trigger")
+            && ((2 * (record_trigger_pre_ + 2)) > sample_buffer_frames_)) {
+            throw std::invalid_argument("error record_trigger_pre config: "
+                                        "must fit in half the sample "
+                                        "buffer!\n");
+        }
+        telemetry_interval_ms_ = tddConf.value("telemetry_interval_ms", 1000);
+        bs_radio_backend_ = tddConf.value("radio_backend", "hardware");
+        if ((bs_radio_backend_ != "hardware")
+            && (bs_radio_backend_ != "synthetic")
+            && (bs_radio_backend_ != "replay")) {
+            throw std::invalid_argument("error radio_backend config: not "
+                                        "hardware/synthetic/replay!\n");
+        }
+        replay_file_ = tddConf.value("replay_file", "");
+        synthetic_rate_ = tddConf.value("synthetic_rate", 1.0);
 
         MLPD_TRACE("Number cells: %zu\n", num_cells_);
         bs_sdr_ids_.resize(num_cells_);
@@ -224,6 +376,15 @@ Config::Config(const std::string& jsonfile, const std::string& directory)
         hw_framer_ = tddConfCl.value("hw_framer", true);
         tx_advance_ = tddConfCl.value("tx_advance", 250); // 250
         ul_data_frame_num_ = tddConfCl.value("ul_data_frame_num", 1);
+        // schedule pilot and UL TX from a second thread, see clientSyncTxRx
+        cl_tx_thread_ = tddConfCl.value("tx_thread", false);
+        // "mmap" or "preload" keep the UL data in memory, "stream" reads
+        // the file from the TX loop
+        ul_data_mode_ = tddConfCl.value("ul_data_mode", "mmap");
+        if (ul_data_mode_ != "mmap" && ul_data_mode_ != "preload"
+            && ul_data_mode_ != "stream")
+            throw std::invalid_argument(
+                "error ul_data_mode: not any of mmap/preload/stream!\n");
 
         // Help verify whether gain exceeds max value
         struct compare {
@@ -417,6 +578,10 @@ Config::Config(const std::string& jsonfile, const std::string& directory)
         = CommsLib::getPilotScValue(fft_size_, symbol_data_subcarrier_num_);
     pilot_sc_ind_
         = CommsLib::getPilotScIndex(fft_size_, symbol_data_subcarrier_num_);
+    if (bs_present_ && record_csi_ && (pilot_sym_.at(0).size() != fft_size_)) {
+        throw std::invalid_argument(
+            "error record_csi config: pilot length does not match fft_size!\n");
+    }
     if (bs_present_ == true) {
         // set trace file path
         time_t now = time(0);
@@ -447,6 +612,13 @@ Config::Config(const std::string& jsonfile, const std::string& directory)
                 + std::to_string(num_cl_antennas_) + ".hdf5";
         }
         trace_file_ = tddConf.value("trace_file", filename);
+        // pipeline counters go next to the trace unless told otherwise
+        std::string telemetry_file = trace_file_;
+        size_t ext = telemetry_file.rfind(".hdf5");
+        if (ext != std::string::npos)
+            telemetry_file.erase(ext);
+        telemetry_file_ = tddConf.value(
+            "telemetry_file", telemetry_file + "-telemetry.csv");
     }
 
     // Multi-threading settings
@@ -456,6 +628,11 @@ Config::Config(const std::string& jsonfile, const std::string& directory)
     if ((bs_present_ == true)
         && (pilot_syms_per_frame_ + ul_syms_per_frame_ > 0)) {
         task_thread_num_ = tddConf.value("task_thread", TASK_THREAD_NUM);
+        if ((record_wait_modes_.size() != 1)
+            && (record_wait_modes_.size() != task_thread_num_)) {
+            throw std::invalid_argument("error record_wait_mode config: "
+                                        "needs 1 or task_thread modes!\n");
+        }
         rx_thread_num_ = (num_cores >= (2 * RX_THREAD_NUM))
             ? std::min(RX_THREAD_NUM, static_cast<int>(num_bs_sdrs_all_))
             : 1;
@@ -484,6 +661,41 @@ Config::Config(const std::string& jsonfile, const std::string& directory)
         MLPD_INFO(
             "Allocating %zu cores to client threads ... \n", num_cl_sdrs_);
     }
+    if (core_alloc_ == true) {
+        std::array<size_t, CorePlanner::kNumRoles> threads = {};
+        threads[CorePlanner::kDispatcher] = 1;
+        threads[CorePlanner::kRx] = rx_thread_num_;
+        threads[CorePlanner::kRecorder] = task_thread_num_;
+        if (client_present_ == true) {
+            threads[CorePlanner::kClient] = num_cl_sdrs_;
+            threads[CorePlanner::kClientTx] = cl_tx_thread_ ? num_cl_sdrs_ : 0;
+        }
+        // Whether this host sends or is a node is only known later, the
+        // senders come last and take what is left
+        if (rx_thread_num_ > 0)
+            threads[CorePlanner::kFanout] = fanout_nodes_.size();
+        // "core_map": {"rx": [2, 3], "dispatcher": 0, ...} pins by hand
+        std::array<std::vector<int>, CorePlanner::kNumRoles> overrides;
+        json core_map = jConf.value("core_map", json::object());
+        for (size_t r = 0; r < CorePlanner::kNumRoles; r++) {
+            const char* role = CorePlanner::roleName(CorePlanner::Role(r));
+            if (!core_map.is_object() || !core_map.contains(role))
+                continue;
+            json cores = core_map.at(role);
+            if (!cores.is_array())
+                cores = json::array({ cores });
+            for (const auto& core : cores) {
+                if (!core.is_number_integer() || core.get<int>() < 0) {
+                    throw std::invalid_argument(std::string("error core_map ")
+                        + role + " must list CPU numbers\n");
+                }
+                overrides[r].push_back(core.get<int>());
+            }
+        }
+        core_plan_.plan(threads, jConf.value("core_nic", ""), overrides);
+        MLPD_INFO("Thread placement: %s\n", core_plan_.describe().c_str());
+    }
+    this->buildSymbolTable();
     running_.store(true);
     MLPD_INFO("Configuration file was successfully parsed!\n");
 }
@@ -618,80 +830,43 @@ size_t Config::getTotNumAntennas()
     return ret;
 }
 
-Config::~Config() {}
-
-int Config::getClientId(int frame_id, int symbol_id)
-{
-    if (reciprocal_calib_)
-        return symbol_id;
-    std::vector<size_t>::iterator it;
-    int fid = frame_id % frames_.size();
-    it = find(pilot_symbols_.at(fid).begin(), pilot_symbols_.at(fid).end(),
-        symbol_id);
-    if (it != pilot_symbols_.at(fid).end()) {
-        return (it - pilot_symbols_.at(fid).begin());
-    }
-    return -1;
-}
-
-int Config::getNoiseSFIndex(int frame_id, int symbol_id)
-{
-    std::vector<size_t>::iterator it;
-    int fid = frame_id % frames_.size();
-    it = find(noise_symbols_.at(fid).begin(), noise_symbols_.at(fid).end(),
-        symbol_id);
-    if (it != noise_symbols_.at(fid).end())
-        return (it - noise_symbols_.at(fid).begin());
-    return -1;
-}
-
-int Config::getUlSFIndex(int frame_id, int symbol_id)
+void Config::fanout_node(int node)
 {
-    std::vector<size_t>::iterator it;
-    int fid = frame_id % frames_.size();
-    it = find(
-        ul_symbols_.at(fid).begin(), ul_symbols_.at(fid).end(), symbol_id);
-    if (it != ul_symbols_.at(fid).end()) {
-        return (it - ul_symbols_.at(fid).begin());
+    if ((node >= 0) && (static_cast<size_t>(node) >= fanout_nodes_.size())) {
+        throw std::invalid_argument(
+            "error fanout_node config: not an entry of fanout_nodes!\n");
     }
-    return -1;
+    fanout_node_ = node;
 }
 
-int Config::getDlSFIndex(int frame_id, int symbol_id)
-{
-    std::vector<size_t>::iterator it;
-    int fid = frame_id % frames_.size();
-    it = find(
-        dl_symbols_.at(fid).begin(), dl_symbols_.at(fid).end(), symbol_id);
-    if (it != dl_symbols_.at(fid).end())
-        return (it - dl_symbols_.at(fid).begin());
-    return -1;
-}
-
-bool Config::isPilot(int frame_id, int symbol_id)
-{
-    try {
-        return frames_[frame_id % frames_.size()].at(symbol_id) == 'P';
-    } catch (const std::out_of_range&) {
-        return false;
-    }
-}
-
-bool Config::isNoise(int frame_id, int symbol_id)
-{
-    try {
-        return frames_[frame_id % frames_.size()].at(symbol_id) == 'N';
-    } catch (const std::out_of_range&) {
-        return false;
-    }
-}
+Config::~Config() {}
 
-bool Config::isData(int frame_id, int symbol_id)
+// Position of every symbol in the pilot/noise/UL/DL symbol lists of its
+// pattern, so the per packet lookups are a single table read
+void Config::buildSymbolTable(void)
 {
-    try {
-        return frames_[frame_id % frames_.size()].at(symbol_id) == 'U';
-    } catch (const std::out_of_range&) {
-        return false;
+    this->symbol_table_patterns_ = this->frames_.size();
+    this->symbol_table_stride_ = 0;
+    for (const auto& frame : this->frames_)
+        this->symbol_table_stride_
+            = std::max(this->symbol_table_stride_, frame.size());
+    if (this->symbol_table_stride_ > INT16_MAX)
+        throw std::invalid_argument("error frame_schedule: frame too long\n");
+    this->symbol_table_.assign(
+        this->symbol_table_patterns_ * this->symbol_table_stride_, kNoSymbol);
+
+    for (size_t f = 0; f < this->symbol_table_patterns_; f++) {
+        SymbolInfo* row = &this->symbol_table_[f * this->symbol_table_stride_];
+        for (size_t s = 0; s < this->frames_[f].size(); s++)
+            row[s].type = this->frames_[f][s];
+        for (size_t i = 0; i < this->pilot_symbols_.at(f).size(); i++)
+            row[this->pilot_symbols_[f][i]].pilot = i;
+        for (size_t i = 0; i < this->noise_symbols_.at(f).size(); i++)
+            row[this->noise_symbols_[f][i]].noise = i;
+        for (size_t i = 0; i < this->ul_symbols_.at(f).size(); i++)
+            row[this->ul_symbols_[f][i]].ul = i;
+        for (size_t i = 0; i < this->dl_symbols_.at(f).size(); i++)
+            row[this->dl_symbols_[f][i]].dl = i;
     }
 }
 
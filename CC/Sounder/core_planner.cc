@@ -0,0 +1,217 @@
+/*
+ Copyright (c) 2018-2020, Rice University
+ RENEW OPEN SOURCE LICENSE: http://renew-wireless.org/license
+
+----------------------------------------------------------------------
+ Topology-aware placement of the sounder threads
+---------------------------------------------------------------------
+*/
+
+#include "include/core_planner.h"
+#include "include/logger.h"
+#include <algorithm>
+#include <cctype>
+#include <dirent.h>
+#include <fstream>
+#include <map>
+#include <sched.h>
+#include <set>
+#include <tuple>
+
+static const char* kSysCpu = "/sys/devices/system/cpu";
+static const char* kSysNode = "/sys/devices/system/node";
+
+// Logical CPU and where it sits. Without sysfs every CPU is its own
+// physical core on node 0.
+struct CpuInfo {
+    int id;
+    int node;
+    int package;
+    int core;
+};
+
+static int readInt(const std::string& path, int fallback)
+{
+    std::ifstream file(path);
+    int value;
+    if (!(file >> value))
+        return fallback;
+    return value;
+}
+
+// "0-3,8-11" style lists of /sys
+static std::vector<int> parseCpuList(const std::string& list)
+{
+    std::vector<int> cpus;
+    size_t pos = 0;
+    while (pos < list.size()) {
+        size_t end = list.find(',', pos);
+        if (end == std::string::npos)
+            end = list.size();
+        std::string range = list.substr(pos, end - pos);
+        size_t dash = range.find('-');
+        try {
+            int first = std::stoi(range.substr(0, dash));
+            int last = (dash == std::string::npos)
+                ? first
+                : std::stoi(range.substr(dash + 1));
+            for (int cpu = first; cpu <= last; cpu++)
+                cpus.push_back(cpu);
+        } catch (const std::exception&) {
+        }
+        pos = end + 1;
+    }
+    return cpus;
+}
+
+static std::map<int, int> readCpuNodes(void)
+{
+    std::map<int, int> nodes;
+    DIR* dir = opendir(kSysNode);
+    if (dir == nullptr)
+        return nodes;
+    while (struct dirent* entry = readdir(dir)) {
+        std::string name = entry->d_name;
+        if (name.compare(0, 4, "node") != 0 || name.size() == 4
+            || !std::isdigit(name[4]))
+            continue;
+        std::ifstream file(std::string(kSysNode) + "/" + name + "/cpulist");
+        std::string list;
+        std::getline(file, list);
+        for (int cpu : parseCpuList(list))
+            nodes[cpu] = std::stoi(name.substr(4));
+    }
+    closedir(dir);
+    return nodes;
+}
+
+// CPUs this process may run on
+static std::vector<CpuInfo> readTopology(void)
+{
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+        return {};
+    std::map<int, int> nodes = readCpuNodes();
+    std::vector<CpuInfo> cpus;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, &allowed))
+            continue;
+        std::string topo = std::string(kSysCpu) + "/cpu" + std::to_string(cpu)
+            + "/topology/";
+        CpuInfo info;
+        info.id = cpu;
+        info.node = nodes.count(cpu) ? nodes[cpu] : 0;
+        info.package = readInt(topo + "physical_package_id", 0);
+        info.core = readInt(topo + "core_id", cpu);
+        cpus.push_back(info);
+    }
+    return cpus;
+}
+
+static int nicNode(const std::string& nic)
+{
+    if (nic.empty())
+        return -1;
+    int node = readInt("/sys/class/net/" + nic + "/device/numa_node", -1);
+    if (node < 0) {
+        MLPD_WARN("No NUMA node found for NIC %s\n", nic.c_str());
+    }
+    return node;
+}
+
+// Usable CPUs in the order threads should get them
+static std::vector<int> cpuOrder(const std::vector<CpuInfo>& cpus, int node)
+{
+    // logical CPUs of each (package, core), in CPU id order
+    std::map<std::pair<int, int>, std::vector<const CpuInfo*>> physical;
+    for (const CpuInfo& cpu : cpus)
+        physical[{ cpu.package, cpu.core }].push_back(&cpu);
+
+    std::vector<std::vector<const CpuInfo*>> cores;
+    for (auto& entry : physical)
+        cores.push_back(entry.second);
+    if (node < 0 && cores.empty() == false)
+        node = cpus.front().node;
+    // the NIC node first, then the other nodes, lowest CPU first
+    std::sort(cores.begin(), cores.end(),
+        [node](const std::vector<const CpuInfo*>& a,
+            const std::vector<const CpuInfo*>& b) {
+            return std::make_tuple(a[0]->node != node, a[0]->node, a[0]->id)
+                < std::make_tuple(b[0]->node != node, b[0]->node, b[0]->id);
+        });
+
+    std::vector<int> order;
+    for (size_t sibling = 0; order.size() < cpus.size(); sibling++) {
+        for (const auto& core : cores) {
+            if (sibling < core.size())
+                order.push_back(core[sibling]->id);
+        }
+    }
+    return order;
+}
+
+const char* CorePlanner::roleName(Role role)
+{
+    static const char* kNames[kNumRoles]
+        = { "rx", "dispatcher", "recorder", "client", "client_tx", "fanout" };
+    return kNames[role];
+}
+
+void CorePlanner::plan(const std::array<size_t, kNumRoles>& threads,
+    const std::string& nic,
+    const std::array<std::vector<int>, kNumRoles>& overrides)
+{
+    std::set<int> reserved;
+    for (size_t r = 0; r < kNumRoles; r++) {
+        this->plan_[r].assign(threads[r], -1);
+        for (size_t i = 0; i < overrides[r].size() && i < threads[r]; i++) {
+            this->plan_[r][i] = overrides[r][i];
+            reserved.insert(overrides[r][i]);
+        }
+    }
+
+    std::vector<int> order;
+    for (int cpu : cpuOrder(readTopology(), nicNode(nic))) {
+        if (reserved.count(cpu) == 0)
+            order.push_back(cpu);
+    }
+    if (order.empty()) {
+        MLPD_WARN("No free CPU to place sounder threads on\n");
+        return;
+    }
+
+    size_t next = 0;
+    for (size_t r = 0; r < kNumRoles; r++) {
+        for (int& core : this->plan_[r]) {
+            if (core >= 0)
+                continue;
+            if (next == order.size()) {
+                MLPD_WARN("More sounder threads than CPUs, sharing cores\n");
+            }
+            core = order[next++ % order.size()];
+        }
+    }
+}
+
+int CorePlanner::core(Role role, size_t index) const
+{
+    const std::vector<int>& cores = this->plan_[role];
+    return (index < cores.size()) ? cores[index] : -1;
+}
+
+std::string CorePlanner::describe(void) const
+{
+    std::string out;
+    for (size_t r = 0; r < kNumRoles; r++) {
+        if (this->plan_[r].empty())
+            continue;
+        if (!out.empty())
+            out += ", ";
+        out += roleName(static_cast<Role>(r));
+        out += ":";
+        for (int core : this->plan_[r])
+            out += " " + std::to_string(core);
+    }
+    return out;
+}
@@ -0,0 +1,74 @@
+/*
+ Copyright (c) 2018-2020, Rice University
+ RENEW OPEN SOURCE LICENSE: http://renew-wireless.org/license
+
+----------------------------------------------------------------------
+ Channel estimation of received pilots ahead of the recorder
+---------------------------------------------------------------------
+*/
+
+#include "include/csi_stage.h"
+#include "include/comms-lib.h"
+#include "include/utils.h"
+
+namespace Sounder {
+// full scale of the received int16 samples
+static const float kSampleScale = 1.f / 32768;
+
+CsiStage::CsiStage(Config* cfg)
+    : cfg_(cfg)
+{
+    // Reference is the transform of the transmitted time domain pilot, so
+    // the FFT scaling cancels out of the estimate
+    std::vector<std::complex<float>> pilot;
+    for (size_t i = 0; i < cfg->pilot_sym().at(0).size(); i++) {
+        pilot.push_back(std::complex<float>(
+            cfg->pilot_sym().at(0).at(i), cfg->pilot_sym().at(1).at(i)));
+    }
+    std::vector<std::complex<float>> pilot_f
+        = CommsLib::FFT(pilot, cfg->fft_size());
+    for (size_t sc : cfg->data_ind()) {
+        std::complex<float> x
+            = pilot_f.at(sc) * static_cast<float>(cfg->symbol_per_subframe());
+        this->ref_.push_back(
+            (std::norm(x) > 0) ? 1.f / x : std::complex<float>(0, 0));
+    }
+}
+
+void CsiStage::estimate(const Package* const* pkgs, size_t count, float* csi)
+{
+    const size_t fft_size = this->cfg_->fft_size();
+    const size_t cp_size = this->cfg_->cp_size();
+    const size_t syms = this->cfg_->symbol_per_subframe();
+    const size_t num_sc = this->ref_.size();
+    this->work_.resize(count * syms * fft_size);
+
+    for (size_t i = 0; i < count; i++) {
+        const short* samples = pkgs[i]->samples() + 2 * this->cfg_->prefix();
+        for (size_t s = 0; s < syms; s++) {
+            const short* in
+                = samples + 2 * (s * (fft_size + cp_size) + cp_size);
+            Utils::cint16_to_cfloat(
+                reinterpret_cast<const std::complex<int16_t>*>(in), fft_size,
+                this->work_.data() + (i * syms + s) * fft_size, kSampleScale);
+        }
+    }
+    CommsLib::FFT(this->work_.data(), this->work_.data(), fft_size,
+        count * syms);
+
+    for (size_t i = 0; i < count; i++) {
+        const std::complex<float>* rx
+            = this->work_.data() + i * syms * fft_size;
+        float* out = csi + i * 2 * num_sc;
+        for (size_t c = 0; c < num_sc; c++) {
+            size_t sc = this->cfg_->data_ind()[c];
+            std::complex<float> sum(0, 0);
+            for (size_t s = 0; s < syms; s++)
+                sum += rx[s * fft_size + sc];
+            std::complex<float> h = sum * this->ref_[c];
+            out[2 * c] = h.real();
+            out[2 * c + 1] = h.imag();
+        }
+    }
+}
+}; /* End namespace Sounder */
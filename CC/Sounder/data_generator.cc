@@ -1,16 +1,43 @@
 #include "include/data_generator.h"
 #include "include/comms-lib.h"
+#include "include/logger.h"
+#include <atomic>
+#include <fcntl.h>
+#include <stdexcept>
+#include <thread>
+#include <unistd.h>
 
-void DataGenerator::GenerateData(const std::string& directory)
+// Frames generated and written together by one task
+static const size_t kFramesPerTask = 16;
+
+// splitmix64 step, used to seed each task and as its generator. Seeding
+// from (seed, task) keeps the output independent of the thread count.
+static inline uint64_t nextRandom(uint64_t& state)
 {
-    srand(time(NULL));
-    int mod_type = cfg_->data_mod() == "64QAM"
-        ? CommsLib::QAM64
-        : (cfg_->data_mod() == "16QAM" ? CommsLib::QAM16 : CommsLib::QPSK);
-    int mod_order = 1 << mod_type;
+    uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static void writeBlock(int fd, const void* data, size_t len, off_t offset)
+{
+    const char* ptr = static_cast<const char*>(data);
+    while (len > 0) {
+        ssize_t ret = pwrite(fd, ptr, len, offset);
+        if (ret < 0)
+            throw std::runtime_error("DataGenerator: file write failed");
+        ptr += ret;
+        len -= ret;
+        offset += ret;
+    }
+}
 
-    std::vector<std::complex<float>> prefix_zpad_t(cfg_->prefix(), 0);
-    std::vector<std::complex<float>> postfix_zpad_t(cfg_->postfix(), 0);
+void DataGenerator::GenerateData(const std::string& directory)
+{
+    uint64_t seed = time(NULL);
+    std::vector<Task> tasks;
+    std::vector<int> fds;
     for (size_t i = 0; i < cfg_->num_cl_sdrs(); i++) {
         std::string filename_tag = cfg_->data_mod() + "_"
             + std::to_string(cfg_->symbol_data_subcarrier_num()) + "_"
@@ -20,72 +47,122 @@ void DataGenerator::GenerateData(const std::string& directory)
             + std::to_string(cfg_->ul_data_frame_num()) + "_"
             + cfg_->cl_channel() + "_" + std::to_string(i) + ".bin";
 
-        std::string filename_ul_data_b
-            = directory + "/ul_data_b_" + filename_tag;
-        std::printf("Saving UL data bits for radio %zu to %s\n", i,
-            filename_ul_data_b.c_str());
-        FILE* fp_tx_b = std::fopen(filename_ul_data_b.c_str(), "wb");
-        std::string filename_ul_data_f
-            = directory + "/ul_data_f_" + filename_tag;
-        std::printf("Saving UL frequency-domain data for radio %zu to %s\n", i,
-            filename_ul_data_f.c_str());
-        FILE* fp_tx_f = std::fopen(filename_ul_data_f.c_str(), "wb");
-        std::string filename_ul_data_t
-            = directory + "/ul_data_t_" + filename_tag;
-        std::printf("Saving UL time-domain data for radio %zu to %s\n", i,
-            filename_ul_data_t.c_str());
-        FILE* fp_tx_t = std::fopen(filename_ul_data_t.c_str(), "wb");
-        // Frame * UL Slots * Channel * Samples
-        for (size_t f = 0; f < cfg_->ul_data_frame_num(); f++) {
-            for (size_t u = 0; u < cfg_->cl_ul_symbols()[i].size(); u++) {
-                for (size_t h = 0; h < cfg_->cl_sdr_ch(); h++) {
-                    std::vector<std::complex<float>> data_time_dom;
-                    std::vector<std::complex<float>> data_freq_dom;
-                    data_time_dom.insert(data_time_dom.begin(),
-                        prefix_zpad_t.begin(), prefix_zpad_t.end());
-                    for (size_t s = 0; s < cfg_->symbol_per_subframe(); s++) {
-                        std::vector<uint8_t> data_bits;
-                        for (size_t c = 0; c < cfg_->data_ind().size(); c++) {
-                            data_bits.push_back((uint8_t)(rand() % mod_order));
-                        }
-                        std::fwrite(data_bits.data(),
-                            cfg_->symbol_data_subcarrier_num(), sizeof(uint8_t),
-                            fp_tx_b);
-                        std::vector<std::complex<float>> mod_data
-                            = CommsLib::modulate(data_bits, mod_type);
-                        std::vector<std::complex<float>> ofdm_sym(
-                            cfg_->fft_size(), 0);
-                        size_t sc = 0;
-                        for (size_t c = 0; c < cfg_->data_ind().size(); c++) {
-                            sc = cfg_->data_ind()[c];
-                            ofdm_sym[sc] = mod_data[c];
-                        }
-                        for (size_t c = 0; c < cfg_->pilot_sc().size(); c++) {
-                            sc = cfg_->pilot_sc_ind().at(c);
-                            ofdm_sym[sc] = cfg_->pilot_sc().at(c);
-                        }
-                        auto tx_sym = CommsLib::IFFT(ofdm_sym, cfg_->fft_size(),
-                            1.f / cfg_->fft_size(), false);
-                        tx_sym.insert(tx_sym.begin(),
-                            tx_sym.end() - cfg_->cp_size(),
-                            tx_sym.end()); // add CP
-                        data_time_dom.insert(
-                            data_time_dom.end(), tx_sym.begin(), tx_sym.end());
-                        data_freq_dom.insert(data_freq_dom.end(),
-                            ofdm_sym.begin(), ofdm_sym.end());
-                    }
-                    data_time_dom.insert(data_time_dom.end(),
-                        postfix_zpad_t.begin(), postfix_zpad_t.end());
-                    std::fwrite(data_freq_dom.data(),
-                        cfg_->fft_size() * cfg_->symbol_per_subframe(),
-                        sizeof(float) * 2, fp_tx_f);
-                    std::fwrite(data_time_dom.data(), cfg_->samps_per_symbol(),
-                        sizeof(float) * 2, fp_tx_t);
+        const std::string kinds[3] = { "bits", "frequency-domain data",
+            "time-domain data" };
+        const std::string prefixes[3] = { "/ul_data_b_", "/ul_data_f_",
+            "/ul_data_t_" };
+        for (size_t k = 0; k < 3; k++) {
+            std::string filename = directory + prefixes[k] + filename_tag;
+            std::printf("Saving UL %s for radio %zu to %s\n", kinds[k].c_str(),
+                i, filename.c_str());
+            int fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fd < 0) {
+                for (int open_fd : fds)
+                    close(open_fd);
+                throw std::runtime_error(
+                    "DataGenerator: cannot create " + filename);
+            }
+            fds.push_back(fd);
+        }
+        for (size_t f = 0; f < cfg_->ul_data_frame_num(); f += kFramesPerTask) {
+            tasks.push_back({ i, f,
+                std::min(kFramesPerTask, cfg_->ul_data_frame_num() - f) });
+        }
+    }
+
+    size_t num_threads = std::min(
+        static_cast<size_t>(std::max(cfg_->getCoreCount(), 1u)), tasks.size());
+    MLPD_INFO("Generating %zu blocks of UL frames on %zu threads\n",
+        tasks.size(), num_threads);
+    std::atomic<size_t> next_task(0);
+    std::atomic<bool> failed(false);
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < num_threads; t++) {
+        threads.emplace_back([&, this] {
+            Buffers buf;
+            size_t id;
+            while (!failed && (id = next_task++) < tasks.size()) {
+                const Task& task = tasks[id];
+                try {
+                    uint64_t task_seed = seed ^ (id * 0xd1b54a32d192ed03ULL);
+                    this->GenerateTask(
+                        task, nextRandom(task_seed), buf, &fds[task.radio * 3]);
+                } catch (const std::exception& e) {
+                    MLPD_ERROR("%s\n", e.what());
+                    failed = true;
                 }
             }
+        });
+    }
+    for (auto& thread : threads)
+        thread.join();
+    for (int fd : fds)
+        close(fd);
+    if (failed)
+        throw std::runtime_error("DataGenerator: UL data generation failed");
+}
+
+void DataGenerator::GenerateTask(
+    const Task& task, uint64_t seed, Buffers& buf, const int fds[3])
+{
+    int mod_type = cfg_->data_mod() == "64QAM"
+        ? CommsLib::QAM64
+        : (cfg_->data_mod() == "16QAM" ? CommsLib::QAM16 : CommsLib::QPSK);
+
+    // Frame * UL Slots * Channel * Samples, every (frame, slot, channel)
+    // record of the block is transformed in a single IFFT batch
+    const size_t fft_size = cfg_->fft_size();
+    const size_t cp_size = cfg_->cp_size();
+    const size_t num_syms = cfg_->symbol_per_subframe();
+    const size_t num_sc = cfg_->data_ind().size();
+    const size_t samps = cfg_->samps_per_symbol();
+    const size_t frame_records
+        = cfg_->cl_ul_symbols()[task.radio].size() * cfg_->cl_sdr_ch();
+    const size_t records = task.num_frames * frame_records;
+
+    buf.bits.resize(records * num_syms * num_sc);
+    buf.freq.assign(records * num_syms * fft_size, 0);
+    buf.syms.resize(buf.freq.size());
+    buf.time.assign(records * samps, 0);
+    buf.mod.resize(num_sc);
+
+    uint64_t state = seed;
+    for (size_t s = 0; s < records * num_syms; s++) {
+        uint8_t* data_bits = buf.bits.data() + s * num_sc;
+        for (size_t c = 0; c < num_sc; c++)
+            data_bits[c] = nextRandom(state) >> (64 - mod_type);
+        CommsLib::modulate(data_bits, num_sc, mod_type, buf.mod.data());
+
+        std::complex<float>* ofdm_sym = buf.freq.data() + s * fft_size;
+        for (size_t c = 0; c < num_sc; c++)
+            ofdm_sym[cfg_->data_ind()[c]] = buf.mod[c];
+        for (size_t c = 0; c < cfg_->pilot_sc().size(); c++)
+            ofdm_sym[cfg_->pilot_sc_ind().at(c)] = cfg_->pilot_sc().at(c);
+    }
+    CommsLib::IFFT(buf.freq.data(), buf.syms.data(), fft_size, 1.f / fft_size,
+        false, records * num_syms);
+
+    // prefix zeros, CP + symbol for each symbol, postfix zeros
+    for (size_t r = 0; r < records; r++) {
+        std::complex<float>* out = buf.time.data() + r * samps + cfg_->prefix();
+        for (size_t s = 0; s < num_syms; s++) {
+            const std::complex<float>* tx_sym
+                = buf.syms.data() + (r * num_syms + s) * fft_size;
+            out = std::copy(
+                tx_sym + fft_size - cp_size, tx_sym + fft_size, out);
+            out = std::copy(tx_sym, tx_sym + fft_size, out);
         }
-        std::fclose(fp_tx_b);
-        std::fclose(fp_tx_f);
-        std::fclose(fp_tx_t);
     }
+
+    const size_t bits_frame = frame_records * num_syms * num_sc;
+    const size_t freq_frame
+        = frame_records * num_syms * fft_size * sizeof(std::complex<float>);
+    const size_t time_frame
+        = frame_records * samps * sizeof(std::complex<float>);
+    writeBlock(fds[0], buf.bits.data(), buf.bits.size(),
+        task.first_frame * bits_frame);
+    writeBlock(fds[1], buf.freq.data(), task.num_frames * freq_frame,
+        task.first_frame * freq_frame);
+    writeBlock(fds[2], buf.time.data(), task.num_frames * time_frame,
+        task.first_frame * time_frame);
 }
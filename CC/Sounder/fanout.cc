@@ -0,0 +1,505 @@
+/*
+ Copyright (c) 2018-2020, Rice University
+ RENEW OPEN SOURCE LICENSE: http://renew-wireless.org/license
+
+----------------------------------------------------------------------
+ UDP fan-out of the received packages to remote recorder nodes
+---------------------------------------------------------------------
+*/
+
+#include "include/fanout.h"
+#include "include/logger.h"
+#include "include/utils.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <new>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+
+namespace Sounder {
+const size_t FanoutSender::kDequeueBulkSize = 16;
+
+// Socket buffers asked for, the kernel caps them at [rw]mem_max
+static const int kFanoutSocketBuffer = 64 * 1024 * 1024;
+// Largest GSO send and segments per send the kernel takes
+static const size_t kGsoMaxBytes = 65000;
+static const size_t kGsoMaxSegments = 64;
+// The end marker is only a datagram, send it a few times
+static const size_t kEndRepeats = 3;
+static const std::chrono::microseconds kSendIdle(20);
+
+size_t fanoutNodeAntennas(Config* cfg)
+{
+    size_t nodes = cfg->fanout_nodes().size();
+    return (cfg->getTotNumAntennas() + nodes - 1) / nodes;
+}
+
+// "host:port" of a fanout_nodes entry
+static bool resolveNode(
+    const std::string& node, sockaddr_storage& addr, socklen_t& addr_len)
+{
+    size_t colon = node.rfind(':');
+    if (colon == std::string::npos)
+        return false;
+    addrinfo hints;
+    std::memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    addrinfo* result = nullptr;
+    if (getaddrinfo(node.substr(0, colon).c_str(),
+            node.substr(colon + 1).c_str(), &hints, &result)
+        != 0)
+        return false;
+    std::memcpy(&addr, result->ai_addr, result->ai_addrlen);
+    addr_len = result->ai_addrlen;
+    freeaddrinfo(result);
+    return true;
+}
+
+static int openSocket(const std::string& node, bool send)
+{
+    sockaddr_storage addr;
+    socklen_t addr_len;
+    if (resolveNode(node, addr, addr_len) == false) {
+        MLPD_ERROR("Fan-out: can not resolve node %s\n", node.c_str());
+        throw std::runtime_error("Fan-out node address is invalid");
+    }
+    // the sender is connected to its node, the node binds to its entry
+    int fd = socket(addr.ss_family, SOCK_DGRAM, 0);
+    int ret = -1;
+    if ((fd >= 0) && (send == true))
+        ret = connect(fd, reinterpret_cast<sockaddr*>(&addr), addr_len);
+    else if (fd >= 0)
+        ret = bind(fd, reinterpret_cast<sockaddr*>(&addr), addr_len);
+    if (ret != 0) {
+        MLPD_ERROR("Fan-out: socket to %s failed: %s\n", node.c_str(),
+            std::strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        throw std::runtime_error("Fan-out socket setup failed");
+    }
+
+    int option = send ? SO_SNDBUF : SO_RCVBUF;
+    int size = kFanoutSocketBuffer;
+    setsockopt(fd, SOL_SOCKET, option, &size, sizeof(size));
+    socklen_t size_len = sizeof(size);
+    getsockopt(fd, SOL_SOCKET, option, &size, &size_len);
+    if (size < kFanoutSocketBuffer) {
+        MLPD_WARN("Fan-out: %s socket buffer is %d bytes, raise "
+                  "net.core.%cmem_max to avoid drops\n",
+            node.c_str(), size, send ? 'w' : 'r');
+    }
+    return fd;
+}
+
+// Buffer of the slot an event refers to, offset within that buffer
+static inline SampleBuffer& eventBuffer(
+    const RecorderThread::RecordEventData& event, size_t& buffer_offset)
+{
+    size_t offset = event.data;
+    size_t buffer_id = (offset / event.rx_buff_size);
+    buffer_offset = offset - (buffer_id * event.rx_buff_size);
+    return event.rx_buffer[buffer_id];
+}
+
+FanoutSender::FanoutSender(
+    Config* in_cfg, size_t node_id, int core, size_t queue_size)
+    : event_queue_(queue_size)
+    , producer_token_(event_queue_)
+    , cfg_(in_cfg)
+    , id_(node_id)
+    , core_alloc_(core)
+    , package_data_length_(in_cfg->getPackageDataLength())
+    , socket_(openSocket(in_cfg->fanout_nodes().at(node_id), true))
+    , gso_(in_cfg->fanout_gso())
+    , sent_(0)
+    , send_errors_(0)
+{
+    size_t datagram = sizeof(FanoutHeader) + this->package_data_length_;
+    if ((this->gso_ == true) && ((2 * datagram) > kGsoMaxBytes)) {
+        MLPD_WARN("Fan-out: %zu byte packages are too large for GSO, "
+                  "using sendmmsg\n",
+            datagram);
+        this->gso_ = false;
+    }
+    this->batch_events_.reserve(in_cfg->fanout_batch());
+    this->batch_headers_.reserve(in_cfg->fanout_batch());
+    this->batch_samples_.reserve(in_cfg->fanout_batch());
+}
+
+FanoutSender::~FanoutSender()
+{
+    if (this->thread_.joinable() == true) {
+        this->Stop();
+        this->thread_.join();
+    }
+    close(this->socket_);
+    MLPD_INFO("Fan-out node %zu: %zu packages sent, %zu send errors\n",
+        this->id_, this->sent_, this->send_errors_);
+}
+
+void FanoutSender::Start(void)
+{
+    MLPD_INFO("Launching fan-out thread to node %zu (%s) on core %d\n",
+        this->id_, this->cfg_->fanout_nodes().at(this->id_).c_str(),
+        this->core_alloc_);
+    this->thread_ = std::thread(&FanoutSender::DoSending, this);
+}
+
+void FanoutSender::Stop(void)
+{
+    RecorderThread::RecordEventData event;
+    event.event_type = RecorderThread::kThreadTermination;
+    this->DispatchWork(event);
+}
+
+bool FanoutSender::DispatchWork(RecorderThread::RecordEventData event)
+{
+    moodycamel::ProducerToken& token = this->producer_token_;
+    if (this->event_queue_.try_enqueue(token, event) == 0) {
+        MLPD_WARN("Queue limit has reached! try to increase queue size.\n");
+        if (this->event_queue_.enqueue(token, event) == 0) {
+            MLPD_ERROR("Fan-out task enqueue failed\n");
+            throw std::runtime_error("Fan-out task enqueue failed");
+        }
+    }
+    return true;
+}
+
+void FanoutSender::DoSending(void)
+{
+    if ((this->core_alloc_ >= 0) && (pin_to_core(this->core_alloc_) != 0)) {
+        MLPD_ERROR("Pin fan-out thread %zu to core %d failed\n", this->id_,
+            this->core_alloc_);
+        throw std::runtime_error("Pin fan-out thread to core failed");
+    }
+
+    moodycamel::ConsumerToken ctok(this->event_queue_);
+    RecorderThread::RecordEventData events[kDequeueBulkSize];
+    bool running = true;
+    while (running == true) {
+        size_t count = this->event_queue_.try_dequeue_bulk(
+            ctok, events, kDequeueBulkSize);
+        if (count == 0) {
+            std::this_thread::sleep_for(kSendIdle);
+            continue;
+        }
+
+        for (size_t i = 0; i < count; i++) {
+            if (events[i].event_type == RecorderThread::kThreadTermination) {
+                running = false;
+                continue;
+            }
+            size_t buffer_offset;
+            SampleBuffer& rx_buffer = eventBuffer(events[i], buffer_offset);
+            if (rx_buffer.claimSlot(buffer_offset, events[i].gen) == false)
+                continue;
+            const Package* pkg = reinterpret_cast<const Package*>(
+                rx_buffer.slot(buffer_offset));
+
+            // A batch never spans frames, the node sees them in order
+            if ((this->batch_events_.empty() == false)
+                && ((this->batch_headers_.back().frame_id != pkg->frame_id)
+                    || (this->batch_events_.size()
+                        == this->cfg_->fanout_batch())))
+                this->Flush();
+            this->batch_events_.push_back(events[i]);
+            this->batch_headers_.push_back({ kFanoutMagic, pkg->frame_id,
+                pkg->symbol_id, pkg->cell_id, pkg->ant_id,
+                static_cast<uint32_t>(this->package_data_length_),
+                pkg->hw_time });
+            this->batch_samples_.push_back(pkg->samples());
+        }
+        // Nothing waits for more packages of the frame
+        this->Flush();
+    }
+    this->SendEnd();
+}
+
+void FanoutSender::Flush(void)
+{
+    size_t count = this->batch_events_.size();
+    size_t sent = 0;
+    while ((this->gso_ == true) && (sent < count)) {
+        size_t gso_sent = this->SendGso(sent, count - sent);
+        if (gso_sent == 0)
+            break;
+        sent += gso_sent;
+    }
+
+    std::vector<iovec> iov(2 * count);
+    std::vector<mmsghdr> msgs(count);
+    std::memset(msgs.data(), 0, count * sizeof(mmsghdr));
+    for (size_t i = sent; i < count; i++) {
+        iov[2 * i] = { &this->batch_headers_[i], sizeof(FanoutHeader) };
+        iov[2 * i + 1] = { const_cast<short*>(this->batch_samples_[i]),
+            this->package_data_length_ };
+        msgs[i].msg_hdr.msg_iov = &iov[2 * i];
+        msgs[i].msg_hdr.msg_iovlen = 2;
+    }
+    while (sent < count) {
+        int ret = sendmmsg(this->socket_, &msgs[sent], count - sent, 0);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            // ECONNREFUSED while the node is not listening yet
+            MLPD_WARN("Fan-out node %zu: send failed: %s\n", this->id_,
+                std::strerror(errno));
+            this->send_errors_ += count - sent;
+            break;
+        }
+        sent += ret;
+        this->sent_ += ret;
+    }
+
+    for (const auto& event : this->batch_events_) {
+        size_t buffer_offset;
+        SampleBuffer& rx_buffer = eventBuffer(event, buffer_offset);
+        rx_buffer.releaseSlot(buffer_offset, event.gen);
+    }
+    this->batch_events_.clear();
+    this->batch_headers_.clear();
+    this->batch_samples_.clear();
+}
+
+// One send the kernel splits into equal datagrams, returns the packages
+// sent or 0 to fall back to sendmmsg
+size_t FanoutSender::SendGso(size_t first, size_t count)
+{
+    size_t datagram = sizeof(FanoutHeader) + this->package_data_length_;
+    count = std::min(count, std::min(kGsoMaxSegments, kGsoMaxBytes / datagram));
+    if (count < 2)
+        return 0;
+
+    std::vector<iovec> iov(2 * count);
+    for (size_t i = 0; i < count; i++) {
+        iov[2 * i] = { &this->batch_headers_[first + i], sizeof(FanoutHeader) };
+        iov[2 * i + 1] = { const_cast<short*>(this->batch_samples_[first + i]),
+            this->package_data_length_ };
+    }
+    char control[CMSG_SPACE(sizeof(uint16_t))];
+    std::memset(control, 0, sizeof(control));
+    msghdr msg;
+    std::memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov.data();
+    msg.msg_iovlen = iov.size();
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = IPPROTO_UDP;
+    cmsg->cmsg_type = UDP_SEGMENT;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+    uint16_t segment = datagram;
+    std::memcpy(CMSG_DATA(cmsg), &segment, sizeof(segment));
+
+    ssize_t ret;
+    do {
+        ret = sendmsg(this->socket_, &msg, 0);
+    } while ((ret < 0) && (errno == EINTR));
+    if (ret < 0) {
+        if ((errno == EIO) || (errno == EINVAL) || (errno == ENOPROTOOPT)) {
+            MLPD_WARN("Fan-out node %zu: no GSO (%s), using sendmmsg\n",
+                this->id_, std::strerror(errno));
+            this->gso_ = false;
+        }
+        return 0;
+    }
+    this->sent_ += count;
+    return count;
+}
+
+void FanoutSender::SendEnd(void)
+{
+    FanoutHeader end = { kFanoutMagic, kFanoutEndFrame, 0, 0, 0, 0, 0 };
+    for (size_t i = 0; i < kEndRepeats; i++)
+        send(this->socket_, &end, sizeof(end), 0);
+}
+
+FanoutReceiver::FanoutReceiver(Config* in_cfg, int core, RxStats* stats)
+    : cfg_(in_cfg)
+    , core_alloc_(core)
+    , stats_(stats)
+    , package_data_length_(in_cfg->getPackageDataLength())
+    , socket_(openSocket(
+          in_cfg->fanout_nodes().at(in_cfg->fanout_node()), false))
+    , antenna_offset_(0)
+    , num_antennas_(0)
+    , antennas_per_recorder_(1)
+    , running_(false)
+    , bad_datagrams_(0)
+{
+    // wake up now and then to see if the capture was stopped
+    timeval timeout = { 0, 100000 };
+    setsockopt(this->socket_, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+        sizeof(timeout));
+
+    size_t slots = in_cfg->sample_buffer_frames()
+        * in_cfg->symbols_per_frame() * fanoutNodeAntennas(in_cfg);
+    this->buffer_.init(slots, sizeof(Package) + this->package_data_length_,
+        backpressurePolicyFromString(in_cfg->rx_backpressure()),
+        in_cfg->sample_buffer_huge_pages());
+    this->scratch_.resize(in_cfg->fanout_batch() * this->package_data_length_);
+}
+
+FanoutReceiver::~FanoutReceiver()
+{
+    this->Stop();
+    close(this->socket_);
+}
+
+void FanoutReceiver::Start(const std::vector<RecorderThread*>& recorders,
+    size_t antenna_offset, size_t antennas_per_recorder)
+{
+    this->recorders_ = recorders;
+    this->antenna_offset_ = antenna_offset;
+    this->num_antennas_ = std::min(fanoutNodeAntennas(this->cfg_),
+        this->cfg_->getTotNumAntennas() - antenna_offset);
+    this->antennas_per_recorder_ = antennas_per_recorder;
+    this->running_ = true;
+    this->thread_ = std::thread(&FanoutReceiver::DoReceiving, this);
+}
+
+void FanoutReceiver::Stop(void)
+{
+    this->running_ = false;
+    if (this->thread_.joinable() == true) {
+        this->thread_.join();
+        MLPD_INFO("Fan-out receiver: %zu bad datagrams, %zu packages "
+                  "dropped, %zu stale\n",
+            this->bad_datagrams_, this->stats_->drops.load(),
+            this->buffer_.stale());
+    }
+}
+
+void FanoutReceiver::DoReceiving(void)
+{
+    if ((this->core_alloc_ >= 0) && (pin_to_core(this->core_alloc_) != 0)) {
+        MLPD_ERROR("Pin fan-out receiver to core %d failed\n",
+            this->core_alloc_);
+        throw std::runtime_error("Pin fan-out receiver to core failed");
+    }
+    // first touch from the receiving thread
+    this->buffer_.prefault();
+    MLPD_INFO("Fan-out receiver: node %d antennas %zu:%zu\n",
+        this->cfg_->fanout_node(), this->antenna_offset_,
+        this->antenna_offset_ + this->num_antennas_ - 1);
+
+    std::vector<moodycamel::ProducerToken> tokens;
+    for (auto recorder : this->recorders_)
+        tokens.push_back(recorder->GetProducerToken());
+
+    const size_t batch = this->cfg_->fanout_batch();
+    std::vector<FanoutHeader> headers(batch);
+    std::vector<iovec> iov(2 * batch);
+    std::vector<mmsghdr> msgs(batch);
+    // Slots acquired but not used by the last call are used by the next
+    std::vector<int> slots;
+    std::vector<uint32_t> gens;
+    std::vector<int> unused_slots;
+    std::vector<uint32_t> unused_gens;
+
+    while (this->running_ == true) {
+        while (slots.size() < batch) {
+            uint32_t gen;
+            slots.push_back(this->buffer_.acquireSlot(gen));
+            gens.push_back(gen);
+        }
+        std::memset(msgs.data(), 0, batch * sizeof(mmsghdr));
+        for (size_t i = 0; i < batch; i++) {
+            char* samples = (slots[i] == SampleBuffer::kInvalidSlot)
+                ? &this->scratch_[i * this->package_data_length_]
+                : reinterpret_cast<char*>(
+                      reinterpret_cast<Package*>(this->buffer_.slot(slots[i]))
+                          ->data);
+            iov[2 * i] = { &headers[i], sizeof(FanoutHeader) };
+            iov[2 * i + 1] = { samples, this->package_data_length_ };
+            msgs[i].msg_hdr.msg_iov = &iov[2 * i];
+            msgs[i].msg_hdr.msg_iovlen = 2;
+        }
+
+        int count = recvmmsg(
+            this->socket_, msgs.data(), batch, MSG_WAITFORONE, nullptr);
+        if (count < 0) {
+            if ((errno != EAGAIN) && (errno != EWOULDBLOCK)
+                && (errno != EINTR)) {
+                MLPD_ERROR(
+                    "Fan-out receive failed: %s\n", std::strerror(errno));
+                this->cfg_->running(false);
+                break;
+            }
+            count = 0;
+        }
+        uint64_t rx_time_ns = telemetryNowNs();
+
+        unused_slots.clear();
+        unused_gens.clear();
+        for (size_t i = 0; i < batch; i++) {
+            const FanoutHeader& header = headers[i];
+            bool received = (static_cast<int>(i) < count)
+                && (msgs[i].msg_len >= sizeof(FanoutHeader))
+                && (header.magic == kFanoutMagic);
+            bool end = (received == true)
+                && (header.frame_id == kFanoutEndFrame);
+            if ((end == true) && (this->running_ == true)) {
+                MLPD_INFO("Fan-out receiver: end of capture\n");
+                this->running_ = false;
+                this->cfg_->running(false);
+            }
+            if ((received == true) && (end == false)
+                && ((msgs[i].msg_len
+                        != sizeof(FanoutHeader) + this->package_data_length_)
+                    || (header.samples_bytes != this->package_data_length_)
+                    || (header.cell_id >= this->cfg_->num_cells())
+                    || (header.symbol_id >= this->cfg_->symbols_per_frame())
+                    || (header.ant_id < this->antenna_offset_)
+                    || (header.ant_id
+                        >= this->antenna_offset_ + this->num_antennas_))) {
+                received = false;
+            }
+            if ((static_cast<int>(i) < count) && (received == false))
+                this->bad_datagrams_++;
+            if ((received == false) || (end == true)) {
+                if (slots[i] != SampleBuffer::kInvalidSlot) {
+                    unused_slots.push_back(slots[i]);
+                    unused_gens.push_back(gens[i]);
+                }
+                continue;
+            }
+            if (slots[i] == SampleBuffer::kInvalidSlot) {
+                telemetryAdd(this->stats_->drops);
+                continue;
+            }
+
+            Package* pkg = new (this->buffer_.slot(slots[i])) Package(
+                header.frame_id, header.symbol_id, header.cell_id,
+                header.ant_id);
+            pkg->rx_time_ns = rx_time_ns;
+            pkg->hw_time = header.hw_time;
+            this->buffer_.publishSlot(slots[i], gens[i]);
+            telemetryAdd(this->stats_->packets);
+
+            size_t recorder_id = (header.ant_id - this->antenna_offset_)
+                / this->antennas_per_recorder_;
+            RecorderThread::RecordEventData do_record_task;
+            do_record_task.event_type = RecorderThread::kTaskRecord;
+            do_record_task.data = slots[i];
+            do_record_task.gen = gens[i];
+            do_record_task.rx_buffer = &this->buffer_;
+            do_record_task.rx_buff_size = this->buffer_.num_slots();
+            this->recorders_.at(recorder_id)
+                ->DispatchWork(do_record_task, tokens.at(recorder_id));
+        }
+        slots.swap(unused_slots);
+        gens.swap(unused_gens);
+    }
+}
+}; /* End namespace Sounder */
@@ -0,0 +1,151 @@
+/*
+ Copyright (c) 2018-2020, Rice University
+ RENEW OPEN SOURCE LICENSE: http://renew-wireless.org/license
+
+----------------------------------------------------------------------
+ Per recorder bookkeeping of the symbols received in each frame
+---------------------------------------------------------------------
+*/
+
+#include "include/frame_tracker.h"
+#include "include/macros.h"
+#include <algorithm>
+#include <cstring>
+
+namespace Sounder {
+static inline bool expectedSymbol(char type)
+{
+    return (type == 'P') || (type == 'N') || (type == 'U');
+}
+
+// Radio time of the start of the frame of pkg. The Iris time packs the
+// frame and symbol ids above the sample count, a UHD symbol read returns
+// the time of that symbol and a UHD frame read the time of the frame.
+static inline int64_t frameStartTime(Config* cfg, const Package& pkg)
+{
+    if (kUseUHD == false)
+        return pkg.hw_time & ~int64_t(0xFFFFFFFF);
+    if (cfg->rx_uhd_frame_reads() == true)
+        return pkg.hw_time;
+    return pkg.hw_time - int64_t(pkg.symbol_id) * cfg->samps_per_symbol();
+}
+
+FrameTracker::FrameTracker(Config* cfg, size_t antenna_offset,
+    size_t num_antennas, size_t window)
+    : cfg_(cfg)
+    , antenna_offset_(antenna_offset)
+    , num_antennas_(num_antennas)
+    , symbols_(cfg->symbols_per_frame())
+    , bitmap_bytes_((symbols_ + 7) / 8)
+    , open_(std::max(window, size_t(1)))
+    , next_close_(0)
+    , frames_seen_(0)
+    , closed_first_(0)
+    , frames_complete_(0)
+    , frames_incomplete_(0)
+    , frames_skipped_(0)
+    , records_missing_(0)
+    , records_late_(0)
+{
+    for (OpenFrame& frame : this->open_) {
+        frame.frame_id = -1;
+        frame.bits.assign((this->symbols_ * num_antennas + 63) / 64, 0);
+    }
+}
+
+bool FrameTracker::add(const Package& pkg, bool recorded)
+{
+    size_t frame_id = pkg.frame_id;
+    if (frame_id < this->next_close_) {
+        this->records_late_++;
+        return false;
+    }
+    while (frame_id >= this->next_close_ + this->open_.size())
+        this->close(this->next_close_++);
+    this->frames_seen_ = std::max(this->frames_seen_, frame_id + 1);
+
+    OpenFrame& frame = this->open_[frame_id % this->open_.size()];
+    if (frame.frame_id != static_cast<int64_t>(frame_id)) {
+        frame.frame_id = frame_id;
+        frame.hw_time = frameStartTime(this->cfg_, pkg);
+        frame.received = 0;
+        frame.skipped = false;
+        std::fill(frame.bits.begin(), frame.bits.end(), 0);
+    }
+    if (recorded == false) {
+        frame.skipped = true;
+        return true;
+    }
+    if ((pkg.symbol_id >= this->symbols_)
+        || (pkg.ant_id - this->antenna_offset_ >= this->num_antennas_)
+        || (expectedSymbol(
+                this->cfg_->symbolInfo(frame_id, pkg.symbol_id).type)
+            == false))
+        return true;
+
+    size_t bit = pkg.symbol_id * this->num_antennas_
+        + (pkg.ant_id - this->antenna_offset_);
+    uint64_t mask = uint64_t(1) << (bit % 64);
+    if ((frame.bits[bit / 64] & mask) == 0) {
+        frame.bits[bit / 64] |= mask;
+        frame.received++;
+    }
+    return true;
+}
+
+void FrameTracker::finish(void)
+{
+    while (this->next_close_ < this->frames_seen_)
+        this->close(this->next_close_++);
+}
+
+void FrameTracker::clearClosed(void)
+{
+    this->closed_first_ = this->next_close_;
+    this->closed_.clear();
+}
+
+void FrameTracker::close(size_t frame_id)
+{
+    OpenFrame& frame = this->open_[frame_id % this->open_.size()];
+    bool seen = (frame.frame_id == static_cast<int64_t>(frame_id));
+
+    size_t row = this->closed_.size();
+    this->closed_.resize(row + this->row_bytes(), 0);
+    char* out = &this->closed_[row];
+    uint64_t id = frame_id;
+    int64_t hw_time = seen ? frame.hw_time : 0;
+    uint32_t received = seen ? frame.received : 0;
+    uint32_t expected = 0;
+    for (size_t s = 0; s < this->symbols_; s++) {
+        if (expectedSymbol(this->cfg_->symbolInfo(frame_id, s).type) == false)
+            continue;
+        expected += this->num_antennas_;
+        bool all = seen;
+        for (size_t a = 0; (all == true) && (a < this->num_antennas_); a++) {
+            size_t bit = s * this->num_antennas_ + a;
+            all = (frame.bits[bit / 64] >> (bit % 64)) & 1;
+        }
+        if (all == true)
+            out[kRowSymbols + s / 8] |= char(1 << (s % 8));
+    }
+    bool skipped = seen && frame.skipped;
+    uint8_t complete = skipped ? 2 : ((received == expected) ? 1 : 0);
+    std::memcpy(out + kRowFrame, &id, sizeof(id));
+    std::memcpy(out + kRowHwTime, &hw_time, sizeof(hw_time));
+    std::memcpy(out + kRowReceived, &received, sizeof(received));
+    std::memcpy(out + kRowExpected, &expected, sizeof(expected));
+    out[kRowComplete] = complete;
+
+    frame.frame_id = -1;
+    if (skipped == true) {
+        this->frames_skipped_++;
+        return;
+    }
+    if (complete == 1)
+        this->frames_complete_++;
+    else
+        this->frames_incomplete_++;
+    this->records_missing_ += expected - received;
+}
+}; /* End namespace Sounder */
@@ -1,3 +1,6 @@
+#ifndef BASE_RADIO_SET_H
+#define BASE_RADIO_SET_H
+
 #include "config.h"
 #include <SoapySDR/Device.hpp>
 #include <chrono>
@@ -7,50 +10,71 @@
 #include <cstdint>
 #include <cstdlib>
 #include <fstream>
+#include <functional>
 #include <iostream>
+#include <memory>
 #include <string>
+#include <vector>
 
+class CalibrationCache;
 class Radio;
 
 class BaseRadioSet {
 public:
     BaseRadioSet(Config* cfg);
-    ~BaseRadioSet(void);
+    virtual ~BaseRadioSet(void);
     void radioTx(const void* const* buffs);
     void radioRx(void* const* buffs);
-    int radioTx(size_t radio_id, size_t cell_id, const void* const* buffs,
-        int flags, long long& frameTime);
+    virtual int radioTx(size_t radio_id, size_t cell_id,
+        const void* const* buffs, int flags, long long& frameTime);
     int radioRx(size_t radio_id, size_t cell_id, void* const* buffs,
         long long& frameTime);
-    int radioRx(size_t radio_id, size_t cell_id, void* const* buffs,
+    virtual int radioRx(size_t radio_id, size_t cell_id, void* const* buffs,
         int numSamps, long long& frameTime);
-    void radioStart(void);
-    void radioStop(void);
+    // Zero-copy receive: buffs point into the driver buffer 'handle' until
+    // it is given back with radioRxRelease
+    virtual size_t radioRxDirectBuffers(size_t radio_id, size_t cell_id);
+    virtual int radioRxDirect(size_t radio_id, size_t cell_id, size_t& handle,
+        const void** buffs, long long& frameTime);
+    virtual void radioRxRelease(size_t radio_id, size_t cell_id, size_t handle);
+    virtual void radioStart(void);
+    virtual void radioStop(void);
     bool getRadioNotFound() { return radioNotFound; }
 
-private:
-    // use for create pthread
-    struct BaseRadioContext {
-        BaseRadioSet* brs;
-        std::atomic_ulong* thread_count;
-        size_t tid;
-        size_t cell;
+protected:
+    // For radio sets with no hardware behind them, opens no radio
+    struct NoRadios {
     };
-    void init(BaseRadioContext* context);
-    void configure(BaseRadioContext* context);
+    BaseRadioSet(Config* cfg, NoRadios);
 
-    static void* init_launch(void* in_context);
-    static void* configure_launch(void* in_context);
+private:
+    // Runs task(0) .. task(count - 1) on at most init_threads() workers
+    // and returns once all of them finished. The first exception thrown
+    // by a task is rethrown here.
+    void runParallel(size_t count, const std::function<void(size_t)>& task);
+    void init(size_t cell, size_t tid);
+    void configure(size_t cell, size_t tid);
 
     void radioTrigger(void);
     void sync_delays(size_t cellIdx);
     SoapySDR::Device* baseRadio(size_t cellId);
-    void collectCSI(bool&);
-    void dciqCalibrationProc(size_t);
+    // Returns true if every radio already lines up with the reference
+    bool collectCSI(bool&);
+    // Applies the cached trigger delays, true if they were all found and,
+    // with calibration_cache_validate, still line the radios up
+    bool loadTriggerDelays(void);
+    void storeTriggerDelays(void);
+    void dciqCalibrationProc(size_t cell, size_t channel);
     void readSensors(void);
 
     Config* _cfg;
     std::vector<SoapySDR::Device*> hubs;
     std::vector<std::vector<Radio*>> bsRadios; // [cell, iris]
     bool radioNotFound;
+    // Calibration results of earlier runs, null without calibration_cache
+    std::unique_ptr<CalibrationCache> calCache;
+    // ADJUST_DELAYS steps applied to each radio of cell 0 since SYNC_DELAYS
+    std::vector<int> triggerDelays;
 };
+
+#endif
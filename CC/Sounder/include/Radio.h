@@ -13,6 +13,7 @@ private:
     SoapySDR::Device* dev;
     SoapySDR::Stream* rxs;
     SoapySDR::Stream* txs;
+    size_t num_direct_rx_buffs;
     void reset_DATA_clk_domain(void);
     void dev_init(Config* _cfg, int ch, double rxgain, double txgain);
     friend class ClientRadioSet;
@@ -23,6 +24,10 @@ public:
         const std::vector<size_t>& channels, double rate);
     ~Radio(void);
     int recv(void* const* buffs, int samples, long long& frameTime);
+    // Direct access to the driver rx buffers, 0 if unsupported
+    size_t numDirectRecvBuffers(void) const { return num_direct_rx_buffs; }
+    int acquireRecv(size_t& handle, const void** buffs, long long& frameTime);
+    void releaseRecv(size_t handle);
     int activateRecv(
         const long long rxTime = 0, const size_t numSamps = 0, int flags = 0);
     void deactivateRecv(void);
@@ -0,0 +1,76 @@
+/*
+ Copyright (c) 2018-2020, Rice University
+ RENEW OPEN SOURCE LICENSE: http://renew-wireless.org/license
+
+---------------------------------------------------------------------
+ Base station radio set without hardware, generates symbols or replays
+ the pilots of a recorded trace at a configurable rate
+---------------------------------------------------------------------
+*/
+
+#ifndef SYNTHETIC_RADIO_SET_H
+#define SYNTHETIC_RADIO_SET_H
+
+#include "BaseRadioSet.h"
+#include <atomic>
+#include <chrono>
+#include <complex>
+#include <vector>
+
+class SyntheticRadioSet : public BaseRadioSet {
+public:
+    SyntheticRadioSet(Config* cfg);
+    ~SyntheticRadioSet(void);
+
+    int radioTx(size_t radio_id, size_t cell_id, const void* const* buffs,
+        int flags, long long& frameTime) override;
+    int radioRx(size_t radio_id, size_t cell_id, void* const* buffs,
+        int numSamps, long long& frameTime) override;
+    size_t radioRxDirectBuffers(size_t radio_id, size_t cell_id) override;
+    int radioRxDirect(size_t radio_id, size_t cell_id, size_t& handle,
+        const void** buffs, long long& frameTime) override;
+    void radioRxRelease(
+        size_t radio_id, size_t cell_id, size_t handle) override;
+    void radioStart(void) override;
+    void radioStop(void) override;
+
+private:
+    // noise symbols generated up front, picked round robin
+    static const size_t kNoiseSymbols;
+    // frames of the replay trace held in memory
+    static const size_t kReplayMaxFrames;
+
+    // Symbol position of one radio, written only by the rx thread owning it
+    struct alignas(64) RadioState {
+        size_t frame_id;
+        size_t symbol_idx; // index into rx_symbols_ of the frame
+    };
+
+    void loadReplay(const std::string& filename);
+    const short* symbolSamples(
+        size_t frame_id, size_t symbol_id, size_t ant_id) const;
+
+    Config* cfg_;
+    size_t num_channels_;
+    // symbols the base station receives in each frame of the schedule
+    std::vector<std::vector<size_t>> rx_symbols_;
+    std::vector<std::vector<RadioState>> radio_state_; // [cell, radio]
+    std::vector<size_t> radio_ant_offset_; // first global antenna per cell
+
+    std::vector<std::complex<int16_t>> pilot_;
+    std::vector<short> noise_;
+
+    // /Data/Pilot_Samples of the replay trace, [frame, pilot, antenna, IQ]
+    std::vector<short> replay_;
+    size_t replay_frames_;
+    size_t replay_pilots_;
+    size_t replay_antennas_;
+
+    // 0 to deliver symbols as fast as they are read
+    std::chrono::nanoseconds symbol_period_;
+    std::chrono::steady_clock::time_point start_time_;
+    // set by radioStart, stands in for the hardware trigger
+    std::atomic<bool> started_;
+};
+
+#endif
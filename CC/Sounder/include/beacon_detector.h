@@ -0,0 +1,53 @@
+/*
+ Copyright (c) 2018-2020, Rice University
+ RENEW OPEN SOURCE LICENSE: http://renew-wireless.org/license
+
+----------------------------------------------------------------------
+ Streaming beacon detector, correlates samples with the gold sequence
+ as they are read and fires on the first peak of the two repetitions
+---------------------------------------------------------------------
+*/
+#ifndef SOUDER_BEACON_DETECTOR_H_
+#define SOUDER_BEACON_DETECTOR_H_
+
+#include "comms-lib.h"
+#include <complex>
+#include <cstddef>
+#include <vector>
+
+/*
+ * Same detection as CommsLib::find_beacon_avx: a peak is a sample where
+ * |c[i] * conj(c[i - L])|^2 exceeds the sum of |c|^2 over the previous L
+ * correlation values, with c the correlation with the length L sequence.
+ * The last L - 1 samples and L correlation values are kept between calls,
+ * so a beacon split across two reads is still found. No allocation after
+ * construction. The correlation and the peak search are fused, see
+ * CommsLib::beacon_search_fused.
+ */
+class BeaconDetector {
+public:
+    BeaconDetector(const std::vector<std::complex<float>>& seq,
+        size_t max_chunk_size);
+
+    // Forget all samples seen so far
+    void reset(void);
+
+    // Feeds 'count' samples (at most max_chunk_size) and returns the index
+    // in 'samples' of the first peak, or -1. On a peak only the samples up
+    // to and including it are consumed.
+    int process(const std::complex<float>* samples, size_t count);
+
+    // Samples consumed since construction or the last reset
+    inline size_t position(void) const { return this->position_; }
+
+private:
+    std::vector<std::complex<float>> seq_;
+    size_t max_chunk_size_;
+
+    // last seq_len - 1 samples followed by the chunk being processed
+    std::vector<std::complex<float>> window_;
+    CommsLib::BeaconSearchState state_;
+    size_t position_;
+};
+
+#endif /* SOUDER_BEACON_DETECTOR_H_ */
@@ -0,0 +1,66 @@
+/*
+ Copyright (c) 2018-2020, Rice University
+ RENEW OPEN SOURCE LICENSE: http://renew-wireless.org/license
+
+----------------------------------------------------------------------
+ On-disk store of the DC offset / IQ imbalance corrections and trigger
+ delay adjustments of the base station boards, so warm restarts with
+ unchanged radio settings can skip calibration
+---------------------------------------------------------------------
+*/
+#ifndef SOUDER_CALIBRATION_CACHE_H_
+#define SOUDER_CALIBRATION_CACHE_H_
+
+#include "config.h"
+#include "nlohmann/json.hpp"
+#include <complex>
+#include <mutex>
+#include <string>
+
+/*
+ * One JSON object per board serial. Each entry records the frequency,
+ * rate and gains it was measured with, and is dropped as soon as a
+ * board is stored again under different settings. Lookups only return
+ * entries measured with the settings of the current run.
+ */
+class CalibrationCache {
+public:
+    // DC offset and IQ imbalance correction of one rx or tx path, gcorr
+    // and iqcorr in the units of the LMS7 registers
+    struct DciqCorrection {
+        std::complex<double> dc;
+        int gcorr;
+        int iqcorr;
+    };
+
+    // A missing or unreadable file starts an empty cache
+    CalibrationCache(const std::string& filename, Config* cfg);
+
+    bool findDciq(const std::string& serial, int direction, size_t channel,
+        DciqCorrection& corr);
+    void storeDciq(const std::string& serial, int direction, size_t channel,
+        const DciqCorrection& corr);
+
+    // Delay adjustment of a board relative to the reference board, in
+    // ADJUST_DELAYS steps after SYNC_DELAYS
+    bool findTriggerDelay(
+        const std::string& serial, const std::string& reference, int& delay);
+    void storeTriggerDelay(
+        const std::string& serial, const std::string& reference, int delay);
+
+    // Written to a temporary file first and renamed over the old one
+    void save(void);
+
+private:
+    // entry of serial if it was measured with the current settings
+    const nlohmann::json* find(const std::string& serial) const;
+    nlohmann::json& entry(const std::string& serial);
+
+    std::string filename_;
+    nlohmann::json settings_;
+    nlohmann::json store_;
+    // radios of a cell are calibrated and stored concurrently
+    std::mutex mutex_;
+};
+
+#endif /* SOUDER_CALIBRATION_CACHE_H_ */
@@ -0,0 +1,77 @@
+/*
+ Copyright (c) 2018-2020, Rice University
+ RENEW OPEN SOURCE LICENSE: http://renew-wireless.org/license
+
+----------------------------------------------------------------------
+ Compression of whole hdf5 chunks outside of the hdf5 library, for
+ chunks written with H5Dwrite_chunk
+---------------------------------------------------------------------
+*/
+#ifndef SOUDER_CHUNK_CODEC_H_
+#define SOUDER_CHUNK_CODEC_H_
+
+#include "H5Cpp.h"
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace Sounder {
+/*
+ * Byte shuffle followed by LZ4 or zstd, the same pipeline as the hdf5
+ * shuffle filter followed by the LZ4 (32004) or zstd (32015) filter
+ * plugin, so h5py reads the files with hdf5plugin. The codec is also
+ * registered with the library, which needs it to read back chunks that
+ * are updated through the regular write path.
+ */
+class ChunkCodec {
+public:
+    enum Type { kNone, kLz4, kZstd };
+
+    // "none", "lz4" or "zstd"
+    ChunkCodec(const std::string& name, int level);
+
+    inline bool enabled(void) const { return this->type_ != kNone; }
+
+    // Shuffle and codec filters of a dataset holding compressed chunks
+    void setFilters(H5::DSetCreatPropList& prop) const;
+
+    // Stored form of a chunk of element_size byte values. swap reverses
+    // the bytes of every value, for datasets of the other byte order.
+    void encode(const char* in, size_t bytes, size_t element_size, bool swap,
+        std::vector<char>& scratch, std::vector<char>& out) const;
+
+private:
+    Type type_;
+    int level_;
+};
+
+// Worker threads the recorder hands chunk encodes to
+class ChunkPool {
+public:
+    // Each thread keeps one scratch buffer it passes to its tasks
+    typedef std::function<void(std::vector<char>& scratch)> Task;
+
+    explicit ChunkPool(size_t num_threads);
+    ~ChunkPool();
+
+    void submit(Task task);
+    // Blocks until ready() is true, it is checked after every task
+    void waitFor(const std::function<bool(void)>& ready);
+
+private:
+    void loop(void);
+
+    std::vector<std::thread> threads_;
+    std::deque<Task> tasks_;
+    std::mutex mutex_;
+    std::condition_variable task_cond_;
+    std::condition_variable done_cond_;
+    bool running_;
+};
+}; /* End namespace Sounder */
+
+#endif /* SOUDER_CHUNK_CODEC_H_ */
@@ -0,0 +1,88 @@
+/*
+ Copyright (c) 2018-2020, Rice University
+ RENEW OPEN SOURCE LICENSE: http://renew-wireless.org/license
+
+----------------------------------------------------------------------
+ Element kernels behind the CommsLib SIMD helpers. There is one table
+ per instruction set, each in its own translation unit built with the
+ matching compiler flags, and the best one the cpu supports is picked
+ once at startup. The rest of the tree is built for the baseline
+ architecture, so one binary runs on every host.
+---------------------------------------------------------------------
+*/
+#ifndef SOUDER_COMMS_LIB_KERNELS_H_
+#define SOUDER_COMMS_LIB_KERNELS_H_
+
+#include <complex>
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * Kernels work on raw pointers only. The files built with wider
+ * instruction sets must not instantiate inline templates, the linker
+ * could otherwise keep their copy for the whole binary.
+ */
+struct CommsKernels {
+    const char* name;
+
+    // out[i] = sum_j in[i + j] * conj(seq[j]) for i < out_len, reads
+    // out_len + seq_len - 1 input samples
+    void (*correlate_cf32)(const std::complex<float>* in, size_t out_len,
+        const std::complex<float>* seq, size_t seq_len,
+        std::complex<float>* out);
+    // out[i] = sum_j in[i + j] * seq[j] for i < out_len
+    void (*correlate_f32)(const float* in, size_t out_len, const float* seq,
+        size_t seq_len, float* out);
+    // out[i] = f[i] * (conj ? conj(g[i]) : g[i])
+    void (*complex_mult_cf32)(const std::complex<float>* f,
+        const std::complex<float>* g, size_t len, bool conj,
+        std::complex<float>* out);
+    // Q15 product, same rounding as the AVX2 madd path
+    void (*complex_mult_ci16)(const std::complex<int16_t>* f,
+        const std::complex<int16_t>* g, size_t len, bool conj,
+        std::complex<int16_t>* out);
+    // out_re[i] = sum_j sign[i + j] * taps_re[j], out_im the same with
+    // taps_im, in one pass over a real (sign) sequence
+    void (*correlate_sign)(const float* sign, size_t out_len,
+        const float* taps_re, const float* taps_im, size_t taps_len,
+        float* out_re, float* out_im);
+    void (*abs2_cf32)(const std::complex<float>* f, size_t len, float* out);
+    void (*abs2_ci16)(
+        const std::complex<int16_t>* f, size_t len, int32_t* out);
+
+    // Sample format conversions, out may be the same buffer as in for
+    // ci16_swap. 'swap' exchanges the two int16 halves of each sample.
+    // out[i] = scale * in[i]
+    void (*ci16_to_cf32)(const std::complex<int16_t>* in, size_t len,
+        bool swap, float scale, std::complex<float>* out);
+    // out[i] = scale * (re[i], im[i]), truncated toward zero like a cast
+    // and saturated to the int16 range
+    void (*f32_to_ci16)(const float* re, const float* im, size_t len,
+        float scale, std::complex<int16_t>* out);
+    // out[i] = conj ? conj(in[i]) : in[i], then swapped
+    void (*ci16_swap)(const std::complex<int16_t>* in, size_t len, bool conj,
+        bool swap, std::complex<int16_t>* out);
+
+    // correlate_cf32 for exactly beacon_block outputs, used by the fused
+    // beacon search; beacon_block is at most kCommsMaxBeaconBlock
+    void (*beacon_block_cf32)(const std::complex<float>* in,
+        const std::complex<float>* seq, size_t seq_len,
+        std::complex<float>* out);
+    size_t beacon_block;
+};
+
+static constexpr size_t kCommsMaxBeaconBlock = 16;
+
+extern const CommsKernels kCommsKernelsScalar;
+#if defined(__x86_64__)
+extern const CommsKernels kCommsKernelsAvx2;
+extern const CommsKernels kCommsKernelsAvx512;
+#endif
+#if defined(__aarch64__)
+extern const CommsKernels kCommsKernelsNeon;
+#endif
+
+// Table for this cpu, selected on the first call
+const CommsKernels& commsKernels(void);
+
+#endif /* SOUDER_COMMS_LIB_KERNELS_H_ */
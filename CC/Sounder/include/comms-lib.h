@@ -12,6 +12,9 @@
 ---------------------------------------------------------------------
 */
 
+#ifndef COMMSLIB_HEADER
+#define COMMSLIB_HEADER
+
 #include "fft.h"
 #include <algorithm>
 #include <complex.h>
@@ -28,6 +31,8 @@
 
 static constexpr size_t kPilotSubcarrierSpacing = 12;
 static constexpr size_t kDefaultPilotScOffset = 6;
+// Sequences at least this long are correlated through FFTs
+static constexpr size_t kFftCorrelationMinTaps = 128;
 
 static inline double computeAbs(std::complex<double> x) { return std::abs(x); }
 
@@ -59,6 +64,10 @@ public:
     static std::vector<std::vector<float>> getSequence(
         size_t type, size_t seq_len = 0);
     static std::vector<std::complex<float>> modulate(std::vector<uint8_t>, int);
+    // Writes len symbols to out, stops at the first value outside the
+    // constellation like the vector version
+    static void modulate(
+        const uint8_t* in, size_t len, int type, std::complex<float>* out);
     static std::vector<size_t> getDataSc(size_t fftSize, size_t DataScNum,
         size_t PilotScOffset = kDefaultPilotScOffset);
     static std::vector<size_t> getNullSc(size_t fftSize, size_t DataScNum);
@@ -71,10 +80,36 @@ public:
     static std::vector<std::complex<float>> IFFT(
         const std::vector<std::complex<float>>&, int, float scale = 0.5,
         bool normalize = true);
+    // Allocation free variants on 'batch' contiguous symbols of fftSize,
+    // using this thread's cached plan. in and out may be the same buffer.
+    static void FFT(const std::complex<float>* in, std::complex<float>* out,
+        size_t fftSize, size_t batch = 1);
+    static void IFFT(const std::complex<float>* in, std::complex<float>* out,
+        size_t fftSize, float scale = 0.5, bool normalize = true,
+        size_t batch = 1);
+
+    // Work buffers of the sign correlation searches, grown on first use
+    // and reused by later calls so repeated searches do not allocate
+    struct SignCorrelation {
+        std::vector<float> sign;
+        std::vector<float> taps_re;
+        std::vector<float> taps_im;
+        std::vector<float> corr_re;
+        std::vector<float> corr_im;
+        std::vector<std::complex<float>> samples;
+        std::vector<std::complex<float>> corr;
+        // |correlation|^2 of the last search, len + seq_len - 1 values
+        std::vector<float> power;
+    };
 
     static int findLTS(const std::vector<std::complex<float>>& iq, int seqLen);
+    static int findLTS(const std::vector<std::complex<float>>& iq, int seqLen,
+        SignCorrelation& work);
     static size_t find_pilot_seq(const std::vector<std::complex<float>>& iq,
         const std::vector<std::complex<float>>& pilot, size_t seqLen);
+    static size_t find_pilot_seq(const std::vector<std::complex<float>>& iq,
+        const std::vector<std::complex<float>>& pilot, size_t seqLen,
+        SignCorrelation& work);
     template <typename T>
     //static std::vector<T> convolve(std::vector<T> const& f, std::vector<T> const& g);
     static std::vector<T> convolve(
@@ -97,9 +132,21 @@ public:
         }
         return out;
     }
+    // Same result as convolve() for complex floats, correlate_avx picks
+    // the direct or the FFT form by the length of g. An empty g gives an
+    // empty result.
+    static std::vector<std::complex<float>> convolve_fast(
+        std::vector<std::complex<float>> const& f,
+        std::vector<std::complex<float>> const& g);
+    // correlate_avx through overlap-save FFTs, for long sequences
+    static void correlate_fft(const std::complex<float>* in, size_t out_len,
+        const std::complex<float>* seq, size_t seq_len,
+        std::complex<float>* out);
     static float find_max_abs(const std::vector<std::complex<float>>& in);
     static std::vector<std::complex<float>> csign(
         const std::vector<std::complex<float>>& iq);
+    // csign() as real values, the imaginary parts are always zero
+    static void csign(const std::complex<float>* iq, size_t len, float* sign);
     static inline int hadamard2(int i, int j)
     {
         return (__builtin_parity(i & j) != 0 ? -1 : 1);
@@ -116,10 +163,36 @@ public:
         std::vector<float> const&, double, double, size_t,
         const size_t delta = 10);
 
-    // Functions using AVX
+    // Beacon search state carried between calls: the last seq_len
+    // correlation values, corr_ring[ring_pos] the oldest, and the sum of
+    // their |c|^2
+    struct BeaconSearchState {
+        std::vector<std::complex<float>> corr_ring;
+        size_t ring_pos;
+        double power_sum;
+    };
+    // Peak search over 'count' correlation values, stops after the first
+    // peak and returns its index or -1
+    static int beacon_scan(const std::complex<float>* corr, size_t count,
+        BeaconSearchState& state);
+
+    // Functions using SIMD, the kernel for the cpu is picked at startup
+    // (comms-lib-kernels.h). The _avx names are kept for the callers.
     static int find_beacon(const std::vector<std::complex<float>>& iq);
     static int find_beacon_avx(const std::vector<std::complex<float>>& iq,
         const std::vector<std::complex<float>>& seq);
+    // Same result as find_beacon_avx in a single pass, see
+    // beacon_search_fused
+    static int find_beacon_fused(const std::vector<std::complex<float>>& iq,
+        const std::vector<std::complex<float>>& seq);
+    // Correlation, delayed product, power and running threshold fused in
+    // one pass over in[0, count + seq_len - 1), a block of correlation
+    // values at a time.
+    // Returns the first peak in [0, count) or -1, 'state' is advanced up
+    // to and including the peak.
+    static int beacon_search_fused(const std::complex<float>* in,
+        size_t count, const std::complex<float>* seq, size_t seq_len,
+        BeaconSearchState& state);
     static std::vector<float> correlate_avx_s(
         std::vector<float> const& f, std::vector<float> const& g);
     static std::vector<int16_t> correlate_avx_si(
@@ -140,6 +213,18 @@ public:
     static std::vector<std::complex<int16_t>> correlate_avx(
         std::vector<std::complex<int16_t>> const& f,
         std::vector<std::complex<int16_t>> const& g);
+    // out[i] = sum_j in[i + j] * conj(seq[j]) for i < out_len, reads
+    // out_len + seq_len - 1 input samples. Direct form below
+    // kFftCorrelationMinTaps taps, overlap-save FFTs above.
+    static void correlate_avx(const std::complex<float>* in, size_t out_len,
+        const std::complex<float>* seq, size_t seq_len,
+        std::complex<float>* out);
+    // work.power[n] = |convolve(csign(iq), conj(reversed seq))[n]|^2 for
+    // n < len + seq_len - 1. The signs are real, so short sequences take
+    // two real correlations in one pass instead of a complex one.
+    static void correlate_sign_avx(const std::complex<float>* iq, size_t len,
+        const std::complex<float>* seq, size_t seq_len,
+        SignCorrelation& work);
     static std::vector<std::complex<float>> complex_mult_avx(
         std::vector<std::complex<float>> const& f,
         std::vector<std::complex<float>> const& g, const bool conj);
@@ -151,3 +236,5 @@ public:
     //    static inline float** init_qam16();
     //    static inline float** init_qam64();
 };
+
+#endif
@@ -11,8 +11,10 @@
 #ifndef CONFIG_HEADER
 #define CONFIG_HEADER
 
+#include "core_planner.h"
 #include <atomic>
 #include <complex.h>
+#include <cstdint>
 #include <vector>
 
 class Config {
@@ -26,6 +28,11 @@ public:
     inline size_t num_bs_sdrs_all(void) const { return this->num_bs_sdrs_all_; }
     inline size_t num_cl_sdrs(void) const { return this->num_cl_sdrs_; }
     inline size_t core_alloc(void) const { return this->core_alloc_; }
+    // Core thread index of role is pinned to, -1 without core_alloc
+    inline int thread_core(CorePlanner::Role role, size_t index) const
+    {
+        return this->core_alloc_ ? this->core_plan_.core(role, index) : -1;
+    }
     inline int subframe_size(void) const { return this->subframe_size_; }
     inline size_t samps_per_symbol(void) const
     {
@@ -57,11 +64,176 @@ public:
     inline int cl_agc_gain_init(void) const { return this->cl_agc_gain_init_; }
     inline bool imbalance_cal_en(void) const { return this->imbalance_cal_en_; }
     inline bool sample_cal_en(void) const { return this->sample_cal_en_; }
+    inline size_t init_threads(void) const { return this->init_threads_; }
+    inline const std::string& cal_cache_file(void) const
+    {
+        return this->cal_cache_file_;
+    }
+    inline bool cal_cache_validate(void) const
+    {
+        return this->cal_cache_validate_;
+    }
     inline size_t max_frame(void) const { return this->max_frame_; }
     inline size_t ul_data_frame_num(void) const
     {
         return this->ul_data_frame_num_;
     }
+    inline bool cl_tx_thread(void) const { return this->cl_tx_thread_; }
+    inline const std::string& ul_data_mode(void) const
+    {
+        return this->ul_data_mode_;
+    }
+    inline size_t record_batch_frames(void) const
+    {
+        return this->record_batch_frames_;
+    }
+    inline size_t record_chunk_frames(void) const
+    {
+        return this->record_chunk_frames_;
+    }
+    inline size_t record_chunk_size_kb(void) const
+    {
+        return this->record_chunk_size_kb_;
+    }
+    inline size_t record_chunk_cache_mb(void) const
+    {
+        return this->record_chunk_cache_mb_;
+    }
+    inline bool record_big_endian(void) const
+    {
+        return this->record_big_endian_;
+    }
+    inline const std::string& record_compression(void) const
+    {
+        return this->record_compression_;
+    }
+    inline int record_compression_level(void) const
+    {
+        return this->record_compression_level_;
+    }
+    inline size_t record_compress_threads(void) const
+    {
+        return this->record_compress_threads_;
+    }
+    inline size_t record_flush_ms(void) const
+    {
+        return this->record_flush_ms_;
+    }
+    inline bool record_csi(void) const { return this->record_csi_; }
+    inline bool record_csi_pilots(void) const
+    {
+        return this->record_csi_pilots_;
+    }
+    inline bool record_master_file(void) const
+    {
+        return this->record_master_file_;
+    }
+    inline bool record_frame_index(void) const
+    {
+        return this->record_frame_index_;
+    }
+    inline bool record_hdf5(void) const { return this->record_hdf5_; }
+    inline size_t live_ring_frames(void) const
+    {
+        return this->live_ring_frames_;
+    }
+    inline const std::string& live_ring_name(void) const
+    {
+        return this->live_ring_name_;
+    }
+    inline const std::string& rx_backpressure(void) const
+    {
+        return this->rx_backpressure_;
+    }
+    inline bool record_direct_routing(void) const
+    {
+        return this->record_direct_routing_;
+    }
+    inline const std::string& record_wait_mode(size_t thread_id) const
+    {
+        if (this->record_wait_modes_.size() == 1)
+            return this->record_wait_modes_.front();
+        return this->record_wait_modes_.at(thread_id);
+    }
+    inline size_t record_spin_count(void) const
+    {
+        return this->record_spin_count_;
+    }
+    inline const std::vector<std::string>& fanout_nodes(void) const
+    {
+        return this->fanout_nodes_;
+    }
+    // Index of this host in fanout_nodes, -1 on the radio host
+    inline int fanout_node(void) const { return this->fanout_node_; }
+    void fanout_node(int node);
+    inline size_t fanout_batch(void) const { return this->fanout_batch_; }
+    inline bool fanout_gso(void) const { return this->fanout_gso_; }
+    inline bool rx_direct_buffers(void) const
+    {
+        return this->rx_direct_buffers_;
+    }
+    inline const std::string& rx_balancing(void) const
+    {
+        return this->rx_balancing_;
+    }
+    inline bool rx_uhd_frame_reads(void) const
+    {
+        return this->rx_uhd_frame_reads_;
+    }
+    inline const std::string& record_policy(void) const
+    {
+        return this->record_policy_;
+    }
+    inline size_t record_decimation(void) const
+    {
+        return this->record_decimation_;
+    }
+    inline double record_trigger_db(void) const
+    {
+        return this->record_trigger_db_;
+    }
+    inline size_t record_trigger_pre(void) const
+    {
+        return this->record_trigger_pre_;
+    }
+    inline size_t record_trigger_post(void) const
+    {
+        return this->record_trigger_post_;
+    }
+    inline size_t sample_buffer_frames(void) const
+    {
+        return this->sample_buffer_frames_;
+    }
+    inline bool sample_buffer_huge_pages(void) const
+    {
+        return this->sample_buffer_huge_pages_;
+    }
+    inline size_t telemetry_interval_ms(void) const
+    {
+        return this->telemetry_interval_ms_;
+    }
+    inline const std::string& telemetry_file(void) const
+    {
+        return this->telemetry_file_;
+    }
+    inline const std::string& bs_radio_backend(void) const
+    {
+        return this->bs_radio_backend_;
+    }
+    inline void bs_radio_backend(const std::string& value)
+    {
+        this->bs_radio_backend_ = value;
+    }
+    inline const std::string& replay_file(void) const
+    {
+        return this->replay_file_;
+    }
+    inline void replay_file(const std::string& value)
+    {
+        this->replay_file_ = value;
+    }
+    inline double synthetic_rate(void) const { return this->synthetic_rate_; }
+    inline void synthetic_rate(double value) { this->synthetic_rate_ = value; }
     inline bool beam_sweep(void) const { return this->beam_sweep_; }
     inline size_t beacon_ant(void) const { return this->beacon_ant_; }
     inline size_t num_cl_antennas(void) const { return this->num_cl_antennas_; }
@@ -133,6 +305,10 @@ public:
     {
         return this->tx_data_;
     };
+    inline const std::vector<std::complex<int16_t>>& pilot_ci16(void) const
+    {
+        return this->pilot_ci16_;
+    }
     inline std::vector<std::complex<float>>& pilot_cf32(void)
     {
         return this->pilot_cf32_;
@@ -268,13 +444,60 @@ public:
     size_t getNumAntennas();
     size_t getMaxNumAntennas();
     size_t getTotNumAntennas();
-    int getClientId(int, int);
-    int getNoiseSFIndex(int, int);
-    int getUlSFIndex(int, int);
-    int getDlSFIndex(int, int);
-    bool isPilot(int, int);
-    bool isNoise(int, int);
-    bool isData(int, int);
+
+    // Type of one symbol of a frame pattern ('P', 'U', ... or 0 past its
+    // end) and its index among the symbols of each type, -1 otherwise
+    struct SymbolInfo {
+        char type;
+        int16_t pilot; // getClientId
+        int16_t noise; // getNoiseSFIndex
+        int16_t ul; // getUlSFIndex
+        int16_t dl; // getDlSFIndex
+    };
+    static constexpr SymbolInfo kNoSymbol = { 0, -1, -1, -1, -1 };
+
+    // Table lookup, built once from the BS frame schedule
+    inline const SymbolInfo& symbolInfo(int frame_id, int symbol_id) const
+    {
+        const size_t patterns = this->symbol_table_patterns_;
+        if ((patterns == 0) || (symbol_id < 0)
+            || (static_cast<size_t>(symbol_id) >= this->symbol_table_stride_))
+            return kNoSymbol;
+        size_t fid
+            = (patterns == 1) ? 0 : static_cast<size_t>(frame_id) % patterns;
+        return this->symbol_table_[fid * this->symbol_table_stride_
+            + symbol_id];
+    }
+    inline int getClientId(int frame_id, int symbol_id) const
+    {
+        if (this->reciprocal_calib_)
+            return symbol_id;
+        return this->symbolInfo(frame_id, symbol_id).pilot;
+    }
+    inline int getNoiseSFIndex(int frame_id, int symbol_id) const
+    {
+        return this->symbolInfo(frame_id, symbol_id).noise;
+    }
+    inline int getUlSFIndex(int frame_id, int symbol_id) const
+    {
+        return this->symbolInfo(frame_id, symbol_id).ul;
+    }
+    inline int getDlSFIndex(int frame_id, int symbol_id) const
+    {
+        return this->symbolInfo(frame_id, symbol_id).dl;
+    }
+    inline bool isPilot(int frame_id, int symbol_id) const
+    {
+        return this->symbolInfo(frame_id, symbol_id).type == 'P';
+    }
+    inline bool isNoise(int frame_id, int symbol_id) const
+    {
+        return this->symbolInfo(frame_id, symbol_id).type == 'N';
+    }
+    inline bool isData(int frame_id, int symbol_id) const
+    {
+        return this->symbolInfo(frame_id, symbol_id).type == 'U';
+    }
     unsigned getCoreCount();
     void loadULData(const std::string&);
 
@@ -332,18 +555,73 @@ private:
     bool hw_framer_;
     size_t max_frame_;
     size_t ul_data_frame_num_;
+    std::string ul_data_mode_;
+    bool cl_tx_thread_;
+    size_t record_batch_frames_; // frames staged per hdf5 write, 0 = per symbol
+    size_t record_chunk_frames_; // frames per hdf5 chunk, 0 = auto size
+    size_t record_chunk_size_kb_; // target chunk size for the auto layout
+    size_t record_chunk_cache_mb_; // raw data chunk cache, 0 = auto size
+    bool record_big_endian_; // store samples big endian instead of native
+    std::string record_compression_; // none, lz4 or zstd chunk compression
+    int record_compression_level_; // zstd level
+    size_t record_compress_threads_; // compression threads per recorder
+    size_t record_flush_ms_; // hdf5 file flush interval, 0 = only at close
+    bool record_csi_; // record pilot channel estimates in /Data/CSI
+    bool record_csi_pilots_; // with record_csi, keep the raw pilots as well
+    bool record_master_file_; // virtual dataset file over the shards
+    bool record_frame_index_; // per frame received symbols, /Data/FrameIndex
+    bool record_hdf5_; // write the hdf5 files, off for live ring only runs
+    size_t live_ring_frames_; // frames in the shared memory ring, 0 = off
+    std::string live_ring_name_; // shared memory segment of the live ring
+    std::string rx_backpressure_; // block, drop_oldest or drop_newest
+    bool record_direct_routing_; // rx threads feed the recorders directly
+    std::vector<std::string> record_wait_modes_; // adaptive or spin
+    size_t record_spin_count_; // polls before an adaptive recorder parks
+    std::vector<std::string> fanout_nodes_; // host:port of recorder nodes
+    int fanout_node_; // this host in fanout_nodes_, -1 = radio host
+    size_t fanout_batch_; // packages per fan-out send and receive call
+    bool fanout_gso_; // send batches as UDP GSO super datagrams
+    bool rx_direct_buffers_; // zero-copy receive when the driver allows
+    std::string rx_balancing_; // static or adaptive radio to rx thread map
+    bool rx_uhd_frame_reads_; // UHD receives a whole frame per read
+    size_t sample_buffer_frames_; // frames held by each rx thread buffer
+    std::string record_policy_; // all, decimate or trigger
+    size_t record_decimation_; // decimate keeps every n-th frame
+    // trigger threshold: pilot SNR over the noise symbols, without noise
+    // symbols in the schedule the pilot power in dBFS
+    double record_trigger_db_;
+    size_t record_trigger_pre_; // frames kept before a trigger
+    size_t record_trigger_post_; // frames kept after a trigger
+    bool sample_buffer_huge_pages_; // back rx buffers with 2MB pages
+    size_t telemetry_interval_ms_; // pipeline counter dump period, 0 = off
+    std::string telemetry_file_; // csv file the counters are appended to
+    std::string bs_radio_backend_; // hardware, synthetic or replay
+    std::string replay_file_; // trace whose pilots the replay backend sends
+    double synthetic_rate_; // speed versus real time, 0 = unpaced
     std::vector<std::vector<size_t>>
         pilot_symbols_; // Accessed through getClientId
     std::vector<std::vector<size_t>> noise_symbols_;
     std::vector<std::vector<size_t>>
         ul_symbols_; // Accessed through getUlSFIndex()
     std::vector<std::vector<size_t>> dl_symbols_; // No accessor
+    // frames_.size() rows of symbol_table_stride_ (longest pattern)
+    // entries, see symbolInfo()
+    std::vector<SymbolInfo> symbol_table_;
+    size_t symbol_table_stride_;
+    size_t symbol_table_patterns_;
+    void buildSymbolTable(void);
     bool single_gain_;
     std::vector<double> tx_gain_;
     std::vector<double> rx_gain_;
     std::vector<double> cal_tx_gain_;
     bool sample_cal_en_;
     bool imbalance_cal_en_;
+    // Radios brought up and calibrated at once, bring-up is I/O bound
+    size_t init_threads_;
+    // DC/IQ and trigger delay results reused across runs, empty disables
+    std::string cal_cache_file_;
+    // Check cached trigger delays with one measurement before using them
+    bool cal_cache_validate_;
     std::string trace_file_;
     std::vector<std::vector<std::string>> calib_frames_;
     bool reciprocal_calib_;
@@ -384,6 +662,7 @@ private:
 
     std::atomic<bool> running_;
     bool core_alloc_;
+    CorePlanner core_plan_;
     unsigned int rx_thread_num_;
     unsigned int task_thread_num_;
 };
@@ -0,0 +1,60 @@
+/*
+ Copyright (c) 2018-2020, Rice University
+ RENEW OPEN SOURCE LICENSE: http://renew-wireless.org/license
+
+----------------------------------------------------------------------
+ Places every pinned sounder thread on a core, from the machine
+ topology read once at configuration time
+---------------------------------------------------------------------
+*/
+#ifndef SOUDER_CORE_PLANNER_H_
+#define SOUDER_CORE_PLANNER_H_
+
+#include <array>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/*
+ * Physical cores of the NUMA node the NIC is attached to are handed out
+ * first, one thread per physical core, then the other nodes. SMT siblings
+ * are only used once every physical core has a thread, and cores are
+ * shared (with a warning) only when even those run out. Threads are
+ * placed in Role order, so the receive threads get the cores closest to
+ * the NIC. CPUs named in the override map are taken out of the plan.
+ */
+class CorePlanner {
+public:
+    enum Role {
+        kRx, // base station receive threads
+        kDispatcher, // main thread of the Recorder
+        kRecorder, // recorder threads
+        kClient, // client TX/RX threads, one per client radio
+        kClientTx, // client TX scheduling threads with tx_thread
+        kFanout, // fan-out sender threads, one per fanout_nodes entry
+        kNumRoles
+    };
+
+    CorePlanner(void) {}
+
+    // threads[role] threads are placed for each role, the first thread of
+    // a role goes to overrides[role][0] if given and so on. An empty nic
+    // places the threads starting from the node of the first usable CPU.
+    void plan(const std::array<size_t, kNumRoles>& threads,
+        const std::string& nic,
+        const std::array<std::vector<int>, kNumRoles>& overrides);
+
+    // CPU of thread index of role, -1 if it was not placed
+    int core(Role role, size_t index) const;
+
+    // "rx: 2 3, recorder: 4 5, ..." for the log
+    std::string describe(void) const;
+
+    // Name of the role in the core_map config object
+    static const char* roleName(Role role);
+
+private:
+    std::array<std::vector<int>, kNumRoles> plan_;
+};
+
+#endif /* SOUDER_CORE_PLANNER_H_ */
@@ -0,0 +1,45 @@
+/*
+ Copyright (c) 2018-2020, Rice University
+ RENEW OPEN SOURCE LICENSE: http://renew-wireless.org/license
+
+----------------------------------------------------------------------
+ Channel estimation of received pilots ahead of the recorder, so the
+ per subcarrier channel can be recorded instead of the raw pilot IQ
+---------------------------------------------------------------------
+*/
+#ifndef SOUDER_CSI_STAGE_H_
+#define SOUDER_CSI_STAGE_H_
+
+#include "config.h"
+#include "receiver.h"
+#include <complex>
+#include <vector>
+
+namespace Sounder {
+/*
+ * Least squares estimate on the data subcarriers, averaged over the OFDM
+ * symbols of the pilot. Symbols are taken at the positions the schedule
+ * puts them (after the prefix and each cyclic prefix), a delay within the
+ * cyclic prefix shows up as a linear phase across the subcarriers.
+ */
+class CsiStage {
+public:
+    explicit CsiStage(Config* cfg);
+
+    // floats of one estimate, IQ interleaved over the data subcarriers
+    inline size_t record_len(void) const { return 2 * this->ref_.size(); }
+
+    // Estimates of count pilot packages, package i written to
+    // csi + i * record_len(). All FFTs of the call run as one batch.
+    void estimate(const Package* const* pkgs, size_t count, float* csi);
+
+private:
+    Config* cfg_;
+    // 1 / (pilot * symbol_per_subframe) on each data subcarrier
+    std::vector<std::complex<float>> ref_;
+    // time domain symbols of a call, transformed in place
+    std::vector<std::complex<float>> work_;
+};
+}; /* End namespace Sounder */
+
+#endif /* SOUDER_CSI_STAGE_H_ */
@@ -7,8 +7,10 @@
 #define DATA_GENERATOR_H_
 
 #include "config.h"
-#include <random>
+#include <complex>
+#include <cstdint>
 #include <string>
+#include <vector>
 
 class DataGenerator {
 public:
@@ -18,9 +20,29 @@ public:
     {
     }
 
+    // Clients and blocks of frames are spread over one thread per core,
+    // each block is written to the files with one pwrite per file
     void GenerateData(const std::string& directory);
 
 private:
+    // A block of consecutive frames of one client
+    struct Task {
+        size_t radio;
+        size_t first_frame;
+        size_t num_frames;
+    };
+    // Per thread buffers, one block of frames of each file
+    struct Buffers {
+        std::vector<uint8_t> bits;
+        std::vector<std::complex<float>> freq;
+        std::vector<std::complex<float>> time;
+        std::vector<std::complex<float>> syms;
+        std::vector<std::complex<float>> mod;
+    };
+
+    void GenerateTask(const Task& task, uint64_t seed, Buffers& buf,
+        const int fds[3]);
+
     Config* cfg_;
 };
 #endif
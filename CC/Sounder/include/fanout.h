@@ -0,0 +1,122 @@
+/*
+ Copyright (c) 2018-2020, Rice University
+ RENEW OPEN SOURCE LICENSE: http://renew-wireless.org/license
+
+----------------------------------------------------------------------
+ UDP fan-out of the received packages to remote recorder nodes
+---------------------------------------------------------------------
+*/
+#ifndef SOUDER_FANOUT_H_
+#define SOUDER_FANOUT_H_
+
+#include "recorder_thread.h"
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+/*
+ * One datagram per package: a FanoutHeader followed by the samples,
+ * getPackageDataLength() bytes, both in host byte order (a node of the
+ * other byte order sees a bad magic and drops them). A header alone with
+ * frame_id kFanoutEndFrame tells the node that the capture is over.
+ *
+ * With N entries in fanout_nodes, node n records the antennas
+ * [n, n + 1) * fanoutNodeAntennas(), split over its recorder threads the
+ * same way a single host splits them.
+ */
+static const uint32_t kFanoutMagic = 0x53464f31; // "SFO1"
+static const uint32_t kFanoutEndFrame = UINT32_MAX;
+
+struct FanoutHeader {
+    uint32_t magic;
+    uint32_t frame_id;
+    uint32_t symbol_id;
+    uint32_t cell_id;
+    uint32_t ant_id;
+    uint32_t samples_bytes;
+    int64_t hw_time;
+};
+
+namespace Sounder {
+// Antennas owned by each node, the last one may get fewer
+size_t fanoutNodeAntennas(Config* cfg);
+
+// Radio host side, one per node. Takes the packages of the node's
+// antennas like a recorder thread does and sends them in batches of up to
+// fanout_batch packages of a frame, with one sendmmsg or GSO send each.
+class FanoutSender {
+public:
+    FanoutSender(Config* in_cfg, size_t node_id, int core, size_t queue_size);
+    ~FanoutSender();
+
+    void Start(void);
+    // Sends what is queued, then the end of capture marker
+    void Stop(void);
+    bool DispatchWork(RecorderThread::RecordEventData event);
+
+private:
+    static const size_t kDequeueBulkSize;
+
+    void DoSending(void);
+    // Sends and releases the batched packages
+    void Flush(void);
+    size_t SendGso(size_t first, size_t count);
+    void SendEnd(void);
+
+    moodycamel::ConcurrentQueue<RecorderThread::RecordEventData> event_queue_;
+    moodycamel::ProducerToken producer_token_;
+    Config* cfg_;
+    size_t id_;
+    int core_alloc_;
+    size_t package_data_length_;
+    int socket_;
+    bool gso_;
+    std::thread thread_;
+
+    // Packages claimed for the next send, all of one frame
+    std::vector<RecorderThread::RecordEventData> batch_events_;
+    std::vector<FanoutHeader> batch_headers_;
+    std::vector<const short*> batch_samples_;
+
+    size_t sent_;
+    size_t send_errors_;
+};
+
+// Worker node side: receives the packages of this node into a sample
+// buffer and dispatches them to the local recorder threads
+class FanoutReceiver {
+public:
+    FanoutReceiver(Config* in_cfg, int core, RxStats* stats);
+    ~FanoutReceiver();
+
+    // recorder i owns antennas antenna_offset + [i, i + 1) *
+    // antennas_per_recorder
+    void Start(const std::vector<RecorderThread*>& recorders,
+        size_t antenna_offset, size_t antennas_per_recorder);
+    void Stop(void);
+
+private:
+    void DoReceiving(void);
+
+    Config* cfg_;
+    int core_alloc_;
+    RxStats* stats_;
+    size_t package_data_length_;
+    int socket_;
+    SampleBuffer buffer_;
+    // receives the packages that find no free slot in buffer_
+    std::vector<char> scratch_;
+
+    std::vector<RecorderThread*> recorders_;
+    size_t antenna_offset_;
+    size_t num_antennas_;
+    size_t antennas_per_recorder_;
+
+    std::atomic<bool> running_;
+    std::thread thread_;
+    size_t bad_datagrams_;
+};
+}; /* End namespace Sounder */
+
+#endif /* SOUDER_FANOUT_H_ */
@@ -0,0 +1,120 @@
+/*
+ Copyright (c) 2018-2020, Rice University
+ RENEW OPEN SOURCE LICENSE: http://renew-wireless.org/license
+
+----------------------------------------------------------------------
+ Per recorder bookkeeping of the symbols received in each frame
+---------------------------------------------------------------------
+*/
+#ifndef SOUDER_FRAME_TRACKER_H_
+#define SOUDER_FRAME_TRACKER_H_
+
+#include "config.h"
+#include "receiver.h"
+#include <cstdint>
+#include <vector>
+
+namespace Sounder {
+/*
+ * Frames stay open for 'window' frames after the newest one seen, so
+ * packages reordered by the rx threads still count. Frames are closed in
+ * order, including frames nothing arrived for, so closed row i always
+ * describes frame first + i.
+ *
+ * A closed row is kRowFixedBytes followed by the symbol bitmap, packed:
+ *   uint64 frame, int64 hw_time, uint32 received, uint32 expected,
+ *   uint8 complete, uint8 symbols[bitmap_bytes()]
+ * hw_time is the radio time of the start of the frame, taken from its
+ * first package. complete is 1 when every expected record arrived, 2 when
+ * the record_policy skipped the frame; skipped frames are not counted as
+ * incomplete or missing.
+ * Bit s of symbols (LSB first) is set when symbol s arrived on every
+ * antenna of the recorder. Only the pilot, noise and uplink symbols of the
+ * frame schedule are expected.
+ */
+class FrameTracker {
+public:
+    static const size_t kRowFrame = 0;
+    static const size_t kRowHwTime = 8;
+    static const size_t kRowReceived = 16;
+    static const size_t kRowExpected = 20;
+    static const size_t kRowComplete = 24;
+    static const size_t kRowSymbols = 25;
+    static const size_t kRowFixedBytes = kRowSymbols;
+
+    FrameTracker(Config* cfg, size_t antenna_offset, size_t num_antennas,
+        size_t window);
+
+    // Returns false if the frame of pkg was closed already. A package the
+    // record_policy did not keep marks its frame as skipped.
+    bool add(const Package& pkg, bool recorded = true);
+    // Closes the frames still open
+    void finish(void);
+
+    inline size_t bitmap_bytes(void) const { return this->bitmap_bytes_; }
+    inline size_t row_bytes(void) const
+    {
+        return kRowFixedBytes + this->bitmap_bytes_;
+    }
+    // Rows closed since the last clearClosed(), of frames closed_first()...
+    inline const std::vector<char>& closed(void) const
+    {
+        return this->closed_;
+    }
+    inline size_t closed_first(void) const { return this->closed_first_; }
+    inline size_t closed_count(void) const
+    {
+        return this->closed_.size() / this->row_bytes();
+    }
+    void clearClosed(void);
+
+    inline size_t frames_complete(void) const
+    {
+        return this->frames_complete_;
+    }
+    inline size_t frames_incomplete(void) const
+    {
+        return this->frames_incomplete_;
+    }
+    inline size_t frames_skipped(void) const { return this->frames_skipped_; }
+    inline size_t records_missing(void) const
+    {
+        return this->records_missing_;
+    }
+    inline size_t records_late(void) const { return this->records_late_; }
+
+private:
+    struct OpenFrame {
+        int64_t frame_id; // -1 when the slot is free
+        int64_t hw_time; // radio time of the frame start
+        uint32_t received;
+        bool skipped;
+        // bit s * num_antennas + antenna
+        std::vector<uint64_t> bits;
+    };
+
+    void close(size_t frame_id);
+
+    Config* cfg_;
+    size_t antenna_offset_;
+    size_t num_antennas_;
+    size_t symbols_;
+    size_t bitmap_bytes_;
+    std::vector<OpenFrame> open_;
+    // oldest frame not closed yet
+    size_t next_close_;
+    // newest frame seen + 1
+    size_t frames_seen_;
+
+    std::vector<char> closed_;
+    size_t closed_first_;
+
+    size_t frames_complete_;
+    size_t frames_incomplete_;
+    size_t frames_skipped_;
+    size_t records_missing_;
+    size_t records_late_;
+};
+}; /* End namespace Sounder */
+
+#endif /* SOUDER_FRAME_TRACKER_H_ */
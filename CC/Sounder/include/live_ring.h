@@ -0,0 +1,99 @@
+/*
+ Copyright (c) 2018-2020, Rice University
+ RENEW OPEN SOURCE LICENSE: http://renew-wireless.org/license
+
+----------------------------------------------------------------------
+ Shared memory ring of the latest received frames, for live consumers
+ of the samples that don't want to wait for the hdf5 files
+---------------------------------------------------------------------
+*/
+#ifndef SOUDER_LIVE_RING_H_
+#define SOUDER_LIVE_RING_H_
+
+#include "config.h"
+#include "receiver.h"
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+/*
+ * Layout of the POSIX shared memory segment, host byte order:
+ *
+ *   LiveRingHeader, then num_slots slots of slot_bytes from slots_offset.
+ *   Each slot starts with its LiveSlotHeader, the pilots follow at
+ *   pilot_offset as int16 [num_cells][pilot_syms][num_antennas][2 * samps]
+ *   and the uplink symbols at ul_offset as [num_cells][ul_syms]... alike,
+ *   the same order as the hdf5 datasets without the frame dimension.
+ *
+ * Frame f goes to slot f % num_slots. A slot's state is (f + 1) << 24 |
+ * records written, it changes to the next frame before any of its
+ * samples are overwritten. Readers check the state again after using the
+ * samples, if it changed they were overwritten meanwhile.
+ */
+static const uint32_t kLiveRingMagic = 0x534c5231; // "SLR1"
+static const uint32_t kLiveRingVersion = 1;
+static const int kLiveRingCountBits = 24;
+
+struct LiveRingHeader {
+    uint32_t magic; // written last, once the layout is valid
+    uint32_t version;
+    uint32_t num_slots;
+    uint32_t num_cells;
+    uint32_t num_antennas;
+    uint32_t pilot_syms;
+    uint32_t ul_syms;
+    uint32_t samps_per_symbol; // complex int16 samples per symbol
+    uint64_t slot_bytes;
+    uint64_t slots_offset;
+    uint64_t pilot_offset;
+    uint64_t ul_offset;
+    // last frame with all its records written, -1 if none
+    std::atomic<int64_t> latest_frame;
+    // last frame any record was written to, -1 if none
+    std::atomic<int64_t> newest_frame;
+};
+
+struct LiveSlotHeader {
+    std::atomic<uint64_t> state;
+};
+
+namespace Sounder {
+// Writer side, shared by all recorder threads
+class LiveRing {
+public:
+    LiveRing(Config* cfg, const std::string& name, size_t num_slots);
+    ~LiveRing();
+
+    // Copies a pilot or uplink package into the slot of its frame, other
+    // symbols and packages of frames already overwritten are skipped
+    void write(const Package& pkg);
+
+private:
+    LiveSlotHeader* slot(size_t frame_id) const;
+
+    Config* cfg_;
+    std::string name_;
+    size_t size_;
+    char* base_;
+    LiveRingHeader* header_;
+    // records of a complete frame
+    uint32_t frame_records_;
+};
+}; /* End namespace Sounder */
+
+// Reader side, for tools linking sounder_module (Python through ctypes)
+extern "C" {
+// nullptr if there is no ring of that name or it is not initialized yet
+void* LiveRing_attach(const char* name);
+void LiveRing_detach(void* ring);
+const LiveRingHeader* LiveRing_header(void* ring);
+// Last complete frame, -1 if none
+int64_t LiveRing_latestFrame(void* ring);
+// Samples of frame, nullptr if its slot holds another frame
+const short* LiveRing_pilots(void* ring, uint64_t frame);
+const short* LiveRing_uplink(void* ring, uint64_t frame);
+// 1 while frame is still in its slot, check after using its samples
+int LiveRing_frameValid(void* ring, uint64_t frame);
+}
+
+#endif /* SOUDER_LIVE_RING_H_ */
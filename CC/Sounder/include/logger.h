@@ -46,68 +46,82 @@
 #define MLPD_LOG_LEVEL MLPD_LOG_LEVEL_TRACE
 #endif
 
+#ifdef MLPD_ASYNC_LOG
+// Messages are queued on a ring of the logging thread and formatted by a
+// drain thread, see mlpd_log() below. Errors are written right away,
+// after what is queued, so they are not lost if the process dies.
+#define MLPD_LOG(stream, level, ...)                                           \
+    do {                                                                       \
+        static MlpdSite mlpd_site;                                             \
+        if (0)                                                                 \
+            fprintf(stream, __VA_ARGS__); /* format checks only */             \
+        mlpd_log(mlpd_site, level, stream, __VA_ARGS__);                       \
+    } while (0)
+#define MLPD_LOG_NOW(stream, level, ...)                                       \
+    do {                                                                       \
+        mlpd_log_flush();                                                      \
+        mlpd_output_log_header(stream, level);                                 \
+        fprintf(stream, __VA_ARGS__);                                          \
+        fflush(stream);                                                        \
+    } while (0)
+#else
+#define MLPD_LOG(stream, level, ...)                                           \
+    do {                                                                       \
+        mlpd_output_log_header(stream, level);                                 \
+        fprintf(stream, __VA_ARGS__);                                          \
+        fflush(stream);                                                        \
+    } while (0)
+#define MLPD_LOG_NOW(stream, level, ...) MLPD_LOG(stream, level, __VA_ARGS__)
+#endif
+
 #if MLPD_LOG_LEVEL >= MLPD_LOG_LEVEL_ERROR
 #define MLPD_ERROR(...)                                                        \
-    mlpd_output_log_header(MLPD_LOG_DEFAULT_STREAM, MLPD_LOG_LEVEL_ERROR);     \
-    fprintf(MLPD_LOG_DEFAULT_STREAM, __VA_ARGS__);                             \
-    fflush(MLPD_LOG_DEFAULT_STREAM)
+    MLPD_LOG_NOW(MLPD_LOG_DEFAULT_STREAM, MLPD_LOG_LEVEL_ERROR, __VA_ARGS__)
 #else
 #define MLPD_ERROR(...) ((void)0)
 #endif
 
 #if MLPD_LOG_LEVEL >= MLPD_LOG_LEVEL_WARN
 #define MLPD_WARN(...)                                                         \
-    mlpd_output_log_header(MLPD_LOG_DEFAULT_STREAM, MLPD_LOG_LEVEL_WARN);      \
-    fprintf(MLPD_LOG_DEFAULT_STREAM, __VA_ARGS__);                             \
-    fflush(MLPD_LOG_DEFAULT_STREAM)
+    MLPD_LOG(MLPD_LOG_DEFAULT_STREAM, MLPD_LOG_LEVEL_WARN, __VA_ARGS__)
 #else
 #define MLPD_WARN(...) ((void)0)
 #endif
 
 #if MLPD_LOG_LEVEL >= MLPD_LOG_LEVEL_INFO
 #define MLPD_INFO(...)                                                         \
-    mlpd_output_log_header(MLPD_LOG_DEFAULT_STREAM, MLPD_LOG_LEVEL_INFO);      \
-    fprintf(MLPD_LOG_DEFAULT_STREAM, __VA_ARGS__);                             \
-    fflush(MLPD_LOG_DEFAULT_STREAM)
+    MLPD_LOG(MLPD_LOG_DEFAULT_STREAM, MLPD_LOG_LEVEL_INFO, __VA_ARGS__)
 #else
 #define MLPD_INFO(...) ((void)0)
 #endif
 
 #if MLPD_LOG_LEVEL >= MLPD_LOG_LEVEL_FRAME
 #define MLPD_FRAME(...)                                                        \
-    mlpd_output_log_header(                                                    \
-        mlpd_trace_file_or_default_stream, MLPD_LOG_LEVEL_FRAME);              \
-    fprintf(mlpd_trace_file_or_default_stream, __VA_ARGS__);                   \
-    fflush(mlpd_trace_file_or_default_stream)
+    MLPD_LOG(                                                                  \
+        mlpd_trace_file_or_default_stream, MLPD_LOG_LEVEL_FRAME, __VA_ARGS__)
 #else
 #define MLPD_FRAME(...) ((void)0)
 #endif
 
 #if MLPD_LOG_LEVEL >= MLPD_LOG_LEVEL_SYMBOL
 #define MLPD_SYMBOL(...)                                                       \
-    mlpd_output_log_header(                                                    \
-        mlpd_trace_file_or_default_stream, MLPD_LOG_LEVEL_SYMBOL);             \
-    fprintf(mlpd_trace_file_or_default_stream, __VA_ARGS__);                   \
-    fflush(mlpd_trace_file_or_default_stream)
+    MLPD_LOG(                                                                  \
+        mlpd_trace_file_or_default_stream, MLPD_LOG_LEVEL_SYMBOL, __VA_ARGS__)
 #else
 #define MLPD_SYMBOL(...) ((void)0)
 #endif
 
 #if MLPD_LOG_LEVEL >= MLPD_LOG_LEVEL_TRACE
 #define MLPD_TRACE(...)                                                        \
-    mlpd_output_log_header(                                                    \
-        mlpd_trace_file_or_default_stream, MLPD_LOG_LEVEL_TRACE);              \
-    fprintf(mlpd_trace_file_or_default_stream, __VA_ARGS__);                   \
-    fflush(mlpd_trace_file_or_default_stream)
+    MLPD_LOG(                                                                  \
+        mlpd_trace_file_or_default_stream, MLPD_LOG_LEVEL_TRACE, __VA_ARGS__)
 #else
 #define MLPD_TRACE(...) ((void)0)
 #endif
 
 /// Return decent-precision time formatted as seconds:microseconds
-static std::string mlpd_get_formatted_time()
+static inline std::string mlpd_get_formatted_time(const struct timespec& t)
 {
-    struct timespec t;
-    clock_gettime(CLOCK_REALTIME, &t);
     char buf[20];
     uint32_t seconds = t.tv_sec % 100; // Rollover every 100 seconds
     uint32_t usec = t.tv_nsec / 1000;
@@ -116,10 +130,18 @@ static std::string mlpd_get_formatted_time()
     return std::string(buf);
 }
 
-// Output log message header
-static inline void mlpd_output_log_header(FILE* stream, int level)
+static inline std::string mlpd_get_formatted_time()
 {
-    std::string formatted_time = mlpd_get_formatted_time();
+    struct timespec t;
+    clock_gettime(CLOCK_REALTIME, &t);
+    return mlpd_get_formatted_time(t);
+}
+
+// Output log message header, stamped with the time the message was logged
+static inline void mlpd_output_log_header(
+    FILE* stream, int level, const struct timespec& time)
+{
+    std::string formatted_time = mlpd_get_formatted_time(time);
 
     const char* type;
     switch (level) {
@@ -148,9 +170,204 @@ static inline void mlpd_output_log_header(FILE* stream, int level)
     fprintf(stream, "%s %s: ", formatted_time.c_str(), type);
 }
 
+// Output log message header
+static inline void mlpd_output_log_header(FILE* stream, int level)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_REALTIME, &t);
+    mlpd_output_log_header(stream, level, t);
+}
+
 /// Return true if the logging verbosity is reasonable for non-developer users
 /// of Agora
 static inline bool is_log_level_reasonable()
 {
     return MLPD_LOG_LEVEL <= MLPD_LOG_LEVEL_INFO;
 }
+
+#ifdef MLPD_ASYNC_LOG
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <tuple>
+#include <type_traits>
+
+// One queued message: the format, the arguments (strings copied into the
+// payload) and the function that formats them on the drain thread
+struct MlpdRecord;
+typedef void (*MlpdFormatter)(const MlpdRecord& record);
+
+static constexpr size_t kMlpdRecordSize = 256;
+// Warnings per call site and second, the others are counted and dropped.
+// The count is reported with the next message of the call site, or at
+// exit if there is none.
+static constexpr uint32_t kMlpdSiteRate = 20;
+
+struct MlpdRecord {
+    MlpdFormatter formatter;
+    FILE* stream;
+    const char* format;
+    struct timespec time;
+    int level;
+    // messages of the call site dropped by the rate limit before this one
+    uint32_t suppressed;
+    alignas(8) char payload[kMlpdRecordSize - 48];
+};
+static_assert(sizeof(MlpdRecord) == kMlpdRecordSize, "MlpdRecord size");
+
+// Rate limit state of a call site
+struct MlpdSite {
+    std::atomic<int64_t> window;
+    std::atomic<uint32_t> count;
+    std::atomic<uint32_t> suppressed;
+    // set when the site first drops a message, for the report at exit
+    std::atomic<bool> listed;
+    const char* format;
+    FILE* stream;
+    int level;
+};
+
+// Slot on the ring of the calling thread, nullptr if it is full
+MlpdRecord* mlpd_log_reserve(void);
+// Queues the slot mlpd_log_reserve returned
+void mlpd_log_commit(void);
+// Writes out everything queued, from the calling thread
+void mlpd_log_flush(void);
+// Keeps site for the report of its dropped messages at exit
+void mlpd_log_add_site(MlpdSite* site);
+// Set once the drain thread stopped at exit, messages are written directly
+extern std::atomic<bool> mlpd_log_sync;
+
+// How an argument is kept until it is formatted, strings are copied
+template <typename T> struct MlpdArg {
+    static_assert(std::is_trivially_copyable<T>::value,
+        "log arguments must be printf arguments");
+    typedef T Stored;
+    static Stored save(T value, char*, size_t&) { return value; }
+    static T load(Stored value, const char*) { return value; }
+};
+
+template <> struct MlpdArg<const char*> {
+    // offset of the copy in the payload
+    typedef uint16_t Stored;
+    static Stored save(const char* value, char* payload, size_t& used)
+    {
+        const size_t size = sizeof(MlpdRecord::payload);
+        if (value == nullptr)
+            value = "(null)";
+        Stored offset = used;
+        size_t len = (used < size) ? strnlen(value, size - used - 1) : 0;
+        if (used < size) {
+            std::memcpy(payload + used, value, len);
+            payload[used + len] = 0;
+            used += len + 1;
+        } else {
+            offset = size - 1; // the terminating 0 of the last copy
+        }
+        return offset;
+    }
+    static const char* load(Stored value, const char* payload)
+    {
+        return payload + value;
+    }
+};
+
+template <> struct MlpdArg<char*> : MlpdArg<const char*> {
+};
+
+static inline void mlpd_output_suppressed(const MlpdRecord& record)
+{
+    if (record.suppressed > 0) {
+        mlpd_output_log_header(record.stream, record.level, record.time);
+        fprintf(record.stream, "%u more like the next message were rate "
+                               "limited\n",
+            record.suppressed);
+    }
+}
+
+template <typename... Args> static void mlpd_format(const MlpdRecord& record)
+{
+    typedef std::tuple<typename MlpdArg<Args>::Stored...> Stored;
+    mlpd_output_suppressed(record);
+    mlpd_output_log_header(record.stream, record.level, record.time);
+    if constexpr (sizeof...(Args) == 0) {
+        fputs(record.format, record.stream);
+    } else {
+        std::apply(
+            [&record](auto... values) {
+                fprintf(record.stream, record.format,
+                    MlpdArg<Args>::load(values, record.payload)...);
+            },
+            *reinterpret_cast<const Stored*>(record.payload));
+    }
+}
+
+// Messages whose arguments don't fit are formatted by the logging thread
+static inline void mlpd_format_text(const MlpdRecord& record)
+{
+    mlpd_output_suppressed(record);
+    mlpd_output_log_header(record.stream, record.level, record.time);
+    fputs(record.payload, record.stream);
+}
+
+template <typename... Args>
+static inline void mlpd_log(MlpdSite& site, int level, FILE* stream,
+    const char* format, Args... args)
+{
+    typedef std::tuple<typename MlpdArg<Args>::Stored...> Stored;
+    struct timespec time;
+    clock_gettime(CLOCK_REALTIME, &time);
+
+    // Repeated warnings within a second beyond kMlpdSiteRate are only
+    // counted, the other levels are written as they come
+    if (level == MLPD_LOG_LEVEL_WARN) {
+        int64_t window = site.window.load(std::memory_order_relaxed);
+        if ((window != time.tv_sec)
+            && site.window.compare_exchange_strong(
+                window, time.tv_sec, std::memory_order_relaxed)) {
+            site.count.store(0, std::memory_order_relaxed);
+        }
+        if (site.count.fetch_add(1, std::memory_order_relaxed)
+            >= kMlpdSiteRate) {
+            if (site.listed.exchange(true) == false) {
+                site.format = format;
+                site.stream = stream;
+                site.level = level;
+                mlpd_log_add_site(&site);
+            }
+            site.suppressed.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+    }
+
+    if (mlpd_log_sync.load(std::memory_order_relaxed) == true) {
+        mlpd_output_log_header(stream, level, time);
+        if constexpr (sizeof...(Args) == 0)
+            fputs(format, stream);
+        else
+            fprintf(stream, format, args...);
+        fflush(stream);
+        return;
+    }
+    MlpdRecord* record = mlpd_log_reserve();
+    if (record == nullptr)
+        return;
+    record->stream = stream;
+    record->format = format;
+    record->time = time;
+    record->level = level;
+    record->suppressed
+        = site.suppressed.exchange(0, std::memory_order_relaxed);
+    if constexpr (sizeof(Stored) < sizeof(MlpdRecord::payload)) {
+        size_t used = sizeof(Stored);
+        new (record->payload)
+            Stored(MlpdArg<Args>::save(args, record->payload, used)...);
+        record->formatter = mlpd_format<Args...>;
+    } else {
+        snprintf(record->payload, sizeof(record->payload), format, args...);
+        record->formatter = mlpd_format_text;
+    }
+    mlpd_log_commit();
+}
+#endif
@@ -0,0 +1,45 @@
+/*
+ Copyright (c) 2018-2020, Rice University
+ RENEW OPEN SOURCE LICENSE: http://renew-wireless.org/license
+
+----------------------------------------------------------------------
+ Master hdf5 file presenting the per recorder shards as single datasets
+---------------------------------------------------------------------
+*/
+#ifndef SOUDER_MASTER_FILE_H_
+#define SOUDER_MASTER_FILE_H_
+
+#include <string>
+#include <vector>
+
+namespace Sounder {
+/*
+ * Each recorder thread writes its antennas to its own file. The master
+ * file maps every /Data dataset of the shards into one virtual dataset
+ * spanning all antennas, no samples are copied. The /Data attributes of
+ * the first shard are copied with ANT_OFFSET and ANT_NUM covering all
+ * antennas. Shards are referenced by file name relative to the master,
+ * so the set can be moved as long as the files stay together.
+ */
+class MasterFile {
+public:
+    explicit MasterFile(size_t total_antennas);
+
+    void addShard(const std::string& file_name, size_t antenna_offset,
+        size_t num_antennas);
+    // Call once the shards are closed, their extents are final then
+    bool write(const std::string& file_name) const;
+
+private:
+    struct Shard {
+        std::string file_name;
+        size_t antenna_offset;
+        size_t num_antennas;
+    };
+
+    size_t total_antennas_;
+    std::vector<Shard> shards_;
+};
+}; /* End namespace Sounder */
+
+#endif /* SOUDER_MASTER_FILE_H_ */
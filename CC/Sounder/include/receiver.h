@@ -13,6 +13,8 @@
 #include "BaseRadioSet.h"
 #include "ClientRadioSet.h"
 #include "concurrentqueue.h"
+#include "sample_buffer.h"
+#include "telemetry.h"
 #include <algorithm>
 #include <arpa/inet.h>
 #include <cassert>
@@ -36,10 +38,15 @@ class ReceiverException : public std::exception {
 
 enum ReceiverEventType { kEventRxSymbol = 0 };
 
+namespace Sounder {
+class RecorderThread;
+};
+
 struct Event_data {
     ReceiverEventType event_type;
     int data;
     int ant_id;
+    uint32_t gen; // generation of the SampleBuffer slot in data
 };
 
 struct Package {
@@ -47,20 +54,27 @@ struct Package {
     uint32_t symbol_id;
     uint32_t cell_id;
     uint32_t ant_id;
+    // steady clock time radioRx returned this package, for telemetry
+    uint64_t rx_time_ns;
+    // radio timestamp of the samples
+    long long hw_time;
+    // driver buffer holding the samples when received zero-copy
+    const short* direct_data;
     short data[];
     Package(int f, int s, int c, int a)
         : frame_id(f)
         , symbol_id(s)
         , cell_id(c)
         , ant_id(a)
+        , rx_time_ns(0)
+        , hw_time(0)
+        , direct_data(nullptr)
     {
     }
-};
-
-// each thread has a SampleBuffer
-struct SampleBuffer {
-    std::vector<char> buffer;
-    std::atomic_int* pkg_buf_inuse;
+    inline const short* samples(void) const
+    {
+        return (direct_data != nullptr) ? direct_data : data;
+    }
 };
 
 class Receiver {
@@ -80,12 +94,18 @@ public:
 
 public:
     Receiver(int n_rx_threads, Config* config,
-        moodycamel::ConcurrentQueue<Event_data>* in_queue);
+        moodycamel::ConcurrentQueue<Event_data>* in_queue,
+        Telemetry* telemetry);
     ~Receiver();
 
-    std::vector<pthread_t> startRecvThreads(
-        SampleBuffer* rx_buffer, unsigned in_core_id = 0);
+    // rx thread i is pinned to the core planned for it by the config
+    std::vector<pthread_t> startRecvThreads(SampleBuffer* rx_buffer);
     void completeRecvThreads(const std::vector<pthread_t>& recv_thread);
+    // rx threads that left their receive loop and queue no more packages
+    inline int recvLoopsDone(void) const
+    {
+        return this->recv_loops_done_.load(std::memory_order_acquire);
+    }
     std::vector<pthread_t> startClientThreads();
     void go();
     static void* loopRecv_launch(void* in_context);
@@ -93,8 +113,20 @@ public:
     static void* clientTxRx_launch(void* in_context);
     void clientTxRx(int tid);
     void clientSyncTxRx(int tid);
+    // Route received packages straight to the recorder threads instead of
+    // the message queue; recorder i owns antennas [i, i + 1) * antennas
+    void setRecorders(const std::vector<Sounder::RecorderThread*>& recorders,
+        size_t antennas_per_recorder);
 
 private:
+    // Radios of rx thread tid with the fixed partition
+    std::vector<size_t> staticRadios(int tid) const;
+    // With adaptive rx_balancing, hands one radio of an overloaded rx
+    // thread tid to the least loaded thread at most every few frames.
+    // Not used with rx_direct_buffers, see Config.
+    void rebalanceRx(
+        int tid, size_t frame_id, const std::vector<size_t>& radios);
+
     Config* config_;
     ClientRadioSet* clientRadioSet_;
     BaseRadioSet* base_radio_set_;
@@ -102,6 +134,28 @@ private:
     int thread_num_;
     // pointer of message_queue_
     moodycamel::ConcurrentQueue<Event_data>* message_queue_;
+    // per rx thread counters, owned by the recorder
+    Telemetry* telemetry_;
+
+    // direct routing, empty when packages go through message_queue_
+    std::vector<Sounder::RecorderThread*> recorders_;
+    size_t antennas_per_recorder_;
+
+    // Adaptive rx balancing. Radio r is received by rx thread
+    // radio_owner_[r] and only that thread may give it away, so a radio
+    // is never read by two threads and packages stay in the buffer of
+    // the thread that received them
+    bool adaptive_rx_;
+    std::unique_ptr<std::atomic<int>[]> radio_owner_;
+    // service time of each radio in ns, moving average kept by its owner
+    std::unique_ptr<std::atomic<uint32_t>[]> radio_cost_ns_;
+    // summed radio costs of each rx thread, kRxLoadUnknown until measured
+    std::unique_ptr<std::atomic<uint64_t>[]> thread_load_ns_;
+    // bumped after every handoff, rx threads then rebuild their radio list
+    std::atomic<uint32_t> assignment_gen_;
+    // frame id of the last handoff
+    std::atomic<size_t> last_rebalance_frame_;
+    std::atomic<int> recv_loops_done_;
 };
 
 #endif
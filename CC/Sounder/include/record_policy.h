@@ -0,0 +1,88 @@
+/*
+ Copyright (c) 2018-2020, Rice University
+ RENEW OPEN SOURCE LICENSE: http://renew-wireless.org/license
+
+----------------------------------------------------------------------
+ Selection of the frames the recorder threads write (record_policy)
+---------------------------------------------------------------------
+*/
+#ifndef SOUDER_RECORD_POLICY_H_
+#define SOUDER_RECORD_POLICY_H_
+
+#include "config.h"
+#include "receiver.h"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace Sounder {
+// Frames any recorder thread triggered on, shared so that all the shards
+// keep the same frames
+class RecordTrigger {
+public:
+    explicit RecordTrigger(size_t window);
+
+    void raise(size_t frame_id);
+    bool raised(size_t frame_id) const;
+
+private:
+    // frame_id + 1 in slot frame_id % window_, 0 when never raised
+    std::unique_ptr<std::atomic<uint64_t>[]> frames_;
+    size_t window_;
+};
+
+/*
+ * "decimate" keeps every record_decimation-th frame, decided on arrival.
+ * "trigger" measures the mean pilot power of each frame over the antennas
+ * of the thread, relative to the noise symbols of the same frame when the
+ * schedule has any. A frame passing record_trigger_db raises a trigger and
+ * the frames from record_trigger_pre before to record_trigger_post after
+ * it are kept. The caller holds packages back (in their rx buffer slots)
+ * until the frames up to frame + holdback() are advanced past, even when
+ * holdback() is 0 so that the frame itself is evaluated first.
+ */
+class RecordPolicy {
+public:
+    RecordPolicy(Config* cfg, RecordTrigger* trigger);
+
+    inline bool decimate(void) const { return this->decimate_; }
+    inline size_t holdback(void) const { return this->holdback_; }
+    // Adds the pilot or noise power of pkg to its frame
+    void measure(const Package& pkg);
+    // Evaluates the measured frames before frame_id
+    void advance(size_t frame_id);
+    bool keep(size_t frame_id);
+    inline size_t triggers(void) const { return this->triggers_; }
+
+private:
+    struct FrameLevel {
+        int64_t frame_id; // -1 when the slot is free
+        double pilot;
+        double noise;
+        size_t pilot_samples;
+        size_t noise_samples;
+    };
+
+    void evaluate(FrameLevel& frame);
+
+    Config* cfg_;
+    RecordTrigger* trigger_;
+    bool decimate_;
+    size_t holdback_;
+    double threshold_; // linear record_trigger_db
+
+    std::vector<FrameLevel> frames_;
+    // oldest frame not evaluated yet, newest frame measured + 1
+    size_t next_evaluate_;
+    size_t frames_measured_;
+    std::vector<int32_t> power_;
+    size_t triggers_;
+
+    // keep() is asked once per package, remember the last frame
+    int64_t decided_frame_;
+    bool decided_keep_;
+};
+}; /* End namespace Sounder */
+
+#endif /* SOUDER_RECORD_POLICY_H_ */
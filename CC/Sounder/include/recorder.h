@@ -11,42 +11,54 @@
 #ifndef SOUDER_RECORDER_H_
 #define SOUDER_RECORDER_H_
 
+#include "fanout.h"
 #include "receiver.h"
 #include "recorder_thread.h"
 
 namespace Sounder {
 class Recorder {
 public:
-    Recorder(Config* in_cfg, unsigned int core_start = 0u);
+    explicit Recorder(Config* in_cfg);
     ~Recorder();
 
     void do_it();
     int getRecordedFrameNum();
     std::string getTraceFileName() { return this->cfg_->trace_file(); }
+    inline Telemetry& telemetry(void) { return *this->telemetry_; }
 
 private:
     void gc(void);
+    // Recorder threads for 'antennas' antennas starting at antenna_offset,
+    // returns the antennas of each thread
+    size_t startRecorders(size_t antenna_offset, size_t antennas);
+    // Waits for the recorders to write what they have left
+    void stopRecorders(void);
+    // Hands the events queued by the rx threads to the recorders or the
+    // fan-out senders, returns the number of events dequeued
+    size_t dispatchEvents(
+        moodycamel::ConsumerToken& ctok, size_t thread_antennas);
 
-    // buffer length of each rx thread
-    static const int kSampleBufferFrameNum;
     // dequeue bulk size, used to reduce the overhead of dequeue in main thread
     static const int KDequeueBulkSize;
 
     Config* cfg_;
     std::unique_ptr<Receiver> receiver_;
     SampleBuffer* rx_buffer_;
+    std::unique_ptr<Telemetry> telemetry_;
+    std::unique_ptr<LiveRing> live_ring_;
+    // record_policy "trigger" frames, shared by the recorder threads
+    std::unique_ptr<RecordTrigger> record_trigger_;
     size_t rx_thread_buff_size_;
 
     //RecorderWorker worker_;
     std::vector<Sounder::RecorderThread*> recorders_;
+    // With fanout_nodes, the packages go to these instead of recorders_.
+    // A node receives them with fanout_receiver_.
+    std::vector<Sounder::FanoutSender*> fanout_;
+    std::unique_ptr<FanoutReceiver> fanout_receiver_;
     size_t max_frame_number_;
 
     moodycamel::ConcurrentQueue<Event_data> message_queue_;
-
-    /* Core assignment start variables */
-    const unsigned int kMainDispatchCore;
-    const unsigned int kRecorderCore;
-    const unsigned int kRecvCore;
 }; /* class Recorder */
 }; /* Namespace sounder */
 #endif /* SOUDER_RECORDER_H_ */
@@ -9,8 +9,13 @@ Event based message queue thread class for the recorder worker
 #ifndef SOUDER_RECORDER_THREAD_H_
 #define SOUDER_RECORDER_THREAD_H_
 
+#include "csi_stage.h"
+#include "record_policy.h"
 #include "recorder_worker.h"
+#include <atomic>
 #include <condition_variable>
+#include <deque>
+#include <memory>
 #include <mutex>
 
 namespace Sounder {
@@ -18,48 +23,97 @@ class RecorderThread {
 public:
     enum RecordEventType { kThreadTermination, kTaskRecord };
 
+    /* How the thread waits for new events
+     * kWaitSpin     - polls the queue, lowest latency, burns the core
+     * kWaitAdaptive - polls spin_count times, then parks until a producer
+     *                 signals; producers only signal a parked thread */
+    enum WaitMode { kWaitSpin, kWaitAdaptive };
+
     struct RecordEventData {
         RecordEventType event_type;
         int data;
+        uint32_t gen;
         SampleBuffer* rx_buffer;
         size_t rx_buff_size;
     };
 
     RecorderThread(Config* in_cfg, size_t thread_id, int core,
         size_t queue_size, size_t antenna_offset, size_t num_antennas,
-        bool wait_signal = true);
+        RecordStats* stats, LiveRing* live_ring = nullptr,
+        WaitMode wait_mode = kWaitAdaptive,
+        size_t spin_count = 0, RecordTrigger* trigger = nullptr);
     ~RecorderThread();
 
     void Start(void);
     void Stop(void);
     bool DispatchWork(RecordEventData event);
+    // For producers other than the dispatcher, each with its own token
+    bool DispatchWork(RecordEventData event, moodycamel::ProducerToken& token);
+    inline moodycamel::ProducerToken GetProducerToken(void)
+    {
+        return moodycamel::ProducerToken(this->event_queue_);
+    }
+    inline const RecorderWorker& GetWorker(void) const
+    {
+        return this->worker_;
+    }
 
 private:
+    // dequeue bulk size, used to reduce the overhead of dequeue
+    static const size_t kDequeueBulkSize;
+
     /*Main threading loop */
     void DoRecording(void);
+    void Park(void);
     void HandleEvent(RecordEventData event);
+    // Records pkg, or holds it for the csi batch, and frees its slot
+    void RecordEvent(RecordEventData event, Package* pkg);
+    // Holds pkg until the record policy decides its frame
+    void HoldEvent(RecordEventData event, Package* pkg);
+    // Records or frees the held packages of the decided frames, all of
+    // them with 'all'
+    void ReleaseHeld(bool all);
+    // Records pkg if the policy keeps its frame, frees its slot if not
+    void DecideEvent(RecordEventData event, Package* pkg);
+    // Estimates and records the pilots HandleEvent held back
+    void FlushCsi(void);
     void Finalize();
 
     //1 - Producer (dispatcher), 1 - Consumer
     moodycamel::ConcurrentQueue<RecordEventData> event_queue_;
     moodycamel::ProducerToken producer_token_;
+    Config* cfg_;
     RecorderWorker worker_;
     std::thread thread_;
 
+    /* With record_csi, the pilots of one dequeue are estimated in a single
+     * batch. Their slots stay claimed until FlushCsi records them. */
+    std::unique_ptr<CsiStage> csi_;
+    std::vector<RecordEventData> csi_events_;
+    std::vector<Package*> csi_pkgs_;
+    std::vector<float> csi_out_;
+
+    /* With a record_policy other than "all", packages wait claimed in
+     * held_ until the policy decides their frame */
+    std::unique_ptr<RecordPolicy> policy_;
+    std::deque<std::pair<RecordEventData, Package*>> held_;
+    // newest frame seen + 1
+    size_t frames_seen_;
+
     size_t id_;
     size_t package_data_length_;
+    RecordStats* stats_;
 
     /* >= 0 to assign a core to the thread
          * <0   to disable thread core assignment */
     int core_alloc_;
 
     /* Synchronization for startup and sleeping */
-    /* Setting wait signal to false will disable the thread waiting on new message
-         * may cause excessive CPU load for infrequent messages.  
-         * However, when the message processing time ~= queue posting time the mutex could 
-         * become unnecessary work
-         */
-    bool wait_signal_;
+    WaitMode wait_mode_;
+    size_t spin_count_;
+    /* Set by the consumer before it parks, producers only take sync_ and
+     * notify when it is set */
+    std::atomic<bool> parked_;
     std::mutex sync_;
     std::condition_variable condition_;
     bool running_;
@@ -10,52 +10,161 @@
 #define SOUDER_RECORDER_WORKER_H_
 
 #include "H5Cpp.h"
+#include "chunk_codec.h"
 #include "config.h"
+#include "frame_tracker.h"
+#include "live_ring.h"
 #include "receiver.h"
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <vector>
 
 namespace Sounder {
 class RecorderWorker {
 public:
-    RecorderWorker(Config* in_cfg, size_t antenna_offset, size_t num_antennas);
+    RecorderWorker(Config* in_cfg, size_t antenna_offset, size_t num_antennas,
+        RecordStats* stats, LiveRing* live_ring = nullptr);
     ~RecorderWorker();
 
     void init(void);
     void finalize(void);
+    // Flushes the file when record_flush_ms has passed since the last
+    // flush. Called with idle set while the queue is empty, a recorder
+    // that is never idle flushes once it is kFlushOverdue intervals late.
+    void flush(bool idle);
     herr_t record(int tid, Package* pkg);
+    // pkg was received but not kept by the record_policy
+    void skip(const Package* pkg);
+    // Channel estimate of a pilot package, CsiStage::record_len() floats
+    void recordCsi(const Package* pkg, const float* csi);
 
-    inline size_t num_antennas(void) { return num_antennas_; }
-    inline size_t antenna_offset(void) { return antenna_offset_; }
+    inline size_t num_antennas(void) const { return num_antennas_; }
+    inline size_t antenna_offset(void) const { return antenna_offset_; }
+    inline const std::string& hdf5_name(void) const { return hdf5_name_; }
 
 private:
-    // pilot dataset size increment
-    static const int kConfigPilotExtentStep;
-    // data dataset size increment
-    static const int kConfigDataExtentStep;
+    // flush intervals after which a busy recorder flushes anyway
+    static const size_t kFlushOverdue;
+    // chunks held by the raw data chunk cache when it is auto sized
+    static const size_t kChunkCacheChunks;
+    // hash table slots of the raw data chunk cache (prime)
+    static const size_t kChunkCacheSlots;
+    // compressed chunks in flight before a flush waits for the oldest
+    static const size_t kMaxPendingChunks;
+
+    // Frame-aligned staging area for one dataset, written with one hyperslab
+    template <typename T> struct RecordBatch {
+        std::vector<T> samples;
+        size_t syms_per_frame;
+        // values per (symbol, antenna) record
+        size_t record_len;
+        // number of frames touched in the current window, 0 if empty
+        size_t num_frames;
+    };
+
+    // Chunk of one batch window and cell, compressed on the chunk pool
+    enum ChunkState { kChunkPending, kChunkDone, kChunkFailed };
+    struct PendingChunk {
+        H5::DataSet* dataset;
+        std::vector<hsize_t> offset;
+        std::vector<char> raw;
+        std::vector<char> stored;
+        std::atomic<int> state;
+    };
 
     void gc(void);
+    template <typename T>
+    void initBatch(
+        RecordBatch<T>& batch, size_t syms_per_frame, size_t record_len);
+    template <typename T>
+    void storeSymbol(H5::DataSet* dataset, RecordBatch<T>& batch,
+        const hsize_t* offset, const T* data);
+    template <typename T>
+    void writeSymbols(H5::DataSet* dataset, const hsize_t* offset,
+        const hsize_t* count, const T* data);
+    template <typename T>
+    void flushBatch(H5::DataSet* dataset, RecordBatch<T>& batch);
+    void flushBatches(void);
+    // Grows the frame extent of a dataset to hold frame_id
+    void growDataset(H5::DataSet* dataset, size_t& extent, size_t frame_id,
+        size_t syms_per_frame, size_t record_len);
+    template <typename T>
+    void queueChunks(H5::DataSet* dataset, const RecordBatch<T>& batch);
+    // Writes compressed chunks in order, waiting until at most keep are
+    // still in flight
+    void writeChunks(size_t keep);
+    // Appends the frames the tracker closed to /Data/FrameIndex
+    void writeFrameIndex(void);
+    void getChunkDims(size_t syms_per_frame, hsize_t record_bytes,
+        hsize_t record_len, hsize_t* cdims);
     herr_t initHDF5();
     void openHDF5();
     void closeHDF5();
     void finishHDF5();
 
     Config* cfg_;
+    RecordStats* stats_;
+    // shared with the other recorders, nullptr without live_ring_frames
+    LiveRing* live_ring_;
     H5std_string hdf5_name_;
 
     H5::H5File* file_;
+    H5::FileAccPropList file_access_prop_;
     // Group* group;
     H5::DSetCreatPropList pilot_prop_;
     H5::DSetCreatPropList noise_prop_;
     H5::DSetCreatPropList data_prop_;
+    H5::DSetCreatPropList csi_prop_;
 
     H5::DataSet* pilot_dataset_;
     H5::DataSet* noise_dataset_;
     H5::DataSet* data_dataset_;
+    H5::DataSet* csi_dataset_;
+    H5::DataSet* frame_index_dataset_;
 
     size_t frame_number_pilot_;
     size_t frame_number_noise_;
     size_t frame_number_data_;
+    size_t frame_number_csi_;
+
+    // highest frame id recorded + 1, the final extent of the datasets
+    size_t frames_recorded_;
+
+    // Received symbols of the open frames, nullptr without
+    // record_frame_index. Closed frames go to /Data/FrameIndex.
+    std::unique_ptr<FrameTracker> frame_tracker_;
+    std::unique_ptr<H5::CompType> frame_index_type_;
+
+    // The file stays open for the whole capture
+    bool file_open_;
+    // records since the last flush
+    bool dirty_;
+    uint64_t last_flush_ns_;
+    uint64_t flush_interval_ns_;
+
+    // Batched writes (disabled when batch_frames_ is 0)
+    size_t batch_frames_;
+    size_t batch_start_frame_;
+    RecordBatch<short> pilot_batch_;
+    RecordBatch<short> noise_batch_;
+    RecordBatch<short> data_batch_;
+    RecordBatch<float> csi_batch_;
+
+    // Raw pilots go to /Data/Pilot_Samples, estimates to /Data/CSI
+    bool record_pilots_;
+    bool record_csi_;
+    // floats per estimate
+    size_t csi_len_;
 
-    size_t max_frame_number_;
+    // Whole batch windows are compressed here and written with
+    // H5Dwrite_chunk, bypassing the hdf5 filter pipeline
+    ChunkCodec codec_;
+    bool swap_bytes_;
+    std::deque<std::unique_ptr<PendingChunk>> pending_chunks_;
+    std::vector<std::unique_ptr<PendingChunk>> spare_chunks_;
+    // declared last, its threads are joined before the chunks go away
+    std::unique_ptr<ChunkPool> chunk_pool_;
 
     size_t antenna_offset_;
     size_t num_antennas_;
@@ -0,0 +1,104 @@
+/*
+ Copyright (c) 2018-2020, Rice University
+ RENEW OPEN SOURCE LICENSE: http://renew-wireless.org/license
+
+----------------------------------------------------------------------
+ Recycling ring of package slots shared by one rx thread (producer)
+ and the recorder threads that write its packages (consumers)
+---------------------------------------------------------------------
+*/
+#ifndef SOUDER_SAMPLE_BUFFER_H_
+#define SOUDER_SAMPLE_BUFFER_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// What the rx thread does when the slot it wants to reuse is still queued
+enum class BackpressurePolicy {
+    kBlock, // wait for the recorder to release the slot
+    kDropOldest, // take the slot back, the queued package is skipped
+    kDropNewest // receive into a scratch slot, the new package is dropped
+};
+
+BackpressurePolicy backpressurePolicyFromString(const std::string& name);
+
+/*
+ * Slots are handed out in order by the single producer. Each slot carries
+ * a generation number in its state word; the generation is also sent with
+ * the queued event so a consumer can tell that a slot was taken back
+ * (kDropOldest) or reused before it got to it.
+ */
+class SampleBuffer {
+public:
+    static constexpr size_t kCacheLineSize = 64;
+    static constexpr size_t kHugePageSize = 2 * 1024 * 1024;
+    static constexpr int kInvalidSlot = -1;
+
+    SampleBuffer(void);
+    ~SampleBuffer(void);
+
+    // Slots are rounded up to a multiple of kCacheLineSize. The memory is
+    // mapped but not touched, see prefault().
+    void init(size_t num_slots, size_t slot_size, BackpressurePolicy policy,
+        bool huge_pages = true);
+    // Touches every page from the calling thread so that, with the default
+    // first-touch policy, the buffer lands on that thread's NUMA node
+    void prefault(void);
+
+    inline size_t num_slots(void) const { return this->num_slots_; }
+    inline size_t slot_size(void) const { return this->slot_size_; }
+    inline bool huge_pages(void) const { return this->huge_pages_; }
+    inline char* slot(size_t index)
+    {
+        return this->buffer_ + (index * this->slot_size_);
+    }
+
+    /* Producer side (rx thread only) */
+    // Returns the next slot to fill or kInvalidSlot if the package must be
+    // dropped. The slot generation to publish with it is stored in 'gen'.
+    int acquireSlot(uint32_t& gen);
+    // Makes a filled slot visible to the consumers
+    void publishSlot(size_t index, uint32_t gen);
+
+    /* Consumer side (recorder threads) */
+    // Returns false if the slot no longer holds the package of 'gen'
+    bool claimSlot(size_t index, uint32_t gen);
+    void releaseSlot(size_t index, uint32_t gen);
+    // True once the package of 'gen' is written out or was dropped
+    bool isSlotReleased(size_t index, uint32_t gen) const;
+
+    inline size_t dropped_newest(void) const { return this->dropped_newest_; }
+    inline size_t dropped_oldest(void) const { return this->dropped_oldest_; }
+    inline size_t blocked(void) const { return this->blocked_; }
+    inline size_t stale(void) const { return this->stale_.load(); }
+
+private:
+    // Slot state word: (generation << kStateBits) | state
+    enum SlotState : uint32_t { kSlotFree = 0, kSlotQueued = 1, kSlotBusy = 2 };
+    static constexpr uint32_t kStateBits = 2;
+    static constexpr uint32_t kStateMask = (1u << kStateBits) - 1;
+
+    void unmap(void);
+
+    char* buffer_;
+    size_t buffer_size_;
+    bool huge_pages_;
+    std::unique_ptr<std::atomic<uint32_t>[]> state_;
+    size_t num_slots_;
+    size_t slot_size_;
+    BackpressurePolicy policy_;
+
+    // Producer owned, kept away from the consumer counters
+    alignas(kCacheLineSize) size_t head_;
+    size_t dropped_newest_;
+    size_t dropped_oldest_;
+    size_t blocked_;
+
+    // Consumer owned
+    alignas(kCacheLineSize) std::atomic<size_t> stale_;
+};
+
+#endif /* SOUDER_SAMPLE_BUFFER_H_ */
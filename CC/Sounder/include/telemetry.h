@@ -0,0 +1,141 @@
+/*
+ Copyright (c) 2018-2020, Rice University
+ RENEW OPEN SOURCE LICENSE: http://renew-wireless.org/license
+
+----------------------------------------------------------------------
+ Always-on counters for the capture pipeline, dumped periodically
+---------------------------------------------------------------------
+*/
+#ifndef SOUDER_TELEMETRY_H_
+#define SOUDER_TELEMETRY_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+ * Every counter has exactly one writer thread, so updates are a relaxed
+ * load and store (no locked instruction). Each stage's counters get their
+ * own cache line so threads never share a line they write to.
+ */
+typedef std::atomic<uint64_t> TelemetryCounter;
+
+static inline void telemetryAdd(TelemetryCounter& counter, uint64_t value = 1)
+{
+    counter.store(counter.load(std::memory_order_relaxed) + value,
+        std::memory_order_relaxed);
+}
+
+static inline void telemetryMax(TelemetryCounter& counter, uint64_t value)
+{
+    if (value > counter.load(std::memory_order_relaxed))
+        counter.store(value, std::memory_order_relaxed);
+}
+
+static inline uint64_t telemetryNowNs(void)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+// Latency histogram, bucket i counts [2^i, 2^(i+1)) microseconds
+static constexpr size_t kLatencyBuckets = 32;
+
+// One per rx thread
+struct alignas(64) RxStats {
+    TelemetryCounter packets;
+    TelemetryCounter short_reads; // radioRx returned less than a symbol
+    TelemetryCounter read_errors; // radioRx returned an error
+    TelemetryCounter drops; // packages dropped by the backpressure policy
+    TelemetryCounter radios; // radios received by the thread, last sample
+};
+
+// Main dispatch thread (unused with direct routing)
+struct alignas(64) DispatchStats {
+    TelemetryCounter packets;
+};
+
+// One per recorder thread
+struct alignas(64) RecordStats {
+    TelemetryCounter packets;
+    TelemetryCounter queue_depth; // events left in the queue, last sample
+    TelemetryCounter extends; // hdf5 dataset extend events
+    TelemetryCounter chunk_bytes; // chunks written compressed, raw size
+    TelemetryCounter stored_bytes; // same chunks, size in the file
+    TelemetryCounter frames_complete; // frames closed with every symbol
+    TelemetryCounter frames_incomplete;
+    TelemetryCounter records_missing; // symbol records of those frames
+    TelemetryCounter policy_skipped; // packages record_policy left out
+    TelemetryCounter triggers; // frames that passed record_trigger_db
+    TelemetryCounter latency_max_ns; // since the start
+    TelemetryCounter latency[kLatencyBuckets]; // radioRx return to record
+};
+
+// Latency from the radioRx return stamped in 'rx_time_ns' until now
+static inline void telemetryLatency(RecordStats& stats, uint64_t rx_time_ns)
+{
+    uint64_t latency_ns = telemetryNowNs() - rx_time_ns;
+    uint64_t latency_us = latency_ns / 1000;
+    size_t bucket
+        = (latency_us == 0) ? 0 : (63 - __builtin_clzll(latency_us));
+    if (bucket >= kLatencyBuckets)
+        bucket = kLatencyBuckets - 1;
+    telemetryAdd(stats.latency[bucket]);
+    telemetryMax(stats.latency_max_ns, latency_ns);
+}
+
+class Telemetry {
+public:
+    Telemetry(size_t num_rx_threads, size_t num_recorder_threads);
+    ~Telemetry();
+
+    inline size_t num_rx_threads(void) const { return this->num_rx_threads_; }
+    inline size_t num_recorder_threads(void) const
+    {
+        return this->num_recorder_threads_;
+    }
+    inline RxStats& rx(size_t tid) { return this->rx_stats_[tid]; }
+    inline DispatchStats& dispatch(void) { return *this->dispatch_stats_; }
+    inline RecordStats& record(size_t tid) { return this->record_stats_[tid]; }
+
+    // Appends one csv row per stage to 'filename' every 'interval_ms'
+    void start(const std::string& filename, size_t interval_ms);
+    void stop(void);
+
+    // Upper bound in microseconds of the bucket holding the given fraction
+    static uint64_t latencyPercentile(const std::vector<uint64_t>& histogram,
+        uint64_t total, double fraction);
+
+private:
+    void dumpLoop(void);
+    void dump(double elapsed_s, double interval_s);
+
+    size_t num_rx_threads_;
+    size_t num_recorder_threads_;
+    std::unique_ptr<RxStats[]> rx_stats_;
+    std::unique_ptr<DispatchStats> dispatch_stats_;
+    std::unique_ptr<RecordStats[]> record_stats_;
+
+    // Values at the previous dump, only touched by the dump thread
+    std::vector<uint64_t> last_rx_packets_;
+    uint64_t last_dispatch_packets_;
+    std::vector<uint64_t> last_record_packets_;
+    std::vector<std::vector<uint64_t>> last_latency_;
+
+    FILE* fp_;
+    size_t interval_ms_;
+    std::thread thread_;
+    std::mutex sync_;
+    std::condition_variable condition_;
+    bool running_;
+};
+
+#endif /* SOUDER_TELEMETRY_H_ */
@@ -0,0 +1,49 @@
+/*
+ Copyright (c) 2018-2020, Rice University
+ RENEW OPEN SOURCE LICENSE: http://renew-wireless.org/license
+
+----------------------------------------------------------------------
+ Uplink time-domain data of one client held in memory for the whole
+ run, so the client TX loop hands out pointers instead of reading the
+ file for every symbol
+---------------------------------------------------------------------
+*/
+#ifndef SOUDER_UL_TX_DATA_H_
+#define SOUDER_UL_TX_DATA_H_
+
+#include <complex>
+#include <cstddef>
+#include <string>
+
+/*
+ * The file is a sequence of records of record_samps samples each
+ * (frame * UL slots * channel order, as written by DataGenerator). With
+ * preload the file is read into page aligned anonymous memory, otherwise
+ * it is mapped read-only with every page faulted in up front. Both try
+ * to lock the pages so they cannot be evicted while transmitting.
+ */
+class UlTxData {
+public:
+    // Throws std::runtime_error if the file cannot be read or holds no
+    // complete record
+    UlTxData(const std::string& filename, size_t record_samps, bool preload);
+    ~UlTxData();
+    UlTxData(const UlTxData&) = delete;
+    UlTxData& operator=(const UlTxData&) = delete;
+
+    inline size_t records(void) const { return this->records_; }
+    // Record 'index', wrapping around the end of the file
+    inline const std::complex<float>* record(size_t index) const
+    {
+        return this->data_ + (index % this->records_) * this->record_samps_;
+    }
+
+private:
+    std::complex<float>* data_;
+    size_t bytes_;
+    size_t record_samps_;
+    size_t records_;
+    bool mapped_;
+};
+
+#endif /* SOUDER_UL_TX_DATA_H_ */
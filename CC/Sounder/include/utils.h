@@ -50,6 +50,18 @@ public:
     static std::vector<uint32_t> cint16_to_uint32(
         const std::vector<std::complex<int16_t>>& in, bool conj,
         const std::string& order);
+    // The same conversions into len samples at out, through the SIMD
+    // kernels and without allocating. Floats are scaled by 'scale' and
+    // saturated to the int16 range. order is "IQ" or "QI".
+    static void cint16_to_cfloat(const std::complex<int16_t>* in, size_t len,
+        std::complex<float>* out, float scale = 1.f / 32768);
+    static void float_to_cint16(const float* re, const float* im, size_t len,
+        std::complex<int16_t>* out, float scale = 32768);
+    static void uint32tocfloat(const uint32_t* in, size_t len,
+        const std::string& order, std::complex<float>* out);
+    // out may be the memory of in
+    static void cint16_to_uint32(const std::complex<int16_t>* in, size_t len,
+        bool conj, const std::string& order, uint32_t* out);
     static std::vector<std::vector<size_t>> loadSymbols(
         const std::vector<std::string>& frames, char sym);
     static void loadDevices(
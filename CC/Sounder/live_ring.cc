@@ -0,0 +1,259 @@
+/*
+ Copyright (c) 2018-2020, Rice University
+ RENEW OPEN SOURCE LICENSE: http://renew-wireless.org/license
+
+----------------------------------------------------------------------
+ Shared memory ring of the latest received frames
+---------------------------------------------------------------------
+*/
+
+#include "include/live_ring.h"
+#include "include/logger.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const uint64_t kLiveCountMask = (1ull << kLiveRingCountBits) - 1;
+static const size_t kLiveAlign = 64;
+
+static size_t alignUp(size_t bytes)
+{
+    return (bytes + kLiveAlign - 1) / kLiveAlign * kLiveAlign;
+}
+
+// Raises value to at least frame
+static void storeMax(std::atomic<int64_t>& value, int64_t frame)
+{
+    int64_t cur = value.load(std::memory_order_relaxed);
+    while ((cur < frame)
+        && (value.compare_exchange_weak(
+               cur, frame, std::memory_order_release)
+            == false)) {
+    }
+}
+
+namespace Sounder {
+LiveRing::LiveRing(Config* cfg, const std::string& name, size_t num_slots)
+    : cfg_(cfg)
+    , name_(name)
+    , size_(0)
+    , base_(nullptr)
+    , header_(nullptr)
+{
+    const size_t IQ = 2 * cfg->samps_per_symbol();
+    const size_t block = cfg->num_cells() * cfg->getTotNumAntennas() * IQ
+        * sizeof(short);
+    const size_t pilot_offset = alignUp(sizeof(LiveSlotHeader));
+    const size_t ul_offset
+        = pilot_offset + alignUp(cfg->pilot_syms_per_frame() * block);
+    const size_t slot_bytes
+        = ul_offset + alignUp(cfg->ul_syms_per_frame() * block);
+    const size_t slots_offset = alignUp(sizeof(LiveRingHeader));
+    this->size_ = slots_offset + num_slots * slot_bytes;
+    this->frame_records_
+        = (cfg->pilot_syms_per_frame() + cfg->ul_syms_per_frame())
+        * cfg->getTotNumAntennas();
+
+    // A segment left by an earlier run is truncated and laid out again
+    int fd = shm_open(name.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (fd < 0) {
+        MLPD_ERROR("Live ring: shm_open %s failed: %s\n", name.c_str(),
+            std::strerror(errno));
+        throw std::runtime_error("Could not create the live ring");
+    }
+    if (ftruncate(fd, this->size_) != 0) {
+        close(fd);
+        shm_unlink(name.c_str());
+        throw std::runtime_error("Could not size the live ring");
+    }
+    void* base = mmap(
+        nullptr, this->size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        shm_unlink(name.c_str());
+        throw std::runtime_error("Could not map the live ring");
+    }
+    this->base_ = static_cast<char*>(base);
+
+    // the new pages are zero, so every slot state is "no frame"
+    this->header_ = reinterpret_cast<LiveRingHeader*>(this->base_);
+    this->header_->version = kLiveRingVersion;
+    this->header_->num_slots = num_slots;
+    this->header_->num_cells = cfg->num_cells();
+    this->header_->num_antennas = cfg->getTotNumAntennas();
+    this->header_->pilot_syms = cfg->pilot_syms_per_frame();
+    this->header_->ul_syms = cfg->ul_syms_per_frame();
+    this->header_->samps_per_symbol = cfg->samps_per_symbol();
+    this->header_->slot_bytes = slot_bytes;
+    this->header_->slots_offset = slots_offset;
+    this->header_->pilot_offset = pilot_offset;
+    this->header_->ul_offset = ul_offset;
+    this->header_->latest_frame.store(-1, std::memory_order_relaxed);
+    this->header_->newest_frame.store(-1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    this->header_->magic = kLiveRingMagic;
+    MLPD_INFO("Live ring %s: %zu frames of %zu bytes\n", name.c_str(),
+        num_slots, slot_bytes);
+}
+
+LiveRing::~LiveRing()
+{
+    if (this->base_ != nullptr) {
+        munmap(this->base_, this->size_);
+        shm_unlink(this->name_.c_str());
+    }
+}
+
+LiveSlotHeader* LiveRing::slot(size_t frame_id) const
+{
+    return reinterpret_cast<LiveSlotHeader*>(this->base_
+        + this->header_->slots_offset
+        + (frame_id % this->header_->num_slots) * this->header_->slot_bytes);
+}
+
+void LiveRing::write(const Package& pkg)
+{
+    const Config::SymbolInfo& symbol
+        = this->cfg_->symbolInfo(pkg.frame_id, pkg.symbol_id);
+    size_t offset;
+    int index;
+    size_t syms;
+    if ((this->cfg_->reciprocal_calib() == true) || (symbol.type == 'P')) {
+        offset = this->header_->pilot_offset;
+        index = this->cfg_->getClientId(pkg.frame_id, pkg.symbol_id);
+        syms = this->header_->pilot_syms;
+    } else if (symbol.type == 'U') {
+        offset = this->header_->ul_offset;
+        index = symbol.ul;
+        syms = this->header_->ul_syms;
+    } else {
+        return;
+    }
+    if ((index < 0) || (static_cast<size_t>(index) >= syms)
+        || (pkg.cell_id >= this->header_->num_cells)
+        || (pkg.ant_id >= this->header_->num_antennas))
+        return;
+
+    // Claim the slot for this frame before any sample is overwritten
+    LiveSlotHeader* slot = this->slot(pkg.frame_id);
+    const uint64_t tag = static_cast<uint64_t>(pkg.frame_id) + 1;
+    uint64_t state = slot->state.load(std::memory_order_acquire);
+    while (((state >> kLiveRingCountBits) < tag)
+        && (slot->state.compare_exchange_weak(state,
+                tag << kLiveRingCountBits, std::memory_order_acq_rel)
+            == false)) {
+    }
+    if ((state >> kLiveRingCountBits) > tag)
+        return; // a newer frame has the slot
+    storeMax(this->header_->newest_frame, pkg.frame_id);
+
+    const size_t IQ = 2 * this->header_->samps_per_symbol;
+    size_t record = (pkg.cell_id * syms + index) * this->header_->num_antennas
+        + pkg.ant_id;
+    short* dst = reinterpret_cast<short*>(reinterpret_cast<char*>(slot)
+                     + offset)
+        + record * IQ;
+    std::memcpy(dst, pkg.samples(), IQ * sizeof(short));
+
+    state = slot->state.load(std::memory_order_relaxed);
+    while (((state >> kLiveRingCountBits) == tag)
+        && (slot->state.compare_exchange_weak(
+                state, state + 1, std::memory_order_acq_rel)
+            == false)) {
+    }
+    if (((state >> kLiveRingCountBits) == tag)
+        && (((state & kLiveCountMask) + 1) == this->frame_records_))
+        storeMax(this->header_->latest_frame, pkg.frame_id);
+}
+}; /* End namespace Sounder */
+
+struct LiveRingReader {
+    const char* base;
+    size_t size;
+    const LiveRingHeader* header;
+};
+
+static const LiveSlotHeader* readerSlot(void* ring, uint64_t frame)
+{
+    const LiveRingReader* reader = static_cast<LiveRingReader*>(ring);
+    const LiveRingHeader* header = reader->header;
+    const LiveSlotHeader* slot
+        = reinterpret_cast<const LiveSlotHeader*>(reader->base
+            + header->slots_offset
+            + (frame % header->num_slots) * header->slot_bytes);
+    uint64_t state = slot->state.load(std::memory_order_acquire);
+    return ((state >> kLiveRingCountBits) == frame + 1) ? slot : nullptr;
+}
+
+extern "C" {
+void* LiveRing_attach(const char* name)
+{
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0)
+        return nullptr;
+    struct stat st;
+    void* base = MAP_FAILED;
+    if ((fstat(fd, &st) == 0)
+        && (static_cast<size_t>(st.st_size) >= sizeof(LiveRingHeader)))
+        base = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+        return nullptr;
+    const LiveRingHeader* header = static_cast<const LiveRingHeader*>(base);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if ((header->magic != kLiveRingMagic)
+        || (header->version != kLiveRingVersion)
+        || (header->slots_offset + header->num_slots * header->slot_bytes
+            > static_cast<size_t>(st.st_size))) {
+        munmap(base, st.st_size);
+        return nullptr;
+    }
+    return new LiveRingReader { static_cast<const char*>(base),
+        static_cast<size_t>(st.st_size), header };
+}
+
+void LiveRing_detach(void* ring)
+{
+    LiveRingReader* reader = static_cast<LiveRingReader*>(ring);
+    munmap(const_cast<char*>(reader->base), reader->size);
+    delete reader;
+}
+
+const LiveRingHeader* LiveRing_header(void* ring)
+{
+    return static_cast<LiveRingReader*>(ring)->header;
+}
+
+int64_t LiveRing_latestFrame(void* ring)
+{
+    return LiveRing_header(ring)->latest_frame.load(std::memory_order_acquire);
+}
+
+const short* LiveRing_pilots(void* ring, uint64_t frame)
+{
+    const LiveSlotHeader* slot = readerSlot(ring, frame);
+    if (slot == nullptr)
+        return nullptr;
+    return reinterpret_cast<const short*>(reinterpret_cast<const char*>(slot)
+        + LiveRing_header(ring)->pilot_offset);
+}
+
+const short* LiveRing_uplink(void* ring, uint64_t frame)
+{
+    const LiveSlotHeader* slot = readerSlot(ring, frame);
+    if (slot == nullptr)
+        return nullptr;
+    return reinterpret_cast<const short*>(reinterpret_cast<const char*>(slot)
+        + LiveRing_header(ring)->ul_offset);
+}
+
+int LiveRing_frameValid(void* ring, uint64_t frame)
+{
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return (readerSlot(ring, frame) != nullptr) ? 1 : 0;
+}
+}
@@ -0,0 +1,219 @@
+/*
+ Copyright (c) 2018-2020, Rice University
+ RENEW OPEN SOURCE LICENSE: http://renew-wireless.org/license
+
+----------------------------------------------------------------------
+ Per thread log rings and the thread draining them
+---------------------------------------------------------------------
+*/
+
+#include "include/logger.h"
+
+#ifdef MLPD_ASYNC_LOG
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+std::atomic<bool> mlpd_log_sync(false);
+
+namespace {
+// Records per thread, a full ring drops messages instead of blocking
+const size_t kRingSlots = 512;
+// Drain thread sleep when all rings are empty
+const std::chrono::milliseconds kDrainIdle(1);
+
+// Single producer (the logging thread), single consumer (whoever holds
+// the drain lock)
+struct Ring {
+    MlpdRecord records[kRingSlots];
+    alignas(64) std::atomic<size_t> head;
+    alignas(64) std::atomic<size_t> tail;
+    std::atomic<size_t> dropped;
+    // the thread exited, the ring goes away once drained
+    std::atomic<bool> orphaned;
+};
+
+class Drain {
+public:
+    Drain()
+        : running_(true)
+    {
+        this->thread_ = std::thread(&Drain::loop, this);
+        std::atexit([] { Drain::get().stop(); });
+    }
+
+    // Never destroyed, threads may log until the process is gone
+    static Drain& get(void)
+    {
+        static Drain* drain = new Drain();
+        return *drain;
+    }
+
+    void add(Ring* ring)
+    {
+        std::lock_guard<std::mutex> lock(this->rings_mutex_);
+        this->rings_.push_back(ring);
+    }
+
+    void add(MlpdSite* site)
+    {
+        std::lock_guard<std::mutex> lock(this->rings_mutex_);
+        this->sites_.push_back(site);
+    }
+
+    // Formats what is queued, returns the number of records written
+    size_t drain(void)
+    {
+        std::lock_guard<std::mutex> lock(this->drain_mutex_);
+        std::vector<Ring*> rings;
+        {
+            std::lock_guard<std::mutex> rings_lock(this->rings_mutex_);
+            rings = this->rings_;
+        }
+        size_t count = 0;
+        for (Ring* ring : rings) {
+            bool orphaned = ring->orphaned.load(std::memory_order_acquire);
+            size_t tail = ring->tail.load(std::memory_order_relaxed);
+            size_t head = ring->head.load(std::memory_order_acquire);
+            for (; tail != head; tail++, count++) {
+                const MlpdRecord& record = ring->records[tail % kRingSlots];
+                record.formatter(record);
+                this->touch(record.stream);
+            }
+            ring->tail.store(tail, std::memory_order_release);
+            size_t dropped = ring->dropped.exchange(0);
+            if (dropped > 0) {
+                mlpd_output_log_header(stdout, MLPD_LOG_LEVEL_WARN);
+                fprintf(stdout, "%zu log messages dropped, ring full\n",
+                    dropped);
+                this->touch(stdout);
+            }
+            if (orphaned == true) {
+                std::lock_guard<std::mutex> rings_lock(this->rings_mutex_);
+                auto it = std::find(
+                    this->rings_.begin(), this->rings_.end(), ring);
+                this->rings_.erase(it);
+                delete ring;
+            }
+        }
+        for (FILE* stream : this->streams_)
+            fflush(stream);
+        this->streams_.clear();
+        return count;
+    }
+
+    void stop(void)
+    {
+        this->running_ = false;
+        if (this->thread_.joinable())
+            this->thread_.join();
+        mlpd_log_sync = true;
+        this->drain();
+        this->reportSites();
+    }
+
+private:
+    // Drops no later message was left to report
+    void reportSites(void)
+    {
+        std::lock_guard<std::mutex> lock(this->rings_mutex_);
+        for (MlpdSite* site : this->sites_) {
+            uint32_t suppressed = site->suppressed.exchange(0);
+            if (suppressed == 0)
+                continue;
+            // the format without its newline
+            int len = std::strlen(site->format);
+            if ((len > 0) && (site->format[len - 1] == '\n'))
+                len--;
+            mlpd_output_log_header(site->stream, site->level);
+            fprintf(site->stream,
+                "%u more like \"%.*s\" were rate limited\n", suppressed, len,
+                site->format);
+            fflush(site->stream);
+        }
+    }
+
+    void loop(void)
+    {
+        while (this->running_ == true) {
+            if (this->drain() == 0)
+                std::this_thread::sleep_for(kDrainIdle);
+        }
+    }
+
+    void touch(FILE* stream)
+    {
+        if (std::find(this->streams_.begin(), this->streams_.end(), stream)
+            == this->streams_.end())
+            this->streams_.push_back(stream);
+    }
+
+    // guards sites_ too
+    std::mutex rings_mutex_;
+    std::vector<Ring*> rings_;
+    std::vector<MlpdSite*> sites_;
+    // serializes the consumers of the rings
+    std::mutex drain_mutex_;
+    std::vector<FILE*> streams_;
+    std::atomic<bool> running_;
+    std::thread thread_;
+};
+
+// Ring of the calling thread, registered on its first message
+class ThreadRing {
+public:
+    ThreadRing()
+        : ring_(nullptr)
+    {
+    }
+    ~ThreadRing()
+    {
+        if (this->ring_ != nullptr)
+            this->ring_->orphaned.store(true, std::memory_order_release);
+    }
+
+    Ring* get(void)
+    {
+        if (this->ring_ == nullptr) {
+            this->ring_ = new Ring();
+            this->ring_->head = 0;
+            this->ring_->tail = 0;
+            this->ring_->dropped = 0;
+            this->ring_->orphaned = false;
+            Drain::get().add(this->ring_);
+        }
+        return this->ring_;
+    }
+
+private:
+    Ring* ring_;
+};
+
+thread_local ThreadRing thread_ring;
+} // namespace
+
+MlpdRecord* mlpd_log_reserve(void)
+{
+    Ring* ring = thread_ring.get();
+    size_t head = ring->head.load(std::memory_order_relaxed);
+    if (head - ring->tail.load(std::memory_order_acquire) == kRingSlots) {
+        ring->dropped.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    return &ring->records[head % kRingSlots];
+}
+
+void mlpd_log_commit(void)
+{
+    Ring* ring = thread_ring.get();
+    ring->head.store(ring->head.load(std::memory_order_relaxed) + 1,
+        std::memory_order_release);
+}
+
+void mlpd_log_flush(void) { Drain::get().drain(); }
+
+void mlpd_log_add_site(MlpdSite* site) { Drain::get().add(site); }
+#endif
@@ -19,15 +19,25 @@ DEFINE_bool(gen_ul_bits, false,
     "Generate random bits for uplink transmissions, otherwise read from file!");
 DEFINE_string(conf, "files/conf.json", "JSON configuration file name");
 DEFINE_string(storepath, "logs", "Dataset store path");
+DEFINE_int32(fanout_node, -1,
+    "Run as this entry of fanout_nodes, recording what the radio host sends");
 
 int main(int argc, char* argv[])
 {
     gflags::ParseCommandLineFlags(&argc, &argv, true);
     Config config(FLAGS_conf, FLAGS_storepath);
+    if (FLAGS_fanout_node >= 0)
+        config.fanout_node(FLAGS_fanout_node);
     int ret = EXIT_SUCCESS;
     if (FLAGS_gen_ul_bits) {
-        DataGenerator dg(&config);
-        dg.GenerateData(FLAGS_storepath);
+        try {
+            DataGenerator dg(&config);
+            dg.GenerateData(FLAGS_storepath);
+        } catch (const std::exception& exc) {
+            std::cerr << "Program terminated Exception: " << exc.what()
+                      << std::endl;
+            ret = EXIT_FAILURE;
+        }
     } else {
         try {
             SignalHandler signalHandler;
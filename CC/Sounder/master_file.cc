@@ -0,0 +1,206 @@
+/*
+ Copyright (c) 2018-2020, Rice University
+ RENEW OPEN SOURCE LICENSE: http://renew-wireless.org/license
+
+----------------------------------------------------------------------
+ Master hdf5 file presenting the per recorder shards as single datasets
+---------------------------------------------------------------------
+*/
+
+#include "include/master_file.h"
+#include "include/logger.h"
+#include "H5Cpp.h"
+#include <algorithm>
+
+namespace Sounder {
+// Datasets of the recorder, frame x cell x symbol x antenna x sample
+static const char* kDatasets[]
+    = { "/Data/Pilot_Samples", "/Data/Noise_Samples", "/Data/UplinkData",
+          "/Data/CSI" };
+static const int kDsRank = 5;
+static const int kDsAntennaAxis = 3;
+
+static std::string baseName(const std::string& path)
+{
+    size_t found_index = path.find_last_of('/');
+    return (found_index == std::string::npos) ? path
+                                              : path.substr(found_index + 1);
+}
+
+// Copies one attribute of the shard /Data group to the master
+static herr_t copyAttribute(
+    hid_t group, const char* name, const H5A_info_t* info, void* data)
+{
+    (void)info;
+    hid_t master_group = *static_cast<hid_t*>(data);
+    hid_t attr = H5Aopen(group, name, H5P_DEFAULT);
+    hid_t type = H5Aget_type(attr);
+    hid_t space = H5Aget_space(attr);
+    size_t points = static_cast<size_t>(H5Sget_simple_extent_npoints(space));
+    std::vector<char> buf(H5Tget_size(type) * std::max(points, size_t(1)));
+    herr_t ret = H5Aread(attr, type, buf.data());
+    if (ret >= 0) {
+        hid_t copy = H5Acreate2(
+            master_group, name, type, space, H5P_DEFAULT, H5P_DEFAULT);
+        ret = (copy < 0) ? -1 : H5Awrite(copy, type, buf.data());
+        if (copy >= 0)
+            H5Aclose(copy);
+        // string attributes are written as variable length strings
+        if (H5Tis_variable_str(type) > 0) {
+#if H5_VERSION_GE(1, 12, 0)
+            H5Treclaim(type, space, H5P_DEFAULT, buf.data());
+#else
+            H5Dvlen_reclaim(type, space, H5P_DEFAULT, buf.data());
+#endif
+        }
+    }
+    H5Sclose(space);
+    H5Tclose(type);
+    H5Aclose(attr);
+    return ret;
+}
+
+static herr_t writeCount(hid_t group, const char* name, double val)
+{
+    if (H5Aexists(group, name) <= 0)
+        return 0;
+    hid_t attr = H5Aopen(group, name, H5P_DEFAULT);
+    herr_t ret = H5Awrite(attr, H5T_NATIVE_DOUBLE, &val);
+    H5Aclose(attr);
+    return ret;
+}
+
+MasterFile::MasterFile(size_t total_antennas)
+    : total_antennas_(total_antennas)
+{
+}
+
+void MasterFile::addShard(
+    const std::string& file_name, size_t antenna_offset, size_t num_antennas)
+{
+    // the last recorders may be given antennas that don't exist
+    if (antenna_offset >= this->total_antennas_)
+        return;
+    this->shards_.push_back({ file_name, antenna_offset,
+        std::min(num_antennas, this->total_antennas_ - antenna_offset) });
+}
+
+bool MasterFile::write(const std::string& file_name) const
+{
+    MLPD_INFO("Creating HDF5 master file: %s over %zu shards\n",
+        file_name.c_str(), this->shards_.size());
+    H5::Exception::dontPrint();
+
+    std::vector<hid_t> shard_files;
+    for (const Shard& shard : this->shards_) {
+        hid_t file = H5Fopen(
+            shard.file_name.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+        if (file < 0) {
+            MLPD_ERROR("Could not open HDF5 shard %s\n",
+                shard.file_name.c_str());
+        }
+        shard_files.push_back(file);
+    }
+
+    bool ok = false;
+    hid_t master = H5Fcreate(
+        file_name.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+    if (master >= 0) {
+        ok = true;
+        hid_t group = H5Gcreate2(
+            master, "/Data", H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+        auto first = std::find_if(shard_files.begin(), shard_files.end(),
+            [](hid_t file) { return file >= 0; });
+        if (first != shard_files.end()) {
+            hid_t shard_group = H5Gopen2(*first, "/Data", H5P_DEFAULT);
+            ok = (shard_group >= 0)
+                && (H5Aiterate2(shard_group, H5_INDEX_NAME, H5_ITER_INC,
+                        nullptr, copyAttribute, &group)
+                    >= 0);
+            if (shard_group >= 0)
+                H5Gclose(shard_group);
+        }
+        ok = ok && (writeCount(group, "ANT_OFFSET", 0) >= 0)
+            && (writeCount(group, "ANT_NUM", this->total_antennas_) >= 0);
+
+        for (const char* name : kDatasets) {
+            hid_t type = -1;
+            hsize_t dims[kDsRank] = { 0 };
+            hid_t dcpl = H5Pcreate(H5P_DATASET_CREATE);
+            std::vector<std::vector<hsize_t>> shard_dims(shard_files.size());
+            for (size_t s = 0; s < shard_files.size(); s++) {
+                if ((shard_files[s] < 0)
+                    || (H5Lexists(shard_files[s], name, H5P_DEFAULT) <= 0))
+                    continue;
+                hid_t dataset = H5Dopen2(shard_files[s], name, H5P_DEFAULT);
+                hid_t space = H5Dget_space(dataset);
+                if (H5Sget_simple_extent_ndims(space) == kDsRank) {
+                    shard_dims[s].resize(kDsRank);
+                    H5Sget_simple_extent_dims(
+                        space, shard_dims[s].data(), nullptr);
+                    if (type < 0) {
+                        type = H5Dget_type(dataset);
+                        std::copy(shard_dims[s].begin(), shard_dims[s].end(),
+                            dims);
+                    }
+                    // shards end at the last frame each of them recorded
+                    dims[0] = std::max(dims[0], shard_dims[s][0]);
+                }
+                H5Sclose(space);
+                H5Dclose(dataset);
+            }
+            if (type < 0) {
+                H5Pclose(dcpl);
+                continue;
+            }
+            dims[kDsAntennaAxis] = this->total_antennas_;
+            hid_t virtual_space = H5Screate_simple(kDsRank, dims, nullptr);
+
+            for (size_t s = 0; s < shard_files.size(); s++) {
+                if (shard_dims[s].empty())
+                    continue;
+                hsize_t start[kDsRank] = { 0 };
+                hsize_t count[kDsRank];
+                std::copy(shard_dims[s].begin(), shard_dims[s].end(), count);
+                count[kDsAntennaAxis] = this->shards_[s].num_antennas;
+                hid_t source_space = H5Screate_simple(
+                    kDsRank, shard_dims[s].data(), nullptr);
+                H5Sselect_hyperslab(source_space, H5S_SELECT_SET, start,
+                    nullptr, count, nullptr);
+                start[kDsAntennaAxis] = this->shards_[s].antenna_offset;
+                H5Sselect_hyperslab(virtual_space, H5S_SELECT_SET, start,
+                    nullptr, count, nullptr);
+                ok = ok
+                    && (H5Pset_virtual(dcpl, virtual_space,
+                            baseName(this->shards_[s].file_name).c_str(),
+                            name, source_space)
+                        >= 0);
+                H5Sclose(source_space);
+            }
+            H5Sselect_all(virtual_space);
+
+            hid_t dataset = H5Dcreate2(master, name, type, virtual_space,
+                H5P_DEFAULT, dcpl, H5P_DEFAULT);
+            ok = ok && (dataset >= 0);
+            if (dataset >= 0)
+                H5Dclose(dataset);
+            H5Sclose(virtual_space);
+            H5Pclose(dcpl);
+            H5Tclose(type);
+        }
+        if (group >= 0)
+            H5Gclose(group);
+        ok = (H5Fclose(master) >= 0) && ok;
+    }
+
+    for (hid_t file : shard_files) {
+        if (file >= 0)
+            H5Fclose(file);
+    }
+    if (ok == false) {
+        MLPD_ERROR("Could not create HDF5 master file: %s\n",
+            file_name.c_str());
+    }
+    return ok;
+}
+}; /* End namespace Sounder */
@@ -9,24 +9,59 @@
 
 #include "include/receiver.h"
 #include "include/ClientRadioSet.h"
+#include "include/beacon_detector.h"
+#include "include/SyntheticRadioSet.h"
 #include "include/comms-lib.h"
 #include "include/logger.h"
 #include "include/macros.h"
+#include "include/recorder_thread.h"
+#include "include/ul_tx_data.h"
 #include "include/utils.h"
 
 #include <SoapySDR/Time.hpp>
 #include <atomic>
+#include <deque>
+#include <memory>
 #include <random>
 #include <unistd.h>
 
 pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
 pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
 
+// Driver rx buffer lent to the recorders by the zero-copy receive path,
+// given back to the driver once all of its packages are released
+struct DirectRxBuffer {
+    size_t radio_id;
+    size_t radio_idx;
+    size_t cell;
+    size_t handle;
+    size_t num_packets;
+    int slot[2];
+    uint32_t gen[2];
+};
+
+// Frames between two radio handoffs of the adaptive rx balancing, long
+// enough for the service times of the last move to settle
+static const size_t kRxRebalanceFrames = 100;
+// An rx thread gives a radio away once its load exceeds the least
+// loaded thread by a quarter
+static const uint64_t kRxRebalanceMarginPct = 125;
+// New samples weigh 1/8 in the radio service time average
+static const unsigned kRxCostShift = 3;
+// Load of an rx thread that has not finished a frame yet
+static const uint64_t kRxLoadUnknown = UINT64_MAX;
+
 Receiver::Receiver(int n_rx_threads, Config* config,
-    moodycamel::ConcurrentQueue<Event_data>* in_queue)
+    moodycamel::ConcurrentQueue<Event_data>* in_queue, Telemetry* telemetry)
     : config_(config)
     , thread_num_(n_rx_threads)
     , message_queue_(in_queue)
+    , telemetry_(telemetry)
+    , antennas_per_recorder_(0)
+    , adaptive_rx_(false)
+    , assignment_gen_(0)
+    , last_rebalance_frame_(0)
+    , recv_loops_done_(0)
 {
     /* initialize random seed: */
     srand(time(NULL));
@@ -35,8 +70,12 @@ Receiver::Receiver(int n_rx_threads, Config* config,
         config_->client_present(), config_->bs_present());
     this->clientRadioSet_
         = config_->client_present() ? new ClientRadioSet(config_) : nullptr;
-    this->base_radio_set_
-        = config_->bs_present() ? new BaseRadioSet(config_) : nullptr;
+    if (config_->bs_present() == false)
+        this->base_radio_set_ = nullptr;
+    else if (config_->bs_radio_backend() == "hardware")
+        this->base_radio_set_ = new BaseRadioSet(config_);
+    else
+        this->base_radio_set_ = new SyntheticRadioSet(config_);
     MLPD_TRACE("Receiver Construction -- number radios %zu\n",
         config_->num_bs_sdrs_all());
 
@@ -101,10 +140,34 @@ std::vector<pthread_t> Receiver::startClientThreads()
     return client_threads;
 }
 
-std::vector<pthread_t> Receiver::startRecvThreads(
-    SampleBuffer* rx_buffer, unsigned in_core_id)
+std::vector<pthread_t> Receiver::startRecvThreads(SampleBuffer* rx_buffer)
 {
-    assert(rx_buffer[0].buffer.size() != 0);
+    assert(rx_buffer[0].num_slots() != 0);
+
+    // With UHD the symbol count is kept per thread, radios cannot move
+    this->adaptive_rx_ = (config_->rx_balancing() == "adaptive")
+        && (kUseUHD == false) && (this->thread_num_ > 1);
+    if ((config_->rx_balancing() == "adaptive") && (kUseUHD == true)) {
+        MLPD_WARN("Adaptive rx balancing is not supported with UHD\n");
+    }
+    if ((config_->rx_uhd_frame_reads() == true) && (kUseUHD == false)) {
+        MLPD_WARN("rx_uhd_frame_reads is only used with UHD\n");
+    }
+    if (this->adaptive_rx_ == true) {
+        size_t num_radios = config_->num_bs_sdrs_all();
+        this->radio_owner_.reset(new std::atomic<int>[num_radios]);
+        this->radio_cost_ns_.reset(new std::atomic<uint32_t>[num_radios]);
+        this->thread_load_ns_.reset(
+            new std::atomic<uint64_t>[this->thread_num_]);
+        for (int i = 0; i < this->thread_num_; i++) {
+            this->thread_load_ns_[i] = kRxLoadUnknown;
+            for (size_t radio : this->staticRadios(i))
+                this->radio_owner_[radio] = i;
+        }
+        for (size_t radio = 0; radio < num_radios; radio++)
+            this->radio_cost_ns_[radio] = 0;
+        MLPD_INFO("Balancing radios over %d rx threads\n", this->thread_num_);
+    }
 
     std::vector<pthread_t> created_threads;
     created_threads.resize(this->thread_num_);
@@ -112,7 +175,7 @@ std::vector<pthread_t> Receiver::startRecvThreads(
         // record the thread id
         ReceiverContext* context = new ReceiverContext;
         context->ptr = this;
-        context->core_id = in_core_id;
+        context->core_id = config_->thread_core(CorePlanner::kRx, i);
         context->tid = i;
         context->buffer = rx_buffer;
         // start socket thread
@@ -137,6 +200,14 @@ void Receiver::completeRecvThreads(const std::vector<pthread_t>& recv_thread)
     }
 }
 
+void Receiver::setRecorders(
+    const std::vector<Sounder::RecorderThread*>& recorders,
+    size_t antennas_per_recorder)
+{
+    this->recorders_ = recorders;
+    this->antennas_per_recorder_ = antennas_per_recorder;
+}
+
 void Receiver::go()
 {
     if (this->base_radio_set_ != NULL) {
@@ -156,13 +227,94 @@ void* Receiver::loopRecv_launch(void* in_context)
     return 0;
 }
 
+std::vector<size_t> Receiver::staticRadios(int tid) const
+{
+    size_t num_radios = config_->num_bs_sdrs_all(); //config_->n_bs_sdrs()[0]
+    std::vector<size_t> radio_ids_in_thread;
+    if (config_->reciprocal_calib()) {
+        if (tid == 0)
+            radio_ids_in_thread.push_back(config_->cal_ref_sdr_id());
+        else
+            // FIXME: Does this work in multi-cell case?
+            for (size_t it = 0; it < config_->num_bs_sdrs_all(); it++)
+                if (it != config_->cal_ref_sdr_id())
+                    radio_ids_in_thread.push_back(it);
+    } else {
+        size_t radio_start = (tid * num_radios) / thread_num_;
+        size_t radio_end = ((tid + 1) * num_radios) / thread_num_;
+        for (size_t it = radio_start; it < radio_end; it++)
+            radio_ids_in_thread.push_back(it);
+    }
+    return radio_ids_in_thread;
+}
+
+/*
+ * A thread that keeps up waits in radioRx, so its pass over its radios
+ * takes about a symbol time. A thread that falls behind never waits and
+ * its pass takes the sum of the real service times, which is longer.
+ * The thread that measures the larger load hands the radio that evens
+ * the two loads out best to the least loaded thread.
+ */
+void Receiver::rebalanceRx(
+    int tid, size_t frame_id, const std::vector<size_t>& radios)
+{
+    const std::memory_order relaxed = std::memory_order_relaxed;
+    uint64_t load = 0;
+    for (size_t radio : radios)
+        load += this->radio_cost_ns_[radio].load(relaxed);
+    this->thread_load_ns_[tid].store(load, relaxed);
+    if (radios.size() < 2)
+        return;
+
+    int target = -1;
+    uint64_t target_load = kRxLoadUnknown;
+    for (int t = 0; t < this->thread_num_; t++) {
+        uint64_t other = this->thread_load_ns_[t].load(relaxed);
+        if (other == kRxLoadUnknown)
+            return;
+        if ((t != tid) && (other < target_load)) {
+            target = t;
+            target_load = other;
+        }
+    }
+    if ((target < 0) || (load * 100 <= target_load * kRxRebalanceMarginPct))
+        return;
+
+    uint64_t gap = load - target_load;
+    size_t best = radios.size();
+    uint64_t best_gap = gap;
+    for (size_t i = 0; i < radios.size(); i++) {
+        uint64_t moved = 2 * this->radio_cost_ns_[radios[i]].load(relaxed);
+        uint64_t new_gap = (moved > gap) ? moved - gap : gap - moved;
+        if (new_gap < best_gap) {
+            best = i;
+            best_gap = new_gap;
+        }
+    }
+    if (best == radios.size())
+        return;
+
+    // one handoff every kRxRebalanceFrames frames over all threads
+    size_t last = this->last_rebalance_frame_.load(relaxed);
+    if (((frame_id >= last) && (frame_id - last < kRxRebalanceFrames))
+        || !this->last_rebalance_frame_.compare_exchange_strong(last, frame_id))
+        return;
+
+    // The owner entry is published before the generation, a thread that
+    // sees the new generation also sees the new owner
+    this->radio_owner_[radios[best]].store(target, std::memory_order_release);
+    this->assignment_gen_.fetch_add(1, std::memory_order_acq_rel);
+    MLPD_INFO("Rx thread %d (%lu ns) hands radio %zu to rx thread %d (%lu "
+              "ns) at frame %zu\n",
+        tid, load, radios[best], target, target_load, frame_id);
+}
+
 void Receiver::loopRecv(int tid, int core_id, SampleBuffer* rx_buffer)
 {
-    if (config_->core_alloc() == true) {
-        MLPD_INFO("Pinning rx thread %d to core %d\n", tid, core_id + tid);
-        if (pin_to_core(core_id + tid) != 0) {
-            MLPD_ERROR(
-                "Pin rx thread %d to core %d failed\n", tid, core_id + tid);
+    if (core_id >= 0) {
+        MLPD_INFO("Pinning rx thread %d to core %d\n", tid, core_id);
+        if (pin_to_core(core_id) != 0) {
+            MLPD_ERROR("Pin rx thread %d to core %d failed\n", tid, core_id);
             throw std::runtime_error("Pin rx thread to core failed");
         }
     }
@@ -178,38 +330,58 @@ void Receiver::loopRecv(int tid, int core_id, SampleBuffer* rx_buffer)
 
     // use token to speed up
     moodycamel::ProducerToken local_ptok(*message_queue_);
+    std::vector<moodycamel::ProducerToken> recorder_ptoks;
+    for (auto recorder : this->recorders_)
+        recorder_ptoks.push_back(recorder->GetProducerToken());
 
     const size_t num_channels = config_->bs_channel().length();
     size_t packageLength = sizeof(Package) + config_->getPackageDataLength();
-    int buffer_chunk_size = rx_buffer[0].buffer.size() / packageLength;
+    int buffer_chunk_size = rx_buffer[0].num_slots();
 
     // handle two channels at each radio
-    // this is assuming buffer_chunk_size is at least 2
-    std::atomic_int* pkg_buf_inuse = rx_buffer[tid].pkg_buf_inuse;
-    char* buffer = rx_buffer[tid].buffer.data();
+    SampleBuffer& sample_buffer = rx_buffer[tid];
+    // first touch after pinning, places the pages on this core's node
+    sample_buffer.prefault();
+    MLPD_INFO("Rx thread %d buffer: %zu slots %s\n", tid,
+        sample_buffer.num_slots(),
+        sample_buffer.huge_pages() ? "on 2MB pages" : "on normal pages");
+    // packages that are dropped or not recorded are received in here
+    std::vector<char> drop_buffer(num_channels * packageLength);
+    RxStats& stats = this->telemetry_->rx(tid);
+
+    // zero-copy receive, driver buffers are given back in the order taken
+    const bool use_direct_rx = config_->rx_direct_buffers() && !kUseUHD;
+    std::deque<DirectRxBuffer> direct_rx_buffers;
+    std::vector<size_t> direct_rx_count(config_->num_bs_sdrs_all(), 0);
+    auto release_direct_rx = [&](bool wait) {
+        while (direct_rx_buffers.empty() == false) {
+            DirectRxBuffer& front = direct_rx_buffers.front();
+            bool released = true;
+            for (size_t ch = 0; ch < front.num_packets; ++ch)
+                released = released
+                    && sample_buffer.isSlotReleased(
+                        front.slot[ch], front.gen[ch]);
+            if (released == false) {
+                if (wait == false)
+                    break;
+                std::this_thread::yield();
+                continue;
+            }
+            this->base_radio_set_->radioRxRelease(
+                front.radio_idx, front.cell, front.handle);
+            direct_rx_count.at(front.radio_id)--;
+            direct_rx_buffers.pop_front();
+        }
+    };
 
     size_t num_radios = config_->num_bs_sdrs_all(); //config_->n_bs_sdrs()[0]
-    std::vector<size_t> radio_ids_in_thread;
-    if (config_->reciprocal_calib()) {
-        if (tid == 0)
-            radio_ids_in_thread.push_back(config_->cal_ref_sdr_id());
-        else
-            // FIXME: Does this work in multi-cell case?
-            for (size_t it = 0; it < config_->num_bs_sdrs_all(); it++)
-                if (it != config_->cal_ref_sdr_id())
-                    radio_ids_in_thread.push_back(it);
-    } else {
-        size_t radio_start = (tid * num_radios) / thread_num_;
-        size_t radio_end = ((tid + 1) * num_radios) / thread_num_;
-        for (size_t it = radio_start; it < radio_end; it++)
-            radio_ids_in_thread.push_back(it);
-    }
+    std::vector<size_t> radio_ids_in_thread = this->staticRadios(tid);
+    uint32_t assignment_gen = 0;
+    telemetryMax(stats.radios, radio_ids_in_thread.size());
     MLPD_INFO(
         "Receiver thread %d has %zu radios\n", tid, radio_ids_in_thread.size());
-    MLPD_TRACE(
-        " -- %d - radio start: %zu, end: %zu, total radios %zu, thread: %d\n",
-        tid, radio_ids_in_thread.front(), radio_ids_in_thread.back(),
-        num_radios, thread_num_);
+    MLPD_TRACE(" -- %d - radios: %zu, total radios %zu, thread: %d\n", tid,
+        radio_ids_in_thread.size(), num_radios, thread_num_);
 
     // prepare BS beacon in host buffer
     std::vector<void*> beaconbuff(2);
@@ -241,6 +413,57 @@ void Receiver::loopRecv(int tid, int core_id, SampleBuffer* rx_buffer)
     if (num_channels == 2)
         samp_buffer[1] = samp_buffer1.data();
 
+    // Schedule next beacon in BEACON_INTERVAL frames, from the time of the
+    // first symbol of a frame
+    // FIXME?? From EACH cell or only one cell?
+    auto schedule_beacon = [&](size_t radio_idx, int cell, size_t frame_id) {
+        txTimeBs = rxTimeBs
+            + config_->samps_per_symbol() * config_->symbols_per_frame()
+                * BEACON_INTERVAL;
+        int r_tx = this->base_radio_set_->radioTx(radio_idx, cell,
+            beaconbuff.data(), kStreamEndBurst, txTimeBs);
+        if (r_tx != (int)config_->samps_per_symbol())
+            std::cerr << "BAD Transmit(" << r_tx << "/"
+                      << config_->samps_per_symbol() << ") at Time "
+                      << txTimeBs << ", frame count " << frame_id
+                      << std::endl;
+    };
+
+    // With rx_uhd_frame_reads each radio reads its whole frame at the
+    // first symbol into staging, channel after channel. The symbols the
+    // recorder keeps are copied into packages, the others are skipped.
+    const bool uhd_frame_reads
+        = (kUseUHD == true) && config_->rx_uhd_frame_reads();
+    const size_t frame_samps
+        = config_->samps_per_symbol() * config_->symbols_per_frame();
+    std::vector<std::vector<std::complex<int16_t>>> frame_staging(
+        uhd_frame_reads ? num_radios : 0);
+    std::vector<uint64_t> frame_rx_ns(uhd_frame_reads ? num_radios : 0, 0);
+    // Samples read into the staging of radio 'it', < 0 on error. Reads
+    // returning less than asked are continued where they stopped.
+    auto read_frame = [&](size_t it, size_t radio_idx, int cell) {
+        std::vector<std::complex<int16_t>>& frame = frame_staging.at(it);
+        frame.resize(num_channels * frame_samps);
+        size_t done = 0;
+        while (done < frame_samps) {
+            void* buffs[num_channels];
+            for (size_t ch = 0; ch < num_channels; ++ch)
+                buffs[ch] = frame.data() + ch * frame_samps + done;
+            long long rx_time = 0;
+            int r = this->base_radio_set_->radioRx(
+                radio_idx, cell, buffs, frame_samps - done, rx_time);
+            if (r < 0)
+                return r;
+            if (r == 0)
+                break;
+            if (done == 0)
+                rxTimeBs = rx_time;
+            done += r;
+        }
+        frame_rx_ns.at(it) = telemetryNowNs();
+        return (int)done;
+    };
+
     int cell = 0;
     if (kUseUHD == true) {
         // For multi-USRP BS perform dummy radioRx to avoid initial late packets
@@ -263,14 +486,37 @@ void Receiver::loopRecv(int tid, int core_id, SampleBuffer* rx_buffer)
         }
     }
 
-    int cursor = 0;
     size_t frame_id = 0;
     size_t symbol_id = 0;
     size_t ant_id = 0;
+    size_t last_frame_id = 0;
+    size_t frames_seen = 0;
     cell = 0;
     MLPD_INFO("Start BS main recv loop in thread %d\n", tid);
     while (config_->running() == true) {
 
+        // Pick up radios handed to or taken from this thread
+        if ((this->adaptive_rx_ == true)
+            && (this->assignment_gen_.load(std::memory_order_acquire)
+                != assignment_gen)) {
+            assignment_gen
+                = this->assignment_gen_.load(std::memory_order_acquire);
+            radio_ids_in_thread.clear();
+            for (size_t radio = 0; radio < num_radios; radio++) {
+                if (this->radio_owner_[radio].load(std::memory_order_acquire)
+                    == tid)
+                    radio_ids_in_thread.push_back(radio);
+            }
+            stats.radios.store(
+                radio_ids_in_thread.size(), std::memory_order_relaxed);
+            if (radio_ids_in_thread.empty() == true)
+                this->thread_load_ns_[tid] = 0;
+        }
+        if (radio_ids_in_thread.empty() == true) {
+            std::this_thread::yield();
+            continue;
+        }
+
         // Global updates of frame and symbol IDs for USRPs
         if (kUseUHD == true) {
             if (symbol_id == config_->symbols_per_frame()) {
@@ -281,8 +527,15 @@ void Receiver::loopRecv(int tid, int core_id, SampleBuffer* rx_buffer)
 
         // Receive data
         for (auto& it : radio_ids_in_thread) {
+            uint64_t service_start_ns = telemetryNowNs();
             Package* pkg[num_channels];
             void* samp[num_channels];
+            const short* direct_samp[num_channels];
+            int slot[num_channels];
+            uint32_t gen[num_channels];
+
+            if (use_direct_rx == true)
+                release_direct_rx(false);
 
             // Find cell this board belongs to...
             for (size_t i = 0; i <= config_->num_cells(); i++) {
@@ -298,46 +551,110 @@ void Receiver::loopRecv(int tid, int core_id, SampleBuffer* rx_buffer)
                 ? 1
                 : num_channels; // receive only on one channel at the ref antenna
 
-            // Set buffer status(es) to full; fail if full already
-            for (size_t ch = 0; ch < num_packets; ++ch) {
-                int bit = 1 << (cursor + ch) % sizeof(std::atomic_int);
-                int offs = (cursor + ch) / sizeof(std::atomic_int);
-                int old = std::atomic_fetch_or(
-                    &pkg_buf_inuse[offs], bit); // now full
-                // if buffer was full, exit
-                if ((old & bit) != 0) {
-                    MLPD_ERROR("thread %d buffer full\n", tid);
-                    throw std::runtime_error("Thread %d buffer full\n");
+            if (uhd_frame_reads == true) {
+                if (symbol_id == 0) {
+                    int r = read_frame(it, radio_idx, cell);
+                    if (r < 0) {
+                        telemetryAdd(stats.read_errors);
+                        config_->running(false);
+                        break;
+                    }
+                    if (r != (int)frame_samps) {
+                        telemetryAdd(stats.short_reads);
+                        std::cerr << "BAD Receive(" << r << "/" << frame_samps
+                                  << ") at Time " << rxTimeBs
+                                  << ", frame count " << frame_id << std::endl;
+                    }
+                    schedule_beacon(radio_idx, cell, frame_id);
                 }
-                // Reserved until marked empty by consumer
+                char type = config_->symbolInfo(frame_id, symbol_id).type;
+                if ((config_->reciprocal_calib() == false) && (type != 'P')
+                    && (type != 'U') && (type != 'N'))
+                    continue;
             }
 
-            // Receive data into buffers
-            size_t packageLength
-                = sizeof(Package) + config_->getPackageDataLength();
+            // Reserve buffer slot(s), reserved until released by consumer.
+            // When the ring is full the backpressure policy decides, a
+            // dropped package is received into the drop buffer.
             for (size_t ch = 0; ch < num_packets; ++ch) {
-                pkg[ch] = (Package*)(buffer + (cursor + ch) * packageLength);
+                slot[ch] = sample_buffer.acquireSlot(gen[ch]);
+                if (slot[ch] == SampleBuffer::kInvalidSlot)
+                    telemetryAdd(stats.drops);
+            }
+
+            // Receive data into buffers
+            for (size_t ch = 0; ch < num_channels; ++ch) {
+                if ((ch < num_packets)
+                    && (slot[ch] != SampleBuffer::kInvalidSlot))
+                    pkg[ch] = (Package*)sample_buffer.slot(slot[ch]);
+                else
+                    pkg[ch] = (Package*)(drop_buffer.data()
+                        + ch * packageLength);
                 samp[ch] = pkg[ch]->data;
+                direct_samp[ch] = nullptr;
             }
-            if (num_packets != num_channels)
-                samp[num_channels - 1]
-                    = std::vector<char>(packageLength).data();
 
             assert(this->base_radio_set_ != NULL);
             ant_id = radio_idx * num_channels;
+            uint64_t rx_time_ns = 0;
+            long long hw_time = 0;
 
             // Schedule BS beacons to be sent from host for USRPs
             if (kUseUHD == false) {
                 long long frameTime;
-                if (this->base_radio_set_->radioRx(
-                        radio_idx, cell, samp, frameTime)
-                    < 0) {
+                int r;
+                // Zero-copy only if no package is dropped and the driver
+                // keeps enough buffers for itself
+                bool direct = use_direct_rx
+                    && ((2 * direct_rx_count.at(it))
+                        < this->base_radio_set_->radioRxDirectBuffers(
+                            radio_idx, cell));
+                for (size_t ch = 0; ch < num_packets; ++ch)
+                    direct = direct && (slot[ch] != SampleBuffer::kInvalidSlot);
+
+                if (direct == true) {
+                    const void* direct_buffs[num_channels];
+                    size_t handle;
+                    r = this->base_radio_set_->radioRxDirect(
+                        radio_idx, cell, handle, direct_buffs, frameTime);
+                    if (r == (int)config_->samps_per_symbol()) {
+                        DirectRxBuffer lent = { it, radio_idx, (size_t)cell,
+                            handle, num_packets, { 0, 0 }, { 0, 0 } };
+                        for (size_t ch = 0; ch < num_packets; ++ch) {
+                            direct_samp[ch] = (const short*)direct_buffs[ch];
+                            lent.slot[ch] = slot[ch];
+                            lent.gen[ch] = gen[ch];
+                        }
+                        direct_rx_buffers.push_back(lent);
+                        direct_rx_count.at(it)++;
+                    } else if (r >= 0) {
+                        // Not a whole symbol, give the buffer back and
+                        // read the symbol through the copying path
+                        this->base_radio_set_->radioRxRelease(
+                            radio_idx, cell, handle);
+                        telemetryAdd(stats.short_reads);
+                        MLPD_WARN("Receiver thread %d: short direct read "
+                                  "(%d/%zu) on radio %zu\n",
+                            tid, r, config_->samps_per_symbol(), radio_idx);
+                        r = this->base_radio_set_->radioRx(
+                            radio_idx, cell, samp, frameTime);
+                    }
+                } else {
+                    r = this->base_radio_set_->radioRx(
+                        radio_idx, cell, samp, frameTime);
+                }
+                rx_time_ns = telemetryNowNs();
+                if (r < 0) {
+                    telemetryAdd(stats.read_errors);
                     config_->running(false);
                     break;
                 }
+                if (r < (int)config_->samps_per_symbol())
+                    telemetryAdd(stats.short_reads);
 
                 frame_id = (size_t)(frameTime >> 32);
                 symbol_id = (size_t)((frameTime >> 16) & 0xFFFF);
+                hw_time = frameTime;
                 if (config_->reciprocal_calib()) {
                     if (radio_idx == config_->cal_ref_sdr_id()) {
                         ant_id = symbol_id < radio_idx * num_channels
@@ -350,44 +667,47 @@ void Receiver::loopRecv(int tid, int core_id, SampleBuffer* rx_buffer)
                         symbol_id = 1; // uplink reciprocal pilot
                     }
                 }
+            } else if (uhd_frame_reads == true) {
+                const size_t symbol_bytes
+                    = config_->samps_per_symbol() * 2 * sizeof(int16_t);
+                const std::complex<int16_t>* frame
+                    = frame_staging.at(it).data()
+                    + symbol_id * config_->samps_per_symbol();
+                for (size_t ch = 0; ch < num_packets; ++ch)
+                    std::memcpy(
+                        samp[ch], frame + ch * frame_samps, symbol_bytes);
+                rx_time_ns = frame_rx_ns.at(it);
+                hw_time = rxTimeBs;
             } else {
                 int rx_len = config_->samps_per_symbol();
                 int r;
 
                 // only write received pilot or data into samp
                 // otherwise use samp_buffer as a dummy buffer
-                if (config_->isPilot(frame_id, symbol_id)
-                    || config_->isData(frame_id, symbol_id))
+                char type = config_->symbolInfo(frame_id, symbol_id).type;
+                if ((type == 'P') || (type == 'U'))
                     r = this->base_radio_set_->radioRx(
                         radio_idx, cell, samp, rxTimeBs);
                 else
                     r = this->base_radio_set_->radioRx(
                         radio_idx, cell, samp_buffer.data(), rxTimeBs);
+                rx_time_ns = telemetryNowNs();
+                hw_time = rxTimeBs;
 
                 if (r < 0) {
+                    telemetryAdd(stats.read_errors);
                     config_->running(false);
                     break;
                 }
                 if (r != rx_len) {
+                    telemetryAdd(stats.short_reads);
                     std::cerr << "BAD Receive(" << r << "/" << rx_len
                               << ") at Time " << rxTimeBs << ", frame count "
                               << frame_id << std::endl;
                 }
 
-                // Schedule next beacon in BEACON_INTERVAL frames
-                // FIXME?? From EACH cell or only one cell?
-                if (symbol_id == 0) {
-                    txTimeBs = rxTimeBs
-                        + config_->samps_per_symbol()
-                            * config_->symbols_per_frame() * BEACON_INTERVAL;
-                    int r_tx = this->base_radio_set_->radioTx(radio_idx, cell,
-                        beaconbuff.data(), kStreamEndBurst, txTimeBs);
-                    if (r_tx != (int)config_->samps_per_symbol())
-                        std::cerr << "BAD Transmit(" << r_tx << "/"
-                                  << config_->samps_per_symbol() << ") at Time "
-                                  << txTimeBs << ", frame count " << frame_id
-                                  << std::endl;
-                }
+                if (symbol_id == 0)
+                    schedule_beacon(radio_idx, cell, frame_id);
             }
 
 #if DEBUG_PRINT
@@ -403,22 +723,57 @@ void Receiver::loopRecv(int tid, int core_id, SampleBuffer* rx_buffer)
 #endif
 
             for (size_t ch = 0; ch < num_packets; ++ch) {
+                if (slot[ch] == SampleBuffer::kInvalidSlot)
+                    continue;
                 // new (pkg[ch]) Package(frame_id, symbol_id, 0, ant_id + ch);
                 new (pkg[ch]) Package(frame_id, symbol_id, cell, ant_id + ch);
+                pkg[ch]->rx_time_ns = rx_time_ns;
+                pkg[ch]->hw_time = hw_time;
+                pkg[ch]->direct_data = direct_samp[ch];
+                sample_buffer.publishSlot(slot[ch], gen[ch]);
+                telemetryAdd(stats.packets);
                 // push kEventRxSymbol event into the queue
                 Event_data package_message;
                 package_message.event_type = kEventRxSymbol;
                 package_message.ant_id = ant_id + ch;
                 // data records the position of this packet in the buffer & tid of this socket
                 // (so that task thread could know which buffer it should visit)
-                package_message.data = cursor + tid * buffer_chunk_size;
-                if (message_queue_->enqueue(local_ptok, package_message)
+                package_message.data = slot[ch] + tid * buffer_chunk_size;
+                package_message.gen = gen[ch];
+                if (this->recorders_.empty() == false) {
+                    size_t recorder_id
+                        = package_message.ant_id / this->antennas_per_recorder_;
+                    Sounder::RecorderThread::RecordEventData do_record_task;
+                    do_record_task.event_type = Sounder::RecorderThread::
+                        RecordEventType::kTaskRecord;
+                    do_record_task.data = package_message.data;
+                    do_record_task.gen = package_message.gen;
+                    do_record_task.rx_buffer = rx_buffer;
+                    do_record_task.rx_buff_size = buffer_chunk_size;
+                    this->recorders_.at(recorder_id)
+                        ->DispatchWork(
+                            do_record_task, recorder_ptoks.at(recorder_id));
+                } else if (message_queue_->enqueue(local_ptok, package_message)
                     == false) {
                     MLPD_ERROR("socket message enqueue failed\n");
                     throw std::runtime_error("socket message enqueue failed");
                 }
-                cursor++;
-                cursor %= buffer_chunk_size;
+            }
+
+            if (this->adaptive_rx_ == true) {
+                std::atomic<uint32_t>& cost = this->radio_cost_ns_[it];
+                int64_t sample = telemetryNowNs() - service_start_ns;
+                int64_t average = cost.load(std::memory_order_relaxed);
+                average += (sample - average) >> kRxCostShift;
+                cost.store(average, std::memory_order_relaxed);
+            }
+        }
+
+        // loads are published once the service times had time to settle
+        if ((this->adaptive_rx_ == true) && (frame_id != last_frame_id)) {
+            last_frame_id = frame_id;
+            if (++frames_seen >= kRxRebalanceFrames) {
+                this->rebalanceRx(tid, frame_id, radio_ids_in_thread);
             }
         }
 
@@ -427,11 +782,23 @@ void Receiver::loopRecv(int tid, int core_id, SampleBuffer* rx_buffer)
             symbol_id++;
         }
     }
+    // The recorders keep running until all rx threads are done, and the
+    // dispatcher forwards the queued packages until all loops are left
+    this->recv_loops_done_.fetch_add(1, std::memory_order_release);
+    release_direct_rx(true);
     MLPD_SYMBOL(
         "Process %d -- Loop Rx Freed memory at: %p\n", tid, zeroes_memory);
     free(zeroes_memory);
 }
 
+// Frame timing handed from the client RX loop to its TX thread
+struct ClientTxJob {
+    size_t frame;
+    long long rx_time;
+};
+// Frames the client TX thread may lag behind before TX is dropped
+static const size_t kClientTxQueueDepth = 4;
+
 void* Receiver::clientTxRx_launch(void* in_context)
 {
     dev_profile* context = (dev_profile*)in_context;
@@ -459,9 +826,8 @@ void Receiver::clientTxRx(int tid)
     unsigned txFrameDelta = (unsigned)(std::ceil(TIME_DELTA / frameTime));
     int NUM_SAMPS = config_->samps_per_symbol();
 
-    if (config_->core_alloc() == true) {
-        int core
-            = tid + 1 + config_->rx_thread_num() + config_->task_thread_num();
+    int core = config_->thread_core(CorePlanner::kClient, tid);
+    if (core >= 0) {
         MLPD_INFO("Pinning client TxRx thread %d to core %d\n", tid, core);
         if (pin_to_core(core) != 0) {
             MLPD_ERROR(
@@ -540,10 +906,8 @@ void Receiver::clientTxRx(int tid)
 
 void Receiver::clientSyncTxRx(int tid)
 {
-    if (config_->core_alloc() == true) {
-        int core
-            = tid + 1 + config_->rx_thread_num() + config_->task_thread_num();
-
+    int core = config_->thread_core(CorePlanner::kClient, tid);
+    if (core >= 0) {
         MLPD_INFO("Pinning client synctxrx thread %d to core %d\n", tid, core);
         if (pin_to_core(core) != 0) {
             MLPD_ERROR(
@@ -611,14 +975,27 @@ void Receiver::clientSyncTxRx(int tid)
     }
 
     FILE* fp = nullptr;
+    std::unique_ptr<UlTxData> ul_data;
+    std::vector<const void*> ul_txbuff(2);
     if (config_->ul_data_sym_present() == true) {
-        std::printf("Opening UL time-domain data for radio %d to %s\n", tid,
-            config_->tx_td_data_files().at(tid).c_str());
-        fp = std::fopen(config_->tx_td_data_files().at(tid).c_str(), "rb");
+        const std::string& ul_file = config_->tx_td_data_files().at(tid);
+        if (config_->ul_data_mode() == "stream") {
+            std::printf("Opening UL time-domain data for radio %d to %s\n",
+                tid, ul_file.c_str());
+            fp = std::fopen(ul_file.c_str(), "rb");
+        } else {
+            ul_data.reset(new UlTxData(ul_file, config_->samps_per_symbol(),
+                config_->ul_data_mode() == "preload"));
+            size_t expected
+                = config_->ul_data_frame_num() * txSyms * config_->cl_sdr_ch();
+            if (ul_data->records() < expected) {
+                MLPD_WARN("%s holds %zu of %zu uplink records, repeating\n",
+                    ul_file.c_str(), ul_data->records(), expected);
+            }
+        }
     }
 
     long long rxTime(0);
-    long long txTime(0);
     int sync_index(-1);
     int rx_offset = 0;
 
@@ -632,31 +1009,32 @@ void Receiver::clientSyncTxRx(int tid)
         }
     }
 
-    // Keep reading one frame worth of data until a beacon is found
-    // Perform initial beacon detection once every BEACON_INTERVAL frames
+    // Stream symbol sized reads through the beacon detector until it fires,
+    // a beacon split across two reads is still found
+    BeaconDetector beacon_detector(config_->gold_cf32(), SYNC_NUM_SAMPS);
+    long long sync_pos = 0; // samples read since the search started
     while ((config_->running() == true) && (sync_index < 0)) {
-        int r;
-        for (int find_beacon_retry = 0; find_beacon_retry < BEACON_INTERVAL;
-             find_beacon_retry++) {
-            r = clientRadioSet_->radioRx(
-                tid, syncrxbuff.data(), SYNC_NUM_SAMPS, rxTime);
-            if (r != SYNC_NUM_SAMPS) {
-                MLPD_WARN("BAD SYNC Receive( %d / %d ) at Time %lld\n", r,
-                    SYNC_NUM_SAMPS, rxTime);
-            }
+        int r = clientRadioSet_->radioRx(
+            tid, syncrxbuff.data(), NUM_SAMPS, rxTime);
+        if (r != NUM_SAMPS) {
+            MLPD_WARN("BAD SYNC Receive( %d / %d ) at Time %lld\n", r,
+                NUM_SAMPS, rxTime);
         }
-        //TODO syncbuff0 is sloppy here since we recevied into syncrxbuff.data(), r bytes.
-#if defined(__x86_64__)
-        sync_index = CommsLib::find_beacon_avx(syncbuff0, config_->gold_cf32());
-#else
-        sync_index = CommsLib::find_beacon(syncbuff0);
-#endif
+        if (r <= 0)
+            continue;
+        sync_index = beacon_detector.process(syncbuff0.data(), r);
 
         if (sync_index >= 0) {
             MLPD_INFO("Beacon detected at Time %lld, sync_index: %d\n", rxTime,
                 sync_index);
-            rx_offset = sync_index - config_->beacon_size() - config_->prefix();
+            // samples left from the end of this read to the next frame start
+            long long frame_start = sync_pos + sync_index
+                - config_->beacon_size() - config_->prefix();
+            long long to_frame
+                = (frame_start - (sync_pos + r)) % SYNC_NUM_SAMPS;
+            rx_offset = (to_frame < 0) ? to_frame + SYNC_NUM_SAMPS : to_frame;
         }
+        sync_pos += r;
     }
 
     // Read rx_offset to align with the begining of a frame
@@ -685,7 +1063,92 @@ void Receiver::clientSyncTxRx(int tid)
 
     // for UHD device, the first pilot should not have an END_BURST flag
     int flags = (((kUseUHD == true) && (config_->cl_sdr_ch() == 2))) ? 1 : 2;
-    int flagsTxUlData;
+
+    // Pilots and UL data of the frame received at rx_time, sent
+    // txFrameDelta frames ahead
+    auto transmit_frame = [&](size_t frame, long long rx_time) {
+        // config_->tx_advance() needs calibration based on SDR model and sampling rate
+        long long txTime = rx_time + txTimeDelta
+            + config_->cl_pilot_symbols().at(tid).at(0) * NUM_SAMPS
+            - config_->tx_advance();
+
+        int r = clientRadioSet_->radioTx(
+            tid, pilotbuffA.data(), NUM_SAMPS, flags, txTime);
+        if (r < NUM_SAMPS) {
+            MLPD_WARN("BAD Write: %d/%d\n", r, NUM_SAMPS);
+        }
+        if (config_->cl_sdr_ch() == 2) {
+            txTime = rx_time + txTimeDelta
+                + config_->cl_pilot_symbols().at(tid).at(1) * NUM_SAMPS
+                - config_->tx_advance();
+
+            r = clientRadioSet_->radioTx(
+                tid, pilotbuffB.data(), NUM_SAMPS, kStreamEndBurst, txTime);
+            if (r < NUM_SAMPS) {
+                MLPD_WARN("BAD Write: %d/%d\n", r, NUM_SAMPS);
+            }
+        }
+        if (config_->ul_data_sym_present() == true) {
+            int flagsTxUlData;
+            // Frame * UL Slots * Channel records
+            size_t ul_frame_rec = (frame % config_->ul_data_frame_num())
+                * txSyms * config_->cl_sdr_ch();
+            for (size_t s = 0; s < txSyms; s++) {
+                txTime = rx_time + txTimeDelta
+                    + config_->cl_ul_symbols().at(tid).at(s) * NUM_SAMPS
+                    - config_->tx_advance();
+                if (ul_data != nullptr) {
+                    size_t rec = ul_frame_rec + s * config_->cl_sdr_ch();
+                    for (size_t ch = 0; ch < config_->cl_sdr_ch(); ch++)
+                        ul_txbuff.at(ch) = ul_data->record(rec + ch);
+                } else {
+                    for (size_t ch = 0; ch < config_->cl_sdr_ch(); ch++) {
+                        size_t read_num = std::fread(txbuff.at(ch),
+                            2 * sizeof(float), config_->samps_per_symbol(), fp);
+                        if (read_num != config_->samps_per_symbol()) {
+                            MLPD_WARN("BAD Uplink Data Read: %zu/%zu\n",
+                                read_num, config_->samps_per_symbol());
+                        }
+                        ul_txbuff.at(ch) = txbuff.at(ch);
+                    }
+                }
+                if (kUseUHD && s < (txSyms - 1))
+                    flagsTxUlData = 1; // HAS_TIME
+                else
+                    flagsTxUlData = 2; // HAS_TIME & END_BURST, fixme
+                r = clientRadioSet_->radioTx(
+                    tid, ul_txbuff.data(), NUM_SAMPS, flagsTxUlData, txTime);
+                if (r < NUM_SAMPS) {
+                    MLPD_WARN("BAD Write: %d/%d\n", r, NUM_SAMPS);
+                }
+            } // end for
+            if (fp != nullptr && frame % config_->ul_data_frame_num() == 0)
+                std::fseek(fp, 0, SEEK_SET);
+        } // end if config_->ul_data_sym_present()
+    };
+
+    // With tx_thread the RX loop only queues the frame timing and a
+    // second thread does the TX scheduling
+    moodycamel::ConcurrentQueue<ClientTxJob> tx_queue(kClientTxQueueDepth);
+    std::atomic<bool> tx_done(false);
+    std::thread tx_thread;
+    if (config_->cl_tx_thread() == true) {
+        tx_thread = std::thread([&] {
+            int tx_core = config_->thread_core(CorePlanner::kClientTx, tid);
+            if ((tx_core >= 0) && (pin_to_core(tx_core) != 0)) {
+                MLPD_WARN("Pin client %d TX thread to core %d failed\n", tid,
+                    tx_core);
+            }
+            ClientTxJob job;
+            while (tx_done == false) {
+                if (tx_queue.try_dequeue(job) == true)
+                    transmit_frame(job.frame, job.rx_time);
+                else
+                    std::this_thread::yield();
+            }
+        });
+        MLPD_INFO("Client %d TX scheduling runs in its own thread\n", tid);
+    }
 
     while (config_->running() == true) {
         for (size_t sf = 0; sf < config_->symbols_per_frame(); sf++) {
@@ -711,16 +1174,10 @@ void Receiver::clientSyncTxRx(int tid)
                 }
                 rx_offset = 0;
                 if (resync == true) {
-                    //Need to bound the beacon detection to the last 'r not the size of the memory (vector)
-                    //TODO: Remove the copy and direct access to syncbuff0
-                    std::vector<std::complex<float>> radio_rx_data(
-                        syncbuff0.begin(), syncbuff0.begin() + r);
-#if defined(__x86_64__)
-                    sync_index = CommsLib::find_beacon_avx(
-                        radio_rx_data, config_->gold_cf32());
-#else
-                    sync_index = CommsLib::find_beacon(radio_rx_data);
-#endif
+                    // the beacon is in the first r samples of this read
+                    beacon_detector.reset();
+                    sync_index
+                        = beacon_detector.process(syncbuff0.data(), r);
                     if (sync_index >= 0) {
                         rx_offset = sync_index - config_->beacon_size()
                             - config_->prefix();
@@ -747,59 +1204,23 @@ void Receiver::clientSyncTxRx(int tid)
                     break;
                 }
 
-                // config_->tx_advance() needs calibration based on SDR model and sampling rate
-                txTime = rxTime + txTimeDelta
-                    + config_->cl_pilot_symbols().at(tid).at(0) * NUM_SAMPS
-                    - config_->tx_advance();
-
-                r = clientRadioSet_->radioTx(
-                    tid, pilotbuffA.data(), NUM_SAMPS, flags, txTime);
-                if (r < NUM_SAMPS) {
-                    MLPD_WARN("BAD Write: %d/%d\n", r, NUM_SAMPS);
+                if (tx_thread.joinable() == false) {
+                    transmit_frame(frame_cnt, rxTime);
+                } else if (tx_queue.size_approx() >= kClientTxQueueDepth) {
+                    MLPD_WARN("Client %d TX thread behind, dropping TX of "
+                              "frame %zu\n",
+                        tid, frame_cnt);
+                } else {
+                    tx_queue.enqueue({ frame_cnt, rxTime });
                 }
-                if (config_->cl_sdr_ch() == 2) {
-                    txTime = rxTime + txTimeDelta
-                        + config_->cl_pilot_symbols().at(tid).at(1) * NUM_SAMPS
-                        - config_->tx_advance();
-
-                    r = clientRadioSet_->radioTx(tid, pilotbuffB.data(),
-                        NUM_SAMPS, kStreamEndBurst, txTime);
-                    if (r < NUM_SAMPS) {
-                        MLPD_WARN("BAD Write: %d/%d\n", r, NUM_SAMPS);
-                    }
-                }
-                if (config_->ul_data_sym_present() == true) {
-                    for (size_t s = 0; s < txSyms; s++) {
-                        txTime = rxTime + txTimeDelta
-                            + config_->cl_ul_symbols().at(tid).at(s) * NUM_SAMPS
-                            - config_->tx_advance();
-                        for (size_t ch = 0; ch < config_->cl_sdr_ch(); ch++) {
-                            size_t read_num
-                                = std::fread(txbuff.at(ch), 2 * sizeof(float),
-                                    config_->samps_per_symbol(), fp);
-                            if (read_num != config_->samps_per_symbol()) {
-                                MLPD_WARN("BAD Uplink Data Read: %zu/%zu\n",
-                                    read_num, config_->samps_per_symbol());
-                            }
-                        }
-                        if (kUseUHD && s < (txSyms - 1))
-                            flagsTxUlData = 1; // HAS_TIME
-                        else
-                            flagsTxUlData = 2; // HAS_TIME & END_BURST, fixme
-                        r = clientRadioSet_->radioTx(tid, txbuff.data(),
-                            NUM_SAMPS, flagsTxUlData, txTime);
-                        if (r < NUM_SAMPS) {
-                            MLPD_WARN("BAD Write: %d/%d\n", r, NUM_SAMPS);
-                        }
-                    } // end for
-                    if (frame_cnt % config_->ul_data_frame_num() == 0)
-                        std::fseek(fp, 0, SEEK_SET);
-                } // end if config_->ul_data_sym_present()
             } // end if sf == 0
         } // end for
         frame_cnt++;
     } // end while
-    if (config_->ul_data_sym_present() == true || fp != nullptr) {
+    tx_done = true;
+    if (tx_thread.joinable() == true)
+        tx_thread.join();
+    if (fp != nullptr) {
         std::fclose(fp);
     }
 
@@ -0,0 +1,145 @@
+/*
+ Copyright (c) 2018-2020, Rice University
+ RENEW OPEN SOURCE LICENSE: http://renew-wireless.org/license
+
+----------------------------------------------------------------------
+ Selection of the frames the recorder threads write (record_policy)
+---------------------------------------------------------------------
+*/
+
+#include "include/record_policy.h"
+#include "include/comms-lib-kernels.h"
+#include <algorithm>
+#include <cmath>
+
+namespace Sounder {
+// mean power of a full scale int16 sine
+static const double kFullScalePower = 32768.0 * 32768.0;
+
+RecordTrigger::RecordTrigger(size_t window)
+    : frames_(new std::atomic<uint64_t>[window])
+    , window_(window)
+{
+    for (size_t i = 0; i < window; i++)
+        this->frames_[i].store(0, std::memory_order_relaxed);
+}
+
+void RecordTrigger::raise(size_t frame_id)
+{
+    this->frames_[frame_id % this->window_].store(
+        frame_id + 1, std::memory_order_relaxed);
+}
+
+bool RecordTrigger::raised(size_t frame_id) const
+{
+    return this->frames_[frame_id % this->window_].load(
+               std::memory_order_relaxed)
+        == (frame_id + 1);
+}
+
+RecordPolicy::RecordPolicy(Config* cfg, RecordTrigger* trigger)
+    : cfg_(cfg)
+    , trigger_(trigger)
+    , decimate_(cfg->record_policy() == "decimate")
+    , holdback_(decimate_ ? 0 : cfg->record_trigger_pre())
+    , threshold_(std::pow(10.0, cfg->record_trigger_db() / 10.0))
+    , next_evaluate_(0)
+    , frames_measured_(0)
+    , triggers_(0)
+    , decided_frame_(-1)
+    , decided_keep_(false)
+{
+    if (this->decimate_ == false) {
+        this->frames_.resize(cfg->sample_buffer_frames());
+        for (FrameLevel& frame : this->frames_)
+            frame.frame_id = -1;
+        this->power_.resize(cfg->samps_per_symbol());
+    }
+}
+
+void RecordPolicy::measure(const Package& pkg)
+{
+    if (this->decimate_ == true)
+        return;
+    size_t frame_id = pkg.frame_id;
+    // evaluated already, too late to count
+    if ((frame_id < this->next_evaluate_)
+        || (pkg.symbol_id >= this->cfg_->symbols_per_frame()))
+        return;
+    char type = this->cfg_->symbolInfo(frame_id, pkg.symbol_id).type;
+    if ((type != 'P') && (type != 'N'))
+        return;
+    if (frame_id >= this->next_evaluate_ + this->frames_.size())
+        this->advance(frame_id + 1 - this->frames_.size());
+    this->frames_measured_ = std::max(this->frames_measured_, frame_id + 1);
+
+    FrameLevel& frame = this->frames_[frame_id % this->frames_.size()];
+    if (frame.frame_id != static_cast<int64_t>(frame_id)) {
+        frame.frame_id = frame_id;
+        frame.pilot = 0;
+        frame.noise = 0;
+        frame.pilot_samples = 0;
+        frame.noise_samples = 0;
+    }
+    size_t samples = this->power_.size();
+    commsKernels().abs2_ci16(
+        reinterpret_cast<const std::complex<int16_t>*>(pkg.samples()),
+        samples, this->power_.data());
+    int64_t sum = 0;
+    for (size_t i = 0; i < samples; i++)
+        sum += this->power_[i];
+    if (type == 'P') {
+        frame.pilot += sum;
+        frame.pilot_samples += samples;
+    } else {
+        frame.noise += sum;
+        frame.noise_samples += samples;
+    }
+}
+
+void RecordPolicy::advance(size_t frame_id)
+{
+    frame_id = std::min(frame_id, this->frames_measured_);
+    for (; this->next_evaluate_ < frame_id; this->next_evaluate_++) {
+        FrameLevel& frame
+            = this->frames_[this->next_evaluate_ % this->frames_.size()];
+        if (frame.frame_id == static_cast<int64_t>(this->next_evaluate_))
+            this->evaluate(frame);
+        frame.frame_id = -1;
+    }
+}
+
+void RecordPolicy::evaluate(FrameLevel& frame)
+{
+    if (frame.pilot_samples == 0)
+        return;
+    double level = frame.pilot / frame.pilot_samples;
+    if (frame.noise_samples > 0)
+        level /= std::max(frame.noise / frame.noise_samples, 1.0);
+    else
+        level /= kFullScalePower;
+    if (level >= this->threshold_) {
+        this->trigger_->raise(frame.frame_id);
+        this->triggers_++;
+    }
+}
+
+bool RecordPolicy::keep(size_t frame_id)
+{
+    if (this->decimate_ == true)
+        return (frame_id % this->cfg_->record_decimation()) == 0;
+    if (this->decided_frame_ == static_cast<int64_t>(frame_id))
+        return this->decided_keep_;
+
+    // a trigger in [frame_id - post, frame_id + pre] keeps the frame
+    size_t first = frame_id
+        - std::min(frame_id, this->cfg_->record_trigger_post());
+    size_t last = frame_id + this->cfg_->record_trigger_pre();
+    bool keep = false;
+    for (size_t t = first; (keep == false) && (t <= last); t++)
+        keep = this->trigger_->raised(t);
+    this->decided_frame_ = frame_id;
+    this->decided_keep_ = keep;
+    return keep;
+}
+}; /* End namespace Sounder */
@@ -9,12 +9,11 @@
 #include "include/recorder.h"
 #include "include/logger.h"
 #include "include/macros.h"
+#include "include/master_file.h"
 #include "include/signalHandler.hpp"
 #include "include/utils.h"
 
 namespace Sounder {
-// buffer length of each rx thread
-const int Recorder::kSampleBufferFrameNum = 80;
 // dequeue bulk size, used to reduce the overhead of dequeue in main thread
 const int Recorder::KDequeueBulkSize = 5;
 
@@ -24,18 +23,20 @@ const int kDsSim = 5;
 
 static const int kQueueSize = 36;
 
-Recorder::Recorder(Config* in_cfg, unsigned int core_start)
+Recorder::Recorder(Config* in_cfg)
     : cfg_(in_cfg)
-    , kMainDispatchCore(core_start)
-    , kRecorderCore(kMainDispatchCore + 1)
-    , kRecvCore(kRecorderCore + in_cfg->task_thread_num())
+    , rx_buffer_(nullptr)
 {
-    size_t rx_thread_num = cfg_->rx_thread_num();
+    // a fan-out node has no radios, it records what the radio host sends
+    bool fanout_node = (cfg_->fanout_node() >= 0);
+    size_t rx_thread_num = fanout_node ? 0 : cfg_->rx_thread_num();
     size_t ant_per_rx_thread = cfg_->bs_present() && rx_thread_num > 0
         ? cfg_->getTotNumAntennas() / rx_thread_num
         : 1;
-    rx_thread_buff_size_
-        = kSampleBufferFrameNum * cfg_->symbols_per_frame() * ant_per_rx_thread;
+    if (fanout_node == true)
+        ant_per_rx_thread = fanoutNodeAntennas(cfg_);
+    rx_thread_buff_size_ = cfg_->sample_buffer_frames()
+        * cfg_->symbols_per_frame() * ant_per_rx_thread;
 
     message_queue_ = moodycamel::ConcurrentQueue<Event_data>(
         rx_thread_buff_size_ * kQueueSize);
@@ -46,20 +47,41 @@ Recorder::Recorder(Config* in_cfg, unsigned int core_start)
 
     if (rx_thread_num > 0) {
         // initialize rx buffers
+        BackpressurePolicy policy
+            = backpressurePolicyFromString(cfg_->rx_backpressure());
         rx_buffer_ = new SampleBuffer[rx_thread_num];
-        size_t intsize = sizeof(std::atomic_int);
-        size_t arraysize = (rx_thread_buff_size_ + intsize - 1) / intsize;
         size_t packageLength = sizeof(Package) + cfg_->getPackageDataLength();
         for (size_t i = 0; i < rx_thread_num; i++) {
-            rx_buffer_[i].buffer.resize(rx_thread_buff_size_ * packageLength);
-            rx_buffer_[i].pkg_buf_inuse = new std::atomic_int[arraysize];
-            std::fill_n(rx_buffer_[i].pkg_buf_inuse, arraysize, 0);
+            // memory is touched first by the rx thread that owns it
+            rx_buffer_[i].init(rx_thread_buff_size_, packageLength, policy,
+                cfg_->sample_buffer_huge_pages());
         }
     }
 
+    telemetry_.reset(new Telemetry(
+        fanout_node ? 1 : rx_thread_num, cfg_->task_thread_num()));
+    if ((rx_thread_num > 0) && (cfg_->live_ring_frames() > 0)) {
+        live_ring_.reset(new LiveRing(
+            cfg_, cfg_->live_ring_name(), cfg_->live_ring_frames()));
+    }
+
+    if (cfg_->record_policy() == "trigger") {
+        // covers the frames a lagging recorder thread may still decide
+        record_trigger_.reset(new RecordTrigger(cfg_->record_trigger_pre()
+            + cfg_->record_trigger_post()
+            + (2 * cfg_->sample_buffer_frames())));
+    }
+
+    if (fanout_node == true) {
+        fanout_receiver_.reset(new FanoutReceiver(cfg_,
+            cfg_->thread_core(CorePlanner::kRx, 0), &telemetry_->rx(0)));
+        return;
+    }
+
     // Receiver object will be used for both BS and clients
     try {
-        receiver_.reset(new Receiver(rx_thread_num, cfg_, &message_queue_));
+        receiver_.reset(new Receiver(
+            rx_thread_num, cfg_, &message_queue_, telemetry_.get()));
     } catch (std::exception& e) {
         std::cout << e.what() << '\n';
         gc();
@@ -71,124 +93,233 @@ void Recorder::gc(void)
 {
     MLPD_TRACE("Garbage collect\n");
     this->receiver_.reset();
-    if (this->cfg_->rx_thread_num() > 0) {
-        for (size_t i = 0; i < this->cfg_->rx_thread_num(); i++) {
-            delete[] this->rx_buffer_[i].pkg_buf_inuse;
-        }
-        delete[] this->rx_buffer_;
-    }
+    this->fanout_receiver_.reset();
+    delete[] this->rx_buffer_;
 }
 
 Recorder::~Recorder() { this->gc(); }
 
-void Recorder::do_it()
+size_t Recorder::startRecorders(size_t antenna_offset, size_t antennas)
 {
     size_t recorder_threads = this->cfg_->task_thread_num();
+    size_t thread_antennas = (antennas / recorder_threads);
+    // If antennas are left, distribute them over the threads. This may assign antennas that don't
+    // exist to the threads at the end. This isn't a concern.
+    if ((antennas % recorder_threads) != 0) {
+        thread_antennas = (thread_antennas + 1);
+    }
+
+    for (unsigned int i = 0u; i < recorder_threads; i++) {
+        int thread_core = this->cfg_->thread_core(CorePlanner::kRecorder, i);
+        size_t first_antenna = antenna_offset + (i * thread_antennas);
+
+        MLPD_INFO("Creating recorder thread: %u, with antennas %zu:%zu "
+                  "total %zu\n",
+            i, first_antenna, first_antenna + thread_antennas - 1,
+            thread_antennas);
+        Sounder::RecorderThread::WaitMode wait_mode
+            = (this->cfg_->record_wait_mode(i) == "spin")
+            ? Sounder::RecorderThread::kWaitSpin
+            : Sounder::RecorderThread::kWaitAdaptive;
+        Sounder::RecorderThread* new_recorder = new Sounder::RecorderThread(
+            this->cfg_, i, thread_core,
+            (this->rx_thread_buff_size_ * kQueueSize), first_antenna,
+            thread_antennas, &this->telemetry_->record(i),
+            this->live_ring_.get(), wait_mode,
+            this->cfg_->record_spin_count(), this->record_trigger_.get());
+        new_recorder->Start();
+        this->recorders_.push_back(new_recorder);
+    }
+    return thread_antennas;
+}
+
+void Recorder::stopRecorders(void)
+{
+    /* Force the recorders to process all of the data they have left and exit cleanly
+         * Send a stop to all the recorders to allow the finalization to be done in parrallel */
+    for (auto recorder : this->recorders_) {
+        recorder->Stop();
+    }
+    MasterFile master_file(this->cfg_->getTotNumAntennas());
+    for (auto recorder : this->recorders_) {
+        const RecorderWorker& worker = recorder->GetWorker();
+        master_file.addShard(worker.hdf5_name(), worker.antenna_offset(),
+            worker.num_antennas());
+    }
+    for (auto recorder : this->recorders_) {
+        delete recorder;
+    }
+    // The shards are closed now, readers see them through one file. A
+    // fan-out node only has its own shards.
+    if ((this->recorders_.empty() == false)
+        && (this->cfg_->record_hdf5() == true)
+        && (this->cfg_->record_master_file() == true)
+        && (this->cfg_->fanout_node() < 0)) {
+        master_file.write(this->cfg_->trace_file());
+    }
+    this->recorders_.clear();
+}
+
+size_t Recorder::dispatchEvents(
+    moodycamel::ConsumerToken& ctok, size_t thread_antennas)
+{
+    Event_data events_list[KDequeueBulkSize];
+    // get a bulk of events from the receivers
+    size_t ret = this->message_queue_.try_dequeue_bulk(
+        ctok, events_list, KDequeueBulkSize);
+    // handle each event
+    for (size_t bulk_count = 0; bulk_count < ret; bulk_count++) {
+        Event_data& event = events_list[bulk_count];
+
+        // if kEventRxSymbol, dispatch to proper worker
+        if (event.event_type == kEventRxSymbol) {
+            size_t thread_index = event.ant_id / thread_antennas;
+            int offset = event.data;
+            Sounder::RecorderThread::RecordEventData do_record_task;
+            do_record_task.event_type
+                = Sounder::RecorderThread::RecordEventType::kTaskRecord;
+            do_record_task.data = offset;
+            do_record_task.gen = event.gen;
+            do_record_task.rx_buffer = this->rx_buffer_;
+            do_record_task.rx_buff_size = this->rx_thread_buff_size_;
+            // Pass the work off to the applicable worker
+            // Worker must free the buffer, future work would involve making
+            // this cleaner
+            bool dispatched = (this->fanout_.empty() == false)
+                ? this->fanout_.at(thread_index)->DispatchWork(do_record_task)
+                : this->recorders_.at(thread_index)
+                      ->DispatchWork(do_record_task);
+            if (dispatched == false) {
+                MLPD_ERROR("Record task enqueue failed\n");
+                throw std::runtime_error("Record task enqueue failed");
+            }
+            telemetryAdd(this->telemetry_->dispatch().packets);
+        }
+    }
+    return ret;
+}
+
+void Recorder::do_it()
+{
     size_t total_antennas = cfg_->getTotNumAntennas();
     size_t thread_antennas = 0;
     std::vector<pthread_t> recv_threads;
 
     MLPD_TRACE("Recorder work thread\n");
-    if ((this->cfg_->core_alloc() == true)
-        && (pin_to_core(kMainDispatchCore) != 0)) {
-        MLPD_ERROR("Pinning main recorder thread to core 0 failed");
-        throw std::runtime_error(
-            "Pinning main recorder thread to core 0 failed");
+    int dispatch_core = this->cfg_->thread_core(CorePlanner::kDispatcher, 0);
+    if ((dispatch_core >= 0) && (pin_to_core(dispatch_core) != 0)) {
+        MLPD_ERROR(
+            "Pinning main recorder thread to core %d failed\n", dispatch_core);
+        throw std::runtime_error("Pinning main recorder thread failed");
+    }
+
+    if (this->cfg_->rx_thread_num() > 0) {
+        this->telemetry_->start(
+            this->cfg_->telemetry_file(), this->cfg_->telemetry_interval_ms());
+    }
+
+    /* A fan-out node records its share of the antennas until the radio
+     * host ends the capture */
+    if (this->fanout_receiver_ != nullptr) {
+        size_t node_antennas = fanoutNodeAntennas(this->cfg_);
+        size_t antenna_offset = this->cfg_->fanout_node() * node_antennas;
+        thread_antennas = this->startRecorders(antenna_offset,
+            std::min(node_antennas, total_antennas - antenna_offset));
+        this->fanout_receiver_->Start(
+            this->recorders_, antenna_offset, thread_antennas);
+        while ((this->cfg_->running() == true)
+            && (SignalHandler::gotExitSignal() == false)) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        this->cfg_->running(false);
+        this->fanout_receiver_->Stop();
+        this->stopRecorders();
+        this->fanout_receiver_.reset();
+        this->telemetry_->stop();
+        return;
     }
 
     if (this->cfg_->client_present() == true) {
         auto client_threads = this->receiver_->startClientThreads();
     }
 
-    if (this->cfg_->rx_thread_num() > 0) {
-
-        thread_antennas = (total_antennas / recorder_threads);
-        // If antennas are left, distribute them over the threads. This may assign antennas that don't
-        // exist to the threads at the end. This isn't a concern.
-        if ((total_antennas % recorder_threads) != 0) {
-            thread_antennas = (thread_antennas + 1);
+    if ((this->cfg_->rx_thread_num() > 0)
+        && (this->cfg_->fanout_nodes().empty() == false)) {
+        // the same split as the recorder threads of one host
+        thread_antennas = fanoutNodeAntennas(this->cfg_);
+        for (size_t i = 0; i < this->cfg_->fanout_nodes().size(); i++) {
+            MLPD_INFO("Fan-out node %zu: %s, with antennas %zu:%zu\n", i,
+                this->cfg_->fanout_nodes().at(i).c_str(),
+                i * thread_antennas, ((i + 1) * thread_antennas) - 1);
+            Sounder::FanoutSender* sender = new Sounder::FanoutSender(
+                this->cfg_, i, this->cfg_->thread_core(CorePlanner::kFanout, i),
+                (this->rx_thread_buff_size_ * kQueueSize));
+            sender->Start();
+            this->fanout_.push_back(sender);
         }
+        recv_threads = this->receiver_->startRecvThreads(this->rx_buffer_);
+    } else if (this->cfg_->rx_thread_num() > 0) {
+        thread_antennas = this->startRecorders(0, total_antennas);
 
-        for (unsigned int i = 0u; i < recorder_threads; i++) {
-            int thread_core = -1;
-            if (this->cfg_->core_alloc() == true) {
-                thread_core = kRecorderCore + i;
-            }
-
-            MLPD_INFO("Creating recorder thread: %u, with antennas %zu:%zu "
-                      "total %zu\n",
-                i, (i * thread_antennas), ((i + 1) * thread_antennas) - 1,
-                thread_antennas);
-            Sounder::RecorderThread* new_recorder
-                = new Sounder::RecorderThread(this->cfg_, i, thread_core,
-                    (this->rx_thread_buff_size_ * kQueueSize),
-                    (i * thread_antennas), thread_antennas, true);
-            new_recorder->Start();
-            this->recorders_.push_back(new_recorder);
+        if (this->cfg_->record_direct_routing() == true) {
+            MLPD_INFO("Routing received packages directly to the recorders\n");
+            this->receiver_->setRecorders(this->recorders_, thread_antennas);
         }
 
         // create socket buffer and socket threads
         recv_threads
-            = this->receiver_->startRecvThreads(this->rx_buffer_, kRecvCore);
+            = this->receiver_->startRecvThreads(this->rx_buffer_);
     } else
         this->receiver_->go(); // only beamsweeping
 
     moodycamel::ConsumerToken ctok(this->message_queue_);
 
-    Event_data events_list[KDequeueBulkSize];
-    int ret = 0;
+    /* With direct routing the receivers feed the recorders, just wait */
+    while ((this->cfg_->record_direct_routing() == true)
+        && (this->cfg_->running() == true)
+        && (SignalHandler::gotExitSignal() == false)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
 
-    /* TODO : we can probably remove the dispatch function and pass directly to the recievers */
     while ((this->cfg_->running() == true)
         && (SignalHandler::gotExitSignal() == false)) {
-        // get a bulk of events from the receivers
-        ret = this->message_queue_.try_dequeue_bulk(
-            ctok, events_list, KDequeueBulkSize);
-        //if (ret > 0)
-        //{
-        //    MLPD_TRACE("Message(s) received: %d\n", ret );
-        //}
-        // handle each event
-        for (int bulk_count = 0; bulk_count < ret; bulk_count++) {
-            Event_data& event = events_list[bulk_count];
-
-            // if kEventRxSymbol, dispatch to proper worker
-            if (event.event_type == kEventRxSymbol) {
-                size_t thread_index = event.ant_id / thread_antennas;
-                int offset = event.data;
-                Sounder::RecorderThread::RecordEventData do_record_task;
-                do_record_task.event_type
-                    = Sounder::RecorderThread::RecordEventType::kTaskRecord;
-                do_record_task.data = offset;
-                do_record_task.rx_buffer = this->rx_buffer_;
-                do_record_task.rx_buff_size = this->rx_thread_buff_size_;
-                // Pass the work off to the applicable worker
-                // Worker must free the buffer, future work would involve making this cleaner
-
-                //If no worker threads, it is possible to handle the event directly.
-                //this->worker_.handleEvent(do_record_task, 0);
-                if (this->recorders_.at(thread_index)
-                        ->DispatchWork(do_record_task)
-                    == false) {
-                    MLPD_ERROR("Record task enqueue failed\n");
-                    throw std::runtime_error("Record task enqueue failed");
-                }
-            }
-        }
+        this->dispatchEvents(ctok, thread_antennas);
     }
     this->cfg_->running(false);
+    // The rx threads wait for the slots they lent driver buffers to, the
+    // packages queued until they left their loops still go out
+    while (this->receiver_->recvLoopsDone() < (int)recv_threads.size()) {
+        if (this->dispatchEvents(ctok, thread_antennas) == 0)
+            std::this_thread::yield();
+    }
+    // and what they queued last
+    while (this->dispatchEvents(ctok, thread_antennas) > 0)
+        continue;
     this->receiver_->completeRecvThreads(recv_threads);
     this->receiver_.reset();
 
-    /* Force the recorders to process all of the data they have left and exit cleanly
-         * Send a stop to all the recorders to allow the finalization to be done in parrallel */
-    for (auto recorder : this->recorders_) {
-        recorder->Stop();
+    // The senders flush what they hold and tell their nodes to stop
+    for (auto sender : this->fanout_) {
+        sender->Stop();
     }
-    for (auto recorder : this->recorders_) {
-        delete recorder;
+    for (auto sender : this->fanout_) {
+        delete sender;
+    }
+    this->fanout_.clear();
+    this->stopRecorders();
+    this->telemetry_->stop();
+
+    for (size_t i = 0; i < this->cfg_->rx_thread_num(); i++) {
+        const SampleBuffer& buffer = this->rx_buffer_[i];
+        if ((buffer.dropped_newest() + buffer.dropped_oldest()
+                + buffer.blocked())
+            > 0) {
+            MLPD_WARN("Rx thread %zu buffer overrun: %zu new and %zu queued "
+                      "packages dropped, %zu stale, blocked %zu times\n",
+                i, buffer.dropped_newest(), buffer.dropped_oldest(),
+                buffer.stale(), buffer.blocked());
+        }
     }
-    this->recorders_.clear();
 }
 
 int Recorder::getRecordedFrameNum() { return this->max_frame_number_; }
@@ -11,20 +11,53 @@
 #include "include/logger.h"
 #include "include/macros.h"
 #include "include/utils.h"
+#include <chrono>
 
 namespace Sounder {
+// dequeue bulk size, used to reduce the overhead of dequeue
+const size_t RecorderThread::kDequeueBulkSize = 16;
+// A thread holding packages wakes up this often to see the end of the
+// capture, the rx threads wait for the held slots
+static const std::chrono::milliseconds kHeldParkPoll(1);
+
+static inline void spin_pause(void)
+{
+#if defined(__x86_64__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
 RecorderThread::RecorderThread(Config* in_cfg, size_t thread_id, int core,
     size_t queue_size, size_t antenna_offset, size_t num_antennas,
-    bool wait_signal)
+    RecordStats* stats, LiveRing* live_ring, WaitMode wait_mode,
+    size_t spin_count, RecordTrigger* trigger)
     : event_queue_(queue_size)
     , producer_token_(event_queue_)
-    , worker_(in_cfg, antenna_offset, num_antennas)
+    , cfg_(in_cfg)
+    , worker_(in_cfg, antenna_offset, num_antennas, stats, live_ring)
     , thread_()
+    , frames_seen_(0)
     , id_(thread_id)
+    , stats_(stats)
     , core_alloc_(core)
-    , wait_signal_(wait_signal)
+    , wait_mode_(wait_mode)
+    , spin_count_(spin_count)
+    , parked_(false)
 {
     package_data_length_ = in_cfg->getPackageDataLength();
+    if (in_cfg->record_csi() == true) {
+        csi_.reset(new CsiStage(in_cfg));
+        csi_events_.reserve(kDequeueBulkSize);
+        csi_pkgs_.reserve(kDequeueBulkSize);
+    }
+    // calibration frames have no pilots to trigger on
+    if ((in_cfg->record_policy() != "all")
+        && (in_cfg->reciprocal_calib() == false)) {
+        assert((in_cfg->record_policy() == "decimate") || (trigger != nullptr));
+        policy_.reset(new RecordPolicy(in_cfg, trigger));
+    }
     worker_.init();
     running_ = false;
 }
@@ -66,27 +99,50 @@ void RecorderThread::Finalize(void)
 /* TODO:  handle producer token better */
 //Returns true for success, false otherwise
 bool RecorderThread::DispatchWork(RecordEventData event)
+{
+    return this->DispatchWork(event, this->producer_token_);
+}
+
+bool RecorderThread::DispatchWork(
+    RecordEventData event, moodycamel::ProducerToken& token)
 {
     //MLPD_TRACE("Dispatching work\n");
     bool ret = true;
-    if (this->event_queue_.try_enqueue(this->producer_token_, event) == 0) {
+    if (this->event_queue_.try_enqueue(token, event) == 0) {
         MLPD_WARN("Queue limit has reached! try to increase queue size.\n");
-        if (this->event_queue_.enqueue(this->producer_token_, event) == 0) {
+        if (this->event_queue_.enqueue(token, event) == 0) {
             MLPD_ERROR("Record task enqueue failed\n");
             throw std::runtime_error("Record task enqueue failed");
             ret = false;
         }
     }
 
-    if (this->wait_signal_ == true) {
-        if (ret == true) {
+    // Pairs with the fence in Park(): either the consumer sees this event
+    // when it re-checks the queue or we see that it is parked
+    if (this->wait_mode_ == kWaitAdaptive) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (this->parked_.load(std::memory_order_relaxed) == true) {
             std::lock_guard<std::mutex> thread_lock(this->sync_);
+            this->condition_.notify_one();
         }
-        this->condition_.notify_all();
     }
     return ret;
 }
 
+void RecorderThread::Park(void)
+{
+    std::unique_lock<std::mutex> thread_wait(this->sync_);
+    this->parked_.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    /* Wait until a new message exists, should eliminate the CPU polling */
+    auto ready = [this] { return this->event_queue_.size_approx() > 0; };
+    if (this->held_.empty() == true)
+        this->condition_.wait(thread_wait, ready);
+    else
+        this->condition_.wait_for(thread_wait, kHeldParkPoll, ready);
+    this->parked_.store(false, std::memory_order_relaxed);
+}
+
 void RecorderThread::DoRecording(void)
 {
     //Sync the start
@@ -111,55 +167,173 @@ void RecorderThread::DoRecording(void)
         this->id_, this->worker_.num_antennas(),
         this->worker_.antenna_offset());
 
-    RecordEventData event;
-    bool ret = false;
+    RecordEventData events[kDequeueBulkSize];
+    size_t idle_polls = 0;
     while (this->running_ == true) {
-        ret = this->event_queue_.try_dequeue(ctok, event);
+        // The capture ended, nothing waits for the frames after the held
+        // ones anymore
+        if ((this->held_.empty() == false)
+            && (this->cfg_->running() == false)) {
+            this->ReleaseHeld(true);
+            this->FlushCsi();
+        }
+        size_t count = this->event_queue_.try_dequeue_bulk(
+            ctok, events, kDequeueBulkSize);
 
-        if (ret == false) /* Queue empty */
+        if (count == 0) /* Queue empty */
         {
-            if (this->wait_signal_ == true) {
-                std::unique_lock<std::mutex> thread_wait(this->sync_);
-                /* Wait until a new message exists, should eliminate the CPU polling */
-                this->condition_.wait(thread_wait, [this, &ctok, &event] {
-                    return this->event_queue_.try_dequeue(ctok, event);
-                });
-                /* return from here with a valid event to process */
-                ret = true;
+            this->worker_.flush(true);
+            if ((this->wait_mode_ == kWaitAdaptive)
+                && (++idle_polls > this->spin_count_)) {
+                this->Park();
+                idle_polls = 0;
+            } else {
+                spin_pause();
             }
+            continue;
         }
 
-        if (ret == true) {
-            this->HandleEvent(event);
+        idle_polls = 0;
+        this->stats_->queue_depth.store(
+            this->event_queue_.size_approx(), std::memory_order_relaxed);
+        for (size_t i = 0; i < count; i++) {
+            this->HandleEvent(events[i]);
         }
+        this->FlushCsi();
+        this->worker_.flush(false);
+    }
+    if (this->policy_ != nullptr) {
+        this->ReleaseHeld(true);
+        this->FlushCsi();
     }
     this->worker_.finalize();
 }
 
+// Buffer of the slot an event refers to, offset within that buffer
+static inline SampleBuffer& eventBuffer(
+    const RecorderThread::RecordEventData& event, size_t& buffer_offset)
+{
+    size_t offset = event.data;
+    size_t buffer_id = (offset / event.rx_buff_size);
+    buffer_offset = offset - (buffer_id * event.rx_buff_size);
+    return event.rx_buffer[buffer_id];
+}
+
 void RecorderThread::HandleEvent(RecordEventData event)
 {
     if (event.event_type == kThreadTermination) {
         this->running_ = false;
     } else {
-        size_t offset = event.data;
-        size_t buffer_id = (offset / event.rx_buff_size);
-        size_t buffer_offset = offset - (buffer_id * event.rx_buff_size);
+        size_t buffer_offset;
+        SampleBuffer& rx_buffer = eventBuffer(event, buffer_offset);
+
+        /* Skip packages whose slot was taken back by the rx thread */
+        if (rx_buffer.claimSlot(buffer_offset, event.gen) == false)
+            return;
+
         if (event.event_type == kTaskRecord) {
-            // read info
-            size_t package_length
-                = sizeof(Package) + this->package_data_length_;
-            char* cur_ptr_buffer = event.rx_buffer[buffer_id].buffer.data()
-                + (buffer_offset * package_length);
-
-            this->worker_.record(
-                this->id_, reinterpret_cast<Package*>(cur_ptr_buffer));
+            Package* pkg
+                = reinterpret_cast<Package*>(rx_buffer.slot(buffer_offset));
+            if (this->policy_ != nullptr)
+                this->HoldEvent(event, pkg);
+            else
+                this->RecordEvent(event, pkg);
+            return;
         }
 
         /* Free up the buffer memory */
-        int bit = 1 << (buffer_offset % sizeof(std::atomic_int));
-        int offs = (buffer_offset / sizeof(std::atomic_int));
-        std::atomic_fetch_and(
-            &event.rx_buffer[buffer_id].pkg_buf_inuse[offs], ~bit); // now empty
+        rx_buffer.releaseSlot(buffer_offset, event.gen);
+    }
+}
+
+void RecorderThread::RecordEvent(RecordEventData event, Package* pkg)
+{
+    bool pilot = (this->cfg_->reciprocal_calib() == true)
+        || (this->cfg_->symbolInfo(pkg->frame_id, pkg->symbol_id).type
+            == 'P');
+    if ((this->csi_ != nullptr) && (pilot == true)) {
+        this->csi_events_.push_back(event);
+        this->csi_pkgs_.push_back(pkg);
+        return;
+    }
+    this->worker_.record(this->id_, pkg);
+    telemetryAdd(this->stats_->packets);
+    telemetryLatency(*this->stats_, pkg->rx_time_ns);
+
+    /* Free up the buffer memory */
+    size_t buffer_offset;
+    SampleBuffer& rx_buffer = eventBuffer(event, buffer_offset);
+    rx_buffer.releaseSlot(buffer_offset, event.gen);
+}
+
+void RecorderThread::HoldEvent(RecordEventData event, Package* pkg)
+{
+    if (this->policy_->decimate() == true) {
+        this->DecideEvent(event, pkg);
+        return;
+    }
+    this->policy_->measure(*pkg);
+    this->frames_seen_
+        = std::max(this->frames_seen_, size_t(pkg->frame_id) + 1);
+    this->held_.emplace_back(event, pkg);
+    this->ReleaseHeld(false);
+}
+
+void RecorderThread::ReleaseHeld(bool all)
+{
+    // one frame of slack for the packages the rx threads reorder
+    size_t evaluated = all
+        ? this->frames_seen_
+        : this->frames_seen_ - std::min(this->frames_seen_, size_t(2));
+    this->policy_->advance(evaluated);
+    size_t holdback = this->policy_->holdback();
+    while (this->held_.empty() == false) {
+        RecordEventData event = this->held_.front().first;
+        Package* pkg = this->held_.front().second;
+        if ((all == false) && ((pkg->frame_id + holdback) >= evaluated))
+            break;
+        this->held_.pop_front();
+        this->DecideEvent(event, pkg);
+    }
+    this->stats_->triggers.store(
+        this->policy_->triggers(), std::memory_order_relaxed);
+}
+
+void RecorderThread::DecideEvent(RecordEventData event, Package* pkg)
+{
+    if (this->policy_->keep(pkg->frame_id) == true) {
+        this->RecordEvent(event, pkg);
+        return;
+    }
+    this->worker_.skip(pkg);
+    size_t buffer_offset;
+    SampleBuffer& rx_buffer = eventBuffer(event, buffer_offset);
+    rx_buffer.releaseSlot(buffer_offset, event.gen);
+    telemetryAdd(this->stats_->policy_skipped);
+}
+
+void RecorderThread::FlushCsi(void)
+{
+    if (this->csi_pkgs_.empty() == true)
+        return;
+
+    size_t count = this->csi_pkgs_.size();
+    size_t len = this->csi_->record_len();
+    this->csi_out_.resize(count * len);
+    this->csi_->estimate(this->csi_pkgs_.data(), count, this->csi_out_.data());
+    for (size_t i = 0; i < count; i++) {
+        Package* pkg = this->csi_pkgs_[i];
+        this->worker_.record(this->id_, pkg);
+        this->worker_.recordCsi(pkg, this->csi_out_.data() + i * len);
+        telemetryAdd(this->stats_->packets);
+        telemetryLatency(*this->stats_, pkg->rx_time_ns);
+
+        size_t buffer_offset;
+        SampleBuffer& rx_buffer
+            = eventBuffer(this->csi_events_[i], buffer_offset);
+        rx_buffer.releaseSlot(buffer_offset, this->csi_events_[i].gen);
     }
+    this->csi_events_.clear();
+    this->csi_pkgs_.clear();
 }
-}; //End namespace Sounder
\ No newline at end of file
+}; //End namespace Sounder
@@ -8,30 +8,61 @@
 */
 
 #include "include/recorder_worker.h"
+#include "include/csi_stage.h"
 #include "include/logger.h"
 #include "include/macros.h"
 #include "include/utils.h"
 
 namespace Sounder {
-// pilot dataset size increment
-const int RecorderWorker::kConfigPilotExtentStep = 400;
-// data dataset size increment
-const int RecorderWorker::kConfigDataExtentStep = 400;
+// flush intervals after which a busy recorder flushes anyway
+const size_t RecorderWorker::kFlushOverdue = 4;
+// chunks held by the raw data chunk cache when it is auto sized
+const size_t RecorderWorker::kChunkCacheChunks = 4;
+// hash table slots of the raw data chunk cache
+const size_t RecorderWorker::kChunkCacheSlots = 12421;
+// compressed chunks in flight before a flush waits for the oldest
+const size_t RecorderWorker::kMaxPendingChunks = 64;
+// rows per /Data/FrameIndex chunk
+static const hsize_t kFrameIndexChunk = 1024;
 
 #if (DEBUG_PRINT)
 const int kDsSim = 5;
 #endif
 
-RecorderWorker::RecorderWorker(
-    Config* in_cfg, size_t antenna_offset, size_t num_antennas)
+RecorderWorker::RecorderWorker(Config* in_cfg, size_t antenna_offset,
+    size_t num_antennas, RecordStats* stats, LiveRing* live_ring)
     : cfg_(in_cfg)
+    , stats_(stats)
+    , live_ring_(live_ring)
+    , codec_(in_cfg->record_compression(), in_cfg->record_compression_level())
 {
     file_ = nullptr;
+    file_open_ = false;
+    dirty_ = false;
+    last_flush_ns_ = 0;
+    frames_recorded_ = 0;
     pilot_dataset_ = nullptr;
     noise_dataset_ = nullptr;
     data_dataset_ = nullptr;
+    csi_dataset_ = nullptr;
+    frame_index_dataset_ = nullptr;
     antenna_offset_ = antenna_offset;
     num_antennas_ = num_antennas;
+    batch_frames_ = in_cfg->record_batch_frames();
+    batch_start_frame_ = 0;
+    record_csi_ = in_cfg->record_csi();
+    record_pilots_ = !record_csi_ || in_cfg->record_csi_pilots();
+    csi_len_ = 2 * in_cfg->data_ind().size();
+    flush_interval_ns_ = in_cfg->record_flush_ms() * 1000000;
+    // Stored values are converted by hand for the direct chunk writes
+    swap_bytes_ = in_cfg->record_big_endian()
+        && (H5::PredType::NATIVE_INT16.getOrder() != H5T_ORDER_BE);
+    if (codec_.enabled() == true) {
+        // every chunk is exactly one batch window
+        if (in_cfg->max_frame() != 0)
+            batch_frames_ = std::min(batch_frames_, in_cfg->max_frame() + 1);
+        chunk_pool_.reset(new ChunkPool(in_cfg->record_compress_threads()));
+    }
 }
 
 RecorderWorker::~RecorderWorker() { gc(); }
@@ -61,6 +92,19 @@ void RecorderWorker::gc(void)
         this->data_dataset_ = nullptr;
     }
 
+    if (this->csi_dataset_ != nullptr) {
+        MLPD_TRACE("CSI dataset exists during garbage collection\n");
+        this->csi_dataset_->close();
+        delete this->csi_dataset_;
+        this->csi_dataset_ = nullptr;
+    }
+
+    if (this->frame_index_dataset_ != nullptr) {
+        this->frame_index_dataset_->close();
+        delete this->frame_index_dataset_;
+        this->frame_index_dataset_ = nullptr;
+    }
+
     if (this->file_ != nullptr) {
         MLPD_TRACE("File exists exists during garbage collection\n");
         this->file_->close();
@@ -80,6 +124,51 @@ void RecorderWorker::init(void)
         + std::to_string(end_antenna);
     this->hdf5_name_.insert(found_index, append);
 
+    size_t IQ = 2 * this->cfg_->samps_per_symbol();
+    this->initBatch(
+        this->pilot_batch_, this->cfg_->pilot_syms_per_frame(), IQ);
+    this->initBatch(
+        this->noise_batch_, this->cfg_->noise_syms_per_frame(), IQ);
+    this->initBatch(this->data_batch_, this->cfg_->ul_syms_per_frame(), IQ);
+    if (this->record_csi_ == true) {
+        this->initBatch(this->csi_batch_, this->cfg_->pilot_syms_per_frame(),
+            this->csi_len_);
+    }
+
+    // Live ring only, no file at all
+    if (this->cfg_->record_hdf5() == false)
+        return;
+
+    // Calibration captures rewrite the symbol ids, there is no schedule
+    // to check them against. A package older than the rx buffers can
+    // hold is not coming anymore. The last recorder can be given more
+    // antennas than there are, only the real ones are expected.
+    if ((this->cfg_->record_frame_index() == true)
+        && (this->cfg_->reciprocal_calib() == false)) {
+        size_t tracked_antennas = std::min(this->num_antennas_,
+            this->cfg_->getTotNumAntennas() - this->antenna_offset_);
+        this->frame_tracker_.reset(new FrameTracker(this->cfg_,
+            this->antenna_offset_, tracked_antennas,
+            this->cfg_->sample_buffer_frames()));
+        const size_t bitmap_bytes = this->frame_tracker_->bitmap_bytes();
+        this->frame_index_type_.reset(
+            new H5::CompType(this->frame_tracker_->row_bytes()));
+        this->frame_index_type_->insertMember("frame",
+            FrameTracker::kRowFrame, H5::PredType::NATIVE_UINT64);
+        this->frame_index_type_->insertMember("hw_time",
+            FrameTracker::kRowHwTime, H5::PredType::NATIVE_INT64);
+        this->frame_index_type_->insertMember("received",
+            FrameTracker::kRowReceived, H5::PredType::NATIVE_UINT32);
+        this->frame_index_type_->insertMember("expected",
+            FrameTracker::kRowExpected, H5::PredType::NATIVE_UINT32);
+        this->frame_index_type_->insertMember("complete",
+            FrameTracker::kRowComplete, H5::PredType::NATIVE_UINT8);
+        hsize_t bitmap_dims[] = { bitmap_bytes };
+        this->frame_index_type_->insertMember("symbols",
+            FrameTracker::kRowSymbols,
+            H5::ArrayType(H5::PredType::NATIVE_UINT8, 1, bitmap_dims));
+    }
+
     if (this->initHDF5() < 0) {
         throw std::runtime_error("Could not init the output file");
     }
@@ -88,6 +177,9 @@ void RecorderWorker::init(void)
 
 void RecorderWorker::finalize(void)
 {
+    // Live ring only, init() created no file
+    if (this->cfg_->record_hdf5() == false)
+        return;
     this->closeHDF5();
     this->finishHDF5();
 }
@@ -210,15 +302,102 @@ enum {
 };
 typedef hsize_t DataspaceIndex[kDsDim];
 
+void RecorderWorker::getChunkDims(size_t syms_per_frame, hsize_t record_bytes,
+    hsize_t record_len, hsize_t* cdims)
+{
+    hsize_t syms = std::max(syms_per_frame, static_cast<size_t>(1));
+    hsize_t antennas = this->num_antennas_;
+    hsize_t frames = this->cfg_->record_chunk_frames();
+
+    if (this->codec_.enabled() == true) {
+        // Compressed chunks are written whole, one per batch window
+        cdims[kDsFrameNumber] = this->batch_frames_;
+        cdims[kDsNumCells] = 1;
+        cdims[kDsSymsPerFrame] = syms;
+        cdims[kDsNumAntennas] = antennas;
+        cdims[kDsPkgDataLen] = record_len;
+        return;
+    }
+    if (frames == 0) {
+        // Auto layout: whole frames of this antenna range, as many as fit
+        // in the target chunk size. Frames larger than the target are
+        // split along the antenna, then the symbol dimension.
+        hsize_t target = std::max(static_cast<hsize_t>(1),
+            (this->cfg_->record_chunk_size_kb() * 1024) / record_bytes);
+        while ((syms * antennas > target) && (antennas > 1))
+            antennas = (antennas + 1) / 2;
+        while ((syms * antennas > target) && (syms > 1))
+            syms = (syms + 1) / 2;
+        frames = std::max(static_cast<hsize_t>(1), target / (syms * antennas));
+    }
+    if (this->cfg_->max_frame() != 0)
+        frames = std::min(
+            frames, static_cast<hsize_t>(this->cfg_->max_frame() + 1));
+
+    cdims[kDsFrameNumber] = frames;
+    cdims[kDsNumCells] = 1;
+    cdims[kDsSymsPerFrame] = syms;
+    cdims[kDsNumAntennas] = antennas;
+    cdims[kDsPkgDataLen] = record_len;
+}
+
 herr_t RecorderWorker::initHDF5()
 {
     MLPD_INFO("Creating output HD5F file: %s\n", this->hdf5_name_.c_str());
 
     // dataset dimension
     hsize_t IQ = 2 * this->cfg_->samps_per_symbol();
-    DataspaceIndex cdims
-        = { 1, 1, 1, 1, IQ }; // pilot chunk size, TODO: optimize size
-    this->frame_number_pilot_ = MAX_FRAME_INC;
+    DataspaceIndex cdims_pilot;
+    DataspaceIndex cdims_noise;
+    DataspaceIndex cdims_data;
+    DataspaceIndex cdims_csi;
+    const size_t IQ_bytes = IQ * sizeof(short);
+    const size_t csi_bytes = this->csi_len_ * sizeof(float);
+    this->getChunkDims(
+        this->cfg_->pilot_syms_per_frame(), IQ_bytes, IQ, cdims_pilot);
+    this->getChunkDims(
+        this->cfg_->noise_syms_per_frame(), IQ_bytes, IQ, cdims_noise);
+    this->getChunkDims(
+        this->cfg_->ul_syms_per_frame(), IQ_bytes, IQ, cdims_data);
+    this->getChunkDims(this->cfg_->pilot_syms_per_frame(), csi_bytes,
+        this->csi_len_, cdims_csi);
+
+    // Raw data chunk cache, large enough to keep a few chunks of the
+    // biggest dataset resident so partial frames never hit the disk twice
+    size_t chunk_bytes = 0;
+    for (auto cdims : { cdims_pilot, cdims_noise, cdims_data }) {
+        size_t bytes = sizeof(short);
+        for (size_t i = 0; i < kDsDim; i++)
+            bytes *= cdims[i];
+        chunk_bytes = std::max(chunk_bytes, bytes);
+    }
+    if (this->record_csi_ == true) {
+        size_t bytes = sizeof(float);
+        for (size_t i = 0; i < kDsDim; i++)
+            bytes *= cdims_csi[i];
+        chunk_bytes = std::max(chunk_bytes, bytes);
+    }
+    size_t cache_bytes = this->cfg_->record_chunk_cache_mb() * 1024 * 1024;
+    if (cache_bytes == 0)
+        cache_bytes = kChunkCacheChunks * chunk_bytes;
+    this->file_access_prop_.setCache(
+        0, kChunkCacheSlots, cache_bytes, 1.0 /* evict fully written */);
+    MLPD_INFO("HDF5 pilot chunk: %llu frames x %llu symbols x %llu antennas, "
+              "chunk cache: %zu bytes\n",
+        cdims_pilot[kDsFrameNumber], cdims_pilot[kDsSymsPerFrame],
+        cdims_pilot[kDsNumAntennas], cache_bytes);
+    if (this->codec_.enabled() == true) {
+        MLPD_INFO("Compressing HDF5 chunks with %s on %zu threads\n",
+            this->cfg_->record_compression().c_str(),
+            this->cfg_->record_compress_threads());
+    }
+
+    // Captures of known length are allocated once, others grow from
+    // MAX_FRAME_INC frames on
+    const size_t initial_frames = (this->cfg_->max_frame() != 0)
+        ? this->cfg_->max_frame() + 1
+        : MAX_FRAME_INC;
+    this->frame_number_pilot_ = initial_frames;
     // pilots
     DataspaceIndex dims_pilot
         = { this->frame_number_pilot_, this->cfg_->num_cells(),
@@ -226,32 +405,57 @@ herr_t RecorderWorker::initHDF5()
     DataspaceIndex max_dims_pilot = { H5S_UNLIMITED, this->cfg_->num_cells(),
         this->cfg_->pilot_syms_per_frame(), this->num_antennas_, IQ };
     // noise
-    this->frame_number_noise_ = MAX_FRAME_INC;
+    this->frame_number_noise_ = initial_frames;
     DataspaceIndex dims_noise
         = { this->frame_number_noise_, this->cfg_->num_cells(),
               this->cfg_->noise_syms_per_frame(), this->num_antennas_, IQ };
     DataspaceIndex max_dims_noise = { H5S_UNLIMITED, this->cfg_->num_cells(),
         this->cfg_->noise_syms_per_frame(), this->num_antennas_, IQ };
     // data
-    this->frame_number_data_ = MAX_FRAME_INC;
+    this->frame_number_data_ = initial_frames;
     DataspaceIndex dims_data
         = { this->frame_number_data_, this->cfg_->num_cells(),
               this->cfg_->ul_syms_per_frame(), this->num_antennas_, IQ };
     DataspaceIndex max_dims_data = { H5S_UNLIMITED, this->cfg_->num_cells(),
         this->cfg_->ul_syms_per_frame(), this->num_antennas_, IQ };
+    // channel estimates, one per pilot
+    this->frame_number_csi_ = initial_frames;
+    DataspaceIndex dims_csi = { this->frame_number_csi_,
+        this->cfg_->num_cells(), this->cfg_->pilot_syms_per_frame(),
+        this->num_antennas_, this->csi_len_ };
+    DataspaceIndex max_dims_csi = { H5S_UNLIMITED, this->cfg_->num_cells(),
+        this->cfg_->pilot_syms_per_frame(), this->num_antennas_,
+        this->csi_len_ };
+
+    // Samples are stored in host byte order unless big endian traces were
+    // requested, avoiding a byte swap of every sample on the record path
+    const H5::PredType& sample_type = this->cfg_->record_big_endian()
+        ? H5::PredType::STD_I16BE
+        : H5::PredType::NATIVE_INT16;
+    const H5::PredType& csi_type = this->cfg_->record_big_endian()
+        ? H5::PredType::IEEE_F32BE
+        : H5::PredType::NATIVE_FLOAT;
 
     try {
         H5::Exception::dontPrint();
 
-        this->file_ = new H5::H5File(this->hdf5_name_, H5F_ACC_TRUNC);
+        this->file_ = new H5::H5File(this->hdf5_name_, H5F_ACC_TRUNC,
+            H5::FileCreatPropList::DEFAULT, this->file_access_prop_);
         auto mainGroup = this->file_->createGroup("/Data");
-        this->pilot_prop_.setChunk(kDsDim, cdims);
-
-        H5::DataSpace pilot_dataspace(kDsDim, dims_pilot, max_dims_pilot);
-        this->file_->createDataSet("/Data/Pilot_Samples",
-            H5::PredType::STD_I16BE, pilot_dataspace, this->pilot_prop_);
+        if (this->record_pilots_ == true) {
+            this->pilot_prop_.setChunk(kDsDim, cdims_pilot);
+            this->codec_.setFilters(this->pilot_prop_);
+            H5::DataSpace pilot_dataspace(kDsDim, dims_pilot, max_dims_pilot);
+            this->file_->createDataSet("/Data/Pilot_Samples", sample_type,
+                pilot_dataspace, this->pilot_prop_);
+        }
 
         // ******* COMMON ******** //
+        // Byte order of the stored IQ samples ("little" or "big")
+        write_attribute(mainGroup, "SAMPLE_ENDIANNESS",
+            std::string(
+                sample_type.getOrder() == H5T_ORDER_BE ? "big" : "little"));
+
         // TX/RX Frequencyfile
         write_attribute(mainGroup, "FREQ", this->cfg_->freq());
 
@@ -469,24 +673,55 @@ herr_t RecorderWorker::initHDF5()
                     this->cfg_->txdata_time_dom().at(i));
             }
         }
+        if (this->record_csi_ == true) {
+            // Subcarriers (indexes) of the /Data/CSI estimates
+            write_attribute(mainGroup, "CSI_SC", this->cfg_->data_ind());
+
+            // Raw pilots recorded along with the estimates
+            write_attribute(
+                mainGroup, "CSI_RAW_PILOTS", this->record_pilots_ ? 1 : 0);
+        }
         // ********************* //
 
         this->pilot_prop_.close();
+        if (this->record_csi_ == true) {
+            H5::DataSpace csi_dataspace(kDsDim, dims_csi, max_dims_csi);
+            this->csi_prop_.setChunk(kDsDim, cdims_csi);
+            this->codec_.setFilters(this->csi_prop_);
+            this->file_->createDataSet(
+                "/Data/CSI", csi_type, csi_dataspace, this->csi_prop_);
+            this->csi_prop_.close();
+        }
         if (this->cfg_->noise_syms_per_frame() > 0) {
             H5::DataSpace noise_dataspace(kDsDim, dims_noise, max_dims_noise);
-            this->noise_prop_.setChunk(kDsDim, cdims);
-            this->file_->createDataSet("/Data/Noise_Samples",
-                H5::PredType::STD_I16BE, noise_dataspace, this->noise_prop_);
+            this->noise_prop_.setChunk(kDsDim, cdims_noise);
+            this->codec_.setFilters(this->noise_prop_);
+            this->file_->createDataSet("/Data/Noise_Samples", sample_type,
+                noise_dataspace, this->noise_prop_);
             this->noise_prop_.close();
         }
 
         if (this->cfg_->ul_syms_per_frame() > 0) {
             H5::DataSpace data_dataspace(kDsDim, dims_data, max_dims_data);
-            this->data_prop_.setChunk(kDsDim, cdims);
-            this->file_->createDataSet("/Data/UplinkData",
-                H5::PredType::STD_I16BE, data_dataspace, this->data_prop_);
+            this->data_prop_.setChunk(kDsDim, cdims_data);
+            this->codec_.setFilters(this->data_prop_);
+            this->file_->createDataSet("/Data/UplinkData", sample_type,
+                data_dataspace, this->data_prop_);
             this->data_prop_.close();
         }
+
+        // One row per frame, written as the frames are closed
+        if (this->frame_tracker_ != nullptr) {
+            hsize_t dims_index[] = { 0 };
+            hsize_t max_dims_index[] = { H5S_UNLIMITED };
+            hsize_t cdims_index[] = { kFrameIndexChunk };
+            H5::DSetCreatPropList index_prop;
+            index_prop.setChunk(1, cdims_index);
+            H5::DataSpace index_dataspace(1, dims_index, max_dims_index);
+            this->file_->createDataSet("/Data/FrameIndex",
+                *this->frame_index_type_, index_dataspace, index_prop);
+            index_prop.close();
+        }
         this->file_->close();
     }
     // catch failure caused by the H5File operations
@@ -506,40 +741,48 @@ herr_t RecorderWorker::initHDF5()
         error.printErrorStack();
         return -1;
     }
-    this->max_frame_number_ = MAX_FRAME_INC;
+    this->frames_recorded_ = 0;
     return 0; // successfully terminated
 }
 
 void RecorderWorker::openHDF5()
 {
     MLPD_TRACE("Open HDF5 file: %s\n", this->hdf5_name_.c_str());
-    this->file_->openFile(this->hdf5_name_, H5F_ACC_RDWR);
-    assert(this->pilot_dataset_ == nullptr);
-    // Get Dataset for pilot and check the shape of it
-    this->pilot_dataset_
-        = new H5::DataSet(this->file_->openDataSet("/Data/Pilot_Samples"));
+    this->file_->openFile(
+        this->hdf5_name_, H5F_ACC_RDWR, this->file_access_prop_);
+    this->file_open_ = true;
+    this->dirty_ = false;
+    this->last_flush_ns_ = telemetryNowNs();
+#if DEBUG_PRINT
+    using std::cout;
+#endif
+    if (this->record_pilots_ == true) {
+        assert(this->pilot_dataset_ == nullptr);
+        // Get Dataset for pilot and check the shape of it
+        this->pilot_dataset_ = new H5::DataSet(
+            this->file_->openDataSet("/Data/Pilot_Samples"));
 
-    // Get the dataset's dataspace and creation property list.
-    H5::DataSpace pilot_filespace(this->pilot_dataset_->getSpace());
-    this->pilot_prop_.copy(this->pilot_dataset_->getCreatePlist());
+        // Get the dataset's dataspace and creation property list.
+        H5::DataSpace pilot_filespace(this->pilot_dataset_->getSpace());
+        this->pilot_prop_.copy(this->pilot_dataset_->getCreatePlist());
 
 #if DEBUG_PRINT
-    hsize_t IQ = 2 * this->cfg_->samps_per_symbol();
-    int cndims_pilot = 0;
-    int ndims = pilot_filespace.getSimpleExtentNdims();
-    DataspaceIndex dims_pilot
-        = { this->frame_number_pilot_, this->cfg_->num_cells(),
-              this->cfg_->pilot_syms_per_frame(), this->num_antennas(), IQ };
-    if (H5D_CHUNKED == this->pilot_prop_.getLayout())
-        cndims_pilot = this->pilot_prop_.getChunk(ndims, dims_pilot);
-    using std::cout;
-    cout << "dim pilot chunk = " << cndims_pilot << std::endl;
-    cout << "New Pilot Dataset Dimension: [";
-    for (auto i = 0; i < kDsSim - 1; ++i)
-        cout << dims_pilot[i] << ",";
-    cout << dims_pilot[kDsSim - 1] << "]" << std::endl;
+        hsize_t IQ = 2 * this->cfg_->samps_per_symbol();
+        int cndims_pilot = 0;
+        int ndims = pilot_filespace.getSimpleExtentNdims();
+        DataspaceIndex dims_pilot = { this->frame_number_pilot_,
+            this->cfg_->num_cells(), this->cfg_->pilot_syms_per_frame(),
+            this->num_antennas(), IQ };
+        if (H5D_CHUNKED == this->pilot_prop_.getLayout())
+            cndims_pilot = this->pilot_prop_.getChunk(ndims, dims_pilot);
+        cout << "dim pilot chunk = " << cndims_pilot << std::endl;
+        cout << "New Pilot Dataset Dimension: [";
+        for (auto i = 0; i < kDsSim - 1; ++i)
+            cout << dims_pilot[i] << ",";
+        cout << dims_pilot[kDsSim - 1] << "]" << std::endl;
 #endif
-    pilot_filespace.close();
+        pilot_filespace.close();
+    }
     // Get Dataset for DATA (If Enabled) and check the shape of it
     if (this->cfg_->ul_syms_per_frame() > 0) {
         this->data_dataset_
@@ -593,6 +836,20 @@ void RecorderWorker::openHDF5()
 #endif
         noise_filespace.close();
     }
+
+    // Get Dataset for CSI (If Enabled)
+    if (this->record_csi_ == true) {
+        assert(this->csi_dataset_ == nullptr);
+        this->csi_dataset_
+            = new H5::DataSet(this->file_->openDataSet("/Data/CSI"));
+        this->csi_prop_.copy(this->csi_dataset_->getCreatePlist());
+    }
+
+    if (this->frame_tracker_ != nullptr) {
+        assert(this->frame_index_dataset_ == nullptr);
+        this->frame_index_dataset_
+            = new H5::DataSet(this->file_->openDataSet("/Data/FrameIndex"));
+    }
 }
 
 void RecorderWorker::closeHDF5()
@@ -602,21 +859,59 @@ void RecorderWorker::closeHDF5()
     if (this->file_ == nullptr) {
         MLPD_WARN("File does not exist while calling close: %s\n",
             this->hdf5_name_.c_str());
-    } else {
-        unsigned frame_number = this->max_frame_number_;
+    } else if (this->file_open_ == true) {
+        // Trim the preallocated extent to the frames actually seen
+        size_t frame_number = this->frames_recorded_;
         hsize_t IQ = 2 * this->cfg_->samps_per_symbol();
 
-        assert(this->pilot_dataset_ != nullptr);
-        // Resize Pilot Dataset
-        this->frame_number_pilot_ = frame_number;
-        DataspaceIndex dims_pilot
-            = { this->frame_number_pilot_, this->cfg_->num_cells(),
-                  this->cfg_->pilot_syms_per_frame(), this->num_antennas_, IQ };
-        this->pilot_dataset_->extend(dims_pilot);
-        this->pilot_prop_.close();
-        this->pilot_dataset_->close();
-        delete this->pilot_dataset_;
-        this->pilot_dataset_ = nullptr;
+        this->flushBatches();
+        this->writeChunks(0);
+
+        if (this->frame_tracker_ != nullptr) {
+            this->frame_tracker_->finish();
+            this->writeFrameIndex();
+            this->frame_index_dataset_->close();
+            delete this->frame_index_dataset_;
+            this->frame_index_dataset_ = nullptr;
+            MLPD_INFO("Frames of antennas %zu:%zu: %zu complete, %zu "
+                      "incomplete, %zu skipped, %zu records missing, %zu "
+                      "late\n",
+                this->antenna_offset_,
+                this->antenna_offset_ + this->num_antennas_ - 1,
+                this->frame_tracker_->frames_complete(),
+                this->frame_tracker_->frames_incomplete(),
+                this->frame_tracker_->frames_skipped(),
+                this->frame_tracker_->records_missing(),
+                this->frame_tracker_->records_late());
+        }
+
+        // Resize Pilot Dataset (If Needed)
+        if (this->record_pilots_ == true) {
+            assert(this->pilot_dataset_ != nullptr);
+            this->frame_number_pilot_ = frame_number;
+            DataspaceIndex dims_pilot = { this->frame_number_pilot_,
+                this->cfg_->num_cells(), this->cfg_->pilot_syms_per_frame(),
+                this->num_antennas_, IQ };
+            this->pilot_dataset_->extend(dims_pilot);
+            this->pilot_prop_.close();
+            this->pilot_dataset_->close();
+            delete this->pilot_dataset_;
+            this->pilot_dataset_ = nullptr;
+        }
+
+        // Resize CSI Dataset (If Needed)
+        if (this->record_csi_ == true) {
+            assert(this->csi_dataset_ != nullptr);
+            this->frame_number_csi_ = frame_number;
+            DataspaceIndex dims_csi = { this->frame_number_csi_,
+                this->cfg_->num_cells(), this->cfg_->pilot_syms_per_frame(),
+                this->num_antennas_, this->csi_len_ };
+            this->csi_dataset_->extend(dims_csi);
+            this->csi_prop_.close();
+            this->csi_dataset_->close();
+            delete this->csi_dataset_;
+            this->csi_dataset_ = nullptr;
+        }
 
         // Resize Data Dataset (If Needed)
         if (this->cfg_->ul_syms_per_frame() > 0) {
@@ -647,11 +942,295 @@ void RecorderWorker::closeHDF5()
         }
 
         this->file_->close();
-        MLPD_INFO("Saving HD5F: %d frames saved on CPU %d\n", frame_number,
+        this->file_open_ = false;
+        MLPD_INFO("Saving HD5F: %zu frames saved on CPU %d\n", frame_number,
             sched_getcpu());
     }
 }
 
+// memory type of the staged values
+static const H5::PredType& memType(const short*)
+{
+    return H5::PredType::NATIVE_INT16;
+}
+
+static const H5::PredType& memType(const float*)
+{
+    return H5::PredType::NATIVE_FLOAT;
+}
+
+template <typename T>
+void RecorderWorker::initBatch(
+    RecordBatch<T>& batch, size_t syms_per_frame, size_t record_len)
+{
+    batch.syms_per_frame = syms_per_frame;
+    batch.record_len = record_len;
+    batch.num_frames = 0;
+    batch.samples.assign(this->batch_frames_ * this->cfg_->num_cells()
+            * syms_per_frame * this->num_antennas_ * record_len,
+        0);
+}
+
+template <typename T>
+void RecorderWorker::writeSymbols(H5::DataSet* dataset, const hsize_t* offset,
+    const hsize_t* count, const T* data)
+{
+    // Select a hyperslab in extended portion of the dataset
+    H5::DataSpace filespace(dataset->getSpace());
+    filespace.selectHyperslab(H5S_SELECT_SET, count, offset);
+    // define memory space
+    H5::DataSpace memspace(kDsDim, count, NULL);
+    dataset->write(data, memType(data), memspace, filespace);
+    filespace.close();
+}
+
+template <typename T>
+void RecorderWorker::storeSymbol(H5::DataSet* dataset, RecordBatch<T>& batch,
+    const hsize_t* offset, const T* data)
+{
+    size_t frame_id = offset[kDsFrameNumber];
+
+    // Symbols of an already flushed window are written on their own
+    if ((this->batch_frames_ == 0) || (frame_id < this->batch_start_frame_)) {
+        // a chunk still in flight would overwrite the symbol
+        if (this->codec_.enabled() == true)
+            this->writeChunks(0);
+        DataspaceIndex count = { 1, 1, 1, 1, batch.record_len };
+        this->writeSymbols(dataset, offset, count, data);
+        return;
+    }
+
+    if (frame_id >= (this->batch_start_frame_ + this->batch_frames_)) {
+        this->flushBatches();
+        this->batch_start_frame_ = frame_id - (frame_id % this->batch_frames_);
+    }
+
+    size_t frame_index = frame_id - this->batch_start_frame_;
+    size_t sample_index
+        = (((frame_index * this->cfg_->num_cells() + offset[kDsNumCells])
+                   * batch.syms_per_frame
+               + offset[kDsSymsPerFrame])
+                  * this->num_antennas_
+              + offset[kDsNumAntennas])
+        * batch.record_len;
+    std::memcpy(
+        &batch.samples.at(sample_index), data, batch.record_len * sizeof(T));
+    batch.num_frames = std::max(batch.num_frames, frame_index + 1);
+}
+
+template <typename T>
+void RecorderWorker::flushBatch(H5::DataSet* dataset, RecordBatch<T>& batch)
+{
+    if ((dataset == nullptr) || (batch.num_frames == 0))
+        return;
+
+    if (this->codec_.enabled() == true) {
+        this->queueChunks(dataset, batch);
+        this->writeChunks(kMaxPendingChunks);
+    } else {
+        DataspaceIndex offset = { this->batch_start_frame_, 0, 0, 0, 0 };
+        DataspaceIndex count = { batch.num_frames, this->cfg_->num_cells(),
+            batch.syms_per_frame, this->num_antennas_, batch.record_len };
+        this->writeSymbols(dataset, offset, count, batch.samples.data());
+    }
+
+    // Symbols that never showed up stay zero, same as the dataset fill value
+    size_t frame_len = this->cfg_->num_cells() * batch.syms_per_frame
+        * this->num_antennas_ * batch.record_len;
+    std::fill(batch.samples.begin(),
+        batch.samples.begin() + batch.num_frames * frame_len, 0);
+    batch.num_frames = 0;
+}
+
+void RecorderWorker::flushBatches(void)
+{
+    this->flushBatch(this->pilot_dataset_, this->pilot_batch_);
+    this->flushBatch(this->noise_dataset_, this->noise_batch_);
+    this->flushBatch(this->data_dataset_, this->data_batch_);
+    this->flushBatch(this->csi_dataset_, this->csi_batch_);
+}
+
+template <typename T>
+void RecorderWorker::queueChunks(
+    H5::DataSet* dataset, const RecordBatch<T>& batch)
+{
+    // the batch is [frame][cell][...], a chunk holds the window of a cell
+    size_t cell_bytes = batch.syms_per_frame * this->num_antennas_
+        * batch.record_len * sizeof(T);
+    const char* samples = reinterpret_cast<const char*>(batch.samples.data());
+    for (size_t c = 0; c < this->cfg_->num_cells(); c++) {
+        std::unique_ptr<PendingChunk> chunk;
+        if (this->spare_chunks_.empty() == true) {
+            chunk.reset(new PendingChunk());
+        } else {
+            chunk = std::move(this->spare_chunks_.back());
+            this->spare_chunks_.pop_back();
+        }
+        chunk->dataset = dataset;
+        chunk->offset.assign({ this->batch_start_frame_, c, 0, 0, 0 });
+        chunk->raw.resize(this->batch_frames_ * cell_bytes);
+        for (size_t f = 0; f < this->batch_frames_; f++) {
+            std::memcpy(&chunk->raw[f * cell_bytes],
+                samples + (f * this->cfg_->num_cells() + c) * cell_bytes,
+                cell_bytes);
+        }
+        chunk->state = kChunkPending;
+
+        PendingChunk* job = chunk.get();
+        const ChunkCodec* codec = &this->codec_;
+        bool swap = this->swap_bytes_;
+        this->chunk_pool_->submit(
+            [job, codec, swap](std::vector<char>& scratch) {
+                try {
+                    codec->encode(job->raw.data(), job->raw.size(),
+                        sizeof(T), swap, scratch, job->stored);
+                    job->state = kChunkDone;
+                } catch (const std::exception& e) {
+                    MLPD_ERROR("Chunk at frame %llu: %s\n", job->offset[0],
+                        e.what());
+                    job->state = kChunkFailed;
+                }
+            });
+        this->pending_chunks_.push_back(std::move(chunk));
+    }
+}
+
+void RecorderWorker::writeChunks(size_t keep)
+{
+    while (this->pending_chunks_.empty() == false) {
+        PendingChunk* chunk = this->pending_chunks_.front().get();
+        if (chunk->state == kChunkPending) {
+            if (this->pending_chunks_.size() <= keep)
+                break;
+            this->chunk_pool_->waitFor(
+                [chunk] { return chunk->state != kChunkPending; });
+        }
+        if (chunk->state == kChunkFailed)
+            throw std::runtime_error("Chunk compression failed");
+        if (H5Dwrite_chunk(chunk->dataset->getId(), H5P_DEFAULT, 0,
+                chunk->offset.data(), chunk->stored.size(),
+                chunk->stored.data())
+            < 0) {
+            MLPD_ERROR("Direct chunk write at frame %llu failed\n",
+                chunk->offset[kDsFrameNumber]);
+            throw std::runtime_error("Direct chunk write failed");
+        }
+        telemetryAdd(this->stats_->chunk_bytes, chunk->raw.size());
+        telemetryAdd(this->stats_->stored_bytes, chunk->stored.size());
+        this->spare_chunks_.push_back(std::move(this->pending_chunks_.front()));
+        this->pending_chunks_.pop_front();
+    }
+}
+
+void RecorderWorker::recordCsi(const Package* pkg, const float* csi)
+{
+    // record() already closed the file past max_frame
+    if ((this->file_open_ == false) || (this->csi_dataset_ == nullptr)
+        || ((this->cfg_->max_frame() != 0)
+            && (pkg->frame_id > this->cfg_->max_frame())))
+        return;
+
+    try {
+        H5::Exception::dontPrint();
+        this->growDataset(this->csi_dataset_, this->frame_number_csi_,
+            pkg->frame_id, this->cfg_->pilot_syms_per_frame(), this->csi_len_);
+        DataspaceIndex hdfoffset = { pkg->frame_id, pkg->cell_id, 0,
+            pkg->ant_id - this->antenna_offset_, 0 };
+        hdfoffset[kDsSymsPerFrame]
+            = this->cfg_->getClientId(pkg->frame_id, pkg->symbol_id);
+        this->storeSymbol(
+            this->csi_dataset_, this->csi_batch_, hdfoffset, csi);
+    }
+    // catch failure caused by the DataSet operations
+    catch (H5::DataSetIException& error) {
+        error.printErrorStack();
+        MLPD_WARN("DataSet: Failed to record CSI from frame: %d , UE %d "
+                  "antenna %d\n",
+            pkg->frame_id,
+            this->cfg_->getClientId(pkg->frame_id, pkg->symbol_id),
+            pkg->ant_id);
+        throw;
+    }
+    // catch failure caused by the DataSpace operations
+    catch (H5::DataSpaceIException& error) {
+        error.printErrorStack();
+        throw;
+    }
+}
+
+void RecorderWorker::growDataset(H5::DataSet* dataset, size_t& extent,
+    size_t frame_id, size_t syms_per_frame, size_t record_len)
+{
+    if (frame_id < extent)
+        return;
+    // Doubling keeps the number of extends logarithmic in the capture
+    // length, past max_frame nothing is recorded
+    extent = std::max(2 * extent, frame_id + 1);
+    if (this->cfg_->max_frame() != 0)
+        extent = std::min(extent, this->cfg_->max_frame() + 1);
+    DataspaceIndex dims = { extent, this->cfg_->num_cells(), syms_per_frame,
+        this->num_antennas_, record_len };
+    dataset->extend(dims);
+    telemetryAdd(this->stats_->extends);
+    MLPD_TRACE("Dataset extent grown to %zu frames at frame %zu\n", extent,
+        frame_id);
+}
+
+void RecorderWorker::flush(bool idle)
+{
+    if ((this->file_open_ == false) || (this->dirty_ == false)
+        || (this->flush_interval_ns_ == 0))
+        return;
+    uint64_t elapsed = telemetryNowNs() - this->last_flush_ns_;
+    if ((elapsed < this->flush_interval_ns_)
+        || ((idle == false)
+            && (elapsed < kFlushOverdue * this->flush_interval_ns_)))
+        return;
+
+    // Only finished chunks and frames, the batch window in progress is
+    // written once it is complete
+    if (this->codec_.enabled() == true)
+        this->writeChunks(kMaxPendingChunks);
+    this->writeFrameIndex();
+    this->file_->flush(H5F_SCOPE_LOCAL);
+    this->dirty_ = false;
+    this->last_flush_ns_ = telemetryNowNs();
+}
+
+void RecorderWorker::writeFrameIndex(void)
+{
+    if ((this->frame_tracker_ == nullptr)
+        || (this->frame_tracker_->closed_count() == 0))
+        return;
+    hsize_t offset[] = { this->frame_tracker_->closed_first() };
+    hsize_t count[] = { this->frame_tracker_->closed_count() };
+    hsize_t dims[] = { offset[0] + count[0] };
+    this->frame_index_dataset_->extend(dims);
+    H5::DataSpace filespace(this->frame_index_dataset_->getSpace());
+    filespace.selectHyperslab(H5S_SELECT_SET, count, offset);
+    H5::DataSpace memspace(1, count, nullptr);
+    this->frame_index_dataset_->write(this->frame_tracker_->closed().data(),
+        *this->frame_index_type_, memspace, filespace);
+    this->frame_tracker_->clearClosed();
+
+    this->stats_->frames_complete.store(
+        this->frame_tracker_->frames_complete(), std::memory_order_relaxed);
+    this->stats_->frames_incomplete.store(
+        this->frame_tracker_->frames_incomplete(), std::memory_order_relaxed);
+    this->stats_->records_missing.store(
+        this->frame_tracker_->records_missing(), std::memory_order_relaxed);
+}
+
+void RecorderWorker::skip(const Package* pkg)
+{
+    // the frames record() leaves out of the file are not indexed either
+    if ((this->frame_tracker_ == nullptr) || (this->file_open_ == false)
+        || ((this->cfg_->max_frame() != 0)
+            && (pkg->frame_id > this->cfg_->max_frame())))
+        return;
+    this->frame_tracker_->add(*pkg, false);
+}
+
 herr_t RecorderWorker::record(int tid, Package* pkg)
 {
     (void)tid;
@@ -678,133 +1257,61 @@ herr_t RecorderWorker::record(int tid, Package* pkg)
         pkg->data[2], pkg->data[3], pkg->data[4], pkg->data[5], pkg->data[6],
         pkg->data[7], pkg->data[8]);
 #endif
+    if (this->live_ring_ != nullptr)
+        this->live_ring_->write(*pkg);
+
     hsize_t IQ = 2 * this->cfg_->samps_per_symbol();
     if ((this->cfg_->max_frame()) != 0
         && (pkg->frame_id > this->cfg_->max_frame())) {
-        closeHDF5();
-        MLPD_TRACE("Closing file due to frame id %d : %zu max\n", pkg->frame_id,
-            this->cfg_->max_frame());
-    } else {
+        if (this->file_open_ == true) {
+            MLPD_TRACE("Closing file due to frame id %d : %zu max\n",
+                pkg->frame_id, this->cfg_->max_frame());
+            closeHDF5();
+        }
+    } else if (this->file_open_ == true) {
         try {
             H5::Exception::dontPrint();
-            // Update the max frame number.
             // Note that the 'frame_id' might be out of order.
-            if (pkg->frame_id >= this->max_frame_number_) {
-                // Open the hdf5 file if we haven't.
-                closeHDF5();
-                openHDF5();
-                this->max_frame_number_
-                    = this->max_frame_number_ + MAX_FRAME_INC;
-            }
+            this->frames_recorded_ = std::max(
+                this->frames_recorded_, static_cast<size_t>(pkg->frame_id) + 1);
+            this->dirty_ = true;
+            if (this->frame_tracker_ != nullptr)
+                this->frame_tracker_->add(*pkg);
 
             uint32_t antenna_index = pkg->ant_id - this->antenna_offset_;
             DataspaceIndex hdfoffset
                 = { pkg->frame_id, pkg->cell_id, 0, antenna_index, 0 };
+            const Config::SymbolInfo& symbol
+                = this->cfg_->symbolInfo(pkg->frame_id, pkg->symbol_id);
             if ((this->cfg_->reciprocal_calib() == true)
-                || (this->cfg_->isPilot(pkg->frame_id, pkg->symbol_id)
-                       == true)) {
+                || (symbol.type == 'P')) {
+                // only the estimates of the pilots are kept
+                if (this->record_pilots_ == false)
+                    return ret;
                 assert(this->pilot_dataset_ != nullptr);
-                // Are we going to extend the dataset?
-                if (pkg->frame_id >= this->frame_number_pilot_) {
-                    this->frame_number_pilot_ += kConfigPilotExtentStep;
-                    if (this->cfg_->max_frame() != 0) {
-                        this->frame_number_pilot_
-                            = std::min(this->frame_number_pilot_,
-                                this->cfg_->max_frame() + 1);
-                    }
-                    DataspaceIndex dims_pilot
-                        = { this->frame_number_pilot_, this->cfg_->num_cells(),
-                              this->cfg_->pilot_syms_per_frame(),
-                              this->num_antennas_, IQ };
-                    this->pilot_dataset_->extend(dims_pilot);
-#if DEBUG_PRINT
-                    std::cout
-                        << "FrameId " << pkg->frame_id << ", (Pilot) Extent to "
-                        << this->frame_number_pilot_ << " Frames" << std::endl;
-#endif
-                }
+                this->growDataset(this->pilot_dataset_,
+                    this->frame_number_pilot_, pkg->frame_id,
+                    this->cfg_->pilot_syms_per_frame(), IQ);
                 hdfoffset[kDsSymsPerFrame]
                     = this->cfg_->getClientId(pkg->frame_id, pkg->symbol_id);
-
-                // Select a hyperslab in extended portion of the dataset
-                H5::DataSpace pilot_filespace(this->pilot_dataset_->getSpace());
-                DataspaceIndex count = { 1, 1, 1, 1, IQ };
-                pilot_filespace.selectHyperslab(
-                    H5S_SELECT_SET, count, hdfoffset);
-                // define memory space
-                H5::DataSpace pilot_memspace(kDsDim, count, NULL);
-                this->pilot_dataset_->write(pkg->data,
-                    H5::PredType::NATIVE_INT16, pilot_memspace,
-                    pilot_filespace);
-                pilot_filespace.close();
-            } else if (this->cfg_->isData(pkg->frame_id, pkg->symbol_id)
-                == true) {
+                this->storeSymbol(this->pilot_dataset_, this->pilot_batch_,
+                    hdfoffset, pkg->samples());
+            } else if (symbol.type == 'U') {
                 assert(this->data_dataset_ != nullptr);
-                // Are we going to extend the dataset?
-                if (pkg->frame_id >= this->frame_number_data_) {
-                    this->frame_number_data_ += kConfigDataExtentStep;
-                    if (this->cfg_->max_frame() != 0)
-                        this->frame_number_data_
-                            = std::min(this->frame_number_data_,
-                                this->cfg_->max_frame() + 1);
-                    DataspaceIndex dims_data
-                        = { this->frame_number_data_, this->cfg_->num_cells(),
-                              this->cfg_->ul_syms_per_frame(),
-                              this->num_antennas_, IQ };
-                    this->data_dataset_->extend(dims_data);
-#if DEBUG_PRINT
-                    std::cout
-                        << "FrameId " << pkg->frame_id << ", (Data) Extent to "
-                        << this->frame_number_data_ << " Frames" << std::endl;
-#endif
-                }
-                hdfoffset[kDsSymsPerFrame]
-                    = this->cfg_->getUlSFIndex(pkg->frame_id, pkg->symbol_id);
-                // Select a hyperslab in extended portion of the dataset
-                H5::DataSpace data_filespace(this->data_dataset_->getSpace());
-                DataspaceIndex count = { 1, 1, 1, 1, IQ };
-                data_filespace.selectHyperslab(
-                    H5S_SELECT_SET, count, hdfoffset);
-                // define memory space
-                H5::DataSpace data_memspace(kDsDim, count, NULL);
-                this->data_dataset_->write(pkg->data,
-                    H5::PredType::NATIVE_INT16, data_memspace, data_filespace);
-                data_filespace.close();
-
-            } else if (this->cfg_->isNoise(pkg->frame_id, pkg->symbol_id)
-                == true) {
+                this->growDataset(this->data_dataset_,
+                    this->frame_number_data_, pkg->frame_id,
+                    this->cfg_->ul_syms_per_frame(), IQ);
+                hdfoffset[kDsSymsPerFrame] = symbol.ul;
+                this->storeSymbol(this->data_dataset_, this->data_batch_,
+                    hdfoffset, pkg->samples());
+            } else if (symbol.type == 'N') {
                 assert(this->noise_dataset_ != nullptr);
-                // Are we going to extend the dataset?
-                if (pkg->frame_id >= this->frame_number_noise_) {
-                    this->frame_number_noise_ += kConfigDataExtentStep;
-                    if (this->cfg_->max_frame() != 0)
-                        this->frame_number_noise_
-                            = std::min(this->frame_number_noise_,
-                                this->cfg_->max_frame() + 1);
-                    DataspaceIndex dims_noise
-                        = { this->frame_number_noise_, this->cfg_->num_cells(),
-                              this->cfg_->noise_syms_per_frame(),
-                              this->num_antennas_, IQ };
-                    this->noise_dataset_->extend(dims_noise);
-#if DEBUG_PRINT
-                    std::cout
-                        << "FrameId " << pkg->frame_id << ", (Noise) Extent to "
-                        << this->frame_number_noise_ << " Frames" << std::endl;
-#endif
-                }
-                hdfoffset[kDsSymsPerFrame] = this->cfg_->getNoiseSFIndex(
-                    pkg->frame_id, pkg->symbol_id);
-                // Select a hyperslab in extended portion of the dataset
-                H5::DataSpace noise_filespace(this->noise_dataset_->getSpace());
-                DataspaceIndex count = { 1, 1, 1, 1, IQ };
-                noise_filespace.selectHyperslab(
-                    H5S_SELECT_SET, count, hdfoffset);
-                // define memory space
-                H5::DataSpace noise_memspace(kDsDim, count, NULL);
-                this->noise_dataset_->write(pkg->data,
-                    H5::PredType::NATIVE_INT16, noise_memspace,
-                    noise_filespace);
-                noise_filespace.close();
+                this->growDataset(this->noise_dataset_,
+                    this->frame_number_noise_, pkg->frame_id,
+                    this->cfg_->noise_syms_per_frame(), IQ);
+                hdfoffset[kDsSymsPerFrame] = symbol.noise;
+                this->storeSymbol(this->noise_dataset_, this->noise_batch_,
+                    hdfoffset, pkg->samples());
             }
         }
         // catch failure caused by the H5File operations
@@ -0,0 +1,164 @@
+/*
+ Copyright (c) 2018-2020, Rice University
+ RENEW OPEN SOURCE LICENSE: http://renew-wireless.org/license
+
+----------------------------------------------------------------------
+ Recycling ring of package slots shared by one rx thread (producer)
+ and the recorder threads that write its packages (consumers)
+---------------------------------------------------------------------
+*/
+
+#include "include/sample_buffer.h"
+#include "include/logger.h"
+#include <cstring>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <thread>
+
+BackpressurePolicy backpressurePolicyFromString(const std::string& name)
+{
+    if (name == "block")
+        return BackpressurePolicy::kBlock;
+    else if (name == "drop_oldest")
+        return BackpressurePolicy::kDropOldest;
+    else if (name == "drop_newest")
+        return BackpressurePolicy::kDropNewest;
+    throw std::invalid_argument("unknown rx backpressure policy " + name);
+}
+
+SampleBuffer::SampleBuffer(void)
+    : buffer_(nullptr)
+    , buffer_size_(0)
+    , huge_pages_(false)
+    , num_slots_(0)
+    , slot_size_(0)
+    , policy_(BackpressurePolicy::kDropNewest)
+    , head_(0)
+    , dropped_newest_(0)
+    , dropped_oldest_(0)
+    , blocked_(0)
+    , stale_(0)
+{
+}
+
+SampleBuffer::~SampleBuffer(void) { this->unmap(); }
+
+void SampleBuffer::unmap(void)
+{
+    if (this->buffer_ != nullptr) {
+        munmap(this->buffer_, this->buffer_size_);
+        this->buffer_ = nullptr;
+    }
+}
+
+void SampleBuffer::init(size_t num_slots, size_t slot_size,
+    BackpressurePolicy policy, bool huge_pages)
+{
+    this->unmap();
+    this->num_slots_ = num_slots;
+    this->slot_size_
+        = ((slot_size + kCacheLineSize - 1) / kCacheLineSize) * kCacheLineSize;
+    this->policy_ = policy;
+
+    // Try explicit 2MB pages first, then fall back to normal pages and ask
+    // for transparent huge pages instead
+    this->buffer_size_ = ((num_slots * this->slot_size_ + kHugePageSize - 1)
+                             / kHugePageSize)
+        * kHugePageSize;
+    void* mem = MAP_FAILED;
+    this->huge_pages_ = false;
+    if (huge_pages == true) {
+        mem = mmap(nullptr, this->buffer_size_, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        this->huge_pages_ = (mem != MAP_FAILED);
+    }
+    if (mem == MAP_FAILED) {
+        mem = mmap(nullptr, this->buffer_size_, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem == MAP_FAILED)
+            throw std::runtime_error("SampleBuffer: memory allocation error");
+        if (huge_pages == true)
+            madvise(mem, this->buffer_size_, MADV_HUGEPAGE);
+    }
+    MLPD_TRACE("SampleBuffer: %zu slots of %zu bytes, %zu bytes mapped %s\n",
+        num_slots, this->slot_size_, this->buffer_size_,
+        this->huge_pages_ ? "on 2MB pages" : "on normal pages");
+    this->buffer_ = static_cast<char*>(mem);
+
+    this->state_.reset(new std::atomic<uint32_t>[num_slots]);
+    for (size_t i = 0; i < num_slots; i++)
+        this->state_[i].store(kSlotFree, std::memory_order_relaxed);
+    this->head_ = 0;
+}
+
+void SampleBuffer::prefault(void)
+{
+    std::memset(this->buffer_, 0, this->buffer_size_);
+}
+
+int SampleBuffer::acquireSlot(uint32_t& gen)
+{
+    size_t index = this->head_;
+    std::atomic<uint32_t>& state = this->state_[index];
+    uint32_t value = state.load(std::memory_order_acquire);
+
+    if ((value & kStateMask) != kSlotFree) {
+        switch (this->policy_) {
+        case BackpressurePolicy::kDropNewest:
+            this->dropped_newest_++;
+            return kInvalidSlot;
+        case BackpressurePolicy::kDropOldest:
+            // Take the slot back unless a recorder is already writing it
+            if (((value & kStateMask) == kSlotQueued)
+                && state.compare_exchange_strong(value,
+                       (value & ~kStateMask) | kSlotFree,
+                       std::memory_order_acq_rel)) {
+                this->dropped_oldest_++;
+                break;
+            }
+            [[fallthrough]];
+        case BackpressurePolicy::kBlock:
+            this->blocked_++;
+            while (((value = state.load(std::memory_order_acquire))
+                       & kStateMask)
+                != kSlotFree) {
+                std::this_thread::yield();
+            }
+            break;
+        }
+    }
+    gen = (value >> kStateBits) + 1;
+    this->head_ = (index + 1) % this->num_slots_;
+    return index;
+}
+
+void SampleBuffer::publishSlot(size_t index, uint32_t gen)
+{
+    this->state_[index].store(
+        (gen << kStateBits) | kSlotQueued, std::memory_order_release);
+}
+
+bool SampleBuffer::claimSlot(size_t index, uint32_t gen)
+{
+    uint32_t expected = (gen << kStateBits) | kSlotQueued;
+    if (this->state_[index].compare_exchange_strong(expected,
+            (gen << kStateBits) | kSlotBusy, std::memory_order_acq_rel)
+        == false) {
+        this->stale_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    return true;
+}
+
+bool SampleBuffer::isSlotReleased(size_t index, uint32_t gen) const
+{
+    uint32_t value = this->state_[index].load(std::memory_order_acquire);
+    return (value != ((gen << kStateBits) | kSlotQueued))
+        && (value != ((gen << kStateBits) | kSlotBusy));
+}
+
+void SampleBuffer::releaseSlot(size_t index, uint32_t gen)
+{
+    this->state_[index].store(
+        (gen << kStateBits) | kSlotFree, std::memory_order_release);
+}
@@ -0,0 +1,156 @@
+/*
+ Copyright (c) 2018-2020, Rice University
+ RENEW OPEN SOURCE LICENSE: http://renew-wireless.org/license
+
+----------------------------------------------------------------------
+ Always-on counters for the capture pipeline, dumped periodically
+---------------------------------------------------------------------
+*/
+
+#include "include/telemetry.h"
+#include "include/logger.h"
+
+uint64_t Telemetry::latencyPercentile(
+    const std::vector<uint64_t>& histogram, uint64_t total, double fraction)
+{
+    if (total == 0)
+        return 0;
+    uint64_t target = static_cast<uint64_t>(fraction * total);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < histogram.size(); i++) {
+        seen += histogram[i];
+        if (seen > target)
+            return (1ull << (i + 1));
+    }
+    return (1ull << histogram.size());
+}
+
+Telemetry::Telemetry(size_t num_rx_threads, size_t num_recorder_threads)
+    : num_rx_threads_(num_rx_threads)
+    , num_recorder_threads_(num_recorder_threads)
+    , rx_stats_(new RxStats[num_rx_threads]())
+    , dispatch_stats_(new DispatchStats())
+    , record_stats_(new RecordStats[num_recorder_threads]())
+    , last_rx_packets_(num_rx_threads, 0)
+    , last_dispatch_packets_(0)
+    , last_record_packets_(num_recorder_threads, 0)
+    , last_latency_(
+          num_recorder_threads, std::vector<uint64_t>(kLatencyBuckets, 0))
+    , fp_(nullptr)
+    , interval_ms_(0)
+    , running_(false)
+{
+}
+
+Telemetry::~Telemetry() { this->stop(); }
+
+void Telemetry::start(const std::string& filename, size_t interval_ms)
+{
+    if (interval_ms == 0)
+        return;
+    this->fp_ = std::fopen(filename.c_str(), "w");
+    if (this->fp_ == nullptr) {
+        MLPD_WARN("Telemetry: could not open %s, counters are not dumped\n",
+            filename.c_str());
+        return;
+    }
+    std::fprintf(this->fp_,
+        "time_s,stage,id,packets,packets_per_s,queue_depth,short_reads,"
+        "read_errors,drops,extends,latency_p50_us,latency_p99_us,"
+        "latency_max_us,radios,chunk_bytes,stored_bytes,frames_complete,"
+        "frames_incomplete,records_missing,policy_skipped,triggers\n");
+    MLPD_INFO("Telemetry: dumping pipeline counters to %s every %zu ms\n",
+        filename.c_str(), interval_ms);
+    this->interval_ms_ = interval_ms;
+    this->running_ = true;
+    this->thread_ = std::thread(&Telemetry::dumpLoop, this);
+}
+
+void Telemetry::stop(void)
+{
+    if (this->thread_.joinable() == true) {
+        {
+            std::lock_guard<std::mutex> lock(this->sync_);
+            this->running_ = false;
+        }
+        this->condition_.notify_all();
+        this->thread_.join();
+    }
+    if (this->fp_ != nullptr) {
+        std::fclose(this->fp_);
+        this->fp_ = nullptr;
+    }
+}
+
+void Telemetry::dumpLoop(void)
+{
+    auto begin = std::chrono::steady_clock::now();
+    auto last = begin;
+    std::unique_lock<std::mutex> lock(this->sync_);
+    while (this->running_ == true) {
+        this->condition_.wait_for(lock,
+            std::chrono::milliseconds(this->interval_ms_),
+            [this] { return this->running_ == false; });
+        // one last row on stop so short runs are covered too
+        auto now = std::chrono::steady_clock::now();
+        this->dump(std::chrono::duration<double>(now - begin).count(),
+            std::chrono::duration<double>(now - last).count());
+        last = now;
+    }
+}
+
+void Telemetry::dump(double elapsed_s, double interval_s)
+{
+    const std::memory_order relaxed = std::memory_order_relaxed;
+    if (interval_s <= 0)
+        interval_s = 1e-9;
+
+    for (size_t i = 0; i < this->num_rx_threads_; i++) {
+        const RxStats& stats = this->rx_stats_[i];
+        uint64_t packets = stats.packets.load(relaxed);
+        double rate = (packets - this->last_rx_packets_[i]) / interval_s;
+        this->last_rx_packets_[i] = packets;
+        std::fprintf(this->fp_,
+            "%.3f,rx,%zu,%lu,%.1f,,%lu,%lu,%lu,,,,,%lu,,,,,,,\n", elapsed_s,
+            i, packets, rate, stats.short_reads.load(relaxed),
+            stats.read_errors.load(relaxed), stats.drops.load(relaxed),
+            stats.radios.load(relaxed));
+    }
+
+    uint64_t dispatched = this->dispatch_stats_->packets.load(relaxed);
+    std::fprintf(this->fp_, "%.3f,dispatch,0,%lu,%.1f,,,,,,,,,,,,,,,,\n",
+        elapsed_s, dispatched,
+        (dispatched - this->last_dispatch_packets_) / interval_s);
+    this->last_dispatch_packets_ = dispatched;
+
+    std::vector<uint64_t> histogram(kLatencyBuckets);
+    for (size_t i = 0; i < this->num_recorder_threads_; i++) {
+        const RecordStats& stats = this->record_stats_[i];
+        uint64_t packets = stats.packets.load(relaxed);
+        double rate = (packets - this->last_record_packets_[i]) / interval_s;
+        this->last_record_packets_[i] = packets;
+
+        // percentiles over this interval only
+        uint64_t total = 0;
+        for (size_t b = 0; b < kLatencyBuckets; b++) {
+            uint64_t count = stats.latency[b].load(relaxed);
+            histogram[b] = count - this->last_latency_[i][b];
+            this->last_latency_[i][b] = count;
+            total += histogram[b];
+        }
+        std::fprintf(this->fp_,
+            "%.3f,record,%zu,%lu,%.1f,%lu,,,,%lu,%lu,%lu,%lu,,%lu,%lu,%lu,"
+            "%lu,%lu,%lu,%lu\n",
+            elapsed_s, i, packets, rate, stats.queue_depth.load(relaxed),
+            stats.extends.load(relaxed),
+            latencyPercentile(histogram, total, 0.50),
+            latencyPercentile(histogram, total, 0.99),
+            stats.latency_max_ns.load(relaxed) / 1000,
+            stats.chunk_bytes.load(relaxed), stats.stored_bytes.load(relaxed),
+            stats.frames_complete.load(relaxed),
+            stats.frames_incomplete.load(relaxed),
+            stats.records_missing.load(relaxed),
+            stats.policy_skipped.load(relaxed), stats.triggers.load(relaxed));
+    }
+    std::fflush(this->fp_);
+}
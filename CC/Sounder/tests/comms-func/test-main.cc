@@ -336,6 +336,17 @@ int main(int argc, char const* argv[])
                                                                : "FAILED")
               << std::endl;
     std::cout << "Correlation took " << diff << " usec" << std::endl;
+
+    std::cout << "Testing find_beacon_fused:\n";
+    clock_gettime(CLOCK_MONOTONIC, &tv);
+    int fused_index = CommsLib::find_beacon_fused(buffs, gold_sym_orig);
+    clock_gettime(CLOCK_MONOTONIC, &tv2);
+    diff = ((tv2.tv_sec - tv.tv_sec) * 1e9 + (tv2.tv_nsec - tv.tv_nsec)) / 1e3;
+    std::cout << "SYNC Found at index " << fused_index - 2 * seqLen + 1
+              << std::endl;
+    std::cout << "TEST " << ((fused_index == sync_index) ? "PASSED" : "FAILED")
+              << std::endl;
+    std::cout << "Fused correlation took " << diff << " usec" << std::endl;
 #else
     size_t symbolsPerFrame = 5;
     size_t sampsPerSymbol = 790;
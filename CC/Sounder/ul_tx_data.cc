@@ -0,0 +1,103 @@
+/*
+ Copyright (c) 2018-2020, Rice University
+ RENEW OPEN SOURCE LICENSE: http://renew-wireless.org/license
+
+----------------------------------------------------------------------
+ Uplink time-domain data of one client held in memory for the whole
+ run
+---------------------------------------------------------------------
+*/
+
+#include "include/ul_tx_data.h"
+#include "include/logger.h"
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+UlTxData::UlTxData(
+    const std::string& filename, size_t record_samps, bool preload)
+    : data_(nullptr)
+    , bytes_(0)
+    , record_samps_(record_samps)
+    , records_(0)
+    , mapped_(!preload)
+{
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw std::runtime_error(filename + std::string(" not found!"));
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        throw std::runtime_error("UlTxData: cannot stat " + filename);
+    }
+    const size_t record_bytes = record_samps * sizeof(std::complex<float>);
+    this->records_ = (record_bytes > 0) ? st.st_size / record_bytes : 0;
+    if (this->records_ == 0) {
+        close(fd);
+        throw std::runtime_error(
+            "UlTxData: no complete uplink record in " + filename);
+    }
+    this->bytes_ = this->records_ * record_bytes;
+
+    // close() and free() may change errno, keep the one of the failure
+    void* mem;
+    int load_errno = 0;
+    if (this->mapped_ == true) {
+        mem = mmap(nullptr, this->bytes_, PROT_READ, MAP_PRIVATE | MAP_POPULATE,
+            fd, 0);
+        if (mem == MAP_FAILED) {
+            load_errno = errno;
+            mem = nullptr;
+        }
+    } else {
+        // aligned_alloc needs a multiple of the alignment
+        size_t page = sysconf(_SC_PAGESIZE);
+        mem = std::aligned_alloc(
+            page, (this->bytes_ + page - 1) / page * page);
+        if (mem == nullptr)
+            load_errno = errno;
+        size_t done = 0;
+        while (mem != nullptr && done < this->bytes_) {
+            ssize_t ret = pread(
+                fd, static_cast<char*>(mem) + done, this->bytes_ - done, done);
+            if (ret <= 0) {
+                // a file shrinking under us reads short without an errno
+                load_errno = (ret < 0) ? errno : EIO;
+                std::free(mem);
+                mem = nullptr;
+            } else {
+                done += ret;
+            }
+        }
+    }
+    close(fd);
+    if (mem == nullptr) {
+        throw std::runtime_error(
+            "UlTxData: cannot load " + filename + ": "
+            + std::strerror(load_errno));
+    }
+    this->data_ = static_cast<std::complex<float>*>(mem);
+
+    if (mlock(mem, this->bytes_) != 0) {
+        MLPD_WARN("UlTxData: could not lock %zu bytes of %s in memory (%s), "
+                  "pages may be evicted\n",
+            this->bytes_, filename.c_str(), std::strerror(errno));
+    }
+    MLPD_INFO("%s %zu uplink records (%zu bytes) of %s\n",
+        this->mapped_ ? "Mapped" : "Preloaded", this->records_, this->bytes_,
+        filename.c_str());
+}
+
+UlTxData::~UlTxData()
+{
+    munlock(this->data_, this->bytes_);
+    if (this->mapped_ == true)
+        munmap(this->data_, this->bytes_);
+    else
+        std::free(this->data_);
+}
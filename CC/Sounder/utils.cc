@@ -9,6 +9,12 @@
 */
 
 #include "include/utils.h"
+#include "include/comms-lib-kernels.h"
+
+// A uint32 sample with the real part in the low half, "QI", has the
+// memory layout of a complex short
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__,
+    "sample word conversions assume a little endian host");
 
 int pin_to_core(int core_id)
 {
@@ -52,45 +58,25 @@ std::vector<size_t> Utils::strToChannels(const std::string& channel)
 std::vector<std::complex<int16_t>> Utils::float_to_cint16(
     const std::vector<std::vector<float>>& in)
 {
-    int len = in[0].size();
+    size_t len = in[0].size();
     std::vector<std::complex<int16_t>> out(len, 0);
-    for (int i = 0; i < len; i++)
-        out[i] = std::complex<int16_t>(
-            (int16_t)(in[0][i] * 32768), (int16_t)(in[1][i] * 32768));
+    Utils::float_to_cint16(in[0].data(), in[1].data(), len, out.data());
     return out;
 }
 
 std::vector<std::complex<float>> Utils::cint16_to_cfloat(
     const std::vector<std::complex<int16_t>>& in)
 {
-    int len = in.size();
-    std::vector<std::complex<float>> out(len);
-    for (int i = 0; i < len; i++)
-        out[i] = std::complex<float>(
-            in[i].real() / 32768.0, in[i].imag() / 32768.0);
+    std::vector<std::complex<float>> out(in.size());
+    Utils::cint16_to_cfloat(in.data(), in.size(), out.data());
     return out;
 }
 
 std::vector<std::complex<float>> Utils::uint32tocfloat(
     const std::vector<uint32_t>& in, const std::string& order)
 {
-    int len = in.size();
-    std::vector<std::complex<float>> out(len, 0);
-    for (size_t i = 0; i < in.size(); i++) {
-        int16_t arr_hi_int = (int16_t)(in[i] >> 16);
-        int16_t arr_lo_int = (int16_t)(in[i] & 0x0FFFF);
-
-        float arr_hi = (float)arr_hi_int / 32768.0;
-        float arr_lo = (float)arr_lo_int / 32768.0;
-
-        if (order == "IQ") {
-            std::complex<float> csamp(arr_hi, arr_lo);
-            out[i] = csamp;
-        } else if (order == "QI") {
-            std::complex<float> csamp(arr_lo, arr_hi);
-            out[i] = csamp;
-        }
-    }
+    std::vector<std::complex<float>> out(in.size(), 0);
+    Utils::uint32tocfloat(in.data(), in.size(), order, out.data());
     return out;
 }
 
@@ -99,17 +85,42 @@ std::vector<uint32_t> Utils::cint16_to_uint32(
     const std::string& order)
 {
     std::vector<uint32_t> out(in.size(), 0);
-    for (size_t i = 0; i < in.size(); i++) {
-        uint16_t re = (uint16_t)in[i].real();
-        uint16_t im = (uint16_t)(conj ? -in[i].imag() : in[i].imag());
-        if (order == "IQ")
-            out[i] = (uint32_t)re << 16 | im;
-        else if (order == "QI")
-            out[i] = (uint32_t)im << 16 | re;
-    }
+    Utils::cint16_to_uint32(in.data(), in.size(), conj, order, out.data());
     return out;
 }
 
+void Utils::cint16_to_cfloat(const std::complex<int16_t>* in, size_t len,
+    std::complex<float>* out, float scale)
+{
+    commsKernels().ci16_to_cf32(in, len, false, scale, out);
+}
+
+void Utils::float_to_cint16(const float* re, const float* im, size_t len,
+    std::complex<int16_t>* out, float scale)
+{
+    commsKernels().f32_to_ci16(re, im, len, scale, out);
+}
+
+void Utils::uint32tocfloat(const uint32_t* in, size_t len,
+    const std::string& order, std::complex<float>* out)
+{
+    // "IQ" has the real part in the high half
+    if ((order != "IQ") && (order != "QI"))
+        return;
+    commsKernels().ci16_to_cf32(
+        reinterpret_cast<const std::complex<int16_t>*>(in), len,
+        (order == "IQ"), 1.f / 32768, out);
+}
+
+void Utils::cint16_to_uint32(const std::complex<int16_t>* in, size_t len,
+    bool conj, const std::string& order, uint32_t* out)
+{
+    if ((order != "IQ") && (order != "QI"))
+        return;
+    commsKernels().ci16_swap(in, len, conj, (order == "IQ"),
+        reinterpret_cast<std::complex<int16_t>*>(out));
+}
+
 std::vector<std::vector<size_t>> Utils::loadSymbols(
     const std::vector<std::string>& frames, char sym)
 {
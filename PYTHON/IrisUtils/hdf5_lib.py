@@ -313,6 +313,8 @@ class hdf5_lib:
                     --Samples
                 -UplinkData
                     --Samples
+                -CSI
+                    --Channel estimates of the pilots
         Dimensions of input sample data (as shown in DataRecorder.cpp in Sounder):
             - Pilots
                 dims_pilot[0] = maxFrame
@@ -327,6 +329,13 @@ class hdf5_lib:
                 dims_data[2] = uplink symbols per frame
                 dims_data[3] = number of antennas (at BS)
                 dims_data[4] = samples per symbol * 2 (IQ)
+
+            - CSI
+                dims_csi[0] = maxFrame
+                dims_csi[1] = number of cells
+                dims_csi[2] = number of UEs
+                dims_csi[3] = number of antennas (at BS)
+                dims_csi[4] = data subcarriers * 2 (IQ)
         """
 
         self.data = self.h5file['Data']
@@ -355,6 +364,24 @@ class hdf5_lib:
                 else:
                     self.noise_samples = self.data['Noise_Samples'][self.n_frm_st:self.n_frm_end:self.sub_sample, ...]
 
+        # Channel estimates recorded by the Sounder (record_csi), IQ
+        # interleaved over the subcarriers listed in the CSI_SC attribute
+        if 'CSI' in self.data:
+            if self.n_frm_st == self.n_frm_end:
+                csi = self.data['CSI'][...]
+            else:
+                csi = self.data['CSI'][self.n_frm_st:self.n_frm_end:self.sub_sample, ...]
+            self.csi = csi[..., 0::2] + 1j * csi[..., 1::2]
+
+        # One row per frame (record_frame_index): frame, hw_time, received,
+        # expected, complete and a bitmap of the symbols received on every
+        # antenna. Select whole frames with frame_index['complete'] == 1
+        if 'FrameIndex' in self.data:
+            if self.n_frm_st == self.n_frm_end:
+                self.frame_index = self.data['FrameIndex'][...]
+            else:
+                self.frame_index = self.data['FrameIndex'][self.n_frm_st:self.n_frm_end:self.sub_sample]
+
         return self.data
 
     def get_metadata(self):
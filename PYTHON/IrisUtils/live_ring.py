@@ -0,0 +1,91 @@
+#!/usr/bin/python3
+"""
+ live_ring.py
+
+ Reader of the shared memory ring the sounder fills with the latest
+ received frames when "live_ring_frames" is set (see
+ Sounder/include/live_ring.h for the layout). Frames are numpy views of
+ the shared memory, nothing is copied.
+
+ Example:
+     ring = LiveRing("/sounder_live")
+     frame, pilots, uplink = ring.latest()
+     power = np.mean(np.abs(pilots.astype(np.float32)) ** 2)
+     if not ring.valid(frame):
+         pass  # overwritten while in use, drop the result
+
+---------------------------------------------------------------------
+ Copyright (c) 2018-2020, Rice University
+ RENEW OPEN SOURCE LICENSE: http://renew-wireless.org/license
+---------------------------------------------------------------------
+"""
+
+import mmap
+import os
+import struct
+import numpy as np
+
+MAGIC = 0x534c5231
+VERSION = 1
+COUNT_BITS = 24
+# LiveRingHeader up to latest_frame and newest_frame
+HEADER = struct.Struct("=8I4Q")
+LATEST_OFFSET = HEADER.size
+
+
+class LiveRing(object):
+    def __init__(self, name="/sounder_live"):
+        fd = os.open("/dev/shm/" + name.lstrip("/"), os.O_RDONLY)
+        try:
+            self.shm = mmap.mmap(fd, 0, mmap.MAP_SHARED, mmap.PROT_READ)
+        finally:
+            os.close(fd)
+        (magic, version, self.num_slots, self.num_cells, self.num_antennas,
+         self.pilot_syms, self.ul_syms, self.samps_per_symbol,
+         self.slot_bytes, self.slots_offset, self.pilot_offset,
+         self.ul_offset) = HEADER.unpack_from(self.shm, 0)
+        if magic != MAGIC or version != VERSION:
+            raise IOError("%s is not a sounder live ring" % name)
+        self.counters = np.ndarray((2,), np.int64, self.shm, LATEST_OFFSET)
+        self.states = [np.ndarray((1,), np.uint64, self.shm,
+                                  self.slots_offset + s * self.slot_bytes)
+                       for s in range(self.num_slots)]
+
+    def latest_frame(self):
+        """Last frame with all its pilots and uplink symbols, -1 if none"""
+        return int(self.counters[0])
+
+    def newest_frame(self):
+        """Last frame written to, possibly still incomplete"""
+        return int(self.counters[1])
+
+    def valid(self, frame):
+        """True while frame is still in its slot"""
+        state = int(self.states[frame % self.num_slots][0])
+        return (state >> COUNT_BITS) == frame + 1
+
+    def frame(self, frame):
+        """Pilots and uplink of frame as int16 [cell, symbol, antenna, IQ]
+        views, None if its slot holds another frame"""
+        if not self.valid(frame):
+            return None
+        slot = self.slots_offset + (frame % self.num_slots) * self.slot_bytes
+        IQ = 2 * self.samps_per_symbol
+        pilots = np.ndarray((self.num_cells, self.pilot_syms,
+                             self.num_antennas, IQ), np.int16, self.shm,
+                            slot + self.pilot_offset)
+        uplink = np.ndarray((self.num_cells, self.ul_syms,
+                             self.num_antennas, IQ), np.int16, self.shm,
+                            slot + self.ul_offset)
+        return pilots, uplink
+
+    def latest(self):
+        """(frame, pilots, uplink) of the latest complete frame, None if
+        there is none yet"""
+        frame = self.latest_frame()
+        if frame < 0:
+            return None
+        views = self.frame(frame)
+        if views is None:
+            return None
+        return (frame,) + views